@@ -11,24 +11,51 @@
 /* Project-wide includes                                                 */
 /*************************************************************************/
 #include <cassert>
+#include <climits>
+#include <cmath>
 #include <csignal>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 
+#include <algorithm>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <limits>
 #include <list>
+#include <map>
 #include <queue>
 #include <stdexcept>
 #include <utility>
 #include <vector>
 
+#if 202002L <= __cplusplus
+/* Only the scripts are built as C++20. */
+#   include <coroutine>
+#endif
+
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <linux/perf_event.h>
+
+#if defined( __GNUC__ ) && (defined( __x86_64__ ) || defined( __i386__ ))
+/// Vectorized code for x86 is built.
+#   define GAME_SIMD_X86
+#   include <immintrin.h>
+#endif
 
 #include <curses.h>
 #include <menu.h>
@@ -182,6 +209,42 @@ enum GameEntity
 /// How many ticks per move by default?
 #define GAME_SPEED_DEFAULT  5
 
+/// Distance of a tile unreachable by pathfinding.
+#define GAME_DIST_INFINITE  std::numeric_limits<unsigned int>::max()
+
+/// Maps with this many tiles use the path graph for monsters.
+#define GAME_PATH_GRAPH_TILES 800 * 800
+/// Number of ticks a monster follows a route before planning again.
+#define GAME_ROUTE_TICKS    GAME_TICKS_PER_SEC
+/// Number of portals a monster looks at when planning a route.
+#define GAME_ROUTE_PORTALS  256
+
+/// How many ticks a client may go without acknowledging a frame?
+#define GAME_NET_LAG_TICKS  GAME_TICKS_PER_SEC
+/// How many bytes of diffs may be queued for a client by default?
+#define GAME_NET_QUEUE_BYTES 256 * 1024
+/// How many control events may be queued for a client?
+#define GAME_NET_QUEUE_CONTROLS GAME_TICKS_PER_SEC
+/// How many ticks may the control events wait for their turn by default?
+#define GAME_NET_JITTER_TICKS 1
+/// How many bytes to read from a socket at once?
+#define GAME_NET_RECV_BYTES 64 * 1024
+/// How many bytes may a datagram take?
+#define GAME_NET_DATAGRAM_BYTES 1200
+/// How many fragments of reliable messages may be in flight?
+#define GAME_NET_WINDOW     64
+/// How many ticks to wait for an acknowledgement before sending again?
+#define GAME_NET_RESEND_TICKS 3
+/// How many of the latest control events does a datagram repeat?
+#define GAME_NET_INPUT_REPEAT 8
+/// How many ticks of silence before a datagram peer is gone?
+#define GAME_NET_TIMEOUT_TICKS 5 * GAME_TICKS_PER_SEC
+/// How many local players may share a connection?
+#define GAME_NET_CHANNELS   8
+
+/// Tick which never comes (eg. no flame ever reaches a tile).
+#define GAME_TICK_NEVER     std::numeric_limits<unsigned int>::max()
+
 /// How many % that a bonus is dropped?
 #define GAME_BONUS_PERCENT        10
 /// How many % that a bonus is a bomb?
@@ -9,11 +9,39 @@
 /*************************************************************************/
 /* NcursesController                                                     */
 /*************************************************************************/
-NcursesController::NcursesController()
+NcursesController::NcursesController(
+    int fd
+    )
+: mHead( 0 ),
+  mTail( 0 ),
+  mDropped( 0 ),
+  mFd( fd ),
+  mRunning( false ),
+  mEscape( 0 )
+{
+    if( stdscr )
+        /* Keys come anytime now, do not let them hold up the screen. */
+        typeahead( -1 );
+
+    if( !pipe( mWake ) )
+        mRunning = !pthread_create( &mThread, NULL, reader, this );
+}
+
+NcursesController::~NcursesController()
 {
-    /* Enable keypad and nodelay. */
-    keypad( stdscr, TRUE );
-    nodelay( stdscr, TRUE );
+    if( mRunning )
+    {
+        /* Wake the input thread up and wait for it. */
+        const char c = 0;
+        while( write( mWake[1], &c, 1 ) < 0 && EINTR == errno );
+        pthread_join( mThread, NULL );
+
+        close( mWake[0] );
+        close( mWake[1] );
+    }
+
+    if( stdscr )
+        typeahead( STDIN_FILENO );
 }
 
 void
@@ -21,14 +49,185 @@ NcursesController::tick(
     GameCtlEvent& event
     )
 {
-    switch( wgetch( stdscr ) )
+    const unsigned long long t = now();
+
+    /* Drain the ring. */
+    const unsigned int tail = __atomic_load_n( &mTail, __ATOMIC_ACQUIRE );
+    for( unsigned int head = mHead; head != tail; ++head )
+    {
+        const Input& in = mRing[head % RING];
+        if( !mPending.empty() && direction( in.event )
+            && direction( mPending.back().event ) )
+        {
+            /* The later direction wins, unless a bomb is in between. */
+            mPending.back() = in;
+            ++mStats.collapsed;
+        }
+        else
+            /* The bombs and RC presses are never lost. */
+            mPending.push_back( in );
+    }
+    /* Hand the slots back to the input thread. */
+    __atomic_store_n( &mHead, tail, __ATOMIC_RELEASE );
+
+    mStats.dropped += __atomic_exchange_n( &mDropped, 0, __ATOMIC_RELAXED );
+
+    /* In the order pressed, the rest keeps until the next tick. */
+    if( !mPending.empty() )
+    {
+        event = mPending.front().event;
+        played( mPending.front(), t );
+        mPending.pop_front();
+    }
+    else
+        event = GCE_NOOP;
+}
+
+void*
+NcursesController::reader(
+    void* ctl
+    )
+{
+    ((NcursesController*)ctl)->read();
+    return NULL;
+}
+
+void
+NcursesController::read()
+{
+    struct pollfd fds[2];
+    fds[0].fd = mFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = mWake[0];
+    fds[1].events = POLLIN;
+
+    while( true )
+    {
+        if( poll( fds, 2, -1 ) < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+            break;
+        }
+
+        if( fds[1].revents )
+            /* Time to quit. */
+            break;
+        if( !fds[0].revents )
+            continue;
+
+        unsigned char buf[64];
+        const ssize_t len = ::read( mFd, buf, sizeof( buf ) );
+        if( len <= 0 )
+        {
+            if( len < 0 && EINTR == errno )
+                continue;
+            /* Nothing more to read. */
+            break;
+        }
+
+        /* All the keys in a read came at once. */
+        Input in;
+        in.time = now();
+        for( ssize_t i = 0; i < len; ++i )
+            if( GCE_NOOP != (in.event = decode( buf[i] )) )
+                push( in );
+    }
+}
+
+GameCtlEvent
+NcursesController::decode(
+    unsigned char c
+    )
+{
+    /* Arrows are ESC [ A or ESC O A, depending on the keypad mode. */
+    switch( mEscape )
     {
-        case KEY_UP:    event = GCE_MOVEUP; break;
-        case KEY_DOWN:  event = GCE_MOVEDOWN; break;
-        case KEY_LEFT:  event = GCE_MOVELEFT; break;
-        case KEY_RIGHT: event = GCE_MOVERIGHT; break;
-        case ' ':       event = GCE_PUTBOMB; break;
-        case '\n':      event = GCE_RCEXPLODE; break;
-        default:        event = GCE_NOOP; break;
+        case 1:
+            mEscape = ('[' == c || 'O' == c ? 2 : 0);
+            return GCE_NOOP;
+
+        case 2:
+            if( ('0' <= c && c <= '9') || ';' == c )
+                /* Modifiers, eg. ESC [ 1 ; 5 A. */
+                return GCE_NOOP;
+
+            mEscape = 0;
+            switch( c )
+            {
+                case 'A': return GCE_MOVEUP;
+                case 'B': return GCE_MOVEDOWN;
+                case 'C': return GCE_MOVERIGHT;
+                case 'D': return GCE_MOVELEFT;
+                default:  return GCE_NOOP;
+            }
     }
+
+    switch( c )
+    {
+        case 0x1B: mEscape = 1; return GCE_NOOP;
+        case ' ':  return GCE_PUTBOMB;
+        case '\r':
+        case '\n': return GCE_RCEXPLODE;
+        default:   return GCE_NOOP;
+    }
+}
+
+void
+NcursesController::push(
+    const Input& in
+    )
+{
+    const unsigned int head = __atomic_load_n( &mHead, __ATOMIC_ACQUIRE );
+    if( RING <= mTail - head )
+    {
+        /* The game is not ticking, never mind. */
+        __atomic_add_fetch( &mDropped, 1, __ATOMIC_RELAXED );
+        return;
+    }
+
+    mRing[mTail % RING] = in;
+    __atomic_store_n( &mTail, mTail + 1, __ATOMIC_RELEASE );
+}
+
+bool
+NcursesController::direction(
+    GameCtlEvent event
+    )
+{
+    return GCE_PUTBOMB != event && GCE_RCEXPLODE != event;
+}
+
+void
+NcursesController::played(
+    const Input& in,
+    unsigned long long t
+    )
+{
+    const unsigned long long latency = t - in.time;
+
+    ++mStats.actions;
+    mStats.latencyNs += latency;
+    mStats.latencyMaxNs = std::max( mStats.latencyMaxNs, latency );
+}
+
+unsigned long long
+NcursesController::now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*************************************************************************/
+/* NcursesController::Stats                                              */
+/*************************************************************************/
+NcursesController::Stats::Stats()
+: actions( 0 ),
+  collapsed( 0 ),
+  dropped( 0 ),
+  latencyNs( 0 ),
+  latencyMaxNs( 0 )
+{
 }
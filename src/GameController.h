@@ -31,12 +31,29 @@ public:
      * @param[out] event Where to store the action.
      */
     virtual void tick( GameCtlEvent& event ) = 0;
+
+    /**
+     * @brief May tick run on a worker thread?
+     *
+     * Concurrent controllers must only read the game state
+     * and must not depend on the order they are ticked in.
+     *
+     * @retval true  Tick may run concurrently with other controllers.
+     * @retval false Tick must run on the main thread.
+     */
+    virtual bool concurrent() const { return false; }
 };
 
 /**
  * @brief An ncurses-based controller.
  *
- * It pulls its events from stdscr keyboard.
+ * A thread of its own reads the keyboard into a ring as the
+ * keys come, each stamped with time. Every tick the ring is
+ * drained into a queue and a key is played from it, in the order
+ * the keys have been pressed. A direction replaces the one before
+ * it unless a bomb or RC press is in between; each bomb or RC press
+ * is played on some tick. Only the keys which come while the ring
+ * is full are lost, see Stats::dropped.
  *
  * @author Jan Bobek
  */
@@ -45,9 +62,39 @@ class NcursesController
 {
 public:
     /**
-     * @brief Initializes stdscr as needed.
+     * @brief Statistics of the input.
+     *
+     * @author Jan Bobek
+     */
+    struct Stats
+    {
+        /**
+         * @brief Zeroes the statistics.
+         */
+        Stats();
+
+        /// Number of actions played from the input.
+        unsigned long long actions;
+        /// Directions replaced by a later one before being played.
+        unsigned long long collapsed;
+        /// Keys dropped because the ring was full.
+        unsigned long long dropped;
+        /// Sum of the times from a key to its action, in nanoseconds.
+        unsigned long long latencyNs;
+        /// Longest time from a key to its action, in nanoseconds.
+        unsigned long long latencyMaxNs;
+    };
+
+    /**
+     * @brief Starts the input thread.
+     *
+     * @param[in] fd Where to read the keys from.
+     */
+    NcursesController( int fd = STDIN_FILENO );
+    /**
+     * @brief Stops the input thread.
      */
-    NcursesController();
+    ~NcursesController();
 
     /**
      * @brief Obtain an action for the current tick.
@@ -55,6 +102,104 @@ public:
      * @param[out] event Where to store the action.
      */
     void tick( GameCtlEvent& event );
+
+    /**
+     * @brief Obtains the statistics of the input.
+     *
+     * @return The statistics.
+     */
+    const Stats& stats() const { return mStats; }
+
+protected:
+    /// Capacity of the ring; a power of two.
+    static const unsigned int RING = 256;
+
+    /**
+     * @brief A key read by the input thread.
+     *
+     * @author Jan Bobek
+     */
+    struct Input
+    {
+        /// The action of the key.
+        GameCtlEvent event;
+        /// When the key has been read, see now().
+        unsigned long long time;
+    };
+
+    /**
+     * @brief Entry point of the input thread.
+     *
+     * @param[in] ctl The controller.
+     *
+     * @return Always NULL.
+     */
+    static void* reader( void* ctl );
+    /**
+     * @brief Reads and decodes the keys until stopped.
+     */
+    void read();
+    /**
+     * @brief Decodes a single byte of input.
+     *
+     * @param[in] c The byte.
+     *
+     * @return The action of a complete key; GCE_NOOP if none.
+     */
+    GameCtlEvent decode( unsigned char c );
+    /**
+     * @brief Appends a key to the ring; the input thread only.
+     *
+     * @param[in] in The key.
+     */
+    void push( const Input& in );
+    /**
+     * @brief Is the action a move?
+     *
+     * @param[in] event The action.
+     *
+     * @retval true  A direction; a later one replaces it.
+     * @retval false A bomb or RC press.
+     */
+    static bool direction( GameCtlEvent event );
+    /**
+     * @brief Accounts an action played from the input.
+     *
+     * @param[in] in The key of the action.
+     * @param[in] t  The current time.
+     */
+    void played( const Input& in, unsigned long long t );
+    /**
+     * @brief Obtains a monotonic time.
+     *
+     * @return The time in nanoseconds.
+     */
+    static unsigned long long now();
+
+    /// The keys read, not yet drained.
+    Input mRing[RING];
+    /// Index of the next key to drain; written by tick() only.
+    unsigned int mHead;
+    /// Index of the next free slot; written by the input thread only.
+    unsigned int mTail;
+    /// Number of keys dropped; written by the input thread only.
+    unsigned int mDropped;
+
+    /// Where the keys are read from.
+    int mFd;
+    /// A pipe waking the input thread up to quit.
+    int mWake[2];
+    /// The input thread.
+    pthread_t mThread;
+    /// Has the input thread started?
+    bool mRunning;
+    /// State of the escape sequence decoder.
+    unsigned char mEscape;
+
+    /// The keys drained but not played yet, in the order pressed.
+    std::deque<Input> mPending;
+    /// The statistics of the input.
+    Stats mStats;
 };
 
 #endif /* !__GAME_CONTROLLER_H__INCL__ */
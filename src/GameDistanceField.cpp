@@ -0,0 +1,326 @@
+/** @file
+ * @brief Implementation of a dynamic distance field.
+ *
+ * @author Jan Bobek
+ */
+
+#include "GameDistanceField.h"
+#include "util.h"
+
+/*************************************************************************/
+/* GameDistanceField                                                     */
+/*************************************************************************/
+GameDistanceField::GameDistanceField(
+    const GameCoord& size
+    )
+: mSize( size ),
+  mDist( safeAllocArray<unsigned int>(
+             (unsigned int)size.row * size.col ) ),
+  mTiles( safeAllocArray<unsigned char>(
+              (unsigned int)size.row * size.col ) ),
+  mRebuild( false ),
+  mVisited( 0 )
+{
+    /* No sources, nothing is reachable. */
+    std::fill( mDist, mDist + (unsigned int)size.row * size.col,
+               GAME_DIST_INFINITE );
+    std::fill( mTiles, mTiles + (unsigned int)size.row * size.col,
+               (unsigned char)TILE_PASSABLE );
+}
+
+GameDistanceField::~GameDistanceField()
+{
+    safeDeleteArray( mTiles );
+    safeDeleteArray( mDist );
+}
+
+void
+GameDistanceField::set(
+    const GameCoord& pos,
+    Tile tile
+    )
+{
+    unsigned char& t = mTiles[(unsigned int)pos.row * mSize.col + pos.col];
+    if( tile == (t & TILE_MASK) )
+        return;
+
+    t = (t & ~TILE_MASK) | tile;
+    if( mRebuild || (t & FLAG_CHANGED) )
+        /* Already taken care of. */
+        return;
+
+    if( (unsigned int)mSize.row * mSize.col / 8 < mChanged.size() )
+    {
+        /* Too many changes, repairing would not pay off. */
+        mRebuild = true;
+        return;
+    }
+
+    t |= FLAG_CHANGED;
+    mChanged.push_back( (unsigned int)pos.row * mSize.col + pos.col );
+}
+
+void
+GameDistanceField::update()
+{
+    mTouched.clear();
+    if( !mRebuild && !mChanged.empty() && !repairIncrease() )
+        /* Affects too much, repairing would not pay off. */
+        mRebuild = true;
+
+    if( mRebuild )
+        rebuild();
+    else if( !mChanged.empty() )
+        repairDecrease();
+
+    /* Forget the repair ... */
+    std::vector<unsigned int>::const_iterator cur, end;
+    cur = mTouched.begin();
+    end = mTouched.end();
+    for(; cur != end; ++cur )
+        mTiles[*cur] &= ~(FLAG_CHECKED | FLAG_ORPHAN);
+
+    /* ... and the changes. */
+    cur = mChanged.begin();
+    end = mChanged.end();
+    for(; cur != end; ++cur )
+        mTiles[*cur] &= ~FLAG_CHANGED;
+
+    mChanged.clear();
+    mRebuild = false;
+}
+
+size_t
+GameDistanceField::memory() const
+{
+    return sizeof( *this )
+        + (unsigned int)mSize.row * mSize.col
+          * (sizeof( *mDist ) + sizeof( *mTiles ))
+        + (mChanged.capacity() + mTouched.capacity()) * sizeof( unsigned int )
+        + (mSeeds.capacity() + mQueue.capacity()) * sizeof( Entry );
+}
+
+void
+GameDistanceField::rebuild()
+{
+    const unsigned int count = (unsigned int)mSize.row * mSize.col;
+    std::fill( mDist, mDist + count, GAME_DIST_INFINITE );
+
+    /* Seed the BFS with the sources. */
+    mQueue.clear();
+    for( unsigned int idx = 0; idx < count; ++idx )
+        if( TILE_SOURCE == (mTiles[idx] & TILE_MASK) )
+        {
+            mDist[idx] = 0;
+            mQueue.push_back( Entry( 0, idx ) );
+        }
+
+    /* Multi-source BFS; the queue grows as we go. */
+    for( size_t head = 0; head < mQueue.size(); ++head )
+    {
+        const unsigned int dist = mQueue[head].first + 1;
+
+        unsigned int next[4];
+        const unsigned int cnt = neighbours( mQueue[head].second, next );
+        for( unsigned int i = 0; i < cnt; ++i )
+            if( dist < mDist[next[i]] && relays( next[i] ) )
+            {
+                mDist[next[i]] = dist;
+                mQueue.push_back( Entry( dist, next[i] ) );
+            }
+    }
+
+    mVisited += count;
+}
+
+bool
+GameDistanceField::repairIncrease()
+{
+    mSeeds.clear();
+    mQueue.clear();
+
+    /* The changed tiles are the first suspects. */
+    std::vector<unsigned int>::const_iterator cur, end;
+    cur = mChanged.begin();
+    end = mChanged.end();
+    for(; cur != end; ++cur )
+        if( GAME_DIST_INFINITE != mDist[*cur] )
+            mSeeds.push_back( Entry( mDist[*cur], *cur ) );
+
+    std::sort( mSeeds.begin(), mSeeds.end() );
+
+    /* Check the suspects by increasing distance, so that all
+       the tiles which could back a suspect are checked first. */
+    size_t seed = 0, head = 0;
+    while( seed < mSeeds.size() || head < mQueue.size() )
+    {
+        const unsigned int idx =
+            (head < mQueue.size() &&
+             (mSeeds.size() <= seed || mQueue[head] < mSeeds[seed])
+             ? mQueue[head++] : mSeeds[seed++]).second;
+
+        if( mTiles[idx] & FLAG_CHECKED )
+            continue;
+
+        mTiles[idx] |= FLAG_CHECKED;
+        mTouched.push_back( idx );
+
+        if( supported( idx ) )
+            continue;
+
+        if( (unsigned int)mSize.row * mSize.col / 4 < mTouched.size() )
+        {
+            /* Give up before it gets as expensive as a rebuild. */
+            mVisited += mTouched.size();
+            return false;
+        }
+
+        /* Whatever went through here is suspect now. */
+        mTiles[idx] |= FLAG_ORPHAN;
+
+        unsigned int next[4];
+        const unsigned int cnt = neighbours( idx, next );
+        for( unsigned int i = 0; i < cnt; ++i )
+            if( mDist[idx] + 1 == mDist[next[i]] )
+                mQueue.push_back( Entry( mDist[next[i]], next[i] ) );
+    }
+
+    mVisited += mTouched.size();
+
+    /* Forget the distances of the orphans ... */
+    cur = mTouched.begin();
+    end = mTouched.end();
+    for(; cur != end; ++cur )
+        if( mTiles[*cur] & FLAG_ORPHAN )
+            mDist[*cur] = GAME_DIST_INFINITE;
+
+    /* ... and find them again from the tiles around. */
+    mSeeds.clear();
+    for( cur = mTouched.begin(); cur != end; ++cur )
+        if( mTiles[*cur] & FLAG_ORPHAN )
+        {
+            mDist[*cur] = relax( *cur );
+            if( GAME_DIST_INFINITE != mDist[*cur] )
+                mSeeds.push_back( Entry( mDist[*cur], *cur ) );
+        }
+
+    /* The changed tiles may open new paths. */
+    cur = mChanged.begin();
+    end = mChanged.end();
+    for(; cur != end; ++cur )
+        if( relays( *cur ) )
+        {
+            mDist[*cur] = std::min( mDist[*cur], relax( *cur ) );
+            if( GAME_DIST_INFINITE != mDist[*cur] )
+                mSeeds.push_back( Entry( mDist[*cur], *cur ) );
+        }
+
+    return true;
+}
+
+void
+GameDistanceField::repairDecrease()
+{
+    std::sort( mSeeds.begin(), mSeeds.end() );
+    mQueue.clear();
+
+    /* BFS from multiple sources at different distances;
+       merging the seeds and the queue keeps the order. */
+    size_t seed = 0, head = 0;
+    while( seed < mSeeds.size() || head < mQueue.size() )
+    {
+        const Entry e =
+            (head < mQueue.size() &&
+             (mSeeds.size() <= seed || mQueue[head] < mSeeds[seed])
+             ? mQueue[head++] : mSeeds[seed++]);
+
+        if( e.first != mDist[e.second] )
+            /* Found shorter since. */
+            continue;
+
+        ++mVisited;
+        const unsigned int dist = e.first + 1;
+
+        unsigned int next[4];
+        const unsigned int cnt = neighbours( e.second, next );
+        for( unsigned int i = 0; i < cnt; ++i )
+            if( dist < mDist[next[i]] && relays( next[i] ) )
+            {
+                mDist[next[i]] = dist;
+                mQueue.push_back( Entry( dist, next[i] ) );
+            }
+    }
+}
+
+bool
+GameDistanceField::supported(
+    unsigned int idx
+    ) const
+{
+    switch( mTiles[idx] & TILE_MASK )
+    {
+        default:
+        case TILE_BLOCKED:  return false;
+        case TILE_SOURCE:   return true;
+        case TILE_PASSABLE: break;
+    }
+
+    if( !mDist[idx] )
+        /* Only sources have zero. */
+        return false;
+
+    unsigned int next[4];
+    const unsigned int cnt = neighbours( idx, next );
+    for( unsigned int i = 0; i < cnt; ++i )
+        if( mDist[idx] == mDist[next[i]] + 1 && relays( next[i] ) &&
+            !(mTiles[next[i]] & FLAG_ORPHAN) )
+            return true;
+
+    return false;
+}
+
+unsigned int
+GameDistanceField::relax(
+    unsigned int idx
+    ) const
+{
+    switch( mTiles[idx] & TILE_MASK )
+    {
+        default:
+        case TILE_BLOCKED:  return GAME_DIST_INFINITE;
+        case TILE_SOURCE:   return 0;
+        case TILE_PASSABLE: break;
+    }
+
+    unsigned int dist = GAME_DIST_INFINITE;
+
+    unsigned int next[4];
+    const unsigned int cnt = neighbours( idx, next );
+    for( unsigned int i = 0; i < cnt; ++i )
+        if( mDist[next[i]] < dist && relays( next[i] ) )
+            dist = mDist[next[i]];
+
+    return GAME_DIST_INFINITE == dist ? dist : dist + 1;
+}
+
+unsigned int
+GameDistanceField::neighbours(
+    unsigned int idx,
+    unsigned int next[4]
+    ) const
+{
+    const unsigned int row = idx / mSize.col;
+    const unsigned int col = idx % mSize.col;
+    unsigned int cnt = 0;
+
+    if( 0 < row )
+        next[cnt++] = idx - mSize.col;
+    if( row + 1 < mSize.row )
+        next[cnt++] = idx + mSize.col;
+    if( 0 < col )
+        next[cnt++] = idx - 1;
+    if( col + 1 < mSize.col )
+        next[cnt++] = idx + 1;
+
+    return cnt;
+}
@@ -0,0 +1,206 @@
+/** @file
+ * @brief A dynamic distance field declarations.
+ *
+ * @author Jan Bobek
+ */
+
+#ifndef __GAME_DISTANCE_FIELD_H__INCL__
+#define __GAME_DISTANCE_FIELD_H__INCL__
+
+#include "Game.h"
+
+/**
+ * @brief A distance field maintained under tile changes.
+ *
+ * Keeps the BFS distance of each tile to the nearest source
+ * tile. Changes of the tiles are collected and repaired in
+ * a batch by update(), touching only the tiles whose distance
+ * depended on the changed ones; when too many tiles are
+ * affected, the field is simply computed again.
+ *
+ * @author Jan Bobek
+ */
+class GameDistanceField
+{
+public:
+    /**
+     * @brief Describes a tile of the field.
+     *
+     * @author Jan Bobek
+     */
+    enum Tile
+    {
+        TILE_BLOCKED,  ///< The path cannot go through.
+        TILE_PASSABLE, ///< The path can go through.
+        TILE_SOURCE    ///< Distance zero; the path starts here.
+    };
+
+    /**
+     * @brief Initializes a field of passable tiles.
+     *
+     * @param[in] size Size of the field.
+     */
+    GameDistanceField( const GameCoord& size );
+    /**
+     * @brief Releases the field.
+     */
+    ~GameDistanceField();
+
+    /**
+     * @brief Obtains the distance of a tile.
+     *
+     * @param[in] pos The tile.
+     *
+     * @return Number of steps to the nearest source as of
+     *         the last update(); GAME_DIST_INFINITE if none
+     *         is reachable.
+     */
+    unsigned int dist( const GameCoord& pos ) const
+    {
+        return mDist[(unsigned int)pos.row * mSize.col + pos.col];
+    }
+    /**
+     * @brief Obtains the distances of all the tiles.
+     *
+     * @return The distances, row by row; see dist().
+     */
+    const unsigned int* distances() const { return mDist; }
+    /**
+     * @brief Obtains a tile.
+     *
+     * @param[in] pos Position of the tile.
+     *
+     * @return The tile.
+     */
+    Tile tile( const GameCoord& pos ) const
+    {
+        return (Tile)(mTiles[(unsigned int)pos.row * mSize.col + pos.col]
+                      & TILE_MASK);
+    }
+
+    /**
+     * @brief Changes a tile.
+     *
+     * The distances stay as they are until update().
+     *
+     * @param[in] pos  Position of the tile.
+     * @param[in] tile The new tile.
+     */
+    void set( const GameCoord& pos, Tile tile );
+    /**
+     * @brief Makes the next update() compute the whole field.
+     */
+    void invalidate() { mRebuild = true; }
+    /**
+     * @brief Brings the distances up to date with the tiles.
+     */
+    void update();
+
+    /**
+     * @brief Obtains number of tiles visited by the updates.
+     *
+     * @return Number of tiles visited since the construction.
+     */
+    unsigned long long visited() const { return mVisited; }
+    /**
+     * @brief Obtains the memory taken by the field.
+     *
+     * @return Number of bytes.
+     */
+    size_t memory() const;
+
+protected:
+    /// Mask of the Tile in mTiles.
+    static const unsigned char TILE_MASK = 0x03;
+    /// The tile has changed since the last update.
+    static const unsigned char FLAG_CHANGED = 0x04;
+    /// The tile has been checked for a valid distance.
+    static const unsigned char FLAG_CHECKED = 0x08;
+    /// The distance of the tile is no longer valid.
+    static const unsigned char FLAG_ORPHAN = 0x10;
+
+    /// A tile index together with its distance.
+    typedef std::pair<unsigned int, unsigned int> Entry;
+
+    /**
+     * @brief Computes the whole field from scratch.
+     */
+    void rebuild();
+    /**
+     * @brief Finds the tiles whose distance is too short now.
+     *
+     * Their distance is reset and the tiles around them
+     * are stored as seeds for repairDecrease().
+     *
+     * @retval true  The seeds are ready.
+     * @retval false Too many tiles are affected; rebuild instead.
+     */
+    bool repairIncrease();
+    /**
+     * @brief Propagates shorter distances from the seeds.
+     */
+    void repairDecrease();
+
+    /**
+     * @brief Checks if the distance of a tile is still backed by a path.
+     *
+     * @param[in] idx Index of the tile.
+     *
+     * @retval true  A neighbour with a valid distance leads to a source.
+     * @retval false The distance has to be found again.
+     */
+    bool supported( unsigned int idx ) const;
+    /**
+     * @brief Computes distance of a tile from its neighbours.
+     *
+     * @param[in] idx Index of the tile.
+     *
+     * @return The distance; GAME_DIST_INFINITE if unreachable.
+     */
+    unsigned int relax( unsigned int idx ) const;
+    /**
+     * @brief Obtains indices of the neighbours of a tile.
+     *
+     * @param[in]  idx  Index of the tile.
+     * @param[out] next Where to store the indices.
+     *
+     * @return Number of the neighbours.
+     */
+    unsigned int neighbours( unsigned int idx, unsigned int next[4] ) const;
+    /**
+     * @brief Checks if a path may go through a tile.
+     *
+     * @param[in] idx Index of the tile.
+     *
+     * @retval true  The tile is passable or a source.
+     * @retval false The tile is blocked.
+     */
+    bool relays( unsigned int idx ) const
+    {
+        return TILE_BLOCKED != (mTiles[idx] & TILE_MASK);
+    }
+
+    /// Size of the field.
+    GameCoord mSize;
+    /// Distance of each tile.
+    unsigned int* mDist;
+    /// Each tile, together with the FLAG_* flags.
+    unsigned char* mTiles;
+
+    /// Tiles changed since the last update.
+    std::vector<unsigned int> mChanged;
+    /// Shall the next update compute the whole field?
+    bool mRebuild;
+
+    /// Tiles visited by the current repair.
+    std::vector<unsigned int> mTouched;
+    /// Seeds of the current repair, sorted by distance.
+    std::vector<Entry> mSeeds;
+    /// The BFS queue, kept to avoid reallocations.
+    std::vector<Entry> mQueue;
+
+    /// Number of tiles visited by the updates.
+    unsigned long long mVisited;
+};
+
+#endif /* !__GAME_DISTANCE_FIELD_H__INCL__ */
@@ -0,0 +1,91 @@
+/** @file
+ * @brief Implementation of a pool of coroutine frames.
+ *
+ * @author Jan Bobek
+ */
+
+#include "GameFramePool.h"
+#include "util.h"
+
+/*************************************************************************/
+/* GameFramePool                                                         */
+/*************************************************************************/
+const size_t GameFramePool::CHUNK;
+
+GameFramePool::GameFramePool()
+: mCur( NULL ),
+  mLeft( 0 ),
+  mFrames( 0 ),
+  mHeapAllocs( 0 )
+{
+    std::fill( mFree, mFree + CLASSES, (Free*)NULL );
+}
+
+GameFramePool::~GameFramePool()
+{
+    assert( !mFrames );
+
+    std::vector<char*>::iterator cur, end;
+    cur = mChunks.begin();
+    end = mChunks.end();
+    for(; cur != end; ++cur )
+        safeDeleteArray( *cur );
+}
+
+void*
+GameFramePool::allocate(
+    size_t size
+    )
+{
+    ++mFrames;
+
+    const size_t cls = (size + GRAIN - 1) / GRAIN;
+    if( CLASSES <= cls )
+    {
+        /* Too big, no class for it. */
+        ++mHeapAllocs;
+        return ::operator new( size );
+    }
+
+    if( mFree[cls] )
+    {
+        /* Reuse a released frame. */
+        Free* f = mFree[cls];
+        mFree[cls] = f->next;
+        return f;
+    }
+
+    if( mLeft < cls * GRAIN )
+    {
+        /* The rest of the chunk is too small, waste it. */
+        ++mHeapAllocs;
+        mChunks.push_back( new char[CHUNK] );
+        mCur = mChunks.back();
+        mLeft = CHUNK;
+    }
+
+    void* p = mCur;
+    mCur += cls * GRAIN;
+    mLeft -= cls * GRAIN;
+    return p;
+}
+
+void
+GameFramePool::release(
+    void* p,
+    size_t size
+    )
+{
+    --mFrames;
+
+    const size_t cls = (size + GRAIN - 1) / GRAIN;
+    if( CLASSES <= cls )
+    {
+        ::operator delete( p );
+        return;
+    }
+
+    Free* f = (Free*)p;
+    f->next = mFree[cls];
+    mFree[cls] = f;
+}
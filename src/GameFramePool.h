@@ -0,0 +1,109 @@
+/** @file
+ * @brief A pool of coroutine frames declarations.
+ *
+ * @author Jan Bobek
+ */
+
+#ifndef __GAME_FRAME_POOL_H__INCL__
+#define __GAME_FRAME_POOL_H__INCL__
+
+#include "Game.h"
+
+/**
+ * @brief A pool of coroutine frames.
+ *
+ * Frames are carved out of large chunks and sorted into
+ * size classes; a released frame waits in a free list
+ * of its class for the next one of the same size.
+ * Frames too big for any class come from the heap.
+ *
+ * Not thread-safe; allocate and release on a single thread.
+ *
+ * @author Jan Bobek
+ */
+class GameFramePool
+{
+public:
+    /**
+     * @brief Initializes an empty pool.
+     */
+    GameFramePool();
+    /**
+     * @brief Releases all the chunks.
+     *
+     * All the frames must have been released by now.
+     */
+    ~GameFramePool();
+
+    /**
+     * @brief Allocates a frame.
+     *
+     * @param[in] size Size of the frame in bytes.
+     *
+     * @return The frame.
+     */
+    void* allocate( size_t size );
+    /**
+     * @brief Releases a frame.
+     *
+     * @param[in] p    The frame.
+     * @param[in] size Size of the frame, as allocated.
+     */
+    void release( void* p, size_t size );
+
+    /**
+     * @brief Obtains number of the frames in use.
+     *
+     * @return Number of the frames.
+     */
+    size_t frames() const { return mFrames; }
+    /**
+     * @brief Obtains number of allocations served from the heap.
+     *
+     * Counts the chunks and the frames too big for a class.
+     *
+     * @return Number of the allocations.
+     */
+    size_t heapAllocs() const { return mHeapAllocs; }
+    /**
+     * @brief Obtains the memory taken by the chunks.
+     *
+     * @return Number of bytes.
+     */
+    size_t memory() const { return mChunks.size() * CHUNK; }
+
+protected:
+    /// Granularity of the size classes; keeps frames aligned.
+    static const size_t GRAIN = 16;
+    /// Number of the size classes.
+    static const size_t CLASSES = 64;
+    /// Size of a chunk.
+    static const size_t CHUNK = 64 * 1024;
+
+    /**
+     * @brief A released frame.
+     *
+     * @author Jan Bobek
+     */
+    struct Free
+    {
+        /// The next released frame of the class.
+        Free* next;
+    };
+
+    /// Released frames of each size class.
+    Free* mFree[CLASSES];
+    /// The chunks.
+    std::vector<char*> mChunks;
+    /// Where the last chunk is not carved yet.
+    char* mCur;
+    /// Number of bytes not carved yet.
+    size_t mLeft;
+
+    /// Number of the frames in use.
+    size_t mFrames;
+    /// Number of allocations served from the heap.
+    size_t mHeapAllocs;
+};
+
+#endif /* !__GAME_FRAME_POOL_H__INCL__ */
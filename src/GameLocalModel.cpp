@@ -7,6 +7,8 @@
 #include "GameLocalModel.h"
 #include "GameCanvas.h"
 #include "GameController.h"
+#include "GamePathGraph.h"
+#include "ThreadPool.h"
 #include "util.h"
 
 /*************************************************************************/
@@ -147,11 +149,41 @@ GameLocalModel::GAME_INTERACTIONS[GENT_COUNT][GENT_COUNT] =
     }
 };
 
+const char
+GameLocalModel::GAME_MOVES[4][2] =
+{
+    { -1,  0 }, /* GCE_MOVEUP */
+    {  1,  0 }, /* GCE_MOVEDOWN */
+    {  0, -1 }, /* GCE_MOVELEFT */
+    {  0,  1 }  /* GCE_MOVERIGHT */
+};
+
 GameLocalModel::GameLocalModel(
     const GameCoord& size
     )
-: GameModel( size )
+: GameModel( size ),
+  mScriptedMonsters( false ),
+  mPlayerDist( size ),
+  mPathGraph( size.row * size.col < GAME_PATH_GRAPH_TILES
+              ? NULL : new GamePathGraph( size ) ),
+  mMonsterKernel( NULL ),
+  mSearchBudgetUs( 0 ),
+  mSearchIterations( 0 ),
+  mTick( 0 ),
+  mDanger( safeAllocArray<unsigned int>( size.row * size.col ) ),
+  mDangerDirty( false ),
+  mPool( NULL )
+{
+    /* Nothing is in danger yet. */
+    std::fill( mDanger, mDanger + size.row * size.col, GAME_TICK_NEVER );
+}
+
+GameLocalModel::~GameLocalModel()
 {
+    safeDelete( mPool );
+    safeDeleteArray( mDanger );
+    safeDelete( mMonsterKernel );
+    safeDelete( mPathGraph );
 }
 
 void
@@ -188,6 +220,78 @@ GameLocalModel::queue(
     mEventPipe.push( event );
 }
 
+void
+GameLocalModel::setSearchBudget(
+    unsigned int us,
+    unsigned int iterations
+    )
+{
+    mSearchBudgetUs = us;
+    mSearchIterations = iterations;
+}
+
+GameLocalModel::SearchStats
+GameLocalModel::searchStats() const
+{
+    SearchStats total;
+
+    std::list<SearchStats>::const_iterator cur, end;
+    cur = mSearchStats.begin();
+    end = mSearchStats.end();
+    for(; cur != end; ++cur )
+        total += *cur;
+
+    return total;
+}
+
+void
+GameLocalModel::setThreads(
+    unsigned int threads
+    )
+{
+    safeDelete( mPool );
+    if( threads )
+        mPool = new ThreadPool( threads );
+}
+
+void
+GameLocalModel::setPathGraph(
+    bool enable
+    )
+{
+    safeDelete( mPathGraph );
+    if( enable )
+        mPathGraph = new GamePathGraph( mSize );
+
+    /* Whichever is in use has missed the changes. */
+    for( GameCoord cur; cur.row < mSize.row; ++cur.row )
+        for( cur.col = 0; cur.col < mSize.col; ++cur.col )
+            if( mPathGraph )
+                mPathGraph->set( cur, pathPassable( at( cur ) ) );
+            else
+                mPlayerDist.set( cur, pathTile( at( cur ) ) );
+
+    if( mPathGraph )
+        mPathGraph->update();
+    mPlayerDist.invalidate();
+}
+
+void
+GameLocalModel::setMonsterKernel(
+    bool enable,
+    GameMonsterKernel::Isa isa
+    )
+{
+    safeDelete( mMonsterKernel );
+    if( !enable )
+        return;
+
+    mMonsterKernel = new GameMonsterKernel( mSize, isa );
+    for( GameCoord cur; cur.row < mSize.row; ++cur.row )
+        for( cur.col = 0; cur.col < mSize.col; ++cur.col )
+            mMonsterKernel->set( cur, pathPassable( at( cur ) ) );
+}
+
 bool
 GameLocalModel::tick()
 {
@@ -195,6 +299,9 @@ GameLocalModel::tick()
     if( !checkEndCond() )
         return false;
 
+    /* Next tick. */
+    ++mTick;
+
     /* Dispatch events in the queue. */
     for(; !mEventPipe.empty(); mEventPipe.pop() )
         dispatch( mEventPipe.front() );
@@ -203,6 +310,9 @@ GameLocalModel::tick()
     bool active = tickBombs();
     assert( !active );
 
+    /* Update the pathfinding. */
+    tickPlayerDist();
+
     /* Visit controlled entities. */
     tickEntities();
     return true;
@@ -238,15 +348,71 @@ GameLocalModel::dispatchSpawnEntity(
     new_event.coords = GameCoordRect( spawn, spawn );
     new_event.ctl    = event.ctl;
 
+    AiController* ai = NULL;
+    MonsterAiController* monster = NULL;
     if( !new_event.ctl )
     {
-        if( GENT_PLAYER == new_event.entity )
-            new_event.ctl = new PlayerAiController;
+        if( GENT_PLAYER == new_event.entity && mSearchBudgetUs )
+        {
+            mSearchStats.push_back( SearchStats() );
+            new_event.ctl = ai = new PlayerSearchController(
+                *this, mSearchBudgetUs, mSearchIterations,
+                mSearchStats.back() );
+        }
+        else if( GENT_PLAYER == new_event.entity )
+            new_event.ctl = ai = new PlayerAiController( *this );
+        else if( GENT_MONSTER == new_event.entity && mScriptedMonsters )
+            new_event.ctl = ai = new PatrolController( *this, mFramePool );
         else if( GENT_MONSTER == new_event.entity )
-            new_event.ctl = new MonsterAiController;
+            new_event.ctl = ai = monster = new MonsterAiController( *this );
     }
 
     dispatch( new_event );
+
+    /* Let our AI know what it controls; nothing else was pushed. */
+    if( ai )
+    {
+        ai->attach( &mCtlEntities.back() );
+        mCtlEntities.back().monster = monster;
+    }
+}
+
+void
+GameLocalModel::dispatchTileChanged(
+    const GameCoord& pos,
+    GameEntity prev
+    )
+{
+    const GameEntity ent = at( pos );
+
+    /* Let the pathfinding know. */
+    if( mPathGraph )
+        mPathGraph->set( pos, pathPassable( ent ) );
+    else
+        mPlayerDist.set( pos, pathTile( ent ) );
+    if( mMonsterKernel )
+        mMonsterKernel->set( pos, pathPassable( ent ) );
+
+    if(
+        /* Bombs take care of the danger map themselves. */
+        GENT_BOMB == prev || GENT_BOMB == ent ||
+        /* Does not change the flames. */
+        flamePassable( prev ) == flamePassable( ent ) )
+        return;
+
+    /* Look for a bomb whose flames may be affected. */
+    std::list<GameBombEntity>::const_iterator cur, end;
+    cur = mBombs.begin();
+    end = mBombs.end();
+    for(; cur != end; ++cur )
+        if( (cur->pos.row == pos.row &&
+             abs( cur->pos.col - pos.col ) <= cur->flames) ||
+            (cur->pos.col == pos.col &&
+             abs( cur->pos.row - pos.row ) <= cur->flames) )
+        {
+            mDangerDirty = true;
+            break;
+        }
 }
 
 bool
@@ -276,6 +442,195 @@ GameLocalModel::checkEndCond()
     return cur != end;
 }
 
+void
+GameLocalModel::tickPlayerDist()
+{
+    std::list<GameCtlEntity>::const_iterator cur, end;
+    cur = mCtlEntities.begin();
+    end = mCtlEntities.end();
+    for(; cur != end; ++cur )
+        if( GENT_MONSTER == cur->ent )
+        {
+            /* Somebody chases the players. */
+            if( mPathGraph )
+                mPathGraph->update();
+            else
+                mPlayerDist.update();
+            break;
+        }
+}
+
+bool
+GameLocalModel::pathPassable(
+    GameEntity ent
+    )
+{
+    /* Monsters move, do not let them block the path. */
+    if( GENT_MONSTER == ent )
+        return true;
+
+    switch( GAME_INTERACTIONS[GENT_MONSTER][ent] )
+    {
+        case GINT_OK:
+        case GINT_DIE:
+        case GINT_DIEBONUS:
+        case GINT_GIVEBONUS:
+        case GINT_GETBONUS:
+            return true;
+
+        default:
+        case GINT_STOP:
+        case GINT_KILL:
+        case GINT_KILLBONUS:
+            return false;
+    }
+}
+
+GameDistanceField::Tile
+GameLocalModel::pathTile(
+    GameEntity ent
+    )
+{
+    if( GENT_PLAYER == ent )
+        return GameDistanceField::TILE_SOURCE;
+    else if( pathPassable( ent ) )
+        return GameDistanceField::TILE_PASSABLE;
+    else
+        return GameDistanceField::TILE_BLOCKED;
+}
+
+void
+GameLocalModel::tickDanger()
+{
+    if( !mDangerDirty )
+        return;
+
+    mDangerDirty = false;
+
+    /* Wipe all the flames. */
+    std::list<GameBombEntity>::iterator cur, end;
+    end = mBombs.end();
+    for( cur = mBombs.begin(); cur != end; ++cur )
+    {
+        dangerClear( *cur );
+        cur->explode = mTick + cur->timer;
+    }
+
+    /* Stamp them again. */
+    for( cur = mBombs.begin(); cur != end; ++cur )
+        dangerStamp( *cur );
+}
+
+unsigned int
+GameLocalModel::dangerIn(
+    const GameCoord& pos
+    ) const
+{
+    if( GENT_FLAME == at( pos ) )
+        /* Already burning. */
+        return 0;
+
+    const unsigned int tick = mDanger[pos.row * mSize.col + pos.col];
+    return GAME_TICK_NEVER == tick ? GAME_TICK_NEVER : tick - mTick;
+}
+
+void
+GameLocalModel::dangerStamp(
+    GameBombEntity& bomb
+    )
+{
+    bomb.horiz = GameCoordRect( bomb.pos, bomb.pos );
+    bomb.vert = GameCoordRect( bomb.pos, bomb.pos );
+
+    /* The bomb itself. */
+    unsigned int& here = mDanger[bomb.pos.row * mSize.col + bomb.pos.col];
+    here = std::min( here, bomb.explode );
+
+    /* Horizontal left. */
+    dangerStampRay( bomb, bomb.horiz.first, 0, -1 );
+    /* Horizontal right. */
+    dangerStampRay( bomb, bomb.horiz.second, 0, 1 );
+    /* Vertical up. */
+    dangerStampRay( bomb, bomb.vert.first, -1, 0 );
+    /* Vertical down. */
+    dangerStampRay( bomb, bomb.vert.second, 1, 0 );
+}
+
+void
+GameLocalModel::dangerStampRay(
+    GameBombEntity& bomb,
+    GameCoord& pos,
+    char rowstep,
+    char colstep
+    )
+{
+    GameCoord newpos(
+        pos.row + rowstep, pos.col + colstep );
+    unsigned char flames = bomb.flames;
+
+    while(
+        /* Limit by length of flames. */
+        0 < flames-- &&
+        /* Limit by height of the game map. */
+        newpos.row < mSize.row &&
+        /* Limit by width of the game map. */
+        newpos.col < mSize.col )
+    {
+        const GameEntity target = at( newpos );
+        if( GENT_BOMB == target )
+        {
+            /* Chain detonation. */
+            std::list<GameBombEntity>::iterator cur, end;
+            cur = mBombs.begin();
+            end = mBombs.end();
+            for(; cur != end; ++cur )
+                if( cur->pos == newpos &&
+                    bomb.explode < cur->explode )
+                {
+                    cur->explode = bomb.explode;
+                    dangerStamp( *cur );
+                    break;
+                }
+
+            return;
+        }
+        else if( !flamePassable( target ) )
+            return;
+
+        /* The flame gets here. */
+        unsigned int& tick = mDanger[newpos.row * mSize.col + newpos.col];
+        tick = std::min( tick, bomb.explode );
+        pos = newpos;
+
+        /* Try next tile. */
+        newpos.row += rowstep;
+        newpos.col += colstep;
+    }
+}
+
+void
+GameLocalModel::dangerClear(
+    const GameBombEntity& bomb
+    )
+{
+    GAME_COORD_RECT_ITERATE( cur, bomb.horiz )
+        mDanger[cur.row * mSize.col + cur.col] = GAME_TICK_NEVER;
+    GAME_COORD_RECT_ITERATE( cur, bomb.vert )
+        mDanger[cur.row * mSize.col + cur.col] = GAME_TICK_NEVER;
+}
+
+bool
+GameLocalModel::flamePassable(
+    GameEntity ent
+    )
+{
+    /* These move; assume the worst. */
+    if( GENT_PLAYER == ent || GENT_MONSTER == ent )
+        return true;
+
+    return GINT_OK == GAME_INTERACTIONS[GENT_FLAME][ent];
+}
+
 bool
 GameLocalModel::tickBombs()
 {
@@ -314,6 +669,9 @@ GameLocalModel::tickBombExploded(
 
     /* Mark as exploding. */
     bomb.timer = 0;
+    /* Its flames are real now. */
+    dangerClear( bomb );
+    mDangerDirty = true;
     /* Refund the bomb to the owner. */
     if( bomb.ctl )
         ++bomb.ctl->bombs;
@@ -409,6 +767,11 @@ GameLocalModel::tickEntities()
 {
     bool died;
 
+    /* Let the AI see the current dangers. */
+    tickDanger();
+    /* Everybody decides first. */
+    tickEntitiesDecide();
+
     std::list<GameCtlEntity>::iterator cur, end;
     cur = mCtlEntities.begin();
     end = mCtlEntities.end();
@@ -426,6 +789,74 @@ GameLocalModel::tickEntities()
     }
 }
 
+void
+GameLocalModel::tickEntitiesDecide()
+{
+    /**
+     * @brief Ticks the concurrent controllers.
+     *
+     * @author Jan Bobek
+     */
+    struct Task
+    : public ThreadPool::Task
+    {
+        /**
+         * @brief Initializes the task.
+         *
+         * @param[in] entities_ The entities to tick.
+         */
+        Task( std::vector<GameCtlEntity*>& entities_ )
+        : entities( entities_ ) {}
+
+        /**
+         * @brief Ticks a single controller.
+         *
+         * @param[in] idx Index of the entity.
+         */
+        void run( unsigned int idx )
+        {
+            entities[idx]->ctl->tick( entities[idx]->action );
+        }
+
+        /// The entities to tick.
+        std::vector<GameCtlEntity*>& entities;
+    };
+
+    mConcurrent.clear();
+    mMonsters.clear();
+    mPlayers.clear();
+
+    /* The batch chases in the distance field only. */
+    const bool batch = mMonsterKernel && !mPathGraph;
+
+    std::list<GameCtlEntity>::iterator cur, end;
+    end = mCtlEntities.end();
+
+    /* Once per tick; the monsters chase them, see tickRoute(). */
+    for( cur = mCtlEntities.begin(); cur != end; ++cur )
+        if( GENT_PLAYER == cur->ent )
+            mPlayers.push_back( cur->pos );
+
+    for( cur = mCtlEntities.begin(); cur != end; ++cur )
+        if( batch && cur->monster )
+            mMonsters.push_back( &*cur );
+        else if( cur->ctl->concurrent() )
+            mConcurrent.push_back( &*cur );
+        else
+            /* Has to be here and now. */
+            cur->ctl->tick( cur->action );
+
+    Task task( mConcurrent );
+    if( mPool )
+        mPool->run( task, mConcurrent.size() );
+    else
+        for( unsigned int i = 0; i < mConcurrent.size(); ++i )
+            task.run( i );
+
+    if( !mMonsters.empty() )
+        tickMonsters();
+}
+
 bool
 GameLocalModel::tickEntity(
     GameCtlEntity& entity
@@ -433,12 +864,8 @@ GameLocalModel::tickEntity(
 {
     bool active = false;
 
-    /* Get control event of the entity. */
-    GameCtlEvent event;
-    entity.ctl->tick( event );
-
-    /* Handle the event. */
-    switch( event )
+    /* Handle the decided event. */
+    switch( entity.action )
     {
         case GCE_NOOP:      /* Fair enough :) */ break;
         case GCE_MOVEUP:    active = tickEntityMoved( entity, -1, 0 ); break;
@@ -456,6 +883,27 @@ GameLocalModel::tickEntity(
     return active;
 }
 
+void
+GameLocalModel::tickMonsters()
+{
+    mMonsterKernel->clear();
+
+    std::vector<GameCtlEntity*>::const_iterator cur, end;
+    cur = mMonsters.begin();
+    end = mMonsters.end();
+    for(; cur != end; ++cur )
+        mMonsterKernel->add( (*cur)->pos, (*cur)->monster->seed() );
+
+    mMonsterKernel->decide( mPlayerDist.distances() );
+
+    /* Hand the decisions over, the moves are applied as usual. */
+    for( unsigned int i = 0; i < mMonsters.size(); ++i )
+    {
+        mMonsters[i]->action = mMonsterKernel->event( i );
+        mMonsters[i]->monster->seed() = mMonsterKernel->seed( i );
+    }
+}
+
 bool
 GameLocalModel::tickEntityMoved(
     GameCtlEntity& entity,
@@ -556,6 +1004,15 @@ GameLocalModel::tickEntityPutBomb(
         /* Take the bomb from the owner. */
         --entity.bombs;
 
+        GameBombEntity& bomb = mBombs.back();
+        bomb.explode = mTick + bomb.timer;
+        if( GAME_TICK_NEVER == mDanger[bomb.pos.row * mSize.col + bomb.pos.col] )
+            /* Stands alone, just add its flames. */
+            dangerStamp( bomb );
+        else
+            /* Other flames reach it, chain them properly. */
+            mDangerDirty = true;
+
         /* Move player to previous position. */
         GameModelEvent event;
         event.entity = GENT_PLAYER;
@@ -780,6 +1237,8 @@ GameLocalModel::GameCtlEntity::GameCtlEntity(
   pos( pos_ ),
   prevpos( pos_ ),
   ctl( ctl_ ),
+  monster( NULL ),
+  action( GCE_NOOP ),
   /* Initialize some sane defaults. */
   bombs( ent_ == GENT_PLAYER ? GAME_BOMBS_DEFAULT : 0 ),
   flames( GAME_FLAMES_DEFAULT ),
@@ -806,19 +1265,58 @@ GameLocalModel::GameBombEntity::GameBombEntity(
 : pos( pos_ ),
   ctl( ctl_ ),
   timer( GAME_BOMB_TICKS ),
-  flames( ctl_->flames )
+  flames( ctl_->flames ),
+  explode( GAME_TICK_NEVER ),
+  horiz( pos_, pos_ ),
+  vert( pos_, pos_ )
+{
+}
+
+/*************************************************************************/
+/* GameLocalModel::AiController                                          */
+/*************************************************************************/
+GameLocalModel::AiController::AiController(
+    const GameLocalModel& model
+    )
+: mModel( model ),
+  mEntity( NULL ),
+  /* Seeded in order of creation, reproducible. */
+  mSeed( rand() )
+{
+}
+
+void
+GameLocalModel::AiController::attach(
+    const GameCtlEntity* entity
+    )
 {
+    mEntity = entity;
 }
 
 /*************************************************************************/
 /* GameLocalModel::MonsterAiController                                   */
 /*************************************************************************/
+GameLocalModel::MonsterAiController::MonsterAiController(
+    const GameLocalModel& model
+    )
+: AiController( model ),
+  mRouteNext( 0 ),
+  mRouteTick( 0 ),
+  mRouteFailed( false )
+{
+}
+
 void
 GameLocalModel::MonsterAiController::tick(
     GameCtlEvent& event
     )
 {
-    switch( rand() % 4 )
+    if( mEntity &&
+        (mModel.mPathGraph ? tickRoute( event ) : tickDownhill( event )) )
+        return;
+
+    /* No player reachable, walk randomly. */
+    switch( random() % 4 )
     {
         case 0: event = GCE_MOVEUP; break;
         case 1: event = GCE_MOVEDOWN; break;
@@ -827,23 +1325,271 @@ GameLocalModel::MonsterAiController::tick(
     }
 }
 
+bool
+GameLocalModel::MonsterAiController::tickDownhill(
+    GameCtlEvent& event
+    )
+{
+    /* Go downhill in the distance field. */
+    const GameCoord& pos = mEntity->pos;
+    unsigned int best = mModel.playerDist( pos ), ties = 0;
+
+    for( unsigned int i = 0; i < 4; ++i )
+    {
+        const GameCoord next(
+            pos.row + GAME_MOVES[i][0],
+            pos.col + GAME_MOVES[i][1] );
+
+        if( !(next.row < mModel.mSize.row) ||
+            !(next.col < mModel.mSize.col) )
+            continue;
+
+        const unsigned int dist = mModel.playerDist( next );
+        if( dist < best )
+        {
+            best = dist;
+            ties = 1;
+            event = (GameCtlEvent)(GCE_MOVEUP + i);
+        }
+        else if( ties && dist == best && !(random() % ++ties) )
+            /* Break ties randomly. */
+            event = (GameCtlEvent)(GCE_MOVEUP + i);
+    }
+
+    return 0 < ties;
+}
+
+bool
+GameLocalModel::MonsterAiController::tickRoute(
+    GameCtlEvent& event
+    )
+{
+    const GamePathGraph& graph = *mModel.mPathGraph;
+    const GameCoord& pos = mEntity->pos;
+
+    /* Chase the nearest player, as the crow flies. */
+    const GameCoord* target = NULL;
+    unsigned int best = GAME_DIST_INFINITE;
+
+    std::vector<GameCoord>::const_iterator cur, end;
+    cur = mModel.mPlayers.begin();
+    end = mModel.mPlayers.end();
+    for(; cur != end; ++cur )
+    {
+        const unsigned int dist =
+            abs( cur->row - pos.row ) + abs( cur->col - pos.col );
+        if( dist < best )
+        {
+            best = dist;
+            target = &*cur;
+        }
+    }
+
+    if( !target )
+        return false;
+
+    /* Skip the part we have walked. */
+    if( mRouteNext < mRoute.size() && mRoute[mRouteNext] == pos )
+        ++mRouteNext;
+
+    const bool old = mRouteTick + GAME_ROUTE_TICKS <= mModel.mTick;
+    if( mRouteFailed && !old )
+        /* Do not search in vain too often. */
+        return false;
+
+    if(
+        /* Walked it all ... */
+        !(mRouteNext < mRoute.size()) ||
+        /* ... or the route is getting old. */
+        old )
+        if( !plan( *target ) )
+            return false;
+
+    /* Close enough, go straight for the player. */
+    GameCoord next;
+    const GameCoord& to =
+        (graph.clusterOf( pos ) == graph.clusterOf( *target )
+         ? *target : mRoute[mRouteNext]);
+
+    if( !graph.step( pos, to, next ) &&
+        /* Something got in the way. */
+        (!plan( *target ) || !graph.step( pos, mRoute[mRouteNext], next )) )
+        return false;
+
+    for( unsigned int i = 0; i < 4; ++i )
+        if( next.row == (GameCoord::coord_t)(pos.row + GAME_MOVES[i][0]) &&
+            next.col == (GameCoord::coord_t)(pos.col + GAME_MOVES[i][1]) )
+        {
+            event = (GameCtlEvent)(GCE_MOVEUP + i);
+            return true;
+        }
+
+    return false;
+}
+
+bool
+GameLocalModel::MonsterAiController::plan(
+    const GameCoord& target
+    )
+{
+    /* Spread the planning of the monsters over the ticks. */
+    mRouteNext = 0;
+    mRouteTick = mModel.mTick - random() % (GAME_ROUTE_TICKS / 2);
+
+    mRouteFailed = !mModel.mPathGraph->route(
+        mEntity->pos, target, mRoute, GAME_ROUTE_PORTALS );
+
+    /* We may be standing at a portal. */
+    while( mRouteNext < mRoute.size() && mRoute[mRouteNext] == mEntity->pos )
+        ++mRouteNext;
+
+    return !mRouteFailed;
+}
+
 /*************************************************************************/
 /* GameLocalModel::PlayerAiController                                   */
 /*************************************************************************/
+GameLocalModel::PlayerAiController::PlayerAiController(
+    const GameLocalModel& model
+    )
+: AiController( model )
+{
+}
+
 void
 GameLocalModel::PlayerAiController::tick(
     GameCtlEvent& event
     )
 {
-    unsigned int x = rand() % 101;
-    if( x < 25 )
-        event = GCE_MOVEUP;
-    else if( x < 50 )
-        event = GCE_MOVEDOWN;
-    else if( x < 75 )
-        event = GCE_MOVELEFT;
-    else if( x < 100 )
-        event = GCE_MOVERIGHT;
-    else
+    event = GCE_NOOP;
+    if( !mEntity )
+        return;
+
+    const GameCoord& pos = mEntity->pos;
+    unsigned int best = mModel.dangerIn( pos ), ties = 0;
+
+    if( GAME_TICK_NEVER != best )
+    {
+        /* In danger, step to a safer tile. */
+        for( unsigned int i = 0; i < 4; ++i )
+        {
+            const GameCoord next(
+                pos.row + GAME_MOVES[i][0],
+                pos.col + GAME_MOVES[i][1] );
+
+            if( !walkable( next ) )
+                continue;
+
+            const unsigned int danger = mModel.dangerIn( next );
+            if( best < danger )
+            {
+                best = danger;
+                ties = 1;
+                event = (GameCtlEvent)(GCE_MOVEUP + i);
+            }
+            else if( ties && danger == best && !(random() % ++ties) )
+                event = (GameCtlEvent)(GCE_MOVEUP + i);
+        }
+
+        /* Nowhere safer; wait and hope. */
+        return;
+    }
+
+    /* Safe for now; is there something to blow up? */
+    bool target = false;
+    for( unsigned int i = 0; i < 4 && !target; ++i )
+    {
+        const GameCoord next(
+            pos.row + GAME_MOVES[i][0],
+            pos.col + GAME_MOVES[i][1] );
+
+        if( next.row < mModel.mSize.row && next.col < mModel.mSize.col )
+            switch( mModel.at( next ) )
+            {
+                case GENT_WALL:
+                case GENT_PLAYER:
+                case GENT_MONSTER:
+                    target = true;
+                    break;
+
+                default:
+                    break;
+            }
+    }
+
+    if( target && !(random() % 2) && canEscape() )
+    {
         event = GCE_PUTBOMB;
+        return;
+    }
+
+    /* Wander among the safe tiles. */
+    for( unsigned int i = 0; i < 4; ++i )
+    {
+        const GameCoord next(
+            pos.row + GAME_MOVES[i][0],
+            pos.col + GAME_MOVES[i][1] );
+
+        if( walkable( next ) &&
+            GAME_TICK_NEVER == mModel.dangerIn( next ) &&
+            !(random() % ++ties) )
+            event = (GameCtlEvent)(GCE_MOVEUP + i);
+    }
+}
+
+bool
+GameLocalModel::PlayerAiController::walkable(
+    const GameCoord& pos
+    ) const
+{
+    if( !(pos.row < mModel.mSize.row) ||
+        !(pos.col < mModel.mSize.col) )
+        return false;
+
+    switch( GAME_INTERACTIONS[mEntity->ent][mModel.at( pos )] )
+    {
+        case GINT_OK:
+        case GINT_GETBONUS:
+            return true;
+
+        default:
+        case GINT_STOP:
+        case GINT_DIE:
+        case GINT_DIEBONUS:
+        case GINT_KILL:
+        case GINT_KILLBONUS:
+        case GINT_GIVEBONUS:
+            return false;
+    }
+}
+
+bool
+GameLocalModel::PlayerAiController::canEscape() const
+{
+    const GameCoord& pos = mEntity->pos;
+    const GameCoord& back = mEntity->prevpos;
+
+    if(
+        /* Out of bombs. */
+        !mEntity->bombs ||
+        /* Bombs are only put after a step. */
+        pos == back ||
+        /* We go back after putting the bomb. */
+        GAME_TICK_NEVER != mModel.dangerIn( back ) )
+        return false;
+
+    /* Find a safe tile off the lines of the bomb. */
+    for( unsigned int i = 0; i < 4; ++i )
+    {
+        const GameCoord next(
+            back.row + GAME_MOVES[i][0],
+            back.col + GAME_MOVES[i][1] );
+
+        if( next.row != pos.row && next.col != pos.col &&
+            walkable( next ) &&
+            GAME_TICK_NEVER == mModel.dangerIn( next ) )
+            return true;
+    }
+
+    return false;
 }
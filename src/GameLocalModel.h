@@ -8,7 +8,13 @@
 #define __GAME_LOCAL_MODEL_H__INCL__
 
 #include "GameController.h"
+#include "GameDistanceField.h"
+#include "GameFramePool.h"
 #include "GameModel.h"
+#include "GameMonsterKernel.h"
+
+class GamePathGraph;
+class ThreadPool;
 
 /**
  * @brief A local (as opposed to remote) game model.
@@ -19,12 +25,68 @@ class GameLocalModel
 : public GameModel
 {
 public:
+    /**
+     * @brief Statistics of the lookahead search AI.
+     *
+     * @author Jan Bobek
+     */
+    struct SearchStats
+    {
+        /**
+         * @brief Zeroes the statistics.
+         */
+        SearchStats();
+
+        /**
+         * @brief Adds other statistics to these.
+         *
+         * @param[in] oth The other statistics.
+         *
+         * @return This object.
+         */
+        SearchStats& operator+=( const SearchStats& oth );
+
+        /// Number of ticks searched.
+        unsigned long long ticks;
+        /// Number of search iterations (playouts).
+        unsigned long long iterations;
+        /// Number of tree nodes expanded.
+        unsigned long long nodes;
+        /// Number of tree nodes reused from earlier ticks.
+        unsigned long long reused;
+        /// Time granted by the budget, in nanoseconds.
+        unsigned long long budgetNs;
+        /// Time actually spent searching, in nanoseconds.
+        unsigned long long usedNs;
+    };
+    /**
+     * @brief A running script of an AI controller.
+     *
+     * Returned by the coroutines of ScriptController.
+     * Coroutines need C++20; they are compiled only
+     * in GameLocalModelScript.cpp, which defines the
+     * promise type as well.
+     *
+     * @author Jan Bobek
+     */
+    struct Script
+    {
+        struct promise_type;
+
+        /// Address of the coroutine frame.
+        void* frame;
+    };
+
     /**
      * @brief Initializes empty game map.
      *
      * @param[in] size Size of the map.
      */
     GameLocalModel( const GameCoord& size );
+    /**
+     * @brief Releases the pathfinding data and worker threads.
+     */
+    ~GameLocalModel();
 
     /**
      * @brief Dispatches a game model event.
@@ -49,7 +111,75 @@ public:
      */
     bool tick();
 
+    /**
+     * @brief Makes newly spawned AI players search ahead.
+     *
+     * @param[in] us         Time budget per tick in microseconds;
+     *                       0 for the plain AI.
+     * @param[in] iterations Optional cap on iterations per tick; 0
+     *                       for none. Makes the search independent
+     *                       of CPU speed.
+     */
+    void setSearchBudget( unsigned int us, unsigned int iterations = 0 );
+    /**
+     * @brief Obtains statistics of all the searching AI players.
+     *
+     * @return The statistics, summed up.
+     */
+    SearchStats searchStats() const;
+    /**
+     * @brief Sets number of threads ticking the AI.
+     *
+     * The game plays the same regardless of the number.
+     *
+     * @param[in] threads Number of worker threads; 0 to tick
+     *                    on the calling thread only.
+     */
+    void setThreads( unsigned int threads );
+    /**
+     * @brief Makes the monsters plan routes over a path graph.
+     *
+     * Otherwise, the monsters follow a distance field
+     * shared by all of them. The path graph is used by
+     * default on maps of GAME_PATH_GRAPH_TILES tiles or more.
+     *
+     * @param[in] enable Use the path graph?
+     */
+    void setPathGraph( bool enable );
+    /**
+     * @brief Decides the moves of all the monsters in a batch.
+     *
+     * The batch only chases players in the distance field;
+     * while the path graph is in use, the monsters decide
+     * one by one regardless.
+     *
+     * @param[in] enable Use the batch?
+     * @param[in] isa    The instruction set of the batch.
+     */
+    void setMonsterKernel( bool enable,
+                           GameMonsterKernel::Isa isa = GameMonsterKernel::best() );
+    /**
+     * @brief Makes newly spawned AI monsters run a patrol script.
+     *
+     * @param[in] enable Run the script?
+     */
+    void setScriptedMonsters( bool enable ) { mScriptedMonsters = enable; }
+    /**
+     * @brief Obtains the pool of the script coroutine frames.
+     *
+     * @return The pool.
+     */
+    const GameFramePool& framePool() const { return mFramePool; }
+
+    /// A table of all possible in-game interactions; the remote
+    /// model predicts the moves of its players by it, too.
+    static const GameInteraction GAME_INTERACTIONS[GENT_COUNT][GENT_COUNT];
+    /// Row and column steps of GCE_MOVEUP through GCE_MOVERIGHT.
+    static const char GAME_MOVES[4][2];
+
 protected:
+    class MonsterAiController;
+
     /**
      * @brief A controlled game entity.
      *
@@ -79,6 +209,10 @@ protected:
         GameCoord prevpos;
         /// The associated controller.
         GameController* ctl;
+        /// The controller if it is our monster AI; NULL otherwise.
+        MonsterAiController* monster;
+        /// Action of the controller in this tick.
+        GameCtlEvent action;
 
         /// Number of available bombs.
         unsigned char bombs;
@@ -118,38 +252,483 @@ protected:
         unsigned char timer;
         /// Length of the flames.
         unsigned char flames;
+
+        /// Tick of explosion, including chain detonations.
+        unsigned int explode;
+        /// Horizontal extent of the flames, as stamped in the danger map.
+        GameCoordRect horiz;
+        /// Vertical extent of the flames, as stamped in the danger map.
+        GameCoordRect vert;
+    };
+    /**
+     * @brief A base of the AI controllers.
+     *
+     * Gives the AI read-only access to the model
+     * and to the controlled entity, and its own stream
+     * of random numbers, so it may tick concurrently.
+     *
+     * @author Jan Bobek
+     */
+    class AiController
+    : public GameController
+    {
+    public:
+        /**
+         * @brief Initializes the controller.
+         *
+         * @param[in] model The model the AI lives in.
+         */
+        AiController( const GameLocalModel& model );
+
+        /**
+         * @brief Couples with the controlled entity.
+         *
+         * @param[in] entity The controlled entity.
+         */
+        virtual void attach( const GameCtlEntity* entity );
+
+        /**
+         * @brief The AI only reads the model.
+         *
+         * @retval true Always.
+         */
+        bool concurrent() const { return true; }
+        /**
+         * @brief Obtains state of our random number stream.
+         *
+         * Lets a batch draw from the stream on our behalf.
+         *
+         * @return The state.
+         */
+        unsigned int& seed() { return mSeed; }
+
+    protected:
+        /**
+         * @brief Obtains a random number.
+         *
+         * @return A random number from our own stream.
+         */
+        unsigned int random() { return rand_r( &mSeed ); }
+
+        /// The model the AI lives in.
+        const GameLocalModel& mModel;
+        /// The controlled entity; may be NULL.
+        const GameCtlEntity* mEntity;
+        /// State of our random number stream.
+        unsigned int mSeed;
     };
     /**
      * @brief A monster AI controller.
      *
+     * Follows the shared player distance field downhill,
+     * or a route to the nearest player over the path graph
+     * if enabled. Walks randomly if no player is reachable.
+     * The monster kernel may decide on its behalf instead.
+     *
      * @author Jan Bobek
      */
     class MonsterAiController
-    : public GameController
+    : public AiController
     {
     public:
+        /**
+         * @brief Initializes the controller.
+         *
+         * @param[in] model The model the AI lives in.
+         */
+        MonsterAiController( const GameLocalModel& model );
+
         /**
          * @brief Extracts the next step.
          *
          * @param[out] event Where to store the next step.
          */
         void tick( GameCtlEvent& event );
+
+    protected:
+        /**
+         * @brief Steps downhill in the player distance field.
+         *
+         * @param[out] event Where to store the next step.
+         *
+         * @retval true  The step has been found.
+         * @retval false No player is reachable.
+         */
+        bool tickDownhill( GameCtlEvent& event );
+        /**
+         * @brief Steps along a route to the nearest player.
+         *
+         * @param[out] event Where to store the next step.
+         *
+         * @retval true  The step has been found.
+         * @retval false No player is reachable.
+         */
+        bool tickRoute( GameCtlEvent& event );
+        /**
+         * @brief Plans a route to a player.
+         *
+         * @param[in] target Position of the player.
+         *
+         * @retval true  The route has been planned.
+         * @retval false The player cannot be reached.
+         */
+        bool plan( const GameCoord& target );
+
+        /// The route to follow.
+        std::vector<GameCoord> mRoute;
+        /// Index of the next tile of the route.
+        size_t mRouteNext;
+        /// Tick at which the route has been planned.
+        unsigned int mRouteTick;
+        /// Has the last planning failed?
+        bool mRouteFailed;
+    };
+    /**
+     * @brief A base of the scripted AI controllers.
+     *
+     * The script is a coroutine which yields an action each
+     * tick, keeping its state in local variables on its frame
+     * rather than in members. The frames come from the frame
+     * pool of the model.
+     *
+     * @author Jan Bobek
+     */
+    class ScriptController
+    : public AiController
+    {
+    public:
+        /**
+         * @brief Initializes the controller.
+         *
+         * @param[in] model The model the AI lives in.
+         * @param[in] pool  Where to allocate the frame.
+         */
+        ScriptController( const GameLocalModel& model,
+                          GameFramePool& pool );
+        /**
+         * @brief Destroys the frame of the script.
+         */
+        ~ScriptController();
+
+        /**
+         * @brief Couples with the entity and starts the script.
+         *
+         * @param[in] entity The controlled entity.
+         */
+        void attach( const GameCtlEntity* entity );
+        /**
+         * @brief Resumes the script until it yields.
+         *
+         * @param[out] event Where to store the yielded action.
+         */
+        void tick( GameCtlEvent& event );
+
+        /**
+         * @brief Obtains the pool of the frame.
+         *
+         * @return The pool.
+         */
+        GameFramePool& pool() const { return mPool; }
+
+    protected:
+        /**
+         * @brief The script.
+         *
+         * Suspends right away; the first tick resumes it.
+         *
+         * @return The coroutine.
+         */
+        virtual Script run() = 0;
+
+        /// Where to allocate the frame.
+        GameFramePool& mPool;
+        /// The coroutine frame; NULL until started.
+        void* mFrame;
+    };
+    /**
+     * @brief A scripted monster.
+     *
+     * Walks straight on until it hits something, turning
+     * now and then, and bites players next to it.
+     *
+     * @author Jan Bobek
+     */
+    class PatrolController
+    : public ScriptController
+    {
+    public:
+        /**
+         * @brief Initializes the controller.
+         *
+         * @param[in] model The model the AI lives in.
+         * @param[in] pool  Where to allocate the frame.
+         */
+        PatrolController( const GameLocalModel& model,
+                          GameFramePool& pool );
+
+    protected:
+        /**
+         * @brief The patrol script.
+         *
+         * @return The coroutine.
+         */
+        Script run();
+        /**
+         * @brief Checks if the monster may step somewhere.
+         *
+         * @param[in] dir The direction, by GAME_MOVES.
+         *
+         * @retval true  The tile is on the map and can be entered.
+         * @retval false The tile cannot be entered.
+         */
+        bool walkable( unsigned int dir ) const;
     };
     /**
      * @brief A player AI controller.
      *
+     * Avoids flames using the danger map and only
+     * drops a bomb when it has somewhere to hide.
+     *
      * @author Jan Bobek
      */
     class PlayerAiController
-    : public GameController
+    : public AiController
     {
     public:
+        /**
+         * @brief Initializes the controller.
+         *
+         * @param[in] model The model the AI lives in.
+         */
+        PlayerAiController( const GameLocalModel& model );
+
         /**
          * @brief Extracts the next step.
          *
          * @param[out] event Where to store the next step.
          */
         void tick( GameCtlEvent& event );
+
+    protected:
+        /**
+         * @brief Checks if the player may step to a tile.
+         *
+         * @param[in] pos The tile.
+         *
+         * @retval true  The tile is on the map and can be entered.
+         * @retval false The tile cannot be entered.
+         */
+        bool walkable( const GameCoord& pos ) const;
+        /**
+         * @brief Checks if a bomb put now leaves a way out.
+         *
+         * @retval true  There is a safe tile to flee to.
+         * @retval false Putting a bomb would be suicide.
+         */
+        bool canEscape() const;
+    };
+    /**
+     * @brief A player AI controller with lookahead.
+     *
+     * Runs a Monte Carlo tree search over clones of the
+     * neighbourhood of the player, within a hard time budget
+     * per tick. The subtree of the played action is kept
+     * and searched further on the following ticks.
+     *
+     * @author Jan Bobek
+     */
+    class PlayerSearchController
+    : public PlayerAiController
+    {
+    public:
+        /**
+         * @brief Initializes the controller.
+         *
+         * @param[in] model      The model the AI lives in.
+         * @param[in] budgetUs   Time budget per tick in microseconds.
+         * @param[in] iterations Cap on iterations per tick; 0 for none.
+         * @param[in] stats      Where to account the search.
+         */
+        PlayerSearchController( const GameLocalModel& model,
+                                unsigned int budgetUs,
+                                unsigned int iterations,
+                                SearchStats& stats );
+
+        /**
+         * @brief Searches and extracts the next step.
+         *
+         * @param[out] event Where to store the next step.
+         */
+        void tick( GameCtlEvent& event );
+
+    protected:
+        /// Radius of the cloned neighbourhood.
+        static const int RADIUS = 6;
+        /// Width of the cloned neighbourhood.
+        static const int WIDTH = 2 * RADIUS + 1;
+        /// How far the search looks, in ticks.
+        static const unsigned int HORIZON = GAME_BOMB_TICKS + GAME_TICKS_PER_SEC;
+        /// Maximal size of the search tree.
+        static const unsigned int NODES_MAX = 1 << 15;
+        /// An invalid node index.
+        static const unsigned int NODE_NONE = ~0U;
+        /// Number of actions considered (RC is not).
+        static const unsigned int ACTIONS = GCE_PUTBOMB + 1;
+        /// Danger of a tile no flame reaches within the horizon.
+        static const unsigned char DANGER_NONE = 0xFF;
+
+        /**
+         * @brief A cloned neighbourhood of the player.
+         *
+         * @author Jan Bobek
+         */
+        struct State
+        {
+            /**
+             * @brief Clones the neighbourhood from the model.
+             *
+             * @param[in] model  The model.
+             * @param[in] entity The player.
+             */
+            void load( const GameLocalModel& model,
+                       const GameCtlEntity& entity );
+
+            /**
+             * @brief Obtains the actions which do something.
+             *
+             * @return A bit mask indexed by GameCtlEvent.
+             */
+            unsigned int legal() const;
+            /**
+             * @brief Plays an action.
+             *
+             * Advances the state until the player may act again.
+             *
+             * @param[in] action The action.
+             *
+             * @return Number of ticks the action took.
+             */
+            unsigned int step( GameCtlEvent action );
+            /**
+             * @brief Evaluates the state.
+             *
+             * @return Value between 0 (dead) and 1.
+             */
+            double value() const;
+
+            /**
+             * @brief Checks if the player may step to a tile.
+             *
+             * @param[in] row Row in the neighbourhood.
+             * @param[in] col Column in the neighbourhood.
+             *
+             * @retval true  The tile can be entered now.
+             * @retval false The tile cannot be entered.
+             */
+            bool walkable( int row, int col ) const;
+            /**
+             * @brief Stamps flames of a bomb of the player.
+             *
+             * @param[in] rowstep How the flame spreads among rows.
+             * @param[in] colstep How the flame spreads among columns.
+             * @param[in] explode Tick of the explosion.
+             */
+            void stamp( int rowstep, int colstep, unsigned char explode );
+
+            /// The tiles.
+            unsigned char tile[WIDTH][WIDTH];
+            /// Tick at which a flame reaches a tile.
+            unsigned char danger[WIDTH][WIDTH];
+            /// Top-left corner of the neighbourhood on the map.
+            GameCoord origin;
+
+            /// Position of the player.
+            int row, col;
+            /// Previous position of the player.
+            int prevrow, prevcol;
+            /// Ticks since the clone.
+            unsigned char tick;
+            /// See GameCtlEntity.
+            unsigned char nextmove, speed, bombs, flames;
+            /// Number of things the bombs of the player hit.
+            unsigned char hits;
+            /// Has the player died?
+            bool dead;
+        };
+        /**
+         * @brief A node of the search tree.
+         *
+         * @author Jan Bobek
+         */
+        struct Node
+        {
+            /**
+             * @brief Initializes a leaf node.
+             *
+             * @param[in] parent_ Index of the parent node.
+             */
+            Node( unsigned int parent_ );
+
+            /// Index of the parent node.
+            unsigned int parent;
+            /// Indices of the child nodes, by action.
+            unsigned int child[ACTIONS];
+            /// Number of visits.
+            unsigned int visits;
+            /// Sum of the values of the visits.
+            double value;
+        };
+
+        /**
+         * @brief Searches until the budget runs out.
+         *
+         * @param[in] root     Index of the root node.
+         * @param[in] state    State at the root node.
+         * @param[in] deadline When to stop, see now().
+         */
+        void search( unsigned int root, const State& state,
+                     unsigned long long deadline );
+        /**
+         * @brief Runs a single search iteration.
+         *
+         * @param[in] root  Index of the root node.
+         * @param[in] state State at the root node.
+         */
+        void iterate( unsigned int root, const State& state );
+        /**
+         * @brief Makes a node the root, dropping the rest of the tree.
+         *
+         * @param[in] node Index of the new root.
+         *
+         * @return Number of nodes kept.
+         */
+        unsigned int reroot( unsigned int node );
+        /**
+         * @brief Obtains a monotonic time.
+         *
+         * @return The time in nanoseconds.
+         */
+        static unsigned long long now();
+
+        /// Time budget per tick in nanoseconds.
+        unsigned long long mBudgetNs;
+        /// Cap on iterations per tick; 0 for none.
+        unsigned int mIterations;
+        /// Where to account the search.
+        SearchStats& mStats;
+
+        /// The search tree; the root is at index 0.
+        std::vector<Node> mNodes;
+        /// State at the root.
+        State mRootState;
+        /// State after the played action.
+        State mPlanState;
+        /// Node of the played action.
+        unsigned int mPlan;
+        /// Ticks left until the played action is done.
+        unsigned int mPlanTicks;
+        /// Where the played action should get us.
+        GameCoord mPlanPos;
     };
 
     /**
@@ -158,6 +737,13 @@ protected:
      * @param[in] event The associated event.
      */
     void dispatchSpawnEntity( const GameModelEvent& event );
+    /**
+     * @brief Updates the pathfinding and the danger map.
+     *
+     * @param[in] pos  Position of the tile.
+     * @param[in] prev The entity which was there before.
+     */
+    void dispatchTileChanged( const GameCoord& pos, GameEntity prev );
 
     /**
      * @brief Checks if the end conditions have been met.
@@ -167,6 +753,94 @@ protected:
      */
     virtual bool checkEndCond();
 
+    /**
+     * @brief Brings the pathfinding up to date.
+     *
+     * Repairs only the tiles affected by the changes since
+     * the last tick, and only if there are monsters to use it.
+     */
+    void tickPlayerDist();
+    /**
+     * @brief Obtains distance to the nearest player.
+     *
+     * @param[in] pos The position.
+     *
+     * @return Number of steps to the nearest player;
+     *         GAME_DIST_INFINITE if none is reachable.
+     */
+    unsigned int playerDist( const GameCoord& pos ) const
+    {
+        return mPlayerDist.dist( pos );
+    }
+    /**
+     * @brief Checks if pathfinding may pass through an entity.
+     *
+     * @param[in] ent The entity.
+     *
+     * @retval true  A monster may walk there (or will soon).
+     * @retval false The entity blocks or kills a monster.
+     */
+    static bool pathPassable( GameEntity ent );
+    /**
+     * @brief Obtains the player distance field tile of an entity.
+     *
+     * @param[in] ent The entity.
+     *
+     * @return The tile.
+     */
+    static GameDistanceField::Tile pathTile( GameEntity ent );
+
+    /**
+     * @brief Rebuilds the danger map if it has been invalidated.
+     *
+     * Touches only the tiles reachable by flames of the
+     * current bombs, never the whole map.
+     */
+    void tickDanger();
+    /**
+     * @brief Obtains number of ticks until a flame reaches a tile.
+     *
+     * @param[in] pos The tile.
+     *
+     * @return Number of ticks; 0 if the tile is on fire and
+     *         GAME_TICK_NEVER if no bomb threatens it.
+     */
+    unsigned int dangerIn( const GameCoord& pos ) const;
+    /**
+     * @brief Stamps flames of a bomb into the danger map.
+     *
+     * Bombs hit by the flames are detonated earlier,
+     * so they are stamped again.
+     *
+     * @param[in] bomb The bomb.
+     */
+    void dangerStamp( GameBombEntity& bomb );
+    /**
+     * @brief Stamps a single ray of bomb flames.
+     *
+     * @param[in]     bomb    The bomb.
+     * @param[in,out] pos     End of the ray.
+     * @param[in]     rowstep How the flame spreads among rows.
+     * @param[in]     colstep How the flame spreads among columns.
+     */
+    void dangerStampRay( GameBombEntity& bomb, GameCoord& pos,
+                         char rowstep, char colstep );
+    /**
+     * @brief Wipes flames of a bomb from the danger map.
+     *
+     * @param[in] bomb The bomb.
+     */
+    void dangerClear( const GameBombEntity& bomb );
+    /**
+     * @brief Checks if flames spread through an entity.
+     *
+     * @param[in] ent The entity.
+     *
+     * @retval true  The flame continues (it may kill the entity).
+     * @retval false The flame stops.
+     */
+    static bool flamePassable( GameEntity ent );
+
     /**
      * @brief Ticks the bombs.
      *
@@ -199,10 +873,22 @@ protected:
 
     /**
      * @brief Ticks the controlled entities.
+     *
+     * First all the controllers decide, seeing the state at
+     * the start of the tick; then the actions are applied
+     * in order of the entities.
      */
     void tickEntities();
     /**
-     * @brief Ticks a single entity.
+     * @brief Obtains actions of all the controllers.
+     *
+     * Concurrent controllers run on the worker threads.
+     * The positions of the players are collected first,
+     * see mPlayers.
+     */
+    void tickEntitiesDecide();
+    /**
+     * @brief Applies the action of a single entity.
      *
      * @param[in] entity The entity to tick.
      *
@@ -210,6 +896,10 @@ protected:
      * @retval false The entity has not died yet.
      */
     bool tickEntity( GameCtlEntity& entity );
+    /**
+     * @brief Obtains actions of the monsters in the batch.
+     */
+    void tickMonsters();
 
     /**
      * @brief Processes entity move.
@@ -273,16 +963,48 @@ protected:
      */
     void tickEntityGiveBonus( GameCtlEntity& entity );
 
+    /// Frames of the scripts; outlives the controllers.
+    GameFramePool mFramePool;
+    /// Shall new AI monsters be scripted?
+    bool mScriptedMonsters;
+
     /// A list of controlled entities.
     std::list<GameCtlEntity> mCtlEntities;
     /// A list of bombs.
     std::list<GameBombEntity> mBombs;
 
+    /// Distance of each tile to the nearest player.
+    GameDistanceField mPlayerDist;
+    /// The path graph used instead of the field; may be NULL.
+    GamePathGraph* mPathGraph;
+    /// Decides moves of the monsters in a batch; may be NULL.
+    GameMonsterKernel* mMonsterKernel;
+    /// Monsters in the batch of this tick.
+    std::vector<GameCtlEntity*> mMonsters;
+    /// Positions of the players as the controllers decide.
+    std::vector<GameCoord> mPlayers;
+
+    /// Time budget of searching AI players, in microseconds.
+    unsigned int mSearchBudgetUs;
+    /// Cap on iterations of searching AI players.
+    unsigned int mSearchIterations;
+    /// Statistics of each searching AI player ever spawned.
+    std::list<SearchStats> mSearchStats;
+
+    /// Number of the current tick.
+    unsigned int mTick;
+    /// Tick at which a flame reaches each tile.
+    unsigned int* mDanger;
+    /// Does the danger map need a rebuild?
+    bool mDangerDirty;
+
+    /// Worker threads for the AI; may be NULL.
+    ThreadPool* mPool;
+    /// Entities whose controllers tick concurrently.
+    std::vector<GameCtlEntity*> mConcurrent;
+
     /// A queue of events to dispatch at next tick.
     std::queue<GameModelEvent> mEventPipe;
-
-    /// A table of all possible in-game interactions.
-    static const GameInteraction GAME_INTERACTIONS[GENT_COUNT][GENT_COUNT];
 };
 
 #endif /* !__GAME_LOCAL_MODEL_H__INCL__ */
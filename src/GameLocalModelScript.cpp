@@ -0,0 +1,231 @@
+/** @file
+ * @brief Implementation of the scripted AI controllers.
+ *
+ * The scripts are C++20 coroutines; unlike the rest
+ * of the game, this file is built as C++20.
+ *
+ * @author Jan Bobek
+ */
+
+#include "GameLocalModel.h"
+
+/*************************************************************************/
+/* GameLocalModel::Script::promise_type                                  */
+/*************************************************************************/
+/**
+ * @brief State of a script shared with its controller.
+ *
+ * @author Jan Bobek
+ */
+struct GameLocalModel::Script::promise_type
+{
+    /// Handle of the coroutine.
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    /// Room before the frame for its pool; keeps the frame aligned.
+    static const size_t HEADER = 16;
+
+    /**
+     * @brief Allocates a frame from the pool of the controller.
+     *
+     * @param[in] size Size of the frame.
+     * @param[in] self The controller running the script.
+     *
+     * @return The frame.
+     */
+    static void* operator new( size_t size, ScriptController& self )
+    {
+        GameFramePool& pool = self.pool();
+        char* p = (char*)pool.allocate( HEADER + size );
+
+        /* Remember the pool for the delete. */
+        *(GameFramePool**)p = &pool;
+        return p + HEADER;
+    }
+    /**
+     * @brief Releases a frame to its pool.
+     *
+     * @param[in] p    The frame.
+     * @param[in] size Size of the frame.
+     */
+    static void operator delete( void* p, size_t size )
+    {
+        char* h = (char*)p - HEADER;
+        (*(GameFramePool**)h)->release( h, HEADER + size );
+    }
+
+    /**
+     * @brief Makes the handle for the controller.
+     *
+     * @return The handle.
+     */
+    Script get_return_object()
+    {
+        Script script = { handle_type::from_promise( *this ).address() };
+        return script;
+    }
+    /**
+     * @brief Waits for the first tick.
+     */
+    std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+    /**
+     * @brief Keeps the frame until the controller destroys it.
+     */
+    std::suspend_always final_suspend() noexcept { return std::suspend_always(); }
+    /**
+     * @brief Passes an action to the controller.
+     *
+     * @param[in] e The action.
+     */
+    std::suspend_always yield_value( GameCtlEvent e ) noexcept
+    {
+        event = e;
+        return std::suspend_always();
+    }
+    /**
+     * @brief The script has ended.
+     */
+    void return_void() noexcept { event = GCE_NOOP; }
+    /**
+     * @brief Lets an exception out of the script through tick().
+     */
+    void unhandled_exception() { throw; }
+
+    /// The action yielded last.
+    GameCtlEvent event;
+};
+
+/*************************************************************************/
+/* GameLocalModel::ScriptController                                      */
+/*************************************************************************/
+GameLocalModel::ScriptController::ScriptController(
+    const GameLocalModel& model,
+    GameFramePool& pool
+    )
+: AiController( model ),
+  mPool( pool ),
+  mFrame( NULL )
+{
+}
+
+GameLocalModel::ScriptController::~ScriptController()
+{
+    if( mFrame )
+        Script::promise_type::handle_type::from_address( mFrame ).destroy();
+}
+
+void
+GameLocalModel::ScriptController::attach(
+    const GameCtlEntity* entity
+    )
+{
+    AiController::attach( entity );
+
+    /* Start here, on the main thread, the pool is not thread-safe. */
+    if( !mFrame )
+        mFrame = run().frame;
+}
+
+void
+GameLocalModel::ScriptController::tick(
+    GameCtlEvent& event
+    )
+{
+    event = GCE_NOOP;
+    if( !mFrame )
+        return;
+
+    Script::promise_type::handle_type h =
+        Script::promise_type::handle_type::from_address( mFrame );
+    if( h.done() )
+        return;
+
+    h.resume();
+    event = h.promise().event;
+}
+
+/*************************************************************************/
+/* GameLocalModel::PatrolController                                      */
+/*************************************************************************/
+GameLocalModel::PatrolController::PatrolController(
+    const GameLocalModel& model,
+    GameFramePool& pool
+    )
+: ScriptController( model, pool )
+{
+}
+
+GameLocalModel::Script
+GameLocalModel::PatrolController::run()
+{
+    /* All of this lives on the frame. */
+    unsigned int dir = random() % 4, walked = 0;
+
+    while( true )
+    {
+        /* Wait until we may move. */
+        while( mEntity->nextmove )
+            co_yield GCE_NOOP;
+
+        /* Bite a player next to us. */
+        unsigned int bite = 0;
+        for(; bite < 4; ++bite )
+        {
+            const GameCoord next(
+                mEntity->pos.row + GAME_MOVES[bite][0],
+                mEntity->pos.col + GAME_MOVES[bite][1] );
+
+            if( next.row < mModel.mSize.row && next.col < mModel.mSize.col &&
+                GENT_PLAYER == mModel.at( next ) )
+                break;
+        }
+        if( bite < 4 )
+        {
+            co_yield (GameCtlEvent)(GCE_MOVEUP + bite);
+            continue;
+        }
+
+        /* Turn when blocked, or now and then after a while. */
+        if( !walkable( dir ) || (3 < walked && !(random() % 4)) )
+        {
+            /* Pick a new way, turning back only if we must. */
+            unsigned int ways[4], cnt = 0;
+            for( unsigned int i = 0; i < 4; ++i )
+                if( (i ^ 1) != dir && walkable( i ) )
+                    ways[cnt++] = i;
+
+            if( cnt )
+                dir = ways[random() % cnt];
+            else if( walkable( dir ^ 1 ) )
+                dir ^= 1;
+            else
+            {
+                /* Boxed in, wait it out. */
+                co_yield GCE_NOOP;
+                continue;
+            }
+
+            walked = 0;
+        }
+
+        ++walked;
+        co_yield (GameCtlEvent)(GCE_MOVEUP + dir);
+    }
+}
+
+bool
+GameLocalModel::PatrolController::walkable(
+    unsigned int dir
+    ) const
+{
+    const GameCoord next(
+        mEntity->pos.row + GAME_MOVES[dir][0],
+        mEntity->pos.col + GAME_MOVES[dir][1] );
+
+    if( !(next.row < mModel.mSize.row) || !(next.col < mModel.mSize.col) )
+        return false;
+
+    /* Neither into the others, nor into flames. */
+    const GameEntity ent = mModel.at( next );
+    return GENT_MONSTER != ent && pathPassable( ent );
+}
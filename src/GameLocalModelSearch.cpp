@@ -0,0 +1,497 @@
+/** @file
+ * @brief Implementation of the lookahead search AI.
+ *
+ * @author Jan Bobek
+ */
+
+#include "GameLocalModel.h"
+#include "util.h"
+
+/*************************************************************************/
+/* GameLocalModel::SearchStats                                           */
+/*************************************************************************/
+GameLocalModel::SearchStats::SearchStats()
+: ticks( 0 ),
+  iterations( 0 ),
+  nodes( 0 ),
+  reused( 0 ),
+  budgetNs( 0 ),
+  usedNs( 0 )
+{
+}
+
+GameLocalModel::SearchStats&
+GameLocalModel::SearchStats::operator+=(
+    const SearchStats& oth
+    )
+{
+    ticks      += oth.ticks;
+    iterations += oth.iterations;
+    nodes      += oth.nodes;
+    reused     += oth.reused;
+    budgetNs   += oth.budgetNs;
+    usedNs     += oth.usedNs;
+
+    return *this;
+}
+
+/*************************************************************************/
+/* GameLocalModel::PlayerSearchController                                */
+/*************************************************************************/
+GameLocalModel::PlayerSearchController::PlayerSearchController(
+    const GameLocalModel& model,
+    unsigned int budgetUs,
+    unsigned int iterations,
+    SearchStats& stats
+    )
+: PlayerAiController( model ),
+  mBudgetNs( 1000ULL * budgetUs ),
+  mIterations( iterations ),
+  mStats( stats ),
+  mPlan( NODE_NONE ),
+  mPlanTicks( 0 )
+{
+}
+
+void
+GameLocalModel::PlayerSearchController::tick(
+    GameCtlEvent& event
+    )
+{
+    event = GCE_NOOP;
+    if( !mEntity )
+        return;
+
+    const unsigned long long start = now();
+    const unsigned long long deadline = start + mBudgetNs;
+
+    if( mPlanTicks && --mPlanTicks )
+    {
+        /* Still playing, think about what comes next. */
+        if( NODE_NONE != mPlan )
+            search( mPlan, mPlanState, deadline );
+    }
+    else
+    {
+        /* Keep what we know about the current state, if anything. */
+        if( NODE_NONE != mPlan && mPlanPos == mEntity->pos )
+            mStats.reused += reroot( mPlan );
+        else
+        {
+            mNodes.clear();
+            mNodes.push_back( Node( NODE_NONE ) );
+        }
+
+        mRootState.load( mModel, *mEntity );
+        search( 0, mRootState, deadline );
+
+        /* Play the most visited action. */
+        unsigned int visits = 0;
+        mPlan = NODE_NONE;
+
+        for( unsigned int i = 0; i < ACTIONS; ++i )
+        {
+            const unsigned int child = mNodes[0].child[i];
+            if( NODE_NONE != child && visits < mNodes[child].visits )
+            {
+                visits = mNodes[child].visits;
+                mPlan = child;
+                event = (GameCtlEvent)i;
+            }
+        }
+
+        mPlanState = mRootState;
+        mPlanTicks = mPlanState.step( event );
+        mPlanPos = GameCoord(
+            mPlanState.origin.row + mPlanState.row,
+            mPlanState.origin.col + mPlanState.col );
+    }
+
+    ++mStats.ticks;
+    mStats.budgetNs += mBudgetNs;
+    mStats.usedNs += now() - start;
+}
+
+void
+GameLocalModel::PlayerSearchController::search(
+    unsigned int root,
+    const State& state,
+    unsigned long long deadline
+    )
+{
+    unsigned int n = 0;
+
+    do
+    {
+        iterate( root, state );
+        ++n;
+    } while( (!mIterations || n < mIterations) && now() < deadline );
+
+    mStats.iterations += n;
+}
+
+void
+GameLocalModel::PlayerSearchController::iterate(
+    unsigned int root,
+    const State& state
+    )
+{
+    State s = state;
+    unsigned int node = root;
+
+    /* Descend the tree. */
+    while( !s.dead && s.tick < HORIZON )
+    {
+        const unsigned int legal = s.legal();
+        unsigned int action = ACTIONS, unexplored = 0;
+
+        /* Pick a random unexplored action. */
+        for( unsigned int i = 0; i < ACTIONS; ++i )
+            if( (legal & (1 << i)) &&
+                NODE_NONE == mNodes[node].child[i] &&
+                !(random() % ++unexplored) )
+                action = i;
+
+        if( unexplored )
+        {
+            if( NODES_MAX <= mNodes.size() )
+                /* The tree is full, just play it out. */
+                break;
+
+            /* Expand it. */
+            const unsigned int child = mNodes.size();
+            mNodes.push_back( Node( node ) );
+            mNodes[node].child[action] = child;
+            ++mStats.nodes;
+
+            s.step( (GameCtlEvent)action );
+            node = child;
+            break;
+        }
+
+        /* All explored, pick by UCB1. */
+        const double logn = log( (double)mNodes[node].visits );
+        double best = -1.0;
+
+        for( unsigned int i = 0; i < ACTIONS; ++i )
+            if( legal & (1 << i) )
+            {
+                const Node& c = mNodes[mNodes[node].child[i]];
+                const double ucb = c.value / c.visits
+                    + 0.7 * sqrt( logn / c.visits );
+
+                if( best < ucb )
+                {
+                    best = ucb;
+                    action = i;
+                }
+            }
+
+        s.step( (GameCtlEvent)action );
+        node = mNodes[node].child[action];
+    }
+
+    /* Play out randomly, avoiding obvious flames. */
+    while( !s.dead && s.tick < HORIZON )
+    {
+        const unsigned int legal = s.legal();
+        unsigned int action = GCE_NOOP, cnt = 0;
+
+        for( unsigned int i = 0; i < ACTIONS; ++i )
+        {
+            if( !(legal & (1 << i)) )
+                continue;
+
+            if( GCE_MOVEUP <= i && i <= GCE_MOVERIGHT )
+            {
+                const unsigned char danger = s.danger
+                    [s.row + GAME_MOVES[i - GCE_MOVEUP][0]]
+                    [s.col + GAME_MOVES[i - GCE_MOVEUP][1]];
+                if( danger <= s.tick + s.speed )
+                    continue;
+            }
+
+            if( !(random() % ++cnt) )
+                action = i;
+        }
+
+        s.step( (GameCtlEvent)action );
+    }
+
+    /* Back it up. */
+    const double value = s.value();
+    for(;; node = mNodes[node].parent )
+    {
+        ++mNodes[node].visits;
+        mNodes[node].value += value;
+
+        if( root == node )
+            break;
+    }
+}
+
+unsigned int
+GameLocalModel::PlayerSearchController::reroot(
+    unsigned int node
+    )
+{
+    std::vector<Node> nodes;
+    std::vector<unsigned int> queue;
+
+    nodes.push_back( mNodes[node] );
+    nodes.back().parent = NODE_NONE;
+    queue.push_back( node );
+
+    /* Copy the subtree breadth-first; nodes[i] is mNodes[queue[i]]. */
+    for( size_t head = 0; head < queue.size(); ++head )
+        for( unsigned int i = 0; i < ACTIONS; ++i )
+        {
+            const unsigned int child = mNodes[queue[head]].child[i];
+            if( NODE_NONE == child )
+                continue;
+
+            nodes[head].child[i] = nodes.size();
+            nodes.push_back( mNodes[child] );
+            nodes.back().parent = head;
+            queue.push_back( child );
+        }
+
+    mNodes.swap( nodes );
+    return mNodes.size();
+}
+
+unsigned long long
+GameLocalModel::PlayerSearchController::now()
+{
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*************************************************************************/
+/* GameLocalModel::PlayerSearchController::State                         */
+/*************************************************************************/
+void
+GameLocalModel::PlayerSearchController::State::load(
+    const GameLocalModel& model,
+    const GameCtlEntity& entity
+    )
+{
+    origin = GameCoord(
+        entity.pos.row - RADIUS,
+        entity.pos.col - RADIUS );
+
+    for( int r = 0; r < WIDTH; ++r )
+        for( int c = 0; c < WIDTH; ++c )
+        {
+            const GameCoord pos( origin.row + r, origin.col + c );
+
+            if( !(pos.row < model.mSize.row) ||
+                !(pos.col < model.mSize.col) )
+            {
+                /* Off the map. */
+                tile[r][c] = GENT_BARRIER;
+                danger[r][c] = DANGER_NONE;
+                continue;
+            }
+
+            const unsigned int d = model.dangerIn( pos );
+            tile[r][c] = model.at( pos );
+            danger[r][c] = (d < DANGER_NONE ? d : DANGER_NONE);
+        }
+
+    /* We are not in our way. */
+    row = col = RADIUS;
+    tile[row][col] = GENT_NONE;
+
+    prevrow = RADIUS + entity.prevpos.row - entity.pos.row;
+    prevcol = RADIUS + entity.prevpos.col - entity.pos.col;
+
+    tick = 0;
+    nextmove = entity.nextmove;
+    speed = entity.speed;
+    bombs = entity.bombs;
+    flames = entity.flames;
+    hits = 0;
+    dead = false;
+}
+
+unsigned int
+GameLocalModel::PlayerSearchController::State::legal() const
+{
+    unsigned int mask = 1 << GCE_NOOP;
+
+    if( !nextmove )
+        for( unsigned int i = 0; i < 4; ++i )
+            if( walkable( row + GAME_MOVES[i][0],
+                          col + GAME_MOVES[i][1] ) )
+                mask |= 1 << (GCE_MOVEUP + i);
+
+    if( bombs && (row != prevrow || col != prevcol) &&
+        walkable( prevrow, prevcol ) &&
+        GENT_BONUS != tile[prevrow][prevcol] )
+        mask |= 1 << GCE_PUTBOMB;
+
+    return mask;
+}
+
+unsigned int
+GameLocalModel::PlayerSearchController::State::step(
+    GameCtlEvent action
+    )
+{
+    unsigned int ticks = 1;
+
+    switch( action )
+    {
+        case GCE_NOOP:
+            /* Wait until we can move again. */
+            if( nextmove )
+                ticks = nextmove;
+            break;
+
+        case GCE_MOVEUP:
+        case GCE_MOVEDOWN:
+        case GCE_MOVELEFT:
+        case GCE_MOVERIGHT:
+        {
+            const int r = row + GAME_MOVES[action - GCE_MOVEUP][0];
+            const int c = col + GAME_MOVES[action - GCE_MOVEUP][1];
+
+            if( nextmove || !walkable( r, c ) )
+                break;
+
+            if( GENT_BONUS == tile[r][c] )
+            {
+                /* Bonuses are nice. */
+                tile[r][c] = GENT_NONE;
+                ++hits;
+            }
+
+            prevrow = row;
+            prevcol = col;
+            row = r;
+            col = c;
+            ticks = nextmove = speed;
+        } break;
+
+        case GCE_PUTBOMB:
+        {
+            if( !(legal() & (1 << GCE_PUTBOMB)) )
+                break;
+
+            const unsigned char explode = tick + GAME_BOMB_TICKS;
+            tile[row][col] = GENT_BOMB;
+            danger[row][col] = std::min( danger[row][col], explode );
+            --bombs;
+
+            stamp( 0, -1, explode );
+            stamp( 0, 1, explode );
+            stamp( -1, 0, explode );
+            stamp( 1, 0, explode );
+
+            /* Step back. */
+            row = prevrow;
+            col = prevcol;
+        } break;
+
+        default:
+        case GCE_RCEXPLODE:
+            break;
+    }
+
+    for( unsigned int i = 0; i < ticks && !dead; ++i )
+    {
+        ++tick;
+        if( nextmove )
+            --nextmove;
+
+        /* Burnt? */
+        dead = (danger[row][col] == tick);
+    }
+
+    return ticks;
+}
+
+double
+GameLocalModel::PlayerSearchController::State::value() const
+{
+    if( dead )
+        return 0.0;
+
+    return 0.5 + 0.1 * std::min<unsigned int>( hits, 5 );
+}
+
+bool
+GameLocalModel::PlayerSearchController::State::walkable(
+    int r,
+    int c
+    ) const
+{
+    if( r < 0 || WIDTH <= r || c < 0 || WIDTH <= c ||
+        /* Just burning. */
+        danger[r][c] == tick )
+        return false;
+
+    switch( GAME_INTERACTIONS[GENT_PLAYER][tile[r][c]] )
+    {
+        case GINT_OK:
+        case GINT_GETBONUS:
+            return true;
+
+        default:
+        case GINT_STOP:
+        case GINT_DIE:
+        case GINT_DIEBONUS:
+        case GINT_KILL:
+        case GINT_KILLBONUS:
+        case GINT_GIVEBONUS:
+            return false;
+    }
+}
+
+void
+GameLocalModel::PlayerSearchController::State::stamp(
+    int rowstep,
+    int colstep,
+    unsigned char explode
+    )
+{
+    int r = row + rowstep, c = col + colstep;
+
+    for( unsigned char i = 0;
+         i < flames && 0 <= r && r < WIDTH && 0 <= c && c < WIDTH;
+         ++i, r += rowstep, c += colstep )
+    {
+        const GameEntity target = (GameEntity)tile[r][c];
+
+        if( GENT_WALL == target || GENT_BONUS == target )
+        {
+            /* Blown up, the flame stops. */
+            ++hits;
+            return;
+        }
+        else if( !flamePassable( target ) )
+            return;
+        else if( GENT_PLAYER == target || GENT_MONSTER == target )
+            /* Got someone (unless they run). */
+            hits += 2;
+
+        danger[r][c] = std::min( danger[r][c], explode );
+    }
+}
+
+/*************************************************************************/
+/* GameLocalModel::PlayerSearchController::Node                          */
+/*************************************************************************/
+GameLocalModel::PlayerSearchController::Node::Node(
+    unsigned int parent_
+    )
+: parent( parent_ ),
+  visits( 0 ),
+  value( 0.0 )
+{
+    for( unsigned int i = 0; i < ACTIONS; ++i )
+        child[i] = NODE_NONE;
+}
@@ -39,13 +39,30 @@ GameModel::dispatch(
     {
         /* Process the event. */
         GAME_COORD_RECT_ITERATE( cur, event.coords )
-            at( cur ) = event.entity;
+        {
+            GameEntity& ent = at( cur );
+            if( event.entity != ent )
+            {
+                const GameEntity prev = ent;
+                ent = event.entity;
+
+                dispatchTileChanged( cur, prev );
+            }
+        }
 
         /* Mark the region dirty. */
         mDirty.push( event.coords );
     }
 }
 
+void
+GameModel::dispatchTileChanged(
+    const GameCoord&,
+    GameEntity
+    )
+{
+}
+
 void
 GameModel::draw(
     GameCanvas& canvas
@@ -95,3 +112,11 @@ GameModel::at(
 {
     return mMap[pos.row * mSize.col + pos.col];
 }
+
+const GameEntity&
+GameModel::at(
+    const GameCoord& pos
+    ) const
+{
+    return mMap[pos.row * mSize.col + pos.col];
+}
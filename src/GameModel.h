@@ -12,14 +12,11 @@
 class GameCanvas;
 class GameController;
 
-/* This structure is going over the wire, so
-   disable any performance aligning. */
-#pragma pack( push, 1 )
 /**
  * @brief An event related to the game model.
  *
- * These events are sent over the wire to keep
- * the remote game models synchronized.
+ * The tiles changed by these events are sent over the wire
+ * (see GameProtocol) to keep the remote game models synchronized.
  *
  * @author Jan Bobek
  */
@@ -33,7 +30,6 @@ struct GameModelEvent
     /// A related entity controller; may be NULL.
     GameController* ctl;
 };
-#pragma pack( pop )
 
 /**
  * @brief A basic game model.
@@ -97,6 +93,17 @@ public:
     void redraw( GameCanvas& canvas );
 
 protected:
+    /**
+     * @brief Handles a change of a single tile.
+     *
+     * Called by dispatch for every tile whose entity
+     * has actually changed.
+     *
+     * @param[in] pos  Position of the tile.
+     * @param[in] prev The entity which was there before.
+     */
+    virtual void dispatchTileChanged( const GameCoord& pos, GameEntity prev );
+
     /**
      * @brief Easier access to an entity.
      *
@@ -105,6 +112,14 @@ protected:
      * @return The entity.
      */
     GameEntity& at( const GameCoord& pos );
+    /**
+     * @brief Easier read-only access to an entity.
+     *
+     * @param[in] pos Coords of the entity.
+     *
+     * @return The entity.
+     */
+    const GameEntity& at( const GameCoord& pos ) const;
 
     /// Size of the game map.
     GameCoord mSize;
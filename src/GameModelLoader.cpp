@@ -8,6 +8,7 @@
 #include "GameLocalModel.h"
 #include "GameServerModel.h"
 #include "GameRemoteModel.h"
+#include "GameRelayModel.h"
 #include "util.h"
 
 /*************************************************************************/
@@ -91,6 +92,35 @@ GameModelLoader::load<GameRemoteModel>()
     return new GameRemoteModel( addr.c_str() );
 }
 
+template<>
+GameRelayModel*
+GameModelLoader::load<GameRelayModel>()
+{
+    /* Choose the address of the server. */
+    std::string addr = "127.0.0.1:34567";
+    if( !chooseAddress( addr, "Prosim zadejte adresu serveru "
+                        "ve formatu adresa:port." ) )
+        return NULL;
+
+    /* Choose an address for the spectators. */
+    std::string local = "0.0.0.0:34568";
+    if( !chooseAddress( local, "Prosim zadejte adresu pro "
+                        "naslouchani divakum ve formatu adresa:port." ) )
+        return NULL;
+
+    /* Connect and open the address. */
+    GameRelayModel* gm = new GameRelayModel( addr.c_str() );
+    if( !gm->open( local.c_str() ) )
+    {
+        msgbox( "Chyba", "Nepodarilo se pripojit ke hre nebo ji otevrit divakum. Zkuste to prosim znovu." );
+        safeDelete( gm );
+        return NULL;
+    }
+
+    /* Success. */
+    return gm;
+}
+
 template<typename T>
 T*
 GameModelLoader::loadMap(
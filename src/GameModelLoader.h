@@ -12,6 +12,7 @@
 class GameLocalModel;
 class GameServerModel;
 class GameRemoteModel;
+class GameRelayModel;
 
 /**
  * @brief Loads a game model.
@@ -74,5 +75,7 @@ template<>
 GameServerModel* GameModelLoader::load<GameServerModel>();
 template<>
 GameRemoteModel* GameModelLoader::load<GameRemoteModel>();
+template<>
+GameRelayModel*  GameModelLoader::load<GameRelayModel>();
 
 #endif /* !__GAME_MODEL_LOADER_H__INCL__ */
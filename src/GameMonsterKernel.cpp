@@ -0,0 +1,360 @@
+/** @file
+ * @brief Implementation of a batched monster move kernel.
+ *
+ * @author Jan Bobek
+ */
+
+#include "GameMonsterKernel.h"
+
+/*************************************************************************/
+/* GameMonsterKernel                                                     */
+/*************************************************************************/
+const unsigned int GameMonsterKernel::WORD_BITS;
+
+GameMonsterKernel::GameMonsterKernel(
+    const GameCoord& size,
+    Isa isa
+    )
+: mSize( size ),
+  mStride( (size.col + 2 + WORD_BITS - 1) / WORD_BITS ),
+  mIsa( std::min( isa, best() ) ),
+  /* Nothing is passable, including the border. */
+  mBits( (size.row + 2) * mStride, 0 )
+{
+}
+
+GameMonsterKernel::Isa
+GameMonsterKernel::best()
+{
+#ifdef GAME_SIMD_X86
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports( "avx2" ) )
+        return ISA_AVX2;
+    else if( __builtin_cpu_supports( "sse2" ) )
+        return ISA_SSE2;
+#endif /* GAME_SIMD_X86 */
+
+    return ISA_SCALAR;
+}
+
+const char*
+GameMonsterKernel::name(
+    Isa isa
+    )
+{
+    switch( isa )
+    {
+        default:
+        case ISA_SCALAR: return "scalar";
+        case ISA_SSE2:   return "SSE2";
+        case ISA_AVX2:   return "AVX2";
+    }
+}
+
+void
+GameMonsterKernel::set(
+    const GameCoord& pos,
+    bool passable
+    )
+{
+    const unsigned int bit = index( pos );
+    if( passable )
+        mBits[bit / WORD_BITS] |= 1U << (bit % WORD_BITS);
+    else
+        mBits[bit / WORD_BITS] &= ~(1U << (bit % WORD_BITS));
+}
+
+void
+GameMonsterKernel::clear()
+{
+    mBit.clear();
+    mTile.clear();
+    mSeed.clear();
+}
+
+void
+GameMonsterKernel::add(
+    const GameCoord& pos,
+    unsigned int seed
+    )
+{
+    mBit.push_back( index( pos ) );
+    mTile.push_back( pos.row * mSize.col + pos.col );
+    /* Zero would stay zero forever. */
+    mSeed.push_back( seed ? seed : 1 );
+}
+
+void
+GameMonsterKernel::decide(
+    const unsigned int* dist
+    )
+{
+    mEvent.resize( mBit.size() );
+
+    unsigned int done = 0;
+    switch( mIsa )
+    {
+#ifdef GAME_SIMD_X86
+        case ISA_AVX2: done = decideAvx2( dist ); break;
+        case ISA_SSE2: done = decideSse2( dist ); break;
+#endif /* GAME_SIMD_X86 */
+        default:       break;
+    }
+
+    /* Whatever did not fill a vector. */
+    decideScalar( done, dist );
+}
+
+void
+GameMonsterKernel::decideScalar(
+    unsigned int first,
+    const unsigned int* dist
+    )
+{
+    const unsigned int row = mStride * WORD_BITS;
+    const unsigned int bitStep[4] = { 0U - row, row, 0U - 1, 1 };
+    const unsigned int tileStep[4] = { 0U - mSize.col, mSize.col, 0U - 1, 1 };
+
+    for( unsigned int i = first; i < mBit.size(); ++i )
+    {
+        /* Where can we go? */
+        unsigned int legal = 0;
+        for( unsigned int d = 0; d < 4; ++d )
+        {
+            const unsigned int bit = mBit[i] + bitStep[d];
+            legal |= ((mBits[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1) << d;
+        }
+
+        unsigned int moves = legal;
+        if( dist )
+        {
+            /* Is any of it closer to a player? */
+            unsigned int near[4], best = GAME_DIST_INFINITE;
+            for( unsigned int d = 0; d < 4; ++d )
+            {
+                near[d] = (legal >> d) & 1
+                    ? dist[mTile[i] + tileStep[d]] : GAME_DIST_INFINITE;
+                best = std::min( best, near[d] );
+            }
+
+            if( best < dist[mTile[i]] )
+            {
+                moves = 0;
+                for( unsigned int d = 0; d < 4; ++d )
+                    if( near[d] == best )
+                        moves |= 1 << d;
+            }
+        }
+
+        mSeed[i] = xorshift( mSeed[i] );
+        mEvent[i] = pick( moves, mSeed[i] );
+    }
+}
+
+#ifdef GAME_SIMD_X86
+__attribute__(( target( "sse2" ) ))
+unsigned int
+GameMonsterKernel::decideSse2(
+    const unsigned int* dist
+    )
+{
+    const unsigned int row = mStride * WORD_BITS;
+    const unsigned int bitStep[4] = { 0U - row, row, 0U - 1, 1 };
+    const unsigned int tileStep[4] = { 0U - mSize.col, mSize.col, 0U - 1, 1 };
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one  = _mm_set1_epi32( 1 );
+    /* SSE2 compares signed only, flipping the top bit fixes that. */
+    const __m128i bias = _mm_set1_epi32( INT_MIN );
+
+    const unsigned int count = mBit.size() & ~3U;
+    for( unsigned int i = 0; i < count; i += 4 )
+    {
+        /* Read the lanes one by one. */
+        unsigned int legal[4] = { 0, 0, 0, 0 }, near[4][4], here[4];
+        for( unsigned int j = 0; j < 4; ++j )
+        {
+            for( unsigned int d = 0; d < 4; ++d )
+            {
+                const unsigned int bit = mBit[i + j] + bitStep[d];
+                legal[j] |= ((mBits[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1) << d;
+            }
+
+            if( !dist )
+                continue;
+
+            here[j] = dist[mTile[i + j]];
+            for( unsigned int d = 0; d < 4; ++d )
+                near[d][j] = (legal[j] >> d) & 1
+                    ? dist[mTile[i + j] + tileStep[d]] : GAME_DIST_INFINITE;
+        }
+
+        __m128i moves = _mm_loadu_si128( (const __m128i*)legal );
+        if( dist )
+        {
+            __m128i nb[4], best;
+            for( unsigned int d = 0; d < 4; ++d )
+                nb[d] = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)near[d] ), bias );
+
+            best = nb[0];
+            for( unsigned int d = 1; d < 4; ++d )
+            {
+                const __m128i lt = _mm_cmplt_epi32( nb[d], best );
+                best = _mm_or_si128( _mm_and_si128( lt, nb[d] ),
+                                     _mm_andnot_si128( lt, best ) );
+            }
+
+            __m128i chase = zero;
+            for( unsigned int d = 0; d < 4; ++d )
+                chase = _mm_or_si128( chase, _mm_and_si128(
+                    _mm_cmpeq_epi32( nb[d], best ), _mm_set1_epi32( 1 << d ) ) );
+
+            const __m128i closer = _mm_cmplt_epi32(
+                best, _mm_xor_si128( _mm_loadu_si128( (const __m128i*)here ), bias ) );
+            moves = _mm_or_si128( _mm_and_si128( closer, chase ),
+                                  _mm_andnot_si128( closer, moves ) );
+        }
+
+        /* Advance the random streams. */
+        __m128i x = _mm_loadu_si128( (const __m128i*)&mSeed[i] );
+        x = _mm_xor_si128( x, _mm_slli_epi32( x, 13 ) );
+        x = _mm_xor_si128( x, _mm_srli_epi32( x, 17 ) );
+        x = _mm_xor_si128( x, _mm_slli_epi32( x, 5 ) );
+        _mm_storeu_si128( (__m128i*)&mSeed[i], x );
+
+        /* Pick a move, see pick(). */
+        const __m128i c0  = _mm_and_si128( moves, one );
+        const __m128i c1  = _mm_add_epi32( c0, _mm_and_si128( _mm_srli_epi32( moves, 1 ), one ) );
+        const __m128i c2  = _mm_add_epi32( c1, _mm_and_si128( _mm_srli_epi32( moves, 2 ), one ) );
+        const __m128i cnt = _mm_add_epi32( c2, _mm_and_si128( _mm_srli_epi32( moves, 3 ), one ) );
+        /* Both halves fit 16 bits; the high product is what we want. */
+        const __m128i k1  = _mm_add_epi32(
+            _mm_mulhi_epu16( _mm_srli_epi32( x, 16 ), cnt ), one );
+
+        __m128i dir = zero;
+        dir = _mm_sub_epi32( dir, _mm_cmpgt_epi32( k1, c0 ) );
+        dir = _mm_sub_epi32( dir, _mm_cmpgt_epi32( k1, c1 ) );
+        dir = _mm_sub_epi32( dir, _mm_cmpgt_epi32( k1, c2 ) );
+
+        const __m128i ev = _mm_andnot_si128(
+            _mm_cmpeq_epi32( moves, zero ),
+            _mm_add_epi32( dir, _mm_set1_epi32( GCE_MOVEUP ) ) );
+        _mm_storeu_si128( (__m128i*)&mEvent[i], ev );
+    }
+
+    return count;
+}
+
+__attribute__(( target( "avx2" ) ))
+unsigned int
+GameMonsterKernel::decideAvx2(
+    const unsigned int* dist
+    )
+{
+    const int row = mStride * WORD_BITS;
+    const int bitStep[4] = { -row, row, -1, 1 };
+    const int tileStep[4] = { -mSize.col, mSize.col, -1, 1 };
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one  = _mm256_set1_epi32( 1 );
+    const __m256i inf  = _mm256_set1_epi32( GAME_DIST_INFINITE );
+    const __m256i low  = _mm256_set1_epi32( WORD_BITS - 1 );
+
+    const int* bits  = (const int*)&mBits[0];
+    const int* dists = (const int*)dist;
+
+    const unsigned int count = mBit.size() & ~7U;
+    for( unsigned int i = 0; i < count; i += 8 )
+    {
+        /* Where can we go? */
+        const __m256i bit = _mm256_loadu_si256( (const __m256i*)&mBit[i] );
+
+        __m256i can[4], legal = zero;
+        for( unsigned int d = 0; d < 4; ++d )
+        {
+            const __m256i b = _mm256_add_epi32( bit, _mm256_set1_epi32( bitStep[d] ) );
+            const __m256i w = _mm256_i32gather_epi32(
+                bits, _mm256_srli_epi32( b, 5 ), 4 );
+
+            can[d] = _mm256_and_si256(
+                _mm256_srlv_epi32( w, _mm256_and_si256( b, low ) ), one );
+            legal = _mm256_or_si256(
+                legal, _mm256_sllv_epi32( can[d], _mm256_set1_epi32( d ) ) );
+        }
+
+        __m256i moves = legal;
+        if( dist )
+        {
+            /* Is any of it closer to a player? */
+            const __m256i tile = _mm256_loadu_si256( (const __m256i*)&mTile[i] );
+            const __m256i here = _mm256_i32gather_epi32( dists, tile, 4 );
+
+            __m256i near[4], best = inf;
+            for( unsigned int d = 0; d < 4; ++d )
+            {
+                /* Off the map only if blocked, so gather just the legal. */
+                near[d] = _mm256_mask_i32gather_epi32(
+                    inf, dists, _mm256_add_epi32( tile, _mm256_set1_epi32( tileStep[d] ) ),
+                    _mm256_cmpeq_epi32( can[d], one ), 4 );
+                best = _mm256_min_epu32( best, near[d] );
+            }
+
+            __m256i chase = zero;
+            for( unsigned int d = 0; d < 4; ++d )
+                chase = _mm256_or_si256( chase, _mm256_and_si256(
+                    _mm256_cmpeq_epi32( near[d], best ), _mm256_set1_epi32( 1 << d ) ) );
+
+            const __m256i closer = _mm256_andnot_si256(
+                _mm256_cmpeq_epi32( best, here ),
+                _mm256_cmpeq_epi32( _mm256_min_epu32( best, here ), best ) );
+            moves = _mm256_blendv_epi8( moves, chase, closer );
+        }
+
+        /* Advance the random streams. */
+        __m256i x = _mm256_loadu_si256( (const __m256i*)&mSeed[i] );
+        x = _mm256_xor_si256( x, _mm256_slli_epi32( x, 13 ) );
+        x = _mm256_xor_si256( x, _mm256_srli_epi32( x, 17 ) );
+        x = _mm256_xor_si256( x, _mm256_slli_epi32( x, 5 ) );
+        _mm256_storeu_si256( (__m256i*)&mSeed[i], x );
+
+        /* Pick a move, see pick(). */
+        const __m256i c0  = _mm256_and_si256( moves, one );
+        const __m256i c1  = _mm256_add_epi32( c0, _mm256_and_si256( _mm256_srli_epi32( moves, 1 ), one ) );
+        const __m256i c2  = _mm256_add_epi32( c1, _mm256_and_si256( _mm256_srli_epi32( moves, 2 ), one ) );
+        const __m256i cnt = _mm256_add_epi32( c2, _mm256_and_si256( _mm256_srli_epi32( moves, 3 ), one ) );
+        const __m256i k1  = _mm256_add_epi32( _mm256_srli_epi32(
+            _mm256_mullo_epi32( _mm256_srli_epi32( x, 16 ), cnt ), 16 ), one );
+
+        __m256i dir = zero;
+        dir = _mm256_sub_epi32( dir, _mm256_cmpgt_epi32( k1, c0 ) );
+        dir = _mm256_sub_epi32( dir, _mm256_cmpgt_epi32( k1, c1 ) );
+        dir = _mm256_sub_epi32( dir, _mm256_cmpgt_epi32( k1, c2 ) );
+
+        const __m256i ev = _mm256_andnot_si256(
+            _mm256_cmpeq_epi32( moves, zero ),
+            _mm256_add_epi32( dir, _mm256_set1_epi32( GCE_MOVEUP ) ) );
+        _mm256_storeu_si256( (__m256i*)&mEvent[i], ev );
+    }
+
+    return count;
+}
+#endif /* GAME_SIMD_X86 */
+
+unsigned int
+GameMonsterKernel::pick(
+    unsigned int moves,
+    unsigned int rnd
+    )
+{
+    /* Running count of the moves, up to each direction. */
+    const unsigned int c0  = moves & 1;
+    const unsigned int c1  = c0 + ((moves >> 1) & 1);
+    const unsigned int c2  = c1 + ((moves >> 2) & 1);
+    const unsigned int cnt = c2 + ((moves >> 3) & 1);
+
+    /* Take the k-th move; no division, it does not vectorize. */
+    const unsigned int k = ((rnd >> 16) * cnt) >> 16;
+    const unsigned int dir = (c0 <= k) + (c1 <= k) + (c2 <= k);
+
+    return moves ? GCE_MOVEUP + dir : (unsigned int)GCE_NOOP;
+}
@@ -0,0 +1,220 @@
+/** @file
+ * @brief A batched monster move kernel declarations.
+ *
+ * @author Jan Bobek
+ */
+
+#ifndef __GAME_MONSTER_KERNEL_H__INCL__
+#define __GAME_MONSTER_KERNEL_H__INCL__
+
+#include "Game.h"
+
+/**
+ * @brief Decides the moves of many monsters at once.
+ *
+ * Keeps a bitboard of the tiles a monster may enter. The legal
+ * moves of a whole batch of monsters are looked up in it, the
+ * monsters chasing a player go downhill in the player distance
+ * field, the rest wander randomly. Each monster draws from its
+ * own xorshift stream, so the vectorized code decides exactly
+ * as the scalar one, lane by lane.
+ *
+ * Only the decisions are made here; the moves are applied
+ * (and the conflicts resolved) by the model as usual.
+ *
+ * @author Jan Bobek
+ */
+class GameMonsterKernel
+{
+public:
+    /**
+     * @brief The instruction sets of the kernel.
+     *
+     * @author Jan Bobek
+     */
+    enum Isa
+    {
+        ISA_SCALAR, ///< Plain C++.
+        ISA_SSE2,   ///< 4 monsters at a time.
+        ISA_AVX2    ///< 8 monsters at a time, with gathers.
+    };
+
+    /**
+     * @brief Initializes a bitboard of passable tiles.
+     *
+     * @param[in] size Size of the map.
+     * @param[in] isa  The instruction set to use; the best
+     *                 supported one is used if unsupported.
+     */
+    GameMonsterKernel( const GameCoord& size, Isa isa );
+
+    /**
+     * @brief Obtains the best instruction set supported by the CPU.
+     *
+     * @return The instruction set.
+     */
+    static Isa best();
+    /**
+     * @brief Obtains name of an instruction set.
+     *
+     * @param[in] isa The instruction set.
+     *
+     * @return The name.
+     */
+    static const char* name( Isa isa );
+    /**
+     * @brief Obtains the instruction set in use.
+     *
+     * @return The instruction set.
+     */
+    Isa isa() const { return mIsa; }
+
+    /**
+     * @brief Checks if a monster may enter a tile.
+     *
+     * @param[in] pos Position of the tile.
+     *
+     * @retval true  The tile is passable.
+     * @retval false The tile is blocked.
+     */
+    bool passable( const GameCoord& pos ) const
+    {
+        const unsigned int bit = index( pos );
+        return (mBits[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1;
+    }
+    /**
+     * @brief Changes a tile.
+     *
+     * @param[in] pos      Position of the tile.
+     * @param[in] passable May a monster enter it?
+     */
+    void set( const GameCoord& pos, bool passable );
+
+    /**
+     * @brief Empties the batch.
+     */
+    void clear();
+    /**
+     * @brief Adds a monster to the batch.
+     *
+     * @param[in] pos  Position of the monster.
+     * @param[in] seed State of its random stream.
+     */
+    void add( const GameCoord& pos, unsigned int seed );
+    /**
+     * @brief Decides the moves of the whole batch.
+     *
+     * @param[in] dist Distance of each tile to the nearest
+     *                 player; NULL to only wander.
+     */
+    void decide( const unsigned int* dist );
+
+    /**
+     * @brief Obtains the decided move of a monster.
+     *
+     * @param[in] i Index of the monster in the batch.
+     *
+     * @return The move; GCE_NOOP if boxed in.
+     */
+    GameCtlEvent event( unsigned int i ) const { return (GameCtlEvent)mEvent[i]; }
+    /**
+     * @brief Obtains the random stream of a monster after decide().
+     *
+     * @param[in] i Index of the monster in the batch.
+     *
+     * @return State of its random stream.
+     */
+    unsigned int seed( unsigned int i ) const { return mSeed[i]; }
+
+protected:
+    /// Number of bits in a word of the bitboard.
+    static const unsigned int WORD_BITS = 32;
+
+    /**
+     * @brief Obtains the bitboard index of a tile.
+     *
+     * The bitboard has a blocked border around the map,
+     * so the neighbours of each tile are always there.
+     *
+     * @param[in] pos Position of the tile.
+     *
+     * @return The bit index.
+     */
+    unsigned int index( const GameCoord& pos ) const
+    {
+        return (pos.row + 1) * mStride * WORD_BITS + pos.col + 1;
+    }
+
+    /**
+     * @brief Decides moves one monster at a time.
+     *
+     * @param[in] first Index of the first monster.
+     * @param[in] dist  See decide().
+     */
+    void decideScalar( unsigned int first, const unsigned int* dist );
+#ifdef GAME_SIMD_X86
+    /**
+     * @brief Decides moves 4 monsters at a time.
+     *
+     * SSE2 cannot gather, so the bitboard and the distances
+     * are read lane by lane; the rest is vectorized.
+     *
+     * @param[in] dist See decide().
+     *
+     * @return Number of monsters decided.
+     */
+    unsigned int decideSse2( const unsigned int* dist );
+    /**
+     * @brief Decides moves 8 monsters at a time.
+     *
+     * @param[in] dist See decide().
+     *
+     * @return Number of monsters decided.
+     */
+    unsigned int decideAvx2( const unsigned int* dist );
+#endif /* GAME_SIMD_X86 */
+
+    /**
+     * @brief Advances a random stream.
+     *
+     * @param[in] x State of the stream.
+     *
+     * @return The next state, which is the random number too.
+     */
+    static unsigned int xorshift( unsigned int x )
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return x;
+    }
+    /**
+     * @brief Picks a move at random.
+     *
+     * @param[in] moves Bit mask of the moves, by GAME_MOVES.
+     * @param[in] rnd   A random number.
+     *
+     * @return The move; GCE_NOOP if there are none.
+     */
+    static unsigned int pick( unsigned int moves, unsigned int rnd );
+
+    /// Size of the map.
+    GameCoord mSize;
+    /// Number of words in a row of the bitboard.
+    unsigned int mStride;
+    /// The instruction set in use.
+    Isa mIsa;
+    /// Passability of each tile, see index().
+    std::vector<unsigned int> mBits;
+
+    /// Bitboard index of each monster.
+    std::vector<unsigned int> mBit;
+    /// Map index of each monster.
+    std::vector<unsigned int> mTile;
+    /// Random stream of each monster.
+    std::vector<unsigned int> mSeed;
+    /// Decided move of each monster.
+    std::vector<unsigned int> mEvent;
+};
+
+#endif /* !__GAME_MONSTER_KERNEL_H__INCL__ */
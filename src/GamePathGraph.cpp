@@ -0,0 +1,503 @@
+/** @file
+ * @brief Implementation of a hierarchical pathfinding graph.
+ *
+ * @author Jan Bobek
+ */
+
+#include "GamePathGraph.h"
+
+/*************************************************************************/
+/* GamePathGraph                                                         */
+/*************************************************************************/
+const unsigned int   GamePathGraph::CLUSTER;
+const unsigned int   GamePathGraph::PORTALS_MAX;
+const unsigned int   GamePathGraph::PORTAL_RUN;
+const unsigned short GamePathGraph::LOCAL_INFINITE;
+const unsigned int   GamePathGraph::NODE_GOAL;
+const unsigned int   GamePathGraph::NODE_NONE;
+
+const char
+GamePathGraph::MOVES[4][2] =
+{
+    { -1,  0 },
+    {  1,  0 },
+    {  0, -1 },
+    {  0,  1 }
+};
+
+GamePathGraph::GamePathGraph(
+    const GameCoord& size
+    )
+: mSize( size ),
+  mClusters( (size.row + CLUSTER - 1) / CLUSTER,
+             (size.col + CLUSTER - 1) / CLUSTER ),
+  mPassable( size.row * size.col, true ),
+  mClusterList( mClusters.row * mClusters.col )
+{
+    for( unsigned int c = 0; c < mClusterList.size(); ++c )
+    {
+        Cluster& cl = mClusterList[c];
+
+        cl.origin = GameCoord(
+            c / mClusters.col * CLUSTER,
+            c % mClusters.col * CLUSTER );
+        cl.size = GameCoord(
+            std::min<unsigned int>( CLUSTER, size.row - cl.origin.row ),
+            std::min<unsigned int>( CLUSTER, size.col - cl.origin.col ) );
+        cl.dirty = false;
+
+        /* Built on the first update. */
+        touch( c );
+    }
+}
+
+void
+GamePathGraph::set(
+    const GameCoord& pos,
+    bool passable
+    )
+{
+    if( passable == mPassable[pos.row * mSize.col + pos.col] )
+        return;
+
+    mPassable[pos.row * mSize.col + pos.col] = passable;
+
+    const unsigned int c = clusterOf( pos );
+    const Cluster& cl = mClusterList[c];
+    touch( c );
+
+    /* The border is shared with the neighbour. */
+    if( pos.row == cl.origin.row && 0 < cl.origin.row )
+        touch( c - mClusters.col );
+    if( pos.row + 1u == cl.origin.row + cl.size.row && pos.row + 1u < mSize.row )
+        touch( c + mClusters.col );
+    if( pos.col == cl.origin.col && 0 < cl.origin.col )
+        touch( c - 1 );
+    if( pos.col + 1u == cl.origin.col + cl.size.col && pos.col + 1u < mSize.col )
+        touch( c + 1 );
+}
+
+void
+GamePathGraph::update()
+{
+    std::vector<unsigned int>::const_iterator cur, end;
+    cur = mDirty.begin();
+    end = mDirty.end();
+    for(; cur != end; ++cur )
+        build( *cur );
+
+    mDirty.clear();
+}
+
+bool
+GamePathGraph::route(
+    const GameCoord& from,
+    const GameCoord& to,
+    std::vector<GameCoord>& route,
+    unsigned int limit
+    ) const
+{
+    route.clear();
+
+    const unsigned int fc = clusterOf( from ), tc = clusterOf( to );
+    const Cluster& fcl = mClusterList[fc];
+    const Cluster& tcl = mClusterList[tc];
+    unsigned short fdist[CLUSTER * CLUSTER], tdist[CLUSTER * CLUSTER];
+
+    bfs( fcl, from, fdist );
+    if( fc == tc && LOCAL_INFINITE != fdist[local( fcl, to )] )
+    {
+        /* Just walk there. */
+        route.push_back( to );
+        return true;
+    }
+
+    bfs( tcl, to, tdist );
+
+    /* Leave through any portal of the first cluster. */
+    Search search;
+    for( unsigned int i = 0; i < fcl.portals.size(); ++i )
+    {
+        const unsigned short d = fdist[local( fcl, fcl.portals[i] )];
+        if( LOCAL_INFINITE != d )
+            search.relax( fc * PORTALS_MAX + i, d, NODE_NONE,
+                          manhattan( fcl.portals[i], to ) );
+    }
+
+    /* The portal closest to the goal, in case we give up. */
+    unsigned int best = NODE_NONE, bestleft = GAME_DIST_INFINITE;
+
+    while( !search.open.empty() )
+    {
+        const Search::Entry top = search.open.top();
+        search.open.pop();
+
+        if( NODE_GOAL == top.second )
+        {
+            best = top.second;
+            break;
+        }
+
+        const unsigned int c = top.second / PORTALS_MAX;
+        const unsigned int i = top.second % PORTALS_MAX;
+        const Cluster& cl = mClusterList[c];
+        const GameCoord& pos = cl.portals[i];
+
+        const unsigned int dist = search.find( top.second ).dist;
+        const unsigned int left = manhattan( pos, to );
+        if( top.first != dist + left )
+            /* Found shorter since. */
+            continue;
+
+        if( left < bestleft )
+        {
+            best = top.second;
+            bestleft = left;
+        }
+
+        if( limit && !--limit )
+            /* Took too long. */
+            break;
+
+        /* Enter the goal. */
+        if( c == tc && LOCAL_INFINITE != tdist[local( tcl, pos )] )
+            search.relax( NODE_GOAL, dist + tdist[local( tcl, pos )],
+                          top.second, 0 );
+
+        /* Go to another portal of the cluster ... */
+        const unsigned int n = cl.portals.size();
+        for( unsigned int j = 0; j < n; ++j )
+            if( j != i && LOCAL_INFINITE != cl.dist[i * n + j] )
+                search.relax( c * PORTALS_MAX + j, dist + cl.dist[i * n + j],
+                              top.second, manhattan( cl.portals[j], to ) );
+
+        /* ... or cross to the neighbour. */
+        for( unsigned int k = 0; k < 4; ++k )
+        {
+            const GameCoord next(
+                pos.row + MOVES[k][0],
+                pos.col + MOVES[k][1] );
+
+            if( !(next.row < mSize.row) || !(next.col < mSize.col) ||
+                inside( cl, next ) )
+                continue;
+
+            const unsigned int nc = clusterOf( next );
+            const std::vector<GameCoord>& np = mClusterList[nc].portals;
+            for( unsigned int j = 0; j < np.size(); ++j )
+                if( np[j] == next )
+                {
+                    search.relax( nc * PORTALS_MAX + j, dist + 1,
+                                  top.second, manhattan( next, to ) );
+                    break;
+                }
+        }
+    }
+
+    if( NODE_NONE == best )
+        /* No way. */
+        return false;
+
+    /* Walk the parents back. */
+    unsigned int node = (NODE_GOAL == best ? search.find( best ).parent : best);
+    for(; NODE_NONE != node; node = search.find( node ).parent )
+        route.push_back(
+            mClusterList[node / PORTALS_MAX].portals[node % PORTALS_MAX] );
+
+    std::reverse( route.begin(), route.end() );
+    if( NODE_GOAL == best )
+        route.push_back( to );
+
+    return true;
+}
+
+bool
+GamePathGraph::step(
+    const GameCoord& from,
+    const GameCoord& to,
+    GameCoord& next
+    ) const
+{
+    if( 1 == manhattan( from, to ) )
+    {
+        /* Right there. */
+        next = to;
+        return true;
+    }
+
+    const Cluster& cl = mClusterList[clusterOf( from )];
+    if( from == to || !inside( cl, to ) )
+        return false;
+
+    unsigned short dist[CLUSTER * CLUSTER];
+    bfs( cl, to, dist );
+
+    /* Go downhill. */
+    unsigned short best = LOCAL_INFINITE;
+    for( unsigned int k = 0; k < 4; ++k )
+    {
+        const GameCoord pos(
+            from.row + MOVES[k][0],
+            from.col + MOVES[k][1] );
+
+        if( !(pos.row < mSize.row) || !(pos.col < mSize.col) ||
+            !inside( cl, pos ) || !(dist[local( cl, pos )] < best) )
+            continue;
+
+        best = dist[local( cl, pos )];
+        next = pos;
+    }
+
+    return LOCAL_INFINITE != best;
+}
+
+unsigned int
+GamePathGraph::portals() const
+{
+    unsigned int count = 0;
+
+    std::vector<Cluster>::const_iterator cur, end;
+    cur = mClusterList.begin();
+    end = mClusterList.end();
+    for(; cur != end; ++cur )
+        count += cur->portals.size();
+
+    return count;
+}
+
+size_t
+GamePathGraph::memory() const
+{
+    size_t bytes = sizeof( *this )
+        + mPassable.capacity() / CHAR_BIT
+        + mClusterList.capacity() * sizeof( Cluster )
+        + mDirty.capacity() * sizeof( unsigned int );
+
+    std::vector<Cluster>::const_iterator cur, end;
+    cur = mClusterList.begin();
+    end = mClusterList.end();
+    for(; cur != end; ++cur )
+        bytes += cur->portals.capacity() * sizeof( GameCoord )
+            + cur->dist.capacity() * sizeof( unsigned short );
+
+    return bytes;
+}
+
+void
+GamePathGraph::touch(
+    unsigned int c
+    )
+{
+    if( !mClusterList[c].dirty )
+    {
+        mClusterList[c].dirty = true;
+        mDirty.push_back( c );
+    }
+}
+
+void
+GamePathGraph::build(
+    unsigned int c
+    )
+{
+    Cluster& cl = mClusterList[c];
+    const GameCoord last(
+        cl.origin.row + cl.size.row - 1,
+        cl.origin.col + cl.size.col - 1 );
+
+    /* Place the portals along the borders ... */
+    cl.portals.clear();
+    if( 0 < cl.origin.row )
+        buildBorder( cl, cl.origin, 0, 1, -1, 0, cl.portals );
+    if( last.row + 1u < mSize.row )
+        buildBorder( cl, GameCoord( last.row, cl.origin.col ),
+                     0, 1, 1, 0, cl.portals );
+    if( 0 < cl.origin.col )
+        buildBorder( cl, cl.origin, 1, 0, 0, -1, cl.portals );
+    if( last.col + 1u < mSize.col )
+        buildBorder( cl, GameCoord( cl.origin.row, last.col ),
+                     1, 0, 0, 1, cl.portals );
+
+    /* ... and find the distances between them. */
+    const unsigned int n = cl.portals.size();
+    cl.dist.resize( n * n );
+
+    unsigned short dist[CLUSTER * CLUSTER];
+    for( unsigned int i = 0; i < n; ++i )
+    {
+        bfs( cl, cl.portals[i], dist );
+        for( unsigned int j = 0; j < n; ++j )
+            cl.dist[i * n + j] = dist[local( cl, cl.portals[j] )];
+    }
+
+    cl.dirty = false;
+}
+
+void
+GamePathGraph::buildBorder(
+    const Cluster& cl,
+    const GameCoord& start,
+    int rowstep,
+    int colstep,
+    int outrow,
+    int outcol,
+    std::vector<GameCoord>& portals
+    ) const
+{
+    const unsigned int len = (rowstep ? cl.size.row : cl.size.col);
+    unsigned int run = 0;
+
+    /* One step past the end closes the last run. */
+    for( unsigned int i = 0; i <= len; ++i )
+    {
+        const GameCoord pos(
+            start.row + i * rowstep,
+            start.col + i * colstep );
+
+        if( i < len && passable( pos ) &&
+            passable( GameCoord( pos.row + outrow, pos.col + outcol ) ) )
+        {
+            ++run;
+            continue;
+        }
+        else if( !run )
+            continue;
+
+        /* The run has ended; both neighbours see it the same way. */
+        unsigned int ends[2], cnt = 0;
+        if( run < PORTAL_RUN )
+            ends[cnt++] = i - run + run / 2;
+        else
+        {
+            ends[cnt++] = i - run;
+            ends[cnt++] = i - 1;
+        }
+
+        for( unsigned int k = 0; k < cnt; ++k )
+        {
+            const GameCoord portal(
+                start.row + ends[k] * rowstep,
+                start.col + ends[k] * colstep );
+
+            /* Corners may be on two borders. */
+            if( portals.end() == std::find( portals.begin(), portals.end(),
+                                            portal ) )
+                portals.push_back( portal );
+        }
+
+        run = 0;
+    }
+
+    assert( portals.size() <= PORTALS_MAX );
+}
+
+void
+GamePathGraph::bfs(
+    const Cluster& cl,
+    const GameCoord& from,
+    unsigned short dist[CLUSTER * CLUSTER]
+    ) const
+{
+    std::fill( dist, dist + CLUSTER * CLUSTER, LOCAL_INFINITE );
+
+    GameCoord queue[CLUSTER * CLUSTER];
+    unsigned int head = 0, tail = 0;
+
+    dist[local( cl, from )] = 0;
+    queue[tail++] = from;
+
+    while( head < tail )
+    {
+        const GameCoord pos = queue[head++];
+        const unsigned short d = dist[local( cl, pos )] + 1;
+
+        for( unsigned int k = 0; k < 4; ++k )
+        {
+            const GameCoord next(
+                pos.row + MOVES[k][0],
+                pos.col + MOVES[k][1] );
+
+            if( !(next.row < mSize.row) || !(next.col < mSize.col) ||
+                !inside( cl, next ) )
+                continue;
+
+            unsigned short& nd = dist[local( cl, next )];
+            if( d < nd && passable( next ) )
+            {
+                nd = d;
+                queue[tail++] = next;
+            }
+        }
+    }
+}
+
+/*************************************************************************/
+/* GamePathGraph::Search                                                 */
+/*************************************************************************/
+GamePathGraph::Search::Search()
+: count( 0 )
+{
+    grow( 1024 );
+}
+
+GamePathGraph::Search::Visit&
+GamePathGraph::Search::find(
+    unsigned int node
+    )
+{
+    const unsigned int mask = visits.size() - 1;
+
+    /* Open addressing, linear probing. */
+    unsigned int h = node * 2654435761U & mask;
+    while( NODE_NONE != visits[h].node && node != visits[h].node )
+        h = (h + 1) & mask;
+
+    return visits[h];
+}
+
+void
+GamePathGraph::Search::relax(
+    unsigned int node,
+    unsigned int dist,
+    unsigned int parent,
+    unsigned int left
+    )
+{
+    Visit* v = &find( node );
+    if( node == v->node && v->dist <= dist )
+        return;
+
+    if( NODE_NONE == v->node )
+    {
+        if( visits.size() < 2 * ++count )
+        {
+            /* Keep the table sparse. */
+            grow( 2 * visits.size() );
+            v = &find( node );
+        }
+
+        v->node = node;
+    }
+
+    v->dist = dist;
+    v->parent = parent;
+    open.push( Entry( dist + left, node ) );
+}
+
+void
+GamePathGraph::Search::grow(
+    unsigned int size
+    )
+{
+    const Visit free = { NODE_NONE, 0, 0 };
+
+    std::vector<Visit> old( size, free );
+    visits.swap( old );
+
+    std::vector<Visit>::const_iterator cur, end;
+    cur = old.begin();
+    end = old.end();
+    for(; cur != end; ++cur )
+        if( NODE_NONE != cur->node )
+            find( cur->node ) = *cur;
+}
@@ -0,0 +1,313 @@
+/** @file
+ * @brief A hierarchical pathfinding graph declarations.
+ *
+ * @author Jan Bobek
+ */
+
+#ifndef __GAME_PATH_GRAPH_H__INCL__
+#define __GAME_PATH_GRAPH_H__INCL__
+
+#include "Game.h"
+
+/**
+ * @brief A hierarchical abstraction of the game map.
+ *
+ * Splits the map into square clusters. Wherever a cluster
+ * borders another one through passable tiles, a portal is
+ * placed on both sides; distances between the portals of
+ * a cluster are precomputed. A route is searched for over
+ * the portals only, and the tiles are looked at just within
+ * the cluster of the walker, one step at a time.
+ *
+ * When a tile changes, only its cluster (and the neighbour
+ * sharing its border, if any) is computed again.
+ *
+ * The queries only read the graph, so they may run
+ * concurrently.
+ *
+ * @author Jan Bobek
+ */
+class GamePathGraph
+{
+public:
+    /// Side of a cluster in tiles.
+    static const unsigned int CLUSTER = 16;
+
+    /**
+     * @brief Initializes a graph of passable tiles.
+     *
+     * The graph is built on the first update().
+     *
+     * @param[in] size Size of the map.
+     */
+    GamePathGraph( const GameCoord& size );
+
+    /**
+     * @brief Obtains the cluster of a tile.
+     *
+     * @param[in] pos Position of the tile.
+     *
+     * @return Index of the cluster.
+     */
+    unsigned int clusterOf( const GameCoord& pos ) const
+    {
+        return pos.row / CLUSTER * mClusters.col + pos.col / CLUSTER;
+    }
+    /**
+     * @brief Checks if a tile is passable.
+     *
+     * @param[in] pos Position of the tile.
+     *
+     * @retval true  The tile is passable.
+     * @retval false The tile is blocked.
+     */
+    bool passable( const GameCoord& pos ) const
+    {
+        return mPassable[pos.row * mSize.col + pos.col];
+    }
+    /**
+     * @brief Changes a tile.
+     *
+     * The graph stays as it is until update().
+     *
+     * @param[in] pos      Position of the tile.
+     * @param[in] passable Is the tile passable?
+     */
+    void set( const GameCoord& pos, bool passable );
+    /**
+     * @brief Computes the clusters with changed tiles again.
+     */
+    void update();
+
+    /**
+     * @brief Searches for a route over the portals.
+     *
+     * Within a single cluster, the route leads straight
+     * to the goal if it can. If the search gives up, the
+     * route leads to the portal closest to the goal.
+     *
+     * @param[in]  from  Where the route starts.
+     * @param[in]  to    Where the route ends.
+     * @param[out] route The portals to go through, followed
+     *                   by the goal if reached.
+     * @param[in]  limit Give up after expanding this many
+     *                   portals; 0 for no limit.
+     *
+     * @retval true  The route has been found.
+     * @retval false There is no way out of the first cluster.
+     */
+    bool route( const GameCoord& from, const GameCoord& to,
+                std::vector<GameCoord>& route,
+                unsigned int limit = 0 ) const;
+    /**
+     * @brief Refines a leg of a route into a single step.
+     *
+     * @param[in]  from Where the walker is.
+     * @param[in]  to   The next tile of the route; in the same
+     *                  cluster, or next to the walker.
+     * @param[out] next Where to step.
+     *
+     * @retval true  The step has been found.
+     * @retval false The tile cannot be reached this way.
+     */
+    bool step( const GameCoord& from, const GameCoord& to,
+               GameCoord& next ) const;
+
+    /**
+     * @brief Obtains number of the portals.
+     *
+     * @return Number of the portals.
+     */
+    unsigned int portals() const;
+    /**
+     * @brief Obtains the memory taken by the graph.
+     *
+     * @return Number of bytes.
+     */
+    size_t memory() const;
+
+protected:
+    /// Maximal number of portals in a cluster.
+    static const unsigned int PORTALS_MAX = 4 * CLUSTER;
+    /// Runs of passable tiles this long get a portal at each end.
+    static const unsigned int PORTAL_RUN = 6;
+    /// Distance of an unreachable tile within a cluster.
+    static const unsigned short LOCAL_INFINITE = 0xFFFF;
+    /// A node of the route search, standing for the goal.
+    static const unsigned int NODE_GOAL = ~0U - 1;
+    /// No node at all.
+    static const unsigned int NODE_NONE = ~0U;
+
+    /**
+     * @brief A cluster of tiles.
+     *
+     * @author Jan Bobek
+     */
+    struct Cluster
+    {
+        /// The top-left tile.
+        GameCoord origin;
+        /// Number of rows and columns.
+        GameCoord size;
+        /// The portals.
+        std::vector<GameCoord> portals;
+        /// Distances between the portals, row by row.
+        std::vector<unsigned short> dist;
+        /// Have its tiles changed?
+        bool dirty;
+    };
+
+    /**
+     * @brief State of an A* search over the portals.
+     *
+     * @author Jan Bobek
+     */
+    struct Search
+    {
+        /// Estimated length and node.
+        typedef std::pair<unsigned int, unsigned int> Entry;
+
+        /**
+         * @brief A node reached by the search.
+         *
+         * @author Jan Bobek
+         */
+        struct Visit
+        {
+            /// The node; NODE_NONE if the slot is free.
+            unsigned int node;
+            /// Length of the shortest path found so far.
+            unsigned int dist;
+            /// The previous node of the path.
+            unsigned int parent;
+        };
+
+        /**
+         * @brief Initializes an empty search.
+         */
+        Search();
+
+        /**
+         * @brief Finds the slot of a node.
+         *
+         * @param[in] node The node.
+         *
+         * @return The slot of the node, or a free one.
+         */
+        Visit& find( unsigned int node );
+        /**
+         * @brief Records a path to a node if it is the shortest yet.
+         *
+         * @param[in] node   The node.
+         * @param[in] dist   Length of the path.
+         * @param[in] parent The previous node of the path.
+         * @param[in] left   Estimated distance to the goal.
+         */
+        void relax( unsigned int node, unsigned int dist,
+                    unsigned int parent, unsigned int left );
+        /**
+         * @brief Resizes the table of the visits.
+         *
+         * @param[in] size The new size; a power of two.
+         */
+        void grow( unsigned int size );
+
+        /// Shortest paths found so far, hashed by node.
+        std::vector<Visit> visits;
+        /// Number of the nodes in the table.
+        unsigned int count;
+        /// The nodes to expand, by estimated length.
+        std::priority_queue<Entry, std::vector<Entry>,
+                            std::greater<Entry> > open;
+    };
+
+    /**
+     * @brief Marks a cluster dirty.
+     *
+     * @param[in] c Index of the cluster.
+     */
+    void touch( unsigned int c );
+    /**
+     * @brief Computes the portals of a cluster and their distances.
+     *
+     * @param[in] c Index of the cluster.
+     */
+    void build( unsigned int c );
+    /**
+     * @brief Places portals along a border of a cluster.
+     *
+     * @param[in]  cl      The cluster.
+     * @param[in]  start   The first tile of the border.
+     * @param[in]  rowstep How the border goes among rows.
+     * @param[in]  colstep How the border goes among columns.
+     * @param[in]  outrow  Where the other cluster is, among rows.
+     * @param[in]  outcol  Where the other cluster is, among columns.
+     * @param[out] portals Where to add the portals.
+     */
+    void buildBorder( const Cluster& cl, const GameCoord& start,
+                      int rowstep, int colstep, int outrow, int outcol,
+                      std::vector<GameCoord>& portals ) const;
+    /**
+     * @brief Runs a BFS within a cluster.
+     *
+     * @param[in]  cl   The cluster.
+     * @param[in]  from The starting tile.
+     * @param[out] dist Distance of each tile of the cluster, see local().
+     */
+    void bfs( const Cluster& cl, const GameCoord& from,
+              unsigned short dist[CLUSTER * CLUSTER] ) const;
+    /**
+     * @brief Obtains index of a tile within its cluster.
+     *
+     * @param[in] cl  The cluster.
+     * @param[in] pos Position of the tile.
+     *
+     * @return The index.
+     */
+    static unsigned int local( const Cluster& cl, const GameCoord& pos )
+    {
+        return (pos.row - cl.origin.row) * CLUSTER + pos.col - cl.origin.col;
+    }
+    /**
+     * @brief Checks if a tile lies within a cluster.
+     *
+     * @param[in] cl  The cluster.
+     * @param[in] pos Position of the tile.
+     *
+     * @retval true  The tile lies within.
+     * @retval false The tile lies outside.
+     */
+    static bool inside( const Cluster& cl, const GameCoord& pos )
+    {
+        return cl.origin.row <= pos.row && pos.row - cl.origin.row < cl.size.row
+            && cl.origin.col <= pos.col && pos.col - cl.origin.col < cl.size.col;
+    }
+    /**
+     * @brief Obtains Manhattan distance of two tiles.
+     *
+     * @param[in] a The first tile.
+     * @param[in] b The second tile.
+     *
+     * @return The distance.
+     */
+    static unsigned int manhattan( const GameCoord& a, const GameCoord& b )
+    {
+        return abs( a.row - b.row ) + abs( a.col - b.col );
+    }
+
+    /// Row and column steps to the neighbours of a tile.
+    static const char MOVES[4][2];
+
+    /// Size of the map.
+    GameCoord mSize;
+    /// Number of cluster rows and columns.
+    GameCoord mClusters;
+    /// Passability of each tile.
+    std::vector<bool> mPassable;
+    /// The clusters, row by row.
+    std::vector<Cluster> mClusterList;
+    /// Indices of the dirty clusters.
+    std::vector<unsigned int> mDirty;
+};
+
+#endif /* !__GAME_PATH_GRAPH_H__INCL__ */
@@ -0,0 +1,633 @@
+/** @file
+ * @brief Implementation of the network protocol.
+ *
+ * @author Jan Bobek
+ */
+
+#include "GameProtocol.h"
+
+/*************************************************************************/
+/* GameProtocol                                                          */
+/*************************************************************************/
+const unsigned char GameProtocol::VERSION;
+const unsigned char GameProtocol::VERSION_MIN;
+const unsigned int GameProtocol::HELLO_SIZE;
+const unsigned int GameProtocol::HEADER_SIZE;
+const unsigned int GameProtocol::ACK_SIZE;
+const unsigned int GameProtocol::CONTROLS_HEAD_SIZE;
+const unsigned int GameProtocol::FRAME_HEAD_SIZE;
+const unsigned int GameProtocol::FRAGMENT_HEAD_SIZE;
+const unsigned int GameProtocol::INPUT_HEAD_SIZE;
+const unsigned int GameProtocol::INPUT_CHANNEL_SIZE;
+const unsigned char GameProtocol::ACK;
+const unsigned char GameProtocol::CONTROLS;
+const unsigned int GameProtocol::ENTITY_BITS;
+const unsigned char GameProtocol::MAGIC[4] = { 'B', 'O', 'M', 'B' };
+
+bool
+GameProtocol::getRecord(
+    const unsigned char*& cur,
+    const unsigned char* end,
+    Record& record
+    )
+{
+    if( cur == end
+        || (RECORD_SNAPSHOT != *cur && RECORD_DIFF != *cur
+            && RECORD_PLAYER != *cur) )
+        return false;
+
+    record = (Record)*cur++;
+    return true;
+}
+
+void
+GameProtocol::encodeSnapshot(
+    const GameCoord& size,
+    const GameEntity* map,
+    std::vector<unsigned char>& buf
+    )
+{
+    buf.push_back( RECORD_SNAPSHOT );
+    putVarint( buf, size.row );
+    putVarint( buf, size.col );
+
+    /* Runs of equal tiles, the entity in the low nibble. */
+    const GameEntity* end = map + size.row * size.col;
+    while( map != end )
+    {
+        const GameEntity* run = map;
+        while( ++map != end && *map == *run );
+
+        putVarint( buf, (map - run - 1) << 4 | *run );
+    }
+}
+
+bool
+GameProtocol::decodeSize(
+    const unsigned char*& cur,
+    const unsigned char* end,
+    GameCoord& size
+    )
+{
+    unsigned int rows, cols;
+    if( !getVarint( cur, end, rows ) || !getVarint( cur, end, cols ) )
+        return false;
+
+    size = GameCoord( rows, cols );
+    return true;
+}
+
+bool
+GameProtocol::decodeSnapshot(
+    const unsigned char*& cur,
+    const unsigned char* end,
+    GameEntity* map,
+    unsigned int count
+    )
+{
+    while( count )
+    {
+        unsigned int run;
+        if( !getVarint( cur, end, run ) || GENT_COUNT <= (run & 0xF)
+            || count <= run >> 4 )
+            /* Malformed or too long. */
+            return false;
+
+        const GameEntity ent = (GameEntity)(run & 0xF);
+        run = (run >> 4) + 1;
+
+        std::fill( map, map + run, ent );
+        map += run;
+        count -= run;
+    }
+
+    return true;
+}
+
+void
+GameProtocol::encodeDiff(
+    const std::vector<unsigned int>& tiles,
+    const GameEntity* map,
+    std::vector<unsigned char>& buf
+    )
+{
+    buf.push_back( RECORD_DIFF );
+    putVarint( buf, tiles.size() );
+    if( tiles.empty() )
+        return;
+
+    /* The gaps are about the mean apart, so it takes
+       about log2 of the mean bits to store them. */
+    const unsigned int mean = (tiles.back() + 1) / tiles.size();
+    unsigned int k = 0;
+    while( (2U << k) <= mean )
+        ++k;
+    putVarint( buf, k );
+
+    BitWriter bits( buf );
+    unsigned int next = 0;
+    std::vector<unsigned int>::const_iterator cur, end;
+    cur = tiles.begin();
+    end = tiles.end();
+    for(; cur != end; ++cur )
+    {
+        /* Rice code: the quotient in unary, the remainder in k bits. */
+        const unsigned int gap = *cur - next;
+        for( unsigned int q = gap >> k; q; q -= std::min( q, 16U ) )
+            bits.put( 0xFFFF, std::min( q, 16U ) );
+        bits.put( 0, 1 );
+        bits.put( gap, k );
+
+        bits.put( map[*cur], ENTITY_BITS );
+        next = *cur + 1;
+    }
+
+    bits.flush();
+}
+
+bool
+GameProtocol::decodeDiff(
+    const unsigned char*& cur,
+    const unsigned char* end,
+    GameEntity* map,
+    unsigned int count,
+    std::vector<unsigned int>& tiles
+    )
+{
+    unsigned int n, k;
+    if( !getVarint( cur, end, n ) )
+        return false;
+    else if( !n )
+        return true;
+    else if( !getVarint( cur, end, k ) || 32 <= k )
+        return false;
+
+    BitReader bits( cur, end );
+    unsigned int next = 0;
+    while( n-- )
+    {
+        unsigned int q = 0, bit, gap, ent;
+        do
+        {
+            if( !bits.get( bit, 1 ) )
+                return false;
+            q += bit;
+        }
+        while( bit && q < count );
+
+        if( !bits.get( gap, k ) || !bits.get( ent, ENTITY_BITS ) )
+            return false;
+
+        gap |= q << k;
+        if( count - next <= gap || GENT_COUNT <= ent )
+            /* Out of the map or unknown entity. */
+            return false;
+
+        next += gap;
+        map[next] = (GameEntity)ent;
+        tiles.push_back( next++ );
+    }
+
+    cur = bits.cur();
+    return true;
+}
+
+void
+GameProtocol::encodePlayer(
+    const Player& player,
+    std::vector<unsigned char>& buf
+    )
+{
+    buf.push_back( RECORD_PLAYER );
+    putVarint( buf, player.channel );
+    putVarint( buf, player.taken );
+    putVarint( buf, player.alive );
+    if( !player.alive )
+        return;
+
+    putVarint( buf, player.pos.row );
+    putVarint( buf, player.pos.col );
+    putVarint( buf, player.speed );
+    putVarint( buf, player.nextmove );
+}
+
+bool
+GameProtocol::decodePlayer(
+    const unsigned char*& cur,
+    const unsigned char* end,
+    Player& player
+    )
+{
+    unsigned int alive, row, col;
+    if( !getVarint( cur, end, player.channel )
+        || !getVarint( cur, end, player.taken )
+        || !getVarint( cur, end, alive ) || 1 < alive )
+        return false;
+
+    player.alive = alive;
+    if( !player.alive )
+        return true;
+
+    if( !getVarint( cur, end, row ) || !getVarint( cur, end, col )
+        || !getVarint( cur, end, player.speed )
+        || !getVarint( cur, end, player.nextmove ) )
+        return false;
+
+    player.pos = GameCoord( row, col );
+    return true;
+}
+
+unsigned char
+GameProtocol::negotiate(
+    unsigned char version
+    )
+{
+    if( version < VERSION_MIN )
+        return 0;
+
+    return std::min( version, VERSION );
+}
+
+void
+GameProtocol::putHello(
+    std::vector<unsigned char>& buf,
+    unsigned char version
+    )
+{
+    buf.insert( buf.end(), MAGIC, MAGIC + sizeof( MAGIC ) );
+    buf.push_back( version );
+}
+
+bool
+GameProtocol::getHello(
+    const unsigned char* buf,
+    unsigned char& version
+    )
+{
+    if( memcmp( buf, MAGIC, sizeof( MAGIC ) ) )
+        return false;
+
+    version = buf[sizeof( MAGIC )];
+    return true;
+}
+
+void
+GameProtocol::putHeader(
+    unsigned char* buf,
+    unsigned int tick,
+    unsigned int size
+    )
+{
+    for( unsigned int i = 0; i < 4; ++i )
+    {
+        buf[i] = tick >> (8 * i);
+        buf[4 + i] = size >> (8 * i);
+    }
+}
+
+void
+GameProtocol::getHeader(
+    const unsigned char* buf,
+    unsigned int& tick,
+    unsigned int& size
+    )
+{
+    tick = size = 0;
+    for( unsigned int i = 0; i < 4; ++i )
+    {
+        tick |= (unsigned int)buf[i] << (8 * i);
+        size |= (unsigned int)buf[4 + i] << (8 * i);
+    }
+}
+
+void
+GameProtocol::putAck(
+    std::vector<unsigned char>& buf,
+    unsigned int tick
+    )
+{
+    buf.push_back( ACK );
+    for( unsigned int i = 0; i < 4; ++i )
+        buf.push_back( tick >> (8 * i) );
+}
+
+unsigned int
+GameProtocol::getAck(
+    const unsigned char* buf
+    )
+{
+    unsigned int tick = 0;
+    for( unsigned int i = 0; i < 4; ++i )
+        tick |= (unsigned int)buf[1 + i] << (8 * i);
+
+    return tick;
+}
+
+void
+GameProtocol::putControls(
+    std::vector<unsigned char>& buf,
+    unsigned int tick,
+    const std::vector<GameCtlEvent>& events
+    )
+{
+    const unsigned int pos = buf.size();
+    buf.resize( pos + CONTROLS_HEAD_SIZE );
+    buf[pos] = CONTROLS;
+    put32( &buf[pos + 1], tick );
+    buf[pos + 5] = events.size();
+
+    std::vector<GameCtlEvent>::const_iterator cur, end;
+    cur = events.begin();
+    end = events.end();
+    for(; cur != end; ++cur )
+        buf.push_back( putCtl( *cur ) );
+}
+
+GameCtlEvent
+GameProtocol::getCtl(
+    unsigned char byte
+    )
+{
+    if( GCE_RCEXPLODE < byte )
+        /* Not a control event we know of. */
+        return GCE_NOOP;
+
+    return (GameCtlEvent)byte;
+}
+
+void
+GameProtocol::putFrameHead(
+    std::vector<unsigned char>& buf,
+    unsigned int base
+    )
+{
+    buf.push_back( DATAGRAM_FRAME );
+    buf.resize( buf.size() + 4 );
+    put32( &buf[buf.size() - 4], base );
+}
+
+bool
+GameProtocol::getFrameHead(
+    const unsigned char* buf,
+    unsigned int len,
+    unsigned int& base
+    )
+{
+    if( len < FRAME_HEAD_SIZE + HEADER_SIZE || DATAGRAM_FRAME != buf[0] )
+        return false;
+
+    /* Whole, or a piece cut off by a small buffer? */
+    unsigned int tick, size;
+    getHeader( buf + FRAME_HEAD_SIZE, tick, size );
+    if( len - FRAME_HEAD_SIZE - HEADER_SIZE != size )
+        return false;
+
+    base = get32( buf + 1 );
+    return true;
+}
+
+void
+GameProtocol::putFragment(
+    std::vector<unsigned char>& buf,
+    unsigned int seq,
+    bool last,
+    const std::vector<unsigned char>& data
+    )
+{
+    buf.push_back( DATAGRAM_FRAGMENT );
+    buf.resize( buf.size() + 4 );
+    put32( &buf[buf.size() - 4], seq );
+    buf.push_back( last );
+    buf.insert( buf.end(), data.begin(), data.end() );
+}
+
+bool
+GameProtocol::getFragment(
+    const unsigned char* buf,
+    unsigned int len,
+    unsigned int& seq,
+    bool& last
+    )
+{
+    if( len < FRAGMENT_HEAD_SIZE || DATAGRAM_FRAGMENT != buf[0]
+        || 1 < buf[5] )
+        return false;
+
+    seq = get32( buf + 1 );
+    last = buf[5];
+    return true;
+}
+
+void
+GameProtocol::putInput(
+    std::vector<unsigned char>& buf,
+    unsigned int ack,
+    unsigned int received,
+    unsigned int tick,
+    unsigned int channels
+    )
+{
+    const unsigned int pos = buf.size();
+    buf.resize( pos + INPUT_HEAD_SIZE );
+    buf[pos] = DATAGRAM_INPUT;
+    put32( &buf[pos + 1], ack );
+    put32( &buf[pos + 5], received );
+    put32( &buf[pos + 9], tick );
+    buf[pos + 13] = channels;
+}
+
+void
+GameProtocol::putInputChannel(
+    std::vector<unsigned char>& buf,
+    unsigned int sent,
+    std::deque<GameCtlEvent>::const_iterator begin,
+    std::deque<GameCtlEvent>::const_iterator end
+    )
+{
+    const unsigned int pos = buf.size();
+    buf.resize( pos + INPUT_CHANNEL_SIZE );
+    put32( &buf[pos], sent );
+    buf[pos + 4] = end - begin;
+
+    for(; begin != end; ++begin )
+        buf.push_back( putCtl( *begin ) );
+}
+
+bool
+GameProtocol::getInput(
+    const unsigned char* buf,
+    unsigned int len,
+    unsigned int& ack,
+    unsigned int& received,
+    unsigned int& tick,
+    unsigned int& channels
+    )
+{
+    if( len < INPUT_HEAD_SIZE || DATAGRAM_INPUT != buf[0] )
+        return false;
+
+    ack = get32( buf + 1 );
+    received = get32( buf + 5 );
+    tick = get32( buf + 9 );
+    channels = buf[13];
+    return true;
+}
+
+bool
+GameProtocol::getInputChannel(
+    const unsigned char*& cur,
+    const unsigned char* end,
+    unsigned int& sent,
+    unsigned int& count,
+    const unsigned char*& events
+    )
+{
+    if( end - cur < (int)INPUT_CHANNEL_SIZE
+        || end - cur - INPUT_CHANNEL_SIZE < cur[4] )
+        return false;
+
+    sent = get32( cur );
+    count = cur[4];
+    events = cur + INPUT_CHANNEL_SIZE;
+    cur = events + count;
+    return true;
+}
+
+bool
+GameProtocol::lose(
+    unsigned int& seed,
+    unsigned int percent
+    )
+{
+    if( !percent )
+        return false;
+
+    /* A generator of its own; rand() is the game's. */
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % 100 < percent;
+}
+
+void
+GameProtocol::putVarint(
+    std::vector<unsigned char>& buf,
+    unsigned int value
+    )
+{
+    for(; 0x80 <= value; value >>= 7 )
+        buf.push_back( value | 0x80 );
+    buf.push_back( value );
+}
+
+bool
+GameProtocol::getVarint(
+    const unsigned char*& cur,
+    const unsigned char* end,
+    unsigned int& value
+    )
+{
+    value = 0;
+    for( unsigned int shift = 0; cur != end && shift < 32; shift += 7 )
+    {
+        const unsigned char byte = *cur++;
+        value |= (unsigned int)(byte & 0x7F) << shift;
+
+        if( !(byte & 0x80) )
+            return true;
+    }
+
+    /* Truncated or too long. */
+    return false;
+}
+
+void
+GameProtocol::put32(
+    unsigned char* buf,
+    unsigned int value
+    )
+{
+    for( unsigned int i = 0; i < 4; ++i )
+        buf[i] = value >> (8 * i);
+}
+
+unsigned int
+GameProtocol::get32(
+    const unsigned char* buf
+    )
+{
+    unsigned int value = 0;
+    for( unsigned int i = 0; i < 4; ++i )
+        value |= (unsigned int)buf[i] << (8 * i);
+
+    return value;
+}
+
+/*************************************************************************/
+/* GameProtocol::BitWriter                                               */
+/*************************************************************************/
+GameProtocol::BitWriter::BitWriter(
+    std::vector<unsigned char>& buf
+    )
+: mBuf( buf ),
+  mAcc( 0 ),
+  mBits( 0 )
+{
+}
+
+void
+GameProtocol::BitWriter::put(
+    unsigned int value,
+    unsigned int bits
+    )
+{
+    if( !bits )
+        return;
+
+    mAcc |= (unsigned long long)(value & (0xFFFFFFFFU >> (32 - bits)))
+        << mBits;
+    for( mBits += bits; 8 <= mBits; mBits -= 8, mAcc >>= 8 )
+        mBuf.push_back( mAcc );
+}
+
+void
+GameProtocol::BitWriter::flush()
+{
+    if( mBits )
+        mBuf.push_back( mAcc );
+
+    mAcc = 0;
+    mBits = 0;
+}
+
+/*************************************************************************/
+/* GameProtocol::BitReader                                               */
+/*************************************************************************/
+GameProtocol::BitReader::BitReader(
+    const unsigned char* cur,
+    const unsigned char* end
+    )
+: mCur( cur ),
+  mEnd( end ),
+  mAcc( 0 ),
+  mBits( 0 )
+{
+}
+
+bool
+GameProtocol::BitReader::get(
+    unsigned int& value,
+    unsigned int bits
+    )
+{
+    for(; mBits < bits; mBits += 8 )
+    {
+        if( mCur == mEnd )
+            return false;
+
+        mAcc |= (unsigned long long)*mCur++ << mBits;
+    }
+
+    value = bits ? mAcc & (0xFFFFFFFFU >> (32 - bits)) : 0;
+    mAcc >>= bits;
+    mBits -= bits;
+    return true;
+}
@@ -0,0 +1,606 @@
+/** @file
+ * @brief The network protocol declarations.
+ *
+ * @author Jan Bobek
+ */
+
+#ifndef __GAME_PROTOCOL_H__INCL__
+#define __GAME_PROTOCOL_H__INCL__
+
+#include "GameModel.h"
+
+/**
+ * @brief Encodes the messages going over the wire.
+ *
+ * A connection starts with a hello from the client, carrying
+ * the newest version it speaks; the server replies with the
+ * version both speak, or 0 and hangs up. Then the server sends
+ * a frame each tick: a header of the tick number and the size
+ * of the records, both 32-bit little-endian, and the records.
+ * The client sends CONTROLS each tick: the number of the tick
+ * of the client, 32-bit little-endian, a byte of the count and
+ * a byte per control event, one for each of its local players,
+ * GCE_NOOP included; the players are numbered by the position
+ * of their event, their channel. The server adds a player for
+ * each channel the first time it comes, and plays the events
+ * in the pace of the ticks they carry. The client acknowledges
+ * the frames it has applied by ACK and the tick, 32-bit
+ * little-endian.
+ *
+ * A record starts with a byte of its kind. A snapshot carries
+ * the size of the map as two varints and the tiles row by row,
+ * run-length encoded as a varint each. A diff carries the tiles
+ * changed since the previous frame: their number and the Rice
+ * parameter as varints, then a bit stream of the gaps between
+ * the changed tiles (Rice coded) and their entities (4 bits).
+ * A client joins with a snapshot and gets diffs from then on.
+ * Player records follow in a frame of their own, sent to their
+ * client only: the channel, the number of the control events
+ * taken so far and, while the player lives, its position, speed
+ * and move timer, all varints. The client predicts its moves
+ * by them.
+ *
+ * Over UDP, a hello goes in a datagram of its own, again until
+ * the reply comes. Then each datagram starts with its kind. The
+ * server sends a frame each tick, with the diff of the tiles
+ * changed since the base, the last frame the client has
+ * acknowledged, and the players; the base goes before the frame,
+ * 32-bit little-endian. Snapshots, and frames too big for
+ * a datagram, go over a reliable channel (see ReliableChannel),
+ * in fragments: the number of the fragment, 32-bit little-endian,
+ * a byte which is 1 for the last fragment of a frame, and the
+ * data. Such a frame comes without the base; it is sent only
+ * after the previous snapshot is through. The client sends the
+ * tick of the last frame applied and the number of the fragments
+ * received in a row and its tick, all 32-bit little-endian, and
+ * a byte of the count of its channels. Then, for each channel,
+ * the number of the control events sent, 32-bit little-endian,
+ * a byte of the count and the latest control events, repeated
+ * in case a datagram gets lost; the last one is of the tick.
+ *
+ * @author Jan Bobek
+ */
+class GameProtocol
+{
+public:
+    /// The newest version we speak.
+    static const unsigned char VERSION = 6;
+    /// The oldest version we speak.
+    static const unsigned char VERSION_MIN = 6;
+    /// Size of a hello message.
+    static const unsigned int HELLO_SIZE = 5;
+    /// Size of a frame header.
+    static const unsigned int HEADER_SIZE = 8;
+    /// Size of an acknowledgement.
+    static const unsigned int ACK_SIZE = 5;
+    /// Size of the control events message without the events.
+    static const unsigned int CONTROLS_HEAD_SIZE = 6;
+
+    /// Size of the kind and base of a frame datagram.
+    static const unsigned int FRAME_HEAD_SIZE = 5;
+    /// Size of the kind, number and flag of a fragment datagram.
+    static const unsigned int FRAGMENT_HEAD_SIZE = 6;
+    /// Size of an input datagram without the channels.
+    static const unsigned int INPUT_HEAD_SIZE = 14;
+    /// Size of a channel of an input datagram without the events.
+    static const unsigned int INPUT_CHANNEL_SIZE = 5;
+
+    /**
+     * @brief The transports of the protocol.
+     *
+     * @author Jan Bobek
+     */
+    enum Transport
+    {
+        TRANSPORT_TCP, ///< A stream; reliable, in order.
+        TRANSPORT_UDP  ///< Datagrams; a lost one stalls nothing.
+    };
+
+    /**
+     * @brief The kinds of datagrams, after the hello.
+     *
+     * @author Jan Bobek
+     */
+    enum Datagram
+    {
+        DATAGRAM_FRAME    = 0x90, ///< A frame, unreliable.
+        DATAGRAM_FRAGMENT = 0x91, ///< A fragment of a reliable message.
+        DATAGRAM_INPUT    = 0x92  ///< Acknowledgements and control events.
+    };
+
+    /**
+     * @brief The kinds of records.
+     *
+     * @author Jan Bobek
+     */
+    enum Record
+    {
+        RECORD_SNAPSHOT = 2, ///< A snapshot of the whole map.
+        RECORD_DIFF     = 3, ///< The tiles changed since the last frame.
+        RECORD_PLAYER   = 4  ///< A player of the client.
+    };
+
+    /**
+     * @brief The player of a client, as of a frame.
+     *
+     * @author Jan Bobek
+     */
+    struct Player
+    {
+        /// Channel of the player.
+        unsigned int channel;
+        /// Number of the control events taken.
+        unsigned int taken;
+        /// Is the player alive?
+        bool alive;
+        /// Position of the player.
+        GameCoord pos;
+        /// Number of ticks between moves.
+        unsigned int speed;
+        /// Number of ticks until the next move.
+        unsigned int nextmove;
+    };
+
+    /**
+     * @brief Reads the kind of the next record.
+     *
+     * @param[in,out] cur    Where the record starts; moved past the kind.
+     * @param[in]     end    Where the frame ends.
+     * @param[out]    record The kind.
+     *
+     * @retval true  The kind has been read.
+     * @retval false The kind is unknown.
+     */
+    static bool getRecord( const unsigned char*& cur,
+                           const unsigned char* end, Record& record );
+
+    /**
+     * @brief Encodes a snapshot of the map.
+     *
+     * @param[in]  size Size of the map.
+     * @param[in]  map  The tiles, row by row.
+     * @param[out] buf  Where to append it.
+     */
+    static void encodeSnapshot( const GameCoord& size, const GameEntity* map,
+                                std::vector<unsigned char>& buf );
+    /**
+     * @brief Decodes the size of the map in a snapshot.
+     *
+     * @param[in,out] cur  Where the size starts; moved past it.
+     * @param[in]     end  Where the frame ends.
+     * @param[out]    size Size of the map.
+     *
+     * @retval true  The size has been decoded.
+     * @retval false The size is malformed.
+     */
+    static bool decodeSize( const unsigned char*& cur,
+                            const unsigned char* end, GameCoord& size );
+    /**
+     * @brief Decodes the tiles of a snapshot.
+     *
+     * @param[in,out] cur   Where the tiles start; moved past them.
+     * @param[in]     end   Where the frame ends.
+     * @param[out]    map   Where to decode the tiles.
+     * @param[in]     count Number of the tiles.
+     *
+     * @retval true  The tiles have been decoded.
+     * @retval false The tiles are malformed.
+     */
+    static bool decodeSnapshot( const unsigned char*& cur,
+                                const unsigned char* end,
+                                GameEntity* map, unsigned int count );
+    /**
+     * @brief Encodes the changed tiles.
+     *
+     * @param[in]  tiles Indices of the changed tiles, ascending.
+     * @param[in]  map   The tiles, row by row.
+     * @param[out] buf   Where to append it.
+     */
+    static void encodeDiff( const std::vector<unsigned int>& tiles,
+                            const GameEntity* map,
+                            std::vector<unsigned char>& buf );
+    /**
+     * @brief Decodes the changed tiles.
+     *
+     * @param[in,out] cur   Where the diff starts; moved past it.
+     * @param[in]     end   Where the frame ends.
+     * @param[in,out] map   Where to store the tiles.
+     * @param[in]     count Number of the tiles.
+     * @param[out]    tiles Where to append indices of the changed tiles.
+     *
+     * @retval true  The diff has been decoded.
+     * @retval false The diff is malformed.
+     */
+    static bool decodeDiff( const unsigned char*& cur,
+                            const unsigned char* end,
+                            GameEntity* map, unsigned int count,
+                            std::vector<unsigned int>& tiles );
+
+    /**
+     * @brief Encodes the player of a client.
+     *
+     * @param[in]  player The player.
+     * @param[out] buf    Where to append it.
+     */
+    static void encodePlayer( const Player& player,
+                              std::vector<unsigned char>& buf );
+    /**
+     * @brief Decodes the player of a client.
+     *
+     * @param[in,out] cur    Where the player starts; moved past it.
+     * @param[in]     end    Where the frame ends.
+     * @param[out]    player The player.
+     *
+     * @retval true  The player has been decoded.
+     * @retval false The player is malformed.
+     */
+    static bool decodePlayer( const unsigned char*& cur,
+                              const unsigned char* end, Player& player );
+
+    /**
+     * @brief Chooses the version to speak with a peer.
+     *
+     * @param[in] version The newest version of the peer.
+     *
+     * @return The version; 0 if there is none in common.
+     */
+    static unsigned char negotiate( unsigned char version );
+    /**
+     * @brief Appends a hello message.
+     *
+     * @param[out] buf     Where to append it.
+     * @param[in]  version The version to announce.
+     */
+    static void putHello( std::vector<unsigned char>& buf,
+                          unsigned char version );
+    /**
+     * @brief Parses a hello message.
+     *
+     * @param[in]  buf     HELLO_SIZE bytes of the message.
+     * @param[out] version The announced version.
+     *
+     * @retval true  The message is a hello.
+     * @retval false The peer does not speak our protocol.
+     */
+    static bool getHello( const unsigned char* buf, unsigned char& version );
+    /**
+     * @brief Writes a frame header.
+     *
+     * @param[out] buf  HEADER_SIZE bytes for the header.
+     * @param[in]  tick Number of the tick.
+     * @param[in]  size Size of the records.
+     */
+    static void putHeader( unsigned char* buf, unsigned int tick,
+                           unsigned int size );
+    /**
+     * @brief Reads a frame header.
+     *
+     * @param[in]  buf  HEADER_SIZE bytes of the header.
+     * @param[out] tick Number of the tick.
+     * @param[out] size Size of the records.
+     */
+    static void getHeader( const unsigned char* buf, unsigned int& tick,
+                           unsigned int& size );
+    /**
+     * @brief Appends an acknowledgement of a frame.
+     *
+     * @param[out] buf  Where to append it.
+     * @param[in]  tick Tick of the frame.
+     */
+    static void putAck( std::vector<unsigned char>& buf, unsigned int tick );
+    /**
+     * @brief Checks if a message is an acknowledgement.
+     *
+     * @param[in] byte The first byte of the message.
+     *
+     * @retval true  ACK_SIZE bytes of an acknowledgement.
+     * @retval false Something else.
+     */
+    static bool isAck( unsigned char byte ) { return ACK == byte; }
+    /**
+     * @brief Reads an acknowledgement of a frame.
+     *
+     * @param[in] buf ACK_SIZE bytes of the acknowledgement.
+     *
+     * @return Tick of the frame.
+     */
+    static unsigned int getAck( const unsigned char* buf );
+    /**
+     * @brief Encodes a control event.
+     *
+     * @param[in] event The control event.
+     *
+     * @return The byte to send.
+     */
+    static unsigned char putCtl( GameCtlEvent event ) { return event; }
+    /**
+     * @brief Decodes a control event.
+     *
+     * @param[in] byte The byte received.
+     *
+     * @return The control event; GCE_NOOP if malformed.
+     */
+    static GameCtlEvent getCtl( unsigned char byte );
+    /**
+     * @brief Appends the control events of a tick.
+     *
+     * @param[out] buf    Where to append them.
+     * @param[in]  tick   Number of the tick of the client.
+     * @param[in]  events An event of each channel, in order.
+     */
+    static void putControls( std::vector<unsigned char>& buf,
+                             unsigned int tick,
+                             const std::vector<GameCtlEvent>& events );
+    /**
+     * @brief Checks if a message carries control events.
+     *
+     * @param[in] byte The first byte of the message.
+     *
+     * @retval true  CONTROLS_HEAD_SIZE bytes and the events.
+     * @retval false Something else.
+     */
+    static bool isControls( unsigned char byte ) { return CONTROLS == byte; }
+    /**
+     * @brief Reads the count of the control events.
+     *
+     * @param[in] buf CONTROLS_HEAD_SIZE bytes of the message.
+     *
+     * @return Number of the events; they follow, a byte each.
+     */
+    static unsigned int getControls( const unsigned char* buf )
+    {
+        return buf[5];
+    }
+    /**
+     * @brief Reads the tick of the control events.
+     *
+     * @param[in] buf CONTROLS_HEAD_SIZE bytes of the message.
+     *
+     * @return Number of the tick of the client.
+     */
+    static unsigned int getControlsTick( const unsigned char* buf )
+    {
+        return get32( buf + 1 );
+    }
+
+    /**
+     * @brief Appends the kind and base of a frame datagram.
+     *
+     * The frame goes right after.
+     *
+     * @param[out] buf  Where to append it.
+     * @param[in]  base Tick of the frame the diff is against.
+     */
+    static void putFrameHead( std::vector<unsigned char>& buf,
+                              unsigned int base );
+    /**
+     * @brief Parses the kind and base of a frame datagram.
+     *
+     * @param[in]  buf  The datagram.
+     * @param[in]  len  Size of the datagram.
+     * @param[out] base Tick of the frame the diff is against.
+     *
+     * @retval true  A frame, whole; at FRAME_HEAD_SIZE.
+     * @retval false Not a frame.
+     */
+    static bool getFrameHead( const unsigned char* buf, unsigned int len,
+                              unsigned int& base );
+    /**
+     * @brief Appends a fragment datagram.
+     *
+     * @param[out] buf  Where to append it.
+     * @param[in]  seq  Number of the fragment.
+     * @param[in]  last Is it the last fragment of a message?
+     * @param[in]  data The data of the fragment.
+     */
+    static void putFragment( std::vector<unsigned char>& buf,
+                             unsigned int seq, bool last,
+                             const std::vector<unsigned char>& data );
+    /**
+     * @brief Parses a fragment datagram.
+     *
+     * @param[in]  buf  The datagram.
+     * @param[in]  len  Size of the datagram.
+     * @param[out] seq  Number of the fragment.
+     * @param[out] last Is it the last fragment of a message?
+     *
+     * @retval true  A fragment; the data at FRAGMENT_HEAD_SIZE.
+     * @retval false Not a fragment.
+     */
+    static bool getFragment( const unsigned char* buf, unsigned int len,
+                             unsigned int& seq, bool& last );
+    /**
+     * @brief Appends the head of an input datagram.
+     *
+     * @param[out] buf      Where to append it.
+     * @param[in]  ack      Tick of the last frame applied.
+     * @param[in]  received Number of the fragments received in a row.
+     * @param[in]  tick     Number of the tick of the client.
+     * @param[in]  channels Number of the channels to follow.
+     */
+    static void putInput( std::vector<unsigned char>& buf, unsigned int ack,
+                          unsigned int received, unsigned int tick,
+                          unsigned int channels );
+    /**
+     * @brief Appends a channel of an input datagram.
+     *
+     * @param[out] buf   Where to append it.
+     * @param[in]  sent  Number of the control events ever sent.
+     * @param[in]  begin The latest control events, the oldest first.
+     * @param[in]  end   Past the latest control event.
+     */
+    static void putInputChannel(
+        std::vector<unsigned char>& buf, unsigned int sent,
+        std::deque<GameCtlEvent>::const_iterator begin,
+        std::deque<GameCtlEvent>::const_iterator end );
+    /**
+     * @brief Parses the head of an input datagram.
+     *
+     * @param[in]  buf      The datagram.
+     * @param[in]  len      Size of the datagram.
+     * @param[out] ack      Tick of the last frame applied.
+     * @param[out] received Number of the fragments received in a row.
+     * @param[out] tick     Number of the tick of the client.
+     * @param[out] channels Number of the channels.
+     *
+     * @retval true  An input; the channels at INPUT_HEAD_SIZE.
+     * @retval false Not an input.
+     */
+    static bool getInput( const unsigned char* buf, unsigned int len,
+                          unsigned int& ack, unsigned int& received,
+                          unsigned int& tick, unsigned int& channels );
+    /**
+     * @brief Parses a channel of an input datagram.
+     *
+     * @param[in,out] cur    Where the channel starts; moved past it.
+     * @param[in]     end    Where the datagram ends.
+     * @param[out]    sent   Number of the control events ever sent.
+     * @param[out]    count  Number of the control events repeated.
+     * @param[out]    events The control events, a byte each.
+     *
+     * @retval true  The channel has been parsed.
+     * @retval false The datagram is truncated.
+     */
+    static bool getInputChannel( const unsigned char*& cur,
+                                 const unsigned char* end,
+                                 unsigned int& sent, unsigned int& count,
+                                 const unsigned char*& events );
+    /**
+     * @brief Decides whether to lose a datagram, for testing.
+     *
+     * @param[in,out] seed    State of the generator.
+     * @param[in]     percent How many % to lose.
+     *
+     * @retval true  Drop it.
+     * @retval false Send it.
+     */
+    static bool lose( unsigned int& seed, unsigned int percent );
+
+protected:
+    /// First byte of an acknowledgement.
+    static const unsigned char ACK = 0x80;
+    /// The first byte of the control events.
+    static const unsigned char CONTROLS = 0x81;
+    /// Bits of an entity in a diff.
+    static const unsigned int ENTITY_BITS = 4;
+    /// Magic of the hello message.
+    static const unsigned char MAGIC[4];
+
+    /**
+     * @brief Appends bits to a buffer, least significant first.
+     *
+     * @author Jan Bobek
+     */
+    class BitWriter
+    {
+    public:
+        /**
+         * @brief Initializes the writer.
+         *
+         * @param[out] buf Where to append the bits.
+         */
+        BitWriter( std::vector<unsigned char>& buf );
+
+        /**
+         * @brief Appends a value.
+         *
+         * @param[in] value The value.
+         * @param[in] bits  Number of its bits, at most 32.
+         */
+        void put( unsigned int value, unsigned int bits );
+        /**
+         * @brief Appends the bits left, padded to a byte.
+         */
+        void flush();
+
+    protected:
+        /// Where to append the bits.
+        std::vector<unsigned char>& mBuf;
+        /// The bits not appended yet.
+        unsigned long long mAcc;
+        /// Number of the bits not appended yet.
+        unsigned int mBits;
+    };
+    /**
+     * @brief Reads bits written by BitWriter.
+     *
+     * @author Jan Bobek
+     */
+    class BitReader
+    {
+    public:
+        /**
+         * @brief Initializes the reader.
+         *
+         * @param[in] cur Where the bits start.
+         * @param[in] end Where the data end.
+         */
+        BitReader( const unsigned char* cur, const unsigned char* end );
+
+        /**
+         * @brief Reads a value.
+         *
+         * @param[out] value The value.
+         * @param[in]  bits  Number of its bits, at most 32.
+         *
+         * @retval true  The value has been read.
+         * @retval false The data have ended.
+         */
+        bool get( unsigned int& value, unsigned int bits );
+        /**
+         * @brief Obtains where the padded bits end.
+         *
+         * @return Past the last byte read.
+         */
+        const unsigned char* cur() const { return mCur; }
+
+    protected:
+        /// Where the next byte is.
+        const unsigned char* mCur;
+        /// Where the data end.
+        const unsigned char* mEnd;
+        /// The bits read, not taken yet.
+        unsigned long long mAcc;
+        /// Number of the bits not taken yet.
+        unsigned int mBits;
+    };
+
+    /**
+     * @brief Appends a varint.
+     *
+     * @param[out] buf   Where to append it.
+     * @param[in]  value The value.
+     */
+    static void putVarint( std::vector<unsigned char>& buf,
+                           unsigned int value );
+    /**
+     * @brief Reads a varint.
+     *
+     * @param[in,out] cur   Where the varint starts; moved past it.
+     * @param[in]     end   Where the data end.
+     * @param[out]    value The value.
+     *
+     * @retval true  The varint has been read.
+     * @retval false The varint is truncated or too long.
+     */
+    static bool getVarint( const unsigned char*& cur,
+                           const unsigned char* end,
+                           unsigned int& value );
+    /**
+     * @brief Writes a 32-bit little-endian value.
+     *
+     * @param[out] buf   Four bytes for the value.
+     * @param[in]  value The value.
+     */
+    static void put32( unsigned char* buf, unsigned int value );
+    /**
+     * @brief Reads a 32-bit little-endian value.
+     *
+     * @param[in] buf Four bytes of the value.
+     *
+     * @return The value.
+     */
+    static unsigned int get32( const unsigned char* buf );
+};
+
+#endif /* !__GAME_PROTOCOL_H__INCL__ */
@@ -0,0 +1,334 @@
+/** @file
+ * @brief Implementation of a relay game model.
+ *
+ * @author Jan Bobek
+ */
+
+#include "GameController.h"
+#include "GameRelayModel.h"
+#include "util.h"
+
+/*************************************************************************/
+/* GameRelayModel                                                        */
+/*************************************************************************/
+GameRelayModel::GameRelayModel(
+    const char* addr,
+    GameProtocol::Transport transport
+    )
+: GameRemoteModel( addr, transport ),
+  mClientSocket( NULL ),
+  mQueueLimit( GAME_NET_QUEUE_BYTES ),
+  mLast( 0 ),
+  mSnapshot( NULL )
+{
+    memset( &mNetStats, 0, sizeof( mNetStats ) );
+}
+
+GameRelayModel::~GameRelayModel()
+{
+    /* Close everything. */
+    close();
+
+    if( mSnapshot )
+        mSnapshot->release();
+}
+
+bool
+GameRelayModel::open(
+    const char* addr
+    )
+{
+    /* Some variables. */
+    addrinfo* ai = NULL, hints;
+    unsigned int reuse_addr = 1;
+
+    /* Extract the parts. */
+    const char* name = addr;
+    const char* serv = addr + strlen( addr ) + 1;
+
+    /* Setup hints. */
+    memset( &hints, 0, sizeof( hints ) );
+    /* Setup some flags. */
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST
+        | AI_NUMERICSERV | AI_ADDRCONFIG;
+    /* The spectators come over a stream. */
+    hints.ai_socktype = SOCK_STREAM;
+
+    if(
+        /* Subscribe to the server first, with no players. */
+        (!mConnection && !dispatchConnect()) ||
+        /* Translate the name. */
+        getaddrinfo( name, serv, &hints, &ai ) || !ai ||
+        /* Use the first address, non-blocking from the start. */
+        mSocket.create(
+            ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            ai->ai_protocol ) ||
+        /* Allow reuse addr. */
+        mSocket.setopt( SOL_SOCKET, SO_REUSEADDR,
+                        &reuse_addr, sizeof( reuse_addr ) ) ||
+        /* Bind to the address. */
+        mSocket.bind( ai->ai_addr, ai->ai_addrlen ) ||
+        /* Start listening. */
+        mSocket.listen() ||
+        /* Wake up on new connections. */
+        mReactor.add( mSocket.fd(), EPOLLIN, NULL )
+        )
+    {
+        /* Do not forget to release the addrinfo. */
+        safeRelease( ai, freeaddrinfo );
+        return false;
+    }
+
+    /* Do not forget to release the addrinfo. */
+    safeRelease( ai, freeaddrinfo );
+    return true;
+}
+
+void
+GameRelayModel::close()
+{
+    /* Send all spectators home. */
+    std::list<Spectator*>::iterator cur, end;
+    cur = mSpectators.begin();
+    end = mSpectators.end();
+    for(; cur != end; ++cur )
+        safeDelete( *cur );
+
+    /* Wipe the list. */
+    mSpectators.clear();
+    /* Close the socket. */
+    mSocket.close();
+    /* Delete the client socket. */
+    safeDelete( mClientSocket );
+}
+
+void
+GameRelayModel::dispatch(
+    const GameModelEvent& event
+    )
+{
+    if( event.ctl )
+    {
+        /* Nobody plays through a relay; the controller is ours. */
+        GameController* ctl = event.ctl;
+        safeDelete( ctl );
+    }
+    else
+        GameRemoteModel::dispatch( event );
+}
+
+bool
+GameRelayModel::tick()
+{
+    /* Apply the frames of the server, queueing them on the way. */
+    const bool cont = GameRemoteModel::tick();
+    /* Accept and read whatever is ready. */
+    tickSockets();
+    /* Push it all out. */
+    tickFlush();
+
+    return cont;
+}
+
+bool
+GameRelayModel::dispatchFrame()
+{
+    if( !GameRemoteModel::dispatchFrame() )
+        return false;
+
+    ++mNetStats.frames;
+    mLast = mConnection->popped();
+
+    /* The map has moved on. */
+    if( mSnapshot )
+    {
+        mSnapshot->release();
+        mSnapshot = NULL;
+    }
+
+    /* The frame as it came, encoded once for everyone. */
+    const unsigned char* frame = mConnection->frame();
+    const unsigned int size = mConnection->frameSize();
+    Message* msg = NULL;
+
+    std::list<Spectator*>::iterator cur, end;
+    cur = mSpectators.begin();
+    end = mSpectators.end();
+    for(; cur != end; ++cur )
+    {
+        Spectator* spectator = *cur;
+        if( !spectator->joined() || spectator->stale() )
+            /* Waits for a snapshot. */
+            continue;
+        else if( spectator->backlog()
+                 && mQueueLimit < spectator->backlog()
+                    + GameProtocol::HEADER_SIZE + size )
+        {
+            /* Stop piling up frames he does not read. */
+            spectator->stall();
+            ++mNetStats.resyncs;
+            continue;
+        }
+
+        if( !msg )
+        {
+            msg = new Message;
+            std::vector<unsigned char>& data = msg->data();
+            data.resize( GameProtocol::HEADER_SIZE );
+            GameProtocol::putHeader( &data[0], mLast, size );
+            data.insert( data.end(), frame, frame + size );
+        }
+
+        spectator->push( msg );
+    }
+
+    /* The spectators hold their own references. */
+    if( msg )
+        msg->release();
+
+    return true;
+}
+
+void
+GameRelayModel::tickSockets()
+{
+    /* A single syscall, however many spectators there are. */
+    const int count = mReactor.wait( 0 );
+    for( int i = 0; i < count; ++i )
+    {
+        Spectator* spectator = (Spectator*)mReactor.data( i );
+        const unsigned int events = mReactor.events( i );
+
+        if( !spectator )
+            /* The listen socket. */
+            tickAccept();
+        else if( !spectator->wake( events ) )
+            /* So long, dont come back. */
+            drop( spectator );
+    }
+}
+
+void
+GameRelayModel::tickAccept()
+{
+    while( true )
+    {
+        /* Create a new socket if we do not have one. */
+        if( !mClientSocket )
+            mClientSocket = new Socket;
+
+        /* Try to accept a connection. */
+        ++mNetStats.accepts;
+        if( mSocket.accept( *mClientSocket, NULL, NULL,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC ) )
+            /* No new connections ... */
+            break;
+
+        /* Handle it. */
+        tickSpectatorConnected( mClientSocket );
+    }
+}
+
+void
+GameRelayModel::tickSpectatorConnected(
+    Socket*& sock
+    )
+{
+    /* Create a Spectator. */
+    Spectator* spectator = new Spectator( sock, mNetStats );
+
+    if( !spectator->watch( mReactor, spectator ) )
+    {
+        /* Strange, should not happen. */
+        safeDelete( spectator );
+        return;
+    }
+
+    /* He gets the frames once he says hello. */
+    mSpectators.push_back( spectator );
+}
+
+void
+GameRelayModel::tickFlush()
+{
+    std::list<Spectator*>::iterator cur, end;
+    cur = mSpectators.begin();
+    end = mSpectators.end();
+    while( cur != end )
+    {
+        Spectator* spectator = *cur;
+        if( spectator->joined() && spectator->stale() && spectator->ready() )
+            /* Start over from the map as we have it. */
+            spectator->sync( tickSnapshot() );
+
+        if( spectator->flush() )
+            ++cur;
+        else
+        {
+            /* So long, dont come back. */
+            safeDelete( spectator );
+            cur = mSpectators.erase( cur );
+        }
+    }
+}
+
+GameRelayModel::Message*
+GameRelayModel::tickSnapshot()
+{
+    if( !mSnapshot )
+    {
+        /* Of the last frame, until the next one comes. */
+        mSnapshot = new Message;
+        std::vector<unsigned char>& data = mSnapshot->data();
+        data.resize( GameProtocol::HEADER_SIZE );
+        GameProtocol::encodeSnapshot( mSize, mMap, data );
+        GameProtocol::putHeader( &data[0], mLast,
+                                 data.size() - GameProtocol::HEADER_SIZE );
+
+        ++mNetStats.snapshots;
+    }
+
+    return mSnapshot;
+}
+
+void
+GameRelayModel::drop(
+    Spectator* spectator
+    )
+{
+    mSpectators.remove( spectator );
+    /* Closing the socket removes it from the reactor. */
+    safeDelete( spectator );
+}
+
+/*************************************************************************/
+/* GameRelayModel::Spectator                                             */
+/*************************************************************************/
+GameRelayModel::Spectator::Spectator(
+    Socket*& sock,
+    NetStats& stats
+    )
+: StreamPeer( sock, stats.recvs, stats.sends, stats.bytesOut ),
+  mStale( true )
+{
+    /* Consume the socket. */
+    sock = NULL;
+}
+
+void
+GameRelayModel::Spectator::sync(
+    Message* snapshot
+    )
+{
+    push( snapshot );
+    mSyncedEnd = mPushed;
+    mStale = false;
+}
+
+void
+GameRelayModel::Spectator::stall()
+{
+    /* The snapshot replaces the frames queued. */
+    mQueue.drop();
+    mStale = true;
+}
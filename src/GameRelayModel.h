@@ -0,0 +1,257 @@
+/** @file
+ * @brief Declarations of a relay game model.
+ *
+ * @author Jan Bobek
+ */
+
+#ifndef __GAME_RELAY_MODEL_H__INCL__
+#define __GAME_RELAY_MODEL_H__INCL__
+
+#include "GameRemoteModel.h"
+#include "Reactor.h"
+#include "StreamPeer.h"
+
+/**
+ * @brief A relay game model.
+ *
+ * Subscribes to a server as a single client without players
+ * and passes the frames it gets on to any number of spectators,
+ * as they are. A spectator which joins, or falls behind, gets
+ * a snapshot of the map of the relay first; it is encoded once
+ * per frame, however many spectators need it. The spectators
+ * speak the protocol of the server, though only over a stream;
+ * whatever they send after the hello is ignored.
+ *
+ * @author Jan Bobek
+ */
+class GameRelayModel
+: public GameRemoteModel
+{
+public:
+    /**
+     * @brief Counts the network syscalls of the relay.
+     *
+     * @author Jan Bobek
+     */
+    struct NetStats
+    {
+        /// Calls to <code>accept4</code>.
+        unsigned long long accepts;
+        /// Calls to <code>recv</code>.
+        unsigned long long recvs;
+        /// Calls to <code>send</code>.
+        unsigned long long sends;
+        /// Frames received from the server.
+        unsigned long long frames;
+        /// Bytes sent to the spectators.
+        unsigned long long bytesOut;
+        /// Snapshots encoded for the spectators.
+        unsigned long long snapshots;
+        /// Spectators resynced by a snapshot after falling behind.
+        unsigned long long resyncs;
+    };
+
+    /**
+     * @brief Initializes the relay.
+     *
+     * @param[in] addr      Address of the server in the form
+     *                      of IP-NUL-port-NUL.
+     * @param[in] transport Stream or datagrams, to the server.
+     */
+    GameRelayModel( const char* addr,
+                    GameProtocol::Transport transport
+                    = GameProtocol::TRANSPORT_TCP );
+    /**
+     * @brief Closes sockets and other resources.
+     */
+    ~GameRelayModel();
+
+    /**
+     * @brief Connects to the server and opens the relay for spectators.
+     *
+     * Blocks until the first snapshot of the server is in.
+     *
+     * @param[in] addr Address to listen at in the form of IP-NUL-port-NUL.
+     *
+     * @retval true  Connected and listening.
+     * @retval false Failed to connect or to start listening.
+     */
+    bool open( const char* addr );
+    /**
+     * @brief Disconnects all spectators.
+     */
+    void close();
+
+    /**
+     * @brief Broadcasts an event, refusing players.
+     *
+     * The relay is read-only; a controller is deleted right away.
+     *
+     * @param[in] event The event to broadcast.
+     */
+    void dispatch( const GameModelEvent& event );
+
+    /**
+     * @brief Handles the sockets.
+     *
+     * Applies the frames of the server and passes them on,
+     * then accepts and reads the spectators and sends them
+     * whatever is queued.
+     *
+     * @retval true  The game continues.
+     * @retval false The game has ended.
+     */
+    bool tick();
+
+    /**
+     * @brief Limits the send queue of each spectator.
+     *
+     * A spectator falls behind when a frame would take its queue
+     * past the limit; the frames queued are dropped and a snapshot
+     * is sent once the queue drains.
+     *
+     * @param[in] bytes Most bytes queued for a spectator.
+     */
+    void setQueueLimit( unsigned int bytes ) { mQueueLimit = bytes; }
+
+    /**
+     * @brief Obtains the network syscall counters.
+     *
+     * @return The counters.
+     */
+    const NetStats& netStats() const { return mNetStats; }
+    /**
+     * @brief Obtains number of the spectators connected.
+     *
+     * @return The number.
+     */
+    unsigned int spectators() const { return mSpectators.size(); }
+
+protected:
+    /// An encoded message shared by the spectators.
+    typedef StreamPeer::Message Message;
+
+    /**
+     * @brief A connected spectator.
+     *
+     * Whatever it sends after the hello is thrown away.
+     *
+     * @author Jan Bobek
+     */
+    class Spectator
+    : public StreamPeer
+    {
+    public:
+        /**
+         * @brief Initializes the spectator.
+         *
+         * @param[in] sock  Socket of the spectator.
+         * @param[in] stats Where to count the syscalls.
+         */
+        Spectator( Socket*& sock, NetStats& stats );
+
+        /**
+         * @brief Has the spectator said hello?
+         *
+         * @retval true  The spectator gets the frames.
+         * @retval false The spectator is still connecting.
+         */
+        bool joined() const { return 0 != mVersion; }
+        /**
+         * @brief Does the spectator need a snapshot?
+         *
+         * @retval true  A frame is no use to the spectator.
+         * @retval false The spectator has all the frames sent.
+         */
+        bool stale() const { return mStale; }
+        /**
+         * @brief Is the spectator ready for a snapshot?
+         *
+         * @retval true  The send queue is drained.
+         * @retval false It would only pile up.
+         */
+        bool ready() const { return mQueue.empty(); }
+        /**
+         * @brief Queues a snapshot for the spectator.
+         *
+         * @param[in] snapshot The frame; a reference is taken.
+         */
+        void sync( Message* snapshot );
+        /**
+         * @brief Stops the frames until the spectator gets a snapshot.
+         */
+        void stall();
+
+    protected:
+        /**
+         * @brief A spectator only reads after the hello.
+         *
+         * @retval true Always.
+         */
+        bool readOnly() const { return true; }
+
+        /// Does the spectator need a snapshot?
+        bool mStale;
+    };
+
+    /**
+     * @brief Applies a frame of the server and passes it on.
+     *
+     * @retval true  The map is up to date.
+     * @retval false The frame is malformed.
+     */
+    bool dispatchFrame();
+
+    /**
+     * @brief Handles the sockets reported ready by the reactor.
+     */
+    void tickSockets();
+    /**
+     * @brief Accepts all pending connections.
+     */
+    void tickAccept();
+    /**
+     * @brief Handles a new spectator.
+     *
+     * @param[in] sock The socket of the spectator.
+     */
+    void tickSpectatorConnected( Socket*& sock );
+    /**
+     * @brief Sends the queued frames to all spectators.
+     *
+     * Those which need a snapshot get it once they drain
+     * their queues.
+     */
+    void tickFlush();
+    /**
+     * @brief Encodes a snapshot of the map, once per frame.
+     *
+     * @return The frame of the snapshot, no reference taken.
+     */
+    Message* tickSnapshot();
+    /**
+     * @brief Disconnects a spectator.
+     *
+     * @param[in] spectator The spectator.
+     */
+    void drop( Spectator* spectator );
+
+    /// Watches our sockets.
+    Reactor mReactor;
+    /// The network syscall counters.
+    NetStats mNetStats;
+    /// Our listen socket.
+    Socket mSocket;
+    /// Candidate spectator socket.
+    Socket* mClientSocket;
+    /// Our connected spectators.
+    std::list<Spectator*> mSpectators;
+    /// Most bytes queued for a spectator.
+    unsigned int mQueueLimit;
+    /// Tick of the last frame of the server.
+    unsigned int mLast;
+    /// The snapshot of the last frame; NULL until needed.
+    Message* mSnapshot;
+};
+
+#endif /* !__GAME_RELAY_MODEL_H__INCL__ */
@@ -5,6 +5,7 @@
  */
 
 #include "GameController.h"
+#include "GameLocalModel.h"
 #include "GameRemoteModel.h"
 #include "util.h"
 
@@ -12,9 +13,15 @@
 /* GameRemoteModel                                                       */
 /*************************************************************************/
 GameRemoteModel::GameRemoteModel(
-    const char* addr
+    const char* addr,
+    GameProtocol::Transport transport
     )
-: GameModel( GameCoord( 0, 0 ) )
+: GameModel( GameCoord( 0, 0 ) ),
+  mConnection( NULL ),
+  mChangedAll( false ),
+  mPrediction( true ),
+  mTransport( transport ),
+  mLoss( 0 )
 {
     unsigned int len = strlen( addr ) + 1;
     len += strlen( addr + len );
@@ -24,7 +31,9 @@ GameRemoteModel::GameRemoteModel(
 
 GameRemoteModel::~GameRemoteModel()
 {
-    std::list<GameRemoteCtlEntity*>::iterator cur, end;
+    safeDelete( mConnection );
+
+    std::vector<GameRemoteCtlEntity*>::iterator cur, end;
     cur = mEntities.begin();
     end = mEntities.end();
     for(; cur != end; ++cur )
@@ -45,30 +54,42 @@ GameRemoteModel::dispatch(
 bool
 GameRemoteModel::tick()
 {
-    std::list<GameRemoteCtlEntity*>::iterator cur, end;
-    cur = mEntities.begin();
-    end = mEntities.end();
-    while( cur != end )
+    /* The frames apply to the map of the server. */
+    tickUnpredict();
+
+    if( mConnection )
     {
-        /* Tick the entity. */
-        (*cur)->tick();
+        /* Tick the entities, all in a single send. */
+        mConnection->tick();
 
-        /* Pull all events. */
-        GameModelEvent event;
-        while( (*cur)->pop( event ) )
-            dispatch( event );
+        /* Read all there is, then apply all frames in one go. */
+        if( mConnection->receive() )
+            while( mConnection->pop() )
+                if( !dispatchFrame() )
+                {
+                    /* Malformed frame, cannot go on. */
+                    mConnection->setEndgame();
+                    break;
+                }
 
         /* Endgame? */
-        if( !(*cur)->endgame() )
-            ++cur;
-        else
-        {
-            safeDelete( *cur );
-            cur = mEntities.erase( cur );
-        }
+        if( mConnection->endgame() )
+            safeDelete( mConnection );
     }
 
-    return !mEntities.empty();
+    /* Replay what the server has not taken yet. */
+    if( mConnection && mPrediction )
+    {
+        std::vector<GameRemoteCtlEntity*>::const_iterator cur, end;
+        cur = mEntities.begin();
+        end = mEntities.end();
+        for(; cur != end; ++cur )
+            tickPredict( *cur );
+    }
+
+    /* Redraw it all at once. */
+    dispatchDirty();
+    return NULL != mConnection;
 }
 
 void
@@ -78,45 +99,214 @@ GameRemoteModel::dispatchEntityAdded(
 {
     /* Create a new entity. */
     GameRemoteCtlEntity* ent = new GameRemoteCtlEntity( ctl );
-    /* Try to connect to the server. */
-    if( !ent->open( mAddr.c_str() ) )
+    if( GAME_NET_CHANNELS <= mEntities.size()
+        || (!mConnection && !dispatchConnect()) )
     {
         /* Failed ... */
         safeDelete( ent );
         return;
     }
 
-    /* It is now still in blocking mode. Pop the first update. */
-    GameModelEvent event;
-    if( !ent->pop( event ) )
+    /* Welcome home; the server adds it once it hears of it. */
+    mEntities.push_back( ent );
+}
+
+bool
+GameRemoteModel::dispatchConnect()
+{
+    /* Try to connect to the server. */
+    mConnection = new GameRemoteConnection( mEntities, mTransport, mLoss );
+    if( !mConnection->open( mAddr.c_str() ) )
     {
         /* Failed ... */
-        safeDelete( ent );
-        return;
+        safeDelete( mConnection );
+        return false;
     }
 
-    assert( GENT_NONE == event.entity );
-    if( mSize.row || mSize.col )
-        assert( mSize == event.coords.second );
-    else
+    /* The snapshot replaces the map of the server. */
+    tickUnpredict();
+
+    /* It is now still in blocking mode. Wait for the snapshot. */
+    bool popped;
+    while( !(popped = mConnection->pop()) && mConnection->receive() );
+
+    if( !popped || !dispatchFrame()
+        /* Now set nonblock. */
+        || !mConnection->setNonblock() )
     {
-        /* We need to create a new map. */
-        safeDeleteArray( mMap );
+        /* Failed ... */
+        safeDelete( mConnection );
+        return false;
+    }
+
+    return true;
+}
+
+bool
+GameRemoteModel::dispatchFrame()
+{
+    const unsigned char* cur = mConnection->frame();
+    const unsigned char* end = cur + mConnection->frameSize();
+    while( cur != end )
+    {
+        GameProtocol::Record record;
+        if( !GameProtocol::getRecord( cur, end, record ) )
+            return false;
+
+        if( GameProtocol::RECORD_SNAPSHOT == record )
+        {
+            GameCoord size;
+            if( !GameProtocol::decodeSize( cur, end, size ) )
+                return false;
+
+            if( mSize != size )
+            {
+                /* We need to create a new map. */
+                safeDeleteArray( mMap );
+
+                mSize = size;
+                mMap = safeAllocArray<GameEntity>( mSize.row * mSize.col );
+            }
 
-        mSize = event.coords.second;
-        mMap = safeAllocArray<GameEntity>( mSize.row * mSize.col );
+            /* Straight into the map. */
+            if( !GameProtocol::decodeSnapshot(
+                    cur, end, mMap, mSize.row * mSize.col ) )
+                return false;
+
+            /* Redraw it whole. */
+            mChangedAll = true;
+        }
+        else if( GameProtocol::RECORD_DIFF == record )
+        {
+            /* Straight into the map, too. */
+            if( !GameProtocol::decodeDiff(
+                    cur, end, mMap, mSize.row * mSize.col, mChanged ) )
+                return false;
+        }
+        else
+        {
+            GameProtocol::Player player;
+            if( !GameProtocol::decodePlayer( cur, end, player )
+                || mEntities.size() <= player.channel
+                || (player.alive && (mSize.row <= player.pos.row
+                                     || mSize.col <= player.pos.col)) )
+                return false;
+
+            mEntities[player.channel]->setPlayer( player );
+        }
     }
 
-    /* Now set nonblock. */
-    if( !ent->setNonblock() )
+    return true;
+}
+
+void
+GameRemoteModel::dispatchDirty()
+{
+    if( mChangedAll )
     {
-        /* Failed ... */
-        safeDelete( ent );
+        if( mSize.row && mSize.col )
+            mDirty.push( GameCoordRect(
+                GameCoord( 0, 0 ),
+                GameCoord( mSize.row - 1, mSize.col - 1 ) ) );
+    }
+    else
+    {
+        /* Each tile once, in the order of the map. */
+        std::sort( mChanged.begin(), mChanged.end() );
+        mChanged.erase( std::unique( mChanged.begin(), mChanged.end() ),
+                        mChanged.end() );
+
+        std::vector<unsigned int>::const_iterator cur, end, run;
+        cur = mChanged.begin();
+        end = mChanged.end();
+        while( cur != end )
+        {
+            /* A run of adjacent tiles within a row. */
+            run = cur;
+            while( ++cur != end && *cur == *(cur - 1) + 1
+                   && *cur % mSize.col );
+
+            const GameCoord first( *run / mSize.col, *run % mSize.col );
+            const GameCoord last( first.row, first.col + (cur - run) - 1 );
+            mDirty.push( GameCoordRect( first, last ) );
+        }
+    }
+
+    mChanged.clear();
+    mChangedAll = false;
+}
+
+void
+GameRemoteModel::tickPredict(
+    const GameRemoteCtlEntity* ent
+    )
+{
+    const GameProtocol::Player* player = ent->player();
+    if( !player || !player->alive )
+        /* Nothing to move. */
         return;
+
+    GameCoord pos = player->pos;
+    unsigned int nextmove = player->nextmove;
+
+    /* The server takes an event each tick, so do we. */
+    std::deque<GameCtlEvent>::const_iterator cur, end;
+    cur = ent->pending().begin();
+    end = ent->pending().end();
+    for(; cur != end; ++cur )
+    {
+        if( !nextmove && GCE_MOVEUP <= *cur && *cur <= GCE_MOVERIGHT )
+        {
+            const char* step = GameLocalModel::GAME_MOVES[*cur - GCE_MOVEUP];
+            const GameCoord newpos( pos.row + step[0], pos.col + step[1] );
+
+            /* Anything but a free tile is up to the server. */
+            if( newpos.row < mSize.row && newpos.col < mSize.col
+                && GINT_OK == GameLocalModel::GAME_INTERACTIONS
+                       [GENT_PLAYER][at( newpos )] )
+            {
+                tickPredictTile( newpos, GENT_PLAYER );
+                tickPredictTile( pos, GENT_NONE );
+
+                pos = newpos;
+                nextmove = player->speed;
+            }
+        }
+
+        /* Tick the move timer. */
+        if( 0 < nextmove )
+            --nextmove;
+    }
+}
+
+void
+GameRemoteModel::tickPredictTile(
+    const GameCoord& pos,
+    GameEntity entity
+    )
+{
+    const unsigned int idx = pos.row * mSize.col + pos.col;
+    mPredicted.push_back( std::make_pair( idx, mMap[idx] ) );
+
+    mMap[idx] = entity;
+    mChanged.push_back( idx );
+}
+
+void
+GameRemoteModel::tickUnpredict()
+{
+    /* Newest first, the oldest holds what the server sent. */
+    std::vector< std::pair<unsigned int, GameEntity> >::reverse_iterator
+        cur, end;
+    cur = mPredicted.rbegin();
+    end = mPredicted.rend();
+    for(; cur != end; ++cur )
+    {
+        mMap[cur->first] = cur->second;
+        mChanged.push_back( cur->first );
     }
 
-    /* Welcome home. */
-    mEntities.push_back( ent );
+    mPredicted.clear();
 }
 
 /*************************************************************************/
@@ -126,7 +316,8 @@ GameRemoteModel::GameRemoteCtlEntity::GameRemoteCtlEntity(
     GameController* ctl
     )
 : mCtl( ctl ),
-  mEndgame( false )
+  mSent( 0 ),
+  mPlayerKnown( false )
 {
 }
 
@@ -135,8 +326,65 @@ GameRemoteModel::GameRemoteCtlEntity::~GameRemoteCtlEntity()
     safeDelete( mCtl );
 }
 
+void
+GameRemoteModel::GameRemoteCtlEntity::tick(
+    GameCtlEvent& event
+    )
+{
+    mCtl->tick( event );
+
+    /* Even a GCE_NOOP, the server takes one each tick. */
+    mPending.push_back( event );
+    ++mSent;
+}
+
+void
+GameRemoteModel::GameRemoteCtlEntity::setPlayer(
+    const GameProtocol::Player& player
+    )
+{
+    mPlayer = player;
+    mPlayerKnown = true;
+
+    /* Keep only what the server has not taken. */
+    const unsigned int ahead = mSent - player.taken;
+    while( ahead < mPending.size() )
+        mPending.pop_front();
+}
+
+/*************************************************************************/
+/* GameRemoteModel::GameRemoteConnection                                 */
+/*************************************************************************/
+GameRemoteModel::GameRemoteConnection::GameRemoteConnection(
+    const std::vector<GameRemoteCtlEntity*>& entities,
+    GameProtocol::Transport transport,
+    unsigned int loss
+    )
+: mEntities( entities ),
+  mTransport( transport ),
+  mLoss( loss ),
+  mLossSeed( 1 ),
+  mReliable( GAME_NET_DATAGRAM_BYTES - GameProtocol::FRAGMENT_HEAD_SIZE,
+             GAME_NET_WINDOW, GAME_NET_RESEND_TICKS ),
+  mReceived( 0 ),
+  mLast( 0 ),
+  mSynced( false ),
+  mQuiet( 0 ),
+  mVersion( 0 ),
+  mInput( GAME_NET_RECV_BYTES ),
+  mInputLen( 0 ),
+  mInputPos( 0 ),
+  mFramePos( 0 ),
+  mFrameSize( 0 ),
+  mPopped( 0 ),
+  mAcked( 0 ),
+  mTick( 0 ),
+  mEndgame( false )
+{
+}
+
 bool
-GameRemoteModel::GameRemoteCtlEntity::open(
+GameRemoteModel::GameRemoteConnection::open(
     const char* addr
     )
 {
@@ -144,6 +392,7 @@ GameRemoteModel::GameRemoteCtlEntity::open(
     addrinfo* ai = NULL, hints;
     unsigned int reuse_addr = 1;
     unsigned int bufsize = 64 * 1024;
+    const bool udp = GameProtocol::TRANSPORT_UDP == mTransport;
 
     /* Extract the parts. */
     const char* name = addr;
@@ -154,8 +403,8 @@ GameRemoteModel::GameRemoteCtlEntity::open(
     /* Setup some flags. */
     hints.ai_flags = AI_NUMERICHOST
         | AI_NUMERICSERV | AI_ADDRCONFIG;
-    /* We want stream socket. */
-    hints.ai_socktype = SOCK_STREAM;
+    /* We want stream socket, or datagrams. */
+    hints.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM;
 
     if(
         /* Translate the name. */
@@ -180,40 +429,287 @@ GameRemoteModel::GameRemoteCtlEntity::open(
 
     /* Do not forget to release the addrinfo. */
     safeRelease( ai, freeaddrinfo );
-    return true;
+
+    /* Say hello, still blocking. */
+    std::vector<unsigned char> hello;
+    GameProtocol::putHello( hello, GameProtocol::VERSION );
+    if( udp )
+        return openDatagram( hello );
+    else if( hello.size() != (unsigned int)mSocket.send(
+            &hello[0], hello.size(), MSG_NOSIGNAL )
+        || hello.size() != (unsigned int)mSocket.recv(
+            &hello[0], hello.size(), MSG_WAITALL )
+        || !GameProtocol::getHello( &hello[0], mVersion ) )
+        return false;
+
+    /* The server speaks no version we do. */
+    return 0 < mVersion && mVersion <= GameProtocol::VERSION;
+}
+
+bool
+GameRemoteModel::GameRemoteConnection::openDatagram(
+    std::vector<unsigned char>& hello
+    )
+{
+    /* Wait a tick for anything, from now on. */
+    timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 1000000 / GAME_TICKS_PER_SEC;
+    if( mSocket.setopt( SOL_SOCKET, SO_RCVTIMEO,
+                        &timeout, sizeof( timeout ) ) )
+        return false;
+
+    unsigned char reply[GAME_NET_DATAGRAM_BYTES];
+    bool replied = false;
+    for( unsigned int i = 0; !replied && i < GAME_NET_TIMEOUT_TICKS; ++i )
+    {
+        /* Either of the two may get lost. */
+        mSocket.send( &hello[0], hello.size(), MSG_NOSIGNAL );
+
+        /* Whatever else comes first is sent again. */
+        const int code = mSocket.recv( reply, sizeof( reply ), 0 );
+        replied = GameProtocol::HELLO_SIZE == (unsigned int)code
+            && GameProtocol::getHello( reply, mVersion );
+    }
+
+    /* The server speaks no version we do. */
+    return replied && 0 < mVersion && mVersion <= GameProtocol::VERSION;
 }
 
 bool
-GameRemoteModel::GameRemoteCtlEntity::setNonblock()
+GameRemoteModel::GameRemoteConnection::setNonblock()
 {
     return !mSocket.fcntl( F_SETFL, O_NONBLOCK );
 }
 
 bool
-GameRemoteModel::GameRemoteCtlEntity::pop(
-    GameModelEvent& event
+GameRemoteModel::GameRemoteConnection::receive()
+{
+    /* Keep what has not been popped, up front. */
+    mInputLen -= mInputPos;
+    memmove( &mInput[0], &mInput[mInputPos], mInputLen );
+    mInputPos = mFramePos = mFrameSize = 0;
+
+    if( GameProtocol::TRANSPORT_UDP == mTransport )
+        return receiveDatagrams();
+
+    while( true )
+    {
+        /* Room for a bulk read, straight behind the rest. */
+        if( mInput.size() < mInputLen + GAME_NET_RECV_BYTES )
+            mInput.resize( mInputLen + GAME_NET_RECV_BYTES );
+
+        const int code = mSocket.recv(
+            &mInput[mInputLen], mInput.size() - mInputLen, 0 );
+        if( 0 < code )
+        {
+            mInputLen += code;
+            if( mInput.size() > mInputLen )
+                /* Short read, the socket is empty. */
+                return true;
+        }
+        else if( !code )
+        {
+            /* The server is gone. */
+            mEndgame = true;
+            return false;
+        }
+        else if( EAGAIN == errno || EWOULDBLOCK == errno )
+            return true;
+        else if( EINTR != errno )
+            /* Something's fucked up. */
+            return false;
+    }
+}
+
+bool
+GameRemoteModel::GameRemoteConnection::receiveDatagrams()
+{
+    unsigned char buf[GAME_NET_DATAGRAM_BYTES];
+    bool heard = false;
+    while( true )
+    {
+        /* Only the first may block. */
+        const int code = mSocket.recv(
+            buf, sizeof( buf ), heard ? MSG_DONTWAIT : 0 );
+        if( 0 <= code )
+        {
+            heard = true;
+            receiveDatagram( buf, code );
+        }
+        else if( EINTR != errno )
+            /* Empty, or refused; the silence tells. */
+            break;
+    }
+
+    if( heard )
+        mQuiet = 0;
+    else if( GAME_NET_TIMEOUT_TICKS < ++mQuiet )
+    {
+        /* The server is gone. */
+        mEndgame = true;
+        return false;
+    }
+
+    /* Do not let him resend the fragments in vain. */
+    if( mReceived != mReliable.received() )
+        sendInput();
+    return true;
+}
+
+void
+GameRemoteModel::GameRemoteConnection::receiveDatagram(
+    const unsigned char* buf,
+    unsigned int len
     )
 {
-    int code = mSocket.recv( &event, sizeof( event ), 0 );
-    if( code <= 0 )
+    unsigned int seq, base, tick, size;
+    bool last;
+
+    if( GameProtocol::getFragment( buf, len, seq, last ) )
+    {
+        if( !mReliable.receive( seq, last,
+                                buf + GameProtocol::FRAGMENT_HEAD_SIZE,
+                                len - GameProtocol::FRAGMENT_HEAD_SIZE ) )
+            return;
+
+        /* A snapshot, or a diff too big for a datagram, whole. */
+        const std::vector<unsigned char>& msg = mReliable.message();
+        if( msg.size() < GameProtocol::HEADER_SIZE )
+            return;
+
+        GameProtocol::getHeader( &msg[0], tick, size );
+        if( msg.size() - GameProtocol::HEADER_SIZE == size
+            && (!mSynced || 0 <= (int)(tick - mLast)) )
+        {
+            receiveFrame( &msg[0], msg.size() );
+            mSynced = true;
+        }
+    }
+    else if( GameProtocol::getFrameHead( buf, len, base ) )
     {
-        mEndgame = !code;
+        /* Newer than the map, against a frame we have. */
+        GameProtocol::getHeader(
+            buf + GameProtocol::FRAME_HEAD_SIZE, tick, size );
+        if( mSynced && 0 < (int)(tick - mLast) && (int)(base - mLast) <= 0 )
+            receiveFrame( buf + GameProtocol::FRAME_HEAD_SIZE,
+                          len - GameProtocol::FRAME_HEAD_SIZE );
+    }
+    /* The rest are hello replies sent again; no matter. */
+}
+
+void
+GameRemoteModel::GameRemoteConnection::receiveFrame(
+    const unsigned char* frame,
+    unsigned int len
+    )
+{
+    if( mInput.size() < mInputLen + len )
+        mInput.resize( mInputLen + len );
+
+    memcpy( &mInput[mInputLen], frame, len );
+    mInputLen += len;
+
+    unsigned int size;
+    GameProtocol::getHeader( frame, mLast, size );
+}
+
+bool
+GameRemoteModel::GameRemoteConnection::pop()
+{
+    /* A whole frame buffered? */
+    const unsigned int avail = mInputLen - mInputPos;
+    if( avail < GameProtocol::HEADER_SIZE )
         return false;
+
+    unsigned int tick, size;
+    GameProtocol::getHeader( &mInput[mInputPos], tick, size );
+    if( avail - GameProtocol::HEADER_SIZE < size )
+        return false;
+
+    /* Frames come in order, though not each tick. */
+    assert( mPopped <= tick );
+    mPopped = tick;
+    mFramePos = mInputPos + GameProtocol::HEADER_SIZE;
+    mFrameSize = size;
+    mInputPos = mFramePos + size;
+    return true;
+}
+
+void
+GameRemoteModel::GameRemoteConnection::tick()
+{
+    /* An event of each entity, by the channels. */
+    ++mTick;
+    mEvents.resize( mEntities.size() );
+    for( unsigned int i = 0; i < mEntities.size(); ++i )
+        mEntities[i]->tick( mEvents[i] );
+
+    if( GameProtocol::TRANSPORT_UDP == mTransport )
+    {
+        /* Each tick, whether acknowledged or not. */
+        sendInput();
+        return;
     }
-    else if( sizeof( event ) != code )
-        /* Incomplete event received */
-        abort();
-    else
-        return true;
+
+    /* A single send for all, behind what the socket has not taken. */
+    if( mAcked != mPopped )
+    {
+        GameProtocol::putAck( mOutput, mPopped );
+        mAcked = mPopped;
+    }
+    GameProtocol::putControls( mOutput, mTick, mEvents );
+
+    flush();
+}
+
+bool
+GameRemoteModel::GameRemoteConnection::flush()
+{
+    while( !mOutput.empty() )
+    {
+        int code = mSocket.send( &mOutput[0], mOutput.size(), MSG_NOSIGNAL );
+
+        if( 0 <= code )
+            /* Sent "code" bytes. */
+            mOutput.erase( mOutput.begin(), mOutput.begin() + code );
+        else if( EAGAIN == errno || EWOULDBLOCK == errno )
+            /* The rest goes with the next tick. */
+            break;
+        else if( EINTR != errno )
+        {
+            /* Something's fucked up. */
+            mEndgame = true;
+            return false;
+        }
+    }
+
+    return true;
 }
 
 void
-GameRemoteModel::GameRemoteCtlEntity::tick()
+GameRemoteModel::GameRemoteConnection::sendInput()
 {
-    GameCtlEvent event;
-    mCtl->tick( event );
+    mOutput.clear();
+    GameProtocol::putInput( mOutput, mPopped, mReliable.received(),
+                            mTick, mEntities.size() );
+
+    std::vector<GameRemoteCtlEntity*>::const_iterator cur, end;
+    cur = mEntities.begin();
+    end = mEntities.end();
+    for(; cur != end; ++cur )
+    {
+        /* The latest events; the server picks those it lacks. */
+        const std::deque<GameCtlEvent>& pending = (*cur)->pending();
+        const unsigned int count =
+            std::min<size_t>( GAME_NET_INPUT_REPEAT, pending.size() );
+
+        GameProtocol::putInputChannel( mOutput, (*cur)->sent(),
+                                       pending.end() - count, pending.end() );
+    }
+    mAcked = mPopped;
+    mReceived = mReliable.received();
 
-    if( GCE_NOOP != event )
-        mSocket.send( &event, sizeof( event ),
-                      MSG_NOSIGNAL );
+    if( !GameProtocol::lose( mLossSeed, mLoss ) )
+        mSocket.send( &mOutput[0], mOutput.size(), MSG_NOSIGNAL );
 }
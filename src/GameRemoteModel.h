@@ -8,11 +8,22 @@
 #define __GAME_REMOTE_MODEL_H__INCL__
 
 #include "GameModel.h"
+#include "GameProtocol.h"
+#include "ReliableChannel.h"
 #include "Socket.h"
 
 /**
  * @brief A remote game model.
  *
+ * The moves of our players show up right away: the map
+ * drawn is the one of the server, with the control events
+ * it has not taken yet replayed on top of it.
+ *
+ * Over datagrams, a frame is applied if it is newer than the map
+ * and its diff is against a frame we have; the rest is covered by
+ * the next one, which the server diffs against the last frame
+ * we have acknowledged.
+ *
  * @author Jan Bobek
  */
 class GameRemoteModel
@@ -22,9 +33,12 @@ public:
     /**
      * @brief Initializes the remote model.
      *
-     * @param[in] addr Address in the form of IP-NUL-port-NUL.
+     * @param[in] addr      Address in the form of IP-NUL-port-NUL.
+     * @param[in] transport Stream or datagrams.
      */
-    GameRemoteModel( const char* addr );
+    GameRemoteModel( const char* addr,
+                     GameProtocol::Transport transport
+                     = GameProtocol::TRANSPORT_TCP );
     /**
      * @brief Releases all remote entities.
      */
@@ -45,10 +59,27 @@ public:
      */
     bool tick();
 
+    /**
+     * @brief Shows the moves of our players before the server does.
+     *
+     * @param[in] enable Predict the moves?
+     */
+    void setPrediction( bool enable ) { mPrediction = enable; }
+    /**
+     * @brief Loses some of the input datagrams, for testing.
+     *
+     * Applies if set before the first entity is added.
+     *
+     * @param[in] percent How many % to lose.
+     */
+    void setLoss( unsigned int percent ) { mLoss = percent; }
+
 protected:
     /**
      * @brief A remote controlled entity.
      *
+     * A local player, with a channel of its own on the connection.
+     *
      * @author Jan Bobek
      */
     class GameRemoteCtlEntity
@@ -65,6 +96,84 @@ protected:
          */
         ~GameRemoteCtlEntity();
 
+        /**
+         * @brief Ticks this entity.
+         *
+         * Gets a control event from the controller and notes
+         * it as pending.
+         *
+         * @param[out] event The control event to send.
+         */
+        void tick( GameCtlEvent& event );
+        /**
+         * @brief Obtains number of the control events ever sent.
+         *
+         * @return The number.
+         */
+        unsigned int sent() const { return mSent; }
+
+        /**
+         * @brief Obtains the player as of the last frame.
+         *
+         * @return The player; NULL until the server tells.
+         */
+        const GameProtocol::Player* player() const
+        {
+            return mPlayerKnown ? &mPlayer : NULL;
+        }
+        /**
+         * @brief Notes the player sent by the server.
+         *
+         * Forgets the control events the server has taken.
+         *
+         * @param[in] player The player.
+         */
+        void setPlayer( const GameProtocol::Player& player );
+        /**
+         * @brief Obtains the control events not taken yet.
+         *
+         * @return The events, the oldest first.
+         */
+        const std::deque<GameCtlEvent>& pending() const
+        {
+            return mPending;
+        }
+
+    protected:
+        /// Associated controller.
+        GameController* mCtl;
+        /// Number of the control events ever sent.
+        unsigned int mSent;
+        /// The control events sent, not taken yet.
+        std::deque<GameCtlEvent> mPending;
+        /// The player as of the last frame.
+        GameProtocol::Player mPlayer;
+        /// Has the server told us about the player?
+        bool mPlayerKnown;
+    };
+
+    /**
+     * @brief A connection to the server.
+     *
+     * Carries the map once for all of our entities, and their
+     * control events, each on the channel of its position.
+     *
+     * @author Jan Bobek
+     */
+    class GameRemoteConnection
+    {
+    public:
+        /**
+         * @brief Initializes the connection.
+         *
+         * @param[in] entities  The entities, by their channels.
+         * @param[in] transport Stream or datagrams.
+         * @param[in] loss      How many % of the inputs to lose.
+         */
+        GameRemoteConnection(
+            const std::vector<GameRemoteCtlEntity*>& entities,
+            GameProtocol::Transport transport, unsigned int loss );
+
         /**
          * @brief Obtains the endgame flag.
          *
@@ -72,15 +181,31 @@ protected:
          * @retval false The game has not ended yet.
          */
         bool endgame() const { return mEndgame; }
+        /**
+         * @brief Ends the game of the connection.
+         */
+        void setEndgame() { mEndgame = true; }
         /**
          * @brief Opens a connection to a server.
          *
+         * Says hello and waits for the reply; over datagrams,
+         * a few times if need be.
+         *
          * @param[in] addr Address in the form of IP-NUL-port-NUL.
          *
          * @retval true  Connection established.
          * @retval false Connection failed.
          */
         bool open( const char* addr );
+        /**
+         * @brief Says hello over datagrams.
+         *
+         * @param[in] hello The hello to send.
+         *
+         * @retval true  The server has replied.
+         * @retval false No reply, or a refusal.
+         */
+        bool openDatagram( std::vector<unsigned char>& hello );
         /**
          * @brief Sets the socket non-blocking.
          *
@@ -90,27 +215,139 @@ protected:
         bool setNonblock();
 
         /**
-         * @brief Pop a game model event from the socket.
+         * @brief Reads everything the server has sent.
          *
-         * @param[out] event The popped event.
+         * Reads GAME_NET_RECV_BYTES at a time, until a short read;
+         * blocks for the first read in blocking mode. Over datagrams,
+         * blocks for a tick at most and the frames which fit go
+         * to the buffer.
          *
-         * @retval true  An event was popped.
-         * @retval false No event available.
+         * @retval true  Read ok.
+         * @retval false The connection is over; see endgame().
          */
-        bool pop( GameModelEvent& event );
+        bool receive();
         /**
-         * @brief Ticks this entity.
+         * @brief Reads all datagrams the server has sent.
          *
-         * Gets a control event from the controller and
-         * sticks it to the socket.
+         * @retval true  Read ok.
+         * @retval false The server has been silent for too long.
+         */
+        bool receiveDatagrams();
+        /**
+         * @brief Pops a frame read by receive().
+         *
+         * The frame is acknowledged by the next tick().
+         *
+         * @retval true  A whole frame is in, see frame().
+         * @retval false No whole frame is buffered.
+         */
+        bool pop();
+        /**
+         * @brief Obtains the records of the popped frame.
+         *
+         * Valid until the next receive().
+         *
+         * @return The records; NULL if there are none.
+         */
+        const unsigned char* frame() const
+        {
+            return mFrameSize ? &mInput[mFramePos] : NULL;
+        }
+        /**
+         * @brief Obtains size of the records of the popped frame.
+         *
+         * @return Size of the records.
+         */
+        unsigned int frameSize() const { return mFrameSize; }
+        /**
+         * @brief Obtains the tick of the popped frame.
+         *
+         * @return Number of the tick.
+         */
+        unsigned int popped() const { return mPopped; }
+        /**
+         * @brief Ticks the entities.
+         *
+         * Sticks a control event of each entity to the socket,
+         * along with an acknowledgement of the frames popped
+         * since the last tick.
          */
         void tick();
+        /**
+         * @brief Sends as much of the output as the socket takes.
+         *
+         * The rest stays buffered for the next tick, so that
+         * the server never gets half of a message.
+         *
+         * @retval true  Send ok, or the socket is full.
+         * @retval false Send failed; see endgame().
+         */
+        bool flush();
+        /**
+         * @brief Sends an input datagram.
+         *
+         * Acknowledges the frames popped and the fragments received,
+         * and repeats the latest control events in case some were lost.
+         */
+        void sendInput();
+        /**
+         * @brief Handles a datagram received.
+         *
+         * @param[in] buf The datagram.
+         * @param[in] len Size of the datagram.
+         */
+        void receiveDatagram( const unsigned char* buf, unsigned int len );
+        /**
+         * @brief Buffers a frame received, to pop.
+         *
+         * @param[in] frame The frame, header included.
+         * @param[in] len   Size of the frame.
+         */
+        void receiveFrame( const unsigned char* frame, unsigned int len );
 
     protected:
-        /// Associated controller.
-        GameController* mCtl;
+        /// The entities, by their channels.
+        const std::vector<GameRemoteCtlEntity*>& mEntities;
         /// Our socket.
         Socket mSocket;
+        /// Stream or datagrams.
+        GameProtocol::Transport mTransport;
+        /// How many % of the inputs to lose.
+        unsigned int mLoss;
+        /// State of the loss generator.
+        unsigned int mLossSeed;
+        /// The snapshots, over datagrams.
+        ReliableChannel mReliable;
+        /// The fragments acknowledged.
+        unsigned int mReceived;
+        /// Tick of the newest frame buffered, over datagrams.
+        unsigned int mLast;
+        /// Has a snapshot been buffered yet?
+        bool mSynced;
+        /// Ticks no datagram has come for.
+        unsigned int mQuiet;
+        /// Version of the protocol spoken.
+        unsigned char mVersion;
+        /// The receive buffer.
+        std::vector<unsigned char> mInput;
+        /// Bytes of the receive buffer filled.
+        unsigned int mInputLen;
+        /// Bytes of the receive buffer popped.
+        unsigned int mInputPos;
+        /// Where the records of the popped frame start.
+        unsigned int mFramePos;
+        /// Size of the records of the popped frame.
+        unsigned int mFrameSize;
+        /// Tick of the last frame popped.
+        unsigned int mPopped;
+        /// The last tick acknowledged.
+        unsigned int mAcked;
+        /// Number of the calls to tick(); stamps the control events.
+        unsigned int mTick;
+        /// The control events of the tick, by channels.
+        std::vector<GameCtlEvent> mEvents;
+        /// The messages not sent yet; a datagram being encoded over UDP.
+        std::vector<unsigned char> mOutput;
         /// An endgame flag.
         bool mEndgame;
     };
@@ -118,12 +355,75 @@ protected:
     /**
      * @brief Handles initalization of a new entity.
      *
+     * The first one connects to the server, the rest
+     * share the connection.
+     *
      * @param[in] ctl Controller of the entity.
      */
     void dispatchEntityAdded( GameController* ctl );
+    /**
+     * @brief Connects to the server and waits for the map.
+     *
+     * @retval true  Connected, the map is in.
+     * @retval false Failed to connect.
+     */
+    bool dispatchConnect();
+    /**
+     * @brief Applies the records of a popped frame.
+     *
+     * The map is updated right away, the tiles to redraw
+     * are only noted for dispatchDirty().
+     *
+     * @retval true  The map is up to date.
+     * @retval false The frame is malformed.
+     */
+    virtual bool dispatchFrame();
+    /**
+     * @brief Marks the tiles changed by the frames dirty.
+     *
+     * Each tile once, adjacent tiles of a row as a single region.
+     */
+    void dispatchDirty();
+
+    /**
+     * @brief Replays the pending moves of an entity on the map.
+     *
+     * Only the moves to free tiles are predicted, the rest
+     * is left to the server.
+     *
+     * @param[in] ent The entity.
+     */
+    void tickPredict( const GameRemoteCtlEntity* ent );
+    /**
+     * @brief Changes a tile by a prediction.
+     *
+     * @param[in] pos    Position of the tile.
+     * @param[in] entity The entity to put there.
+     */
+    void tickPredictTile( const GameCoord& pos, GameEntity entity );
+    /**
+     * @brief Takes all the predictions back.
+     *
+     * The map is then the one of the server again.
+     */
+    void tickUnpredict();
 
-    /// Our entities.
-    std::list<GameRemoteCtlEntity*> mEntities;
+    /// Our entities, by their channels.
+    std::vector<GameRemoteCtlEntity*> mEntities;
+    /// The connection; NULL until the first entity.
+    GameRemoteConnection* mConnection;
+    /// Indices of the tiles changed by the frames; may repeat.
+    std::vector<unsigned int> mChanged;
+    /// Has a frame replaced the whole map?
+    bool mChangedAll;
+    /// The tiles changed by predictions, with what was there before.
+    std::vector< std::pair<unsigned int, GameEntity> > mPredicted;
+    /// Shall we predict the moves?
+    bool mPrediction;
+    /// Stream or datagrams.
+    GameProtocol::Transport mTransport;
+    /// How many % of the inputs to lose.
+    unsigned int mLoss;
     /// Address of the server.
     std::string mAddr;
 };
@@ -14,8 +14,17 @@ GameServerModel::GameServerModel(
     const GameCoord& size
     )
 : GameLocalModel( size ),
-  mClientSocket( NULL )
+  mTransport( GameProtocol::TRANSPORT_TCP ),
+  mClientSocket( NULL ),
+  mQueueLimit( GAME_NET_QUEUE_BYTES ),
+  mOverflow( OVERFLOW_RESYNC ),
+  mJitter( GAME_NET_JITTER_TICKS ),
+  mSent( size.row * size.col, GENT_NONE ),
+  mLoss( 0 ),
+  mLossSeed( 1 ),
+  mClock( 0 )
 {
+    memset( &mNetStats, 0, sizeof( mNetStats ) );
 }
 
 GameServerModel::~GameServerModel()
@@ -26,12 +35,16 @@ GameServerModel::~GameServerModel()
 
 bool
 GameServerModel::open(
-    const char* addr
+    const char* addr,
+    GameProtocol::Transport transport
     )
 {
     /* Some variables. */
     addrinfo* ai = NULL, hints;
     unsigned int reuse_addr = 1;
+    /* Shared by all datagram clients. */
+    unsigned int bufsize = 1024 * 1024;
+    const bool udp = GameProtocol::TRANSPORT_UDP == transport;
 
     /* Extract the parts. */
     const char* name = addr;
@@ -42,24 +55,29 @@ GameServerModel::open(
     /* Setup some flags. */
     hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST
         | AI_NUMERICSERV | AI_ADDRCONFIG;
-    /* We want stream socket. */
-    hints.ai_socktype = SOCK_STREAM;
+    /* We want stream socket, or datagrams. */
+    hints.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM;
 
     if(
         /* Translate the name. */
         getaddrinfo( name, serv, &hints, &ai ) || !ai ||
-        /* Use the first address. */
+        /* Use the first address, non-blocking from the start. */
         mSocket.create(
-            ai->ai_family, ai->ai_socktype, ai->ai_protocol ) ||
+            ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            ai->ai_protocol ) ||
         /* Allow reuse addr. */
         mSocket.setopt( SOL_SOCKET, SO_REUSEADDR,
                         &reuse_addr, sizeof( reuse_addr ) ) ||
         /* Bind to the address. */
         mSocket.bind( ai->ai_addr, ai->ai_addrlen ) ||
-        /* Setup non-block. */
-        mSocket.fcntl( F_SETFL, O_NONBLOCK ) ||
-        /* Start listening. */
-        mSocket.listen()
+        /* Start listening, or make room for the datagrams. */
+        (udp ? mSocket.setopt( SOL_SOCKET, SO_RCVBUF,
+                               &bufsize, sizeof( bufsize ) ) ||
+               mSocket.setopt( SOL_SOCKET, SO_SNDBUF,
+                               &bufsize, sizeof( bufsize ) )
+         : mSocket.listen()) ||
+        /* Wake up on new connections or datagrams. */
+        mReactor.add( mSocket.fd(), EPOLLIN, NULL )
         )
     {
         /* Do not forget to release the addrinfo. */
@@ -69,6 +87,7 @@ GameServerModel::open(
 
     /* Do not forget to release the addrinfo. */
     safeRelease( ai, freeaddrinfo );
+    mTransport = transport;
     return true;
 }
 
@@ -84,6 +103,7 @@ GameServerModel::close()
 
     /* Wipe the list. */
     mClients.clear();
+    mPeers.clear();
     /* Close the socket. */
     mSocket.close();
     /* Delete the client socket. */
@@ -95,45 +115,53 @@ GameServerModel::dispatch(
     const GameModelEvent& event
     )
 {
-    /* Parents first. */
+    /* Parents first; the changed tiles go out at the end of the tick. */
     GameLocalModel::dispatch( event );
-    /* If it has invalid position, not for us. */
-    if( event.coords.second == mSize ) return;
 
-    /* Broadcast to all clients. */
-    std::list<GameClient*>::iterator cur, end;
-    cur = mClients.begin();
-    end = mClients.end();
-    while( cur != end )
-        if( (*cur)->push( event ) )
-            ++cur;
-        else
-        {
-            /* So long, dont come back. */
-            safeDelete( *cur );
-            cur = mClients.erase( cur );
-        }
+    /* If it has invalid position, it changes no tiles. */
+    if( event.coords.second != mSize )
+        ++mNetStats.events;
 }
 
 bool
 GameServerModel::tick()
 {
-    while( true )
-    {
-        /* Create a new socket if we do not have one. */
-        if( !mClientSocket )
-            mClientSocket = new Socket;
+    /* Accept and read whatever is ready. */
+    ++mClock;
+    tickSockets();
+    /* Pick the control events of the tick. */
+    tickControls();
+    /* Play the tick. */
+    const bool cont = GameLocalModel::tick();
+    /* Push its updates out. */
+    tickFlush();
 
-        /* Try to accept a connection. */
-        if( mSocket.accept( *mClientSocket, NULL, NULL ) )
-            /* No new connections ... */
-            break;
+    return cont;
+}
 
-        /* Handle it. */
-        tickClientConnected( mClientSocket );
-    }
+void
+GameServerModel::setQueueLimit(
+    unsigned int bytes,
+    Overflow overflow
+    )
+{
+    mQueueLimit = bytes;
+    mOverflow = overflow;
+}
+
+void
+GameServerModel::clientStats(
+    std::vector<ClientStats>& stats
+    ) const
+{
+    stats.clear();
 
-    return GameLocalModel::tick();
+    std::list<GameClient*>::const_iterator cur, end;
+    cur = mClients.begin();
+    end = mClients.end();
+    for(; cur != end; ++cur )
+        if( (*cur)->joined() )
+            stats.push_back( (*cur)->stats() );
 }
 
 bool
@@ -149,159 +177,987 @@ GameServerModel::checkEndCond()
     return false;
 }
 
+void
+GameServerModel::tickSockets()
+{
+    /* A single syscall, however many clients there are. */
+    const int count = mReactor.wait( 0 );
+    ++mNetStats.waits;
+
+    for( int i = 0; i < count; ++i )
+    {
+        GameClient* client = (GameClient*)mReactor.data( i );
+        const unsigned int events = mReactor.events( i );
+
+        if( !client && GameProtocol::TRANSPORT_UDP == mTransport )
+            /* The datagram socket. */
+            tickDatagrams();
+        else if( !client )
+            /* The listen socket. */
+            tickAccept();
+        else if( !client->wake( events ) )
+            /* So long, dont come back. */
+            drop( client );
+        else if( !client->joined() )
+            tickClientHello( client );
+        else
+            tickClientSpawn( client );
+    }
+}
+
+void
+GameServerModel::tickAccept()
+{
+    while( true )
+    {
+        /* Create a new socket if we do not have one. */
+        if( !mClientSocket )
+            mClientSocket = new Socket;
+
+        /* Try to accept a connection. */
+        ++mNetStats.accepts;
+        if( mSocket.accept( *mClientSocket, NULL, NULL,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC ) )
+            /* No new connections ... */
+            break;
+
+        /* Handle it. */
+        tickClientConnected( mClientSocket );
+    }
+}
+
 void
 GameServerModel::tickClientConnected(
     Socket*& sock
     )
 {
-    unsigned int bufsize = 64 * 1024;
-    if(
-        /* Increase recv buffer size. */
-        sock->setopt( SOL_SOCKET, SO_RCVBUF,
-                               &bufsize, sizeof( bufsize ) ) ||
-        /* Enable non-block */
-        sock->fcntl( F_SETFL, O_NONBLOCK ) )
+    /* Create a GameClient. */
+    GameClient* client = new GameClient( sock, mNetStats );
+
+    if( !client->watch( mReactor, client ) )
     {
         /* Strange, should not happen. */
-        sock->close();
+        safeDelete( client );
         return;
     }
 
-    /* Create a GameClient. */
-    GameClient* client = new GameClient( sock );
+    /* He joins once he says hello. */
+    mClients.push_back( client );
+}
 
-    /* Add him to the game. */
+void
+GameServerModel::tickClientHello(
+    GameClient* client
+    )
+{
+    if( !client->version() )
+        /* Still waiting for the hello. */
+        return;
+
+    tickClientJoin( client );
+}
+
+void
+GameServerModel::tickClientJoin(
+    GameClient* client
+    )
+{
+    /* From now on, he gets the updates, a snapshot first. */
+    client->join();
+    /* He may have opened channels already. */
+    tickClientSpawn( client );
+}
+
+void
+GameServerModel::tickClientSpawn(
+    GameClient* client
+    )
+{
+    /* Add his players to the game. */
     GameModelEvent event;
     event.entity = GENT_PLAYER;
     event.coords = GameCoordRect( mSize, mSize );
-    event.ctl = client->ctl();
-    dispatch( event );
 
-    /* First send him dimensions of the game map. */
-    GameCoordRect rect(
-        GameCoord( 0, 0 ),
-        GameCoord( mSize ) );
+    while( client->spawned() < client->channels() )
+    {
+        event.ctl = client->ctl( client->spawned() );
+        dispatch( event );
+        client->attach( client->spawned(), &mCtlEntities.back() );
+    }
+}
+
+void
+GameServerModel::tickControls()
+{
+    std::list<GameClient*>::iterator cur, end;
+    cur = mClients.begin();
+    end = mClients.end();
+    for(; cur != end; ++cur )
+        (*cur)->drain( mClock, mJitter );
+}
+
+void
+GameServerModel::tickDatagrams()
+{
+    unsigned char buf[GAME_NET_DATAGRAM_BYTES];
+    while( true )
+    {
+        sockaddr_storage from;
+        unsigned int fromlen = sizeof( from );
+
+        ++mNetStats.recvs;
+        const int code = mSocket.recvfrom(
+            buf, sizeof( buf ), 0, (sockaddr*)&from, &fromlen );
+        if( code < 0 && EINTR == errno )
+            continue;
+        else if( code < 0 )
+            /* Empty, or something's fucked up; no matter. */
+            break;
+
+        const std::string key( (const char*)&from, fromlen );
+        std::map<std::string, GameClient*>::iterator peer = mPeers.find( key );
+        GameClient* client = mPeers.end() == peer ? NULL : peer->second;
+
+        unsigned char version;
+        if( GameProtocol::HELLO_SIZE != (unsigned int)code
+            || !GameProtocol::getHello( buf, version ) )
+        {
+            /* Strangers are ignored. */
+            if( client )
+            {
+                client->receive( buf, code, mClock );
+                tickClientSpawn( client );
+            }
+            continue;
+        }
+
+        if( !client )
+        {
+            client = new GameClient( (sockaddr*)&from, fromlen, mNetStats );
+            client->hello( version, mClock );
+            if( client->version() )
+            {
+                mClients.push_back( client );
+                mPeers[key] = client;
+                tickClientJoin( client );
+            }
+        }
+
+        /* Reply, again if the reply got lost. */
+        std::vector<unsigned char> reply;
+        GameProtocol::putHello( reply, client->version() );
+        sendDatagram( client, reply );
+
+        if( !client->version() )
+            /* We have told him why. */
+            safeDelete( client );
+    }
+}
+
+void
+GameServerModel::dispatchTileChanged(
+    const GameCoord& pos,
+    GameEntity prev
+    )
+{
+    /* Parents first. */
+    GameLocalModel::dispatchTileChanged( pos, prev );
+
+    mChanged.push_back( pos.row * mSize.col + pos.col );
+}
+
+void
+GameServerModel::tickFlush()
+{
+    /* The same frames for everyone, encoded once. */
+    Message* diff = tickDiff();
+    Message* snapshot = NULL;
 
-    event.entity = GENT_NONE;
-    event.coords = rect;
-    event.ctl = NULL;
+    /* The diffs of datagram clients, one for each base. */
+    std::map<unsigned int, Message*> deltas;
 
-    /* Push it to him. */
-    if( !client->push( event ) )
+    /* One frame and one send per client. */
+    std::list<GameClient*>::iterator cur, end;
+    cur = mClients.begin();
+    end = mClients.end();
+    while( cur != end )
     {
-        /* So soon and you're going? */
-        safeDelete( client );
-        return;
+        if( (*cur)->datagram()
+            ? tickFlushDatagram( *cur, deltas, snapshot )
+            : tickFlushClient( *cur, diff, snapshot ) )
+            ++cur;
+        else
+        {
+            /* So long, dont come back. */
+            if( (*cur)->datagram() )
+                mPeers.erase( (*cur)->key() );
+            safeDelete( *cur );
+            cur = mClients.erase( cur );
+        }
     }
 
-    /* Now push the entire game map to him. */
-    --rect.second.row;
-    --rect.second.col;
+    /* The clients hold their own references. */
+    diff->release();
+    if( snapshot )
+        snapshot->release();
+
+    std::map<unsigned int, Message*>::iterator delta;
+    for( delta = deltas.begin(); delta != deltas.end(); ++delta )
+        delta->second->release();
+}
 
-    GAME_COORD_RECT_ITERATE( cur, rect )
+bool
+GameServerModel::tickFlushClient(
+    GameClient* client,
+    Message* diff,
+    Message*& snapshot
+    )
+{
+    if( !client->joined() )
+        /* Still saying hello. */
+        ;
+    else if( client->stale() )
     {
-        /* Fill the event. */
-        event.entity = at( cur );
-        event.coords = GameCoordRect( cur, cur );
-        event.ctl = NULL;
+        /* A diff is no use, start over once he reads again. */
+        if( client->ready() )
+        {
+            if( !snapshot )
+                snapshot = tickSnapshot();
+            client->sync( mTick, snapshot );
+            client->report( mTick );
+        }
+    }
+    else if( client->behind( mTick )
+             || (client->backlog()
+                 && mQueueLimit < client->backlog() + diff->size()) )
+    {
+        if( OVERFLOW_DISCONNECT == mOverflow )
+        {
+            /* Not worth our memory. */
+            ++mNetStats.disconnects;
+            return false;
+        }
+
+        /* Stop piling up diffs he does not read. */
+        client->stall();
+        ++mNetStats.resyncs;
+    }
+    else
+    {
+        client->push( diff );
+        client->report( mTick );
+    }
+
+    return client->flush();
+}
 
-        /* Push it to him. */
-        if( !client->push( event ) )
+bool
+GameServerModel::tickFlushDatagram(
+    GameClient* client,
+    std::map<unsigned int, Message*>& deltas,
+    Message*& snapshot
+    )
+{
+    if( client->silent( mClock ) )
+        /* Gone without a word. */
+        return false;
+    else if( client->stale() )
+    {
+        /* Once the previous snapshot is through. */
+        if( client->ready() )
         {
-            /* So soon and you're going? */
-            safeDelete( client );
-            return;
+            if( !snapshot )
+                snapshot = tickSnapshot();
+            client->sync( mTick, snapshot );
         }
     }
+    else if( !client->reliable().empty() )
+        /* The diffs are no use before the snapshot, or the diff
+           split into fragments, gets through. */
+        ;
+    else if( client->behind( mTick ) )
+    {
+        if( OVERFLOW_DISCONNECT == mOverflow )
+        {
+            ++mNetStats.disconnects;
+            return false;
+        }
 
-    /* Welcome to the family. */
-    mClients.push_back( client );
+        /* The history does not reach back to him. */
+        client->stall();
+        ++mNetStats.resyncs;
+    }
+    else
+    {
+        Message*& delta = deltas[client->base()];
+        if( !delta )
+            delta = tickDelta( client->base() );
+
+        /* The shared diff, then his players. */
+        mDatagram.clear();
+        GameProtocol::putFrameHead( mDatagram, client->base() );
+        mDatagram.insert( mDatagram.end(), delta->begin(),
+                          delta->begin() + delta->size() );
+        client->players( mDatagram );
+        GameProtocol::putHeader(
+            &mDatagram[GameProtocol::FRAME_HEAD_SIZE], mTick,
+            mDatagram.size() - GameProtocol::FRAME_HEAD_SIZE
+            - GameProtocol::HEADER_SIZE );
+
+        if( GAME_NET_DATAGRAM_BYTES < mDatagram.size() )
+        {
+            /* Too big for a datagram; in fragments, like a snapshot. */
+            client->reliable().push(
+                &mDatagram[GameProtocol::FRAME_HEAD_SIZE],
+                mDatagram.size() - GameProtocol::FRAME_HEAD_SIZE );
+            ++mNetStats.split;
+        }
+        else
+            sendDatagram( client, mDatagram );
+    }
+
+    /* The fragments new or not acknowledged in time. */
+    mNetStats.resent += client->reliable().resend( mClock, mDue );
+
+    std::vector<const ReliableChannel::Fragment*>::const_iterator cur, end;
+    cur = mDue.begin();
+    end = mDue.end();
+    for(; cur != end; ++cur )
+    {
+        mDatagram.clear();
+        GameProtocol::putFragment( mDatagram, (*cur)->seq, (*cur)->last,
+                                   (*cur)->data );
+        sendDatagram( client, mDatagram );
+    }
+
+    return true;
+}
+
+GameServerModel::Message*
+GameServerModel::tickDelta(
+    unsigned int base
+    )
+{
+    /* All the tiles changed since, each once. */
+    mDelta.clear();
+
+    std::deque< std::pair< unsigned int, std::vector<unsigned int> > >
+        ::const_iterator cur, end;
+    cur = mHistory.begin();
+    end = mHistory.end();
+    for(; cur != end; ++cur )
+        if( 0 < (int)(cur->first - base) )
+            mDelta.insert( mDelta.end(),
+                           cur->second.begin(), cur->second.end() );
+
+    std::sort( mDelta.begin(), mDelta.end() );
+    mDelta.erase( std::unique( mDelta.begin(), mDelta.end() ),
+                  mDelta.end() );
+
+    Message* msg = new Message;
+    std::vector<unsigned char>& data = msg->data();
+    data.resize( GameProtocol::HEADER_SIZE );
+    GameProtocol::encodeDiff( mDelta, mMap, data );
+    GameProtocol::putHeader( &data[0], mTick,
+                             data.size() - GameProtocol::HEADER_SIZE );
+
+    mNetStats.bytesEncoded += msg->size();
+    return msg;
+}
+
+void
+GameServerModel::sendDatagram(
+    GameClient* client,
+    const std::vector<unsigned char>& data
+    )
+{
+    ++mNetStats.datagrams;
+    if( GameProtocol::lose( mLossSeed, mLoss ) )
+    {
+        ++mNetStats.lost;
+        return;
+    }
+
+    /* Nobody waits for it; if it does not fit, it is lost. */
+    ++mNetStats.sends;
+    const int code = mSocket.sendto( &data[0], data.size(), MSG_NOSIGNAL,
+                                     client->peer(), client->peerLength() );
+    if( 0 < code )
+        mNetStats.bytesOut += code;
+}
+
+GameServerModel::Message*
+GameServerModel::tickDiff()
+{
+    /* Each tile once, in the order of the map. */
+    std::sort( mChanged.begin(), mChanged.end() );
+    mChanged.erase( std::unique( mChanged.begin(), mChanged.end() ),
+                    mChanged.end() );
+
+    std::vector<unsigned int>::iterator cur, end, last;
+    cur = last = mChanged.begin();
+    end = mChanged.end();
+    for(; cur != end; ++cur )
+        if( mMap[*cur] != mSent[*cur] )
+        {
+            /* Changed for real. */
+            mSent[*cur] = mMap[*cur];
+            *last++ = *cur;
+        }
+    mChanged.erase( last, end );
+
+    Message* msg = new Message;
+    std::vector<unsigned char>& data = msg->data();
+    data.resize( GameProtocol::HEADER_SIZE );
+    GameProtocol::encodeDiff( mChanged, mMap, data );
+    GameProtocol::putHeader( &data[0], mTick,
+                             data.size() - GameProtocol::HEADER_SIZE );
+
+    mNetStats.tiles += mChanged.size();
+    mNetStats.bytesEncoded += msg->size();
+
+    if( GameProtocol::TRANSPORT_UDP == mTransport )
+    {
+        /* Kept for the diffs against older frames. */
+        mHistory.push_back( std::make_pair(
+            mTick, std::vector<unsigned int>() ) );
+        mHistory.back().second.swap( mChanged );
+        if( GAME_NET_LAG_TICKS < mHistory.size() )
+            mHistory.pop_front();
+    }
+
+    mChanged.clear();
+    return msg;
+}
+
+GameServerModel::Message*
+GameServerModel::tickSnapshot()
+{
+    Message* msg = new Message;
+    std::vector<unsigned char>& data = msg->data();
+    data.resize( GameProtocol::HEADER_SIZE );
+    GameProtocol::encodeSnapshot( mSize, mMap, data );
+    GameProtocol::putHeader( &data[0], mTick,
+                             data.size() - GameProtocol::HEADER_SIZE );
+
+    mNetStats.bytesEncoded += msg->size();
+    return msg;
+}
+
+void
+GameServerModel::drop(
+    GameClient* client
+    )
+{
+    mClients.remove( client );
+    if( client->datagram() )
+        mPeers.erase( client->key() );
+    /* Closing the socket removes it from the reactor. */
+    safeDelete( client );
 }
 
 /*************************************************************************/
 /* GameServerModel::GameClient                                           */
 /*************************************************************************/
 GameServerModel::GameClient::GameClient(
-    Socket*& sock
+    Socket*& sock,
+    NetStats& stats
     )
-: mSocket( sock ),
-  mCtl( NULL )
+: StreamPeer( sock, stats.recvs, stats.sends, stats.bytesOut ),
+  mSpawned( 0 ),
+  mOffset( 0 ),
+  mAnchored( false ),
+  mAcked( 0 ),
+  mSynced( 0 ),
+  mResyncs( 0 ),
+  mPeerLen( 0 ),
+  mReliable( GAME_NET_DATAGRAM_BYTES - GameProtocol::FRAGMENT_HEAD_SIZE,
+             GAME_NET_WINDOW, GAME_NET_RESEND_TICKS ),
+  mHeard( 0 ),
+  mJoined( false ),
+  mStale( false ),
+  mWaiting( false )
 {
     /* Consume the socket. */
     sock = NULL;
 }
 
-GameServerModel::GameClient::~GameClient()
+GameServerModel::GameClient::GameClient(
+    const sockaddr* peer,
+    unsigned int peerlen,
+    NetStats& stats
+    )
+: StreamPeer( NULL, stats.recvs, stats.sends, stats.bytesOut ),
+  mSpawned( 0 ),
+  mOffset( 0 ),
+  mAnchored( false ),
+  mAcked( 0 ),
+  mSynced( 0 ),
+  mResyncs( 0 ),
+  mPeerLen( std::min<unsigned int>( peerlen, sizeof( mPeer ) ) ),
+  mReliable( GAME_NET_DATAGRAM_BYTES - GameProtocol::FRAGMENT_HEAD_SIZE,
+             GAME_NET_WINDOW, GAME_NET_RESEND_TICKS ),
+  mHeard( 0 ),
+  mJoined( false ),
+  mStale( false ),
+  mWaiting( false )
 {
-    /* If we have a controller, decouple. */
-    if( mCtl )
-        mCtl->setClient( NULL );
+    memcpy( &mPeer, peer, mPeerLen );
+}
 
-    /* Delete the socket. */
-    safeDelete( mSocket );
+GameServerModel::GameClient::~GameClient()
+{
+    /* If we have controllers, decouple. */
+    std::vector<Channel>::iterator cur, end;
+    cur = mChannels.begin();
+    end = mChannels.end();
+    for(; cur != end; ++cur )
+        if( cur->ctl )
+            cur->ctl->setClient( NULL );
 }
 
 GameController*
-GameServerModel::GameClient::ctl()
+GameServerModel::GameClient::ctl(
+    unsigned int channel
+    )
 {
-    if( !mCtl )
-        mCtl = new Controller( this );
-    return mCtl;
+    Channel& chan = mChannels[channel];
+    if( !chan.ctl )
+        chan.ctl = new Controller( this, channel );
+    return chan.ctl;
+}
+
+void
+GameServerModel::GameClient::attach(
+    unsigned int channel,
+    const GameCtlEntity* entity
+    )
+{
+    mChannels[channel].entity = entity;
+    mSpawned = std::max( mSpawned, channel + 1 );
 }
 
 bool
-GameServerModel::GameClient::push(
-    const GameModelEvent& event
+GameServerModel::GameClient::behind(
+    unsigned int tick
+    ) const
+{
+    /* Give him time to acknowledge the snapshot, too. */
+    return GAME_NET_LAG_TICKS < tick - std::max( mAcked, mSynced );
+}
+
+void
+GameServerModel::GameClient::sync(
+    unsigned int tick,
+    Message* snapshot
     )
 {
-    /* Stick it to the buffer. */
-    mBuffer.insert(
-        mBuffer.end(),
-        (const unsigned char*)&event,
-        (const unsigned char*)&event + sizeof( event ) );
+    if( datagram() )
+        mReliable.push( snapshot->begin(), snapshot->size() );
+    else
+        push( snapshot );
+    mSyncedEnd = mPushed;
 
-    /* Push the buffer out. */
-    return push();
+    /* Diffs against it from now on. */
+    mSynced = tick;
+    mStale = false;
+    /* Tell him where they are again. */
+    std::vector<Channel>::iterator cur, end;
+    cur = mChannels.begin();
+    end = mChannels.end();
+    for(; cur != end; ++cur )
+        cur->reported.clear();
 }
 
 void
-GameServerModel::GameClient::die()
+GameServerModel::GameClient::report(
+    unsigned int tick
+    )
 {
-    /* The controller died. */
-    mCtl = NULL;
-    /* No more receives. */
-    mSocket->shutdown( SHUT_RD );
+    Message* msg = NULL;
+    std::vector<unsigned char> record;
+    for( unsigned int i = 0; i < mSpawned; ++i )
+    {
+        GameProtocol::Player player;
+        this->player( i, player );
+
+        record.clear();
+        GameProtocol::encodePlayer( player, record );
+        if( record == mChannels[i].reported )
+            /* He knows already. */
+            continue;
+        mChannels[i].reported.swap( record );
+
+        if( !msg )
+        {
+            msg = new Message;
+            msg->data().resize( GameProtocol::HEADER_SIZE );
+        }
+
+        msg->data().insert( msg->data().end(),
+                            mChannels[i].reported.begin(),
+                            mChannels[i].reported.end() );
+    }
+
+    if( !msg )
+        return;
+
+    std::vector<unsigned char>& data = msg->data();
+    GameProtocol::putHeader( &data[0], tick,
+                             data.size() - GameProtocol::HEADER_SIZE );
+
+    push( msg );
+    msg->release();
+}
+
+void
+GameServerModel::GameClient::player(
+    unsigned int channel,
+    GameProtocol::Player& player
+    ) const
+{
+    const Channel& chan = mChannels[channel];
+
+    /* The events dropped or collapsed count as taken. */
+    player.channel = channel;
+    player.taken = chan.received - chan.queued;
+    player.alive = chan.entity;
+    if( chan.entity )
+    {
+        player.pos = chan.entity->pos;
+        player.speed = chan.entity->speed;
+        player.nextmove = chan.entity->nextmove;
+    }
+}
+
+void
+GameServerModel::GameClient::players(
+    std::vector<unsigned char>& buf
+    ) const
+{
+    for( unsigned int i = 0; i < mSpawned; ++i )
+    {
+        GameProtocol::Player player;
+        this->player( i, player );
+        GameProtocol::encodePlayer( player, buf );
+    }
+}
+
+void
+GameServerModel::GameClient::hello(
+    unsigned char version,
+    unsigned int tick
+    )
+{
+    mVersion = GameProtocol::negotiate( version );
+    mHeard = tick;
+}
+
+void
+GameServerModel::GameClient::receive(
+    const unsigned char* buf,
+    unsigned int len,
+    unsigned int tick
+    )
+{
+    unsigned int ack, received, stamp, channels;
+    if( !GameProtocol::getInput( buf, len, ack, received, stamp, channels ) )
+        /* A stray hello or garbage. */
+        return;
+
+    mHeard = tick;
+    mAcked = std::max( mAcked, ack );
+    /* He is alive. */
+    mWaiting = false;
+    mReliable.ack( received );
+
+    const unsigned char* cur = buf + GameProtocol::INPUT_HEAD_SIZE;
+    const unsigned char* end = buf + len;
+    for( unsigned int i = 0; i < channels; ++i )
+    {
+        unsigned int sent, count;
+        const unsigned char* events;
+        if( !GameProtocol::getInputChannel( cur, end, sent, count, events )
+            || !open( i ) )
+            return;
+
+        /* Datagrams may come late or twice; mind the wrap. */
+        unsigned int& received = mChannels[i].received;
+        const int fresh = sent - received;
+        if( fresh <= 0 )
+            continue;
+        else if( count < (unsigned int)fresh )
+            /* Lost for good; taken as nothing. */
+            received = sent - count;
+
+        /* The last one is of the tick of the datagram. */
+        while( received != sent )
+            control( i, stamp - (sent - received - 1), GameProtocol::getCtl(
+                         events[count - (sent - received)] ) );
+    }
+}
+
+void
+GameServerModel::GameClient::stall()
+{
+    mQueue.drop();
+    mStale = mWaiting = true;
+    ++mResyncs;
+}
+
+GameServerModel::ClientStats
+GameServerModel::GameClient::stats() const
+{
+    ClientStats stats;
+    stats.queued = mQueue.size();
+    stats.bytes = mQueue.bytes();
+    stats.backlog = backlog();
+    stats.peak = mPeak;
+    stats.resyncs = mResyncs;
+    return stats;
+}
+
+void
+GameServerModel::GameClient::die(
+    unsigned int channel
+    )
+{
+    /* The controller died; keep reading the acknowledgements. */
+    Channel& chan = mChannels[channel];
+    chan.ctl = NULL;
+    chan.entity = NULL;
+    chan.arrived.clear();
+    chan.buffer.clear();
+    chan.due = GCE_NOOP;
+    chan.queued = 0;
+}
+
+void
+GameServerModel::GameClient::parse()
+{
+    unsigned int pos = 0;
+    while( pos < mInputLen )
+    {
+        if( GameProtocol::isAck( mInput[pos] ) )
+        {
+            if( mInputLen - pos < GameProtocol::ACK_SIZE )
+                /* The rest is on the way. */
+                break;
+
+            mAcked = std::max( mAcked, GameProtocol::getAck( &mInput[pos] ) );
+            pos += GameProtocol::ACK_SIZE;
+            /* He is alive. */
+            mWaiting = false;
+        }
+        else if( GameProtocol::isControls( mInput[pos] ) )
+        {
+            if( mInputLen - pos < GameProtocol::CONTROLS_HEAD_SIZE
+                || mInputLen - pos - GameProtocol::CONTROLS_HEAD_SIZE
+                   < GameProtocol::getControls( &mInput[pos] ) )
+                /* The rest is on the way. */
+                break;
+
+            /* An event of each channel, in order. */
+            const unsigned int count =
+                GameProtocol::getControls( &mInput[pos] );
+            const unsigned int stamp =
+                GameProtocol::getControlsTick( &mInput[pos] );
+            pos += GameProtocol::CONTROLS_HEAD_SIZE;
+            for( unsigned int i = 0; i < count; ++i, ++pos )
+                if( open( i ) )
+                    control( i, stamp, GameProtocol::getCtl( mInput[pos] ) );
+        }
+        else
+            /* Not a message we know of. */
+            ++pos;
+    }
+
+    consume( pos );
+}
+
+void
+GameServerModel::GameClient::consume(
+    unsigned int count
+    )
+{
+    /* Only an incomplete message is left, if anything. */
+    mInputLen -= count;
+    memmove( &mInput[0], &mInput[count], mInputLen );
 }
 
 bool
-GameServerModel::GameClient::push()
+GameServerModel::GameClient::open(
+    unsigned int channel
+    )
 {
-    int code = mSocket->send(
-        &mBuffer[0], mBuffer.size(), MSG_NOSIGNAL );
+    if( GAME_NET_CHANNELS <= channel )
+        /* Enough is enough. */
+        return false;
 
-    if( 0 <= code )
+    while( mChannels.size() <= channel )
     {
-        /* Sent "code" bytes. */
-        mBuffer.erase(
-            mBuffer.begin(),
-            mBuffer.begin() + code );
+        mChannels.push_back( Channel() );
+        mChannels.back().ctl = NULL;
+        mChannels.back().entity = NULL;
+        mChannels.back().due = GCE_NOOP;
+        mChannels.back().queued = 0;
+        mChannels.back().received = 0;
+    }
 
-        return true;
+    return true;
+}
+
+void
+GameServerModel::GameClient::control(
+    unsigned int channel,
+    unsigned int tick,
+    GameCtlEvent event
+    )
+{
+    /* Nobody to pop it once dead, and a second is plenty. */
+    Channel& chan = mChannels[channel];
+    ++chan.received;
+    if( !chan.ctl || GAME_NET_QUEUE_CONTROLS <= chan.queued )
+        return;
+
+    Input input;
+    input.tick = tick;
+    input.event = event;
+    input.count = 1;
+
+    chan.arrived.push_back( input );
+    ++chan.queued;
+}
+
+void
+GameServerModel::GameClient::drain(
+    unsigned int tick,
+    unsigned int depth
+    )
+{
+    std::vector<Channel>::iterator cur, end;
+    cur = mChannels.begin();
+    end = mChannels.end();
+    for(; cur != end; ++cur )
+    {
+        /* Everything read since the last tick goes in. */
+        std::vector<Input>::iterator in, inend;
+        in = cur->arrived.begin();
+        inend = cur->arrived.end();
+        for(; in != inend; ++in )
+        {
+            in->tick = target( in->tick, tick, depth );
+
+            if( !cur->buffer.empty() )
+            {
+                /* Never before those buffered; mind the wrap. */
+                Input& last = cur->buffer.back();
+                if( (int)(in->tick - last.tick) <= 0 )
+                {
+                    in->tick = last.tick;
+                    if( collapse( last.event, in->event ) )
+                    {
+                        last.count += in->count;
+                        continue;
+                    }
+                }
+            }
+
+            cur->buffer.push_back( *in );
+        }
+        cur->arrived.clear();
+
+        /* Whatever is due, collapsed as far as it goes. */
+        cur->due = GCE_NOOP;
+        while( !cur->buffer.empty()
+               && (int)(cur->buffer.front().tick - tick) <= 0
+               && collapse( cur->due, cur->buffer.front().event ) )
+        {
+            cur->queued -= cur->buffer.front().count;
+            cur->buffer.pop_front();
+        }
+    }
+}
+
+unsigned int
+GameServerModel::GameClient::target(
+    unsigned int stamp,
+    unsigned int tick,
+    unsigned int depth
+    )
+{
+    if( !mAnchored )
+    {
+        /* Leave room for the jitter to come. */
+        mOffset = tick + depth - stamp;
+        mAnchored = true;
+    }
+
+    /* Mind the wrap. */
+    const unsigned int at = stamp + mOffset;
+    if( 0 < (int)(at - tick - depth) )
+    {
+        /* The client runs ahead of us; do not let it pile up. */
+        mOffset -= at - tick - depth;
+        return tick + depth;
+    }
+    else if( (int)(at - tick) < 0 )
+    {
+        /* Later than ever; wait that much from now on. */
+        mOffset += tick - at;
+        return tick;
     }
-    else if( EAGAIN == errno || EWOULDBLOCK == errno )
+
+    return at;
+}
+
+bool
+GameServerModel::GameClient::collapse(
+    GameCtlEvent& into,
+    GameCtlEvent event
+    )
+{
+    if( GCE_NOOP == event )
+        /* Nothing to add. */
         return true;
-    else
-        /* Something's fucked up. */
+    else if( GCE_NOOP == into
+             || (GCE_MOVEUP <= into && into <= GCE_MOVERIGHT
+                 && GCE_MOVEUP <= event && event <= GCE_MOVERIGHT) )
+    {
+        /* Only the last move counts. */
+        into = event;
+        return true;
+    }
+
+    /* A bomb or a trigger; takes a tick of its own. */
+    return false;
+}
+
+bool
+GameServerModel::GameClient::pop(
+    unsigned int channel,
+    GameCtlEvent& event
+    )
+{
+    GameCtlEvent& due = mChannels[channel].due;
+    if( GCE_NOOP == due )
+        /* Nothing this tick. */
         return false;
+
+    event = due;
+    due = GCE_NOOP;
+    return true;
 }
 
 /*************************************************************************/
 /* GameServerModel::GameClient::Controller                               */
 /*************************************************************************/
 GameServerModel::GameClient::Controller::Controller(
-    GameServerModel::GameClient* client
+    GameServerModel::GameClient* client,
+    unsigned int channel
     )
-: mClient( client )
+: mClient( client ),
+  mChannel( channel )
 {
 }
 
@@ -309,7 +1165,7 @@ GameServerModel::GameClient::Controller::~Controller()
 {
     /* Tell him he's dead. */
     if( mClient )
-        mClient->die();
+        mClient->die( mChannel );
 }
 
 void
@@ -317,16 +1173,10 @@ GameServerModel::GameClient::Controller::tick(
     GameCtlEvent& event
     )
 {
-    int code = 0;
-    if( mClient )
-        code = mClient->mSocket->recv( &event, sizeof( event ), 0 );
-
-    if( code <= 0 )
+    /* The reactor has read it already, no syscall here. */
+    if( !mClient || !mClient->pop( mChannel, event ) )
         /* Nothing to do. */
         event = GCE_NOOP;
-    else if( sizeof( event ) != code )
-        /* Received incomplete event ... */
-        abort();
 }
 
 void
@@ -9,7 +9,10 @@
 
 #include "GameController.h"
 #include "GameLocalModel.h"
-#include "Socket.h"
+#include "GameProtocol.h"
+#include "Reactor.h"
+#include "ReliableChannel.h"
+#include "StreamPeer.h"
 
 /**
  * @brief Server game model.
@@ -20,6 +23,73 @@ class GameServerModel
 : public GameLocalModel
 {
 public:
+    /**
+     * @brief Counts the network syscalls of the server.
+     *
+     * @author Jan Bobek
+     */
+    struct NetStats
+    {
+        /// Calls to <code>epoll_wait</code>.
+        unsigned long long waits;
+        /// Calls to <code>accept4</code>.
+        unsigned long long accepts;
+        /// Calls to <code>recv</code>.
+        unsigned long long recvs;
+        /// Calls to <code>send</code>.
+        unsigned long long sends;
+        /// Events dispatched by the game.
+        unsigned long long events;
+        /// Tiles changed and sent to the clients.
+        unsigned long long tiles;
+        /// Bytes sent to the clients.
+        unsigned long long bytesOut;
+        /// Bytes encoded for the clients, once for all of them.
+        unsigned long long bytesEncoded;
+        /// Clients resynced by a snapshot after falling behind.
+        unsigned long long resyncs;
+        /// Clients disconnected after falling behind.
+        unsigned long long disconnects;
+        /// Datagrams sent, lost ones included.
+        unsigned long long datagrams;
+        /// Fragments sent again.
+        unsigned long long resent;
+        /// Frames too big for a datagram, sent in fragments.
+        unsigned long long split;
+        /// Datagrams lost on purpose, see setLoss().
+        unsigned long long lost;
+    };
+
+    /**
+     * @brief Describes the send queue of a client.
+     *
+     * @author Jan Bobek
+     */
+    struct ClientStats
+    {
+        /// Messages queued.
+        unsigned int queued;
+        /// Bytes queued.
+        unsigned long long bytes;
+        /// Bytes of diffs queued, see setQueueLimit().
+        unsigned long long backlog;
+        /// Most bytes ever queued.
+        unsigned long long peak;
+        /// Snapshots sent after falling behind.
+        unsigned int resyncs;
+    };
+
+    /**
+     * @brief What to do with a client which falls behind.
+     *
+     * @author Jan Bobek
+     */
+    enum Overflow
+    {
+        OVERFLOW_RESYNC,    ///< Drop the diffs queued, send a snapshot.
+        OVERFLOW_DISCONNECT ///< Hang up.
+    };
+
     /**
      * @brief Initialize the server.
      *
@@ -34,89 +104,477 @@ public:
     /**
      * @brief Open the model for remote players.
      *
-     * @param[in] addr Address in the form of IP-NUL-port-NUL.
+     * @param[in] addr      Address in the form of IP-NUL-port-NUL.
+     * @param[in] transport The transport to use.
      *
      * @retval true  Listening started.
      * @retval false Failed to start listening.
      */
-    bool open( const char* addr );
+    bool open( const char* addr,
+               GameProtocol::Transport transport = GameProtocol::TRANSPORT_TCP );
     /**
      * @brief Close all remote connections.
      */
     void close();
 
     /**
-     * @brief Broadcasts the updates to all connected clients.
+     * @brief Dispatches an event, counting it.
      *
-     * @param[in] event The event to broadcast.
+     * The clients do not get the events; they get
+     * the tiles changed by them at the end of the tick.
+     *
+     * @param[in] event The event to dispatch.
      */
     void dispatch( const GameModelEvent& event );
 
     /**
      * @brief Handles the sockets.
      *
+     * Accepts and reads whatever the reactor reports ready,
+     * ticks the game and sends the frame of its changes.
+     *
      * @retval true  The game continues.
      * @retval false The game has ended.
      */
     bool tick();
 
+    /**
+     * @brief Limits the send queue of each client.
+     *
+     * A client falls behind when a diff would take its queue
+     * past the limit, or when it has not acknowledged a frame
+     * for GAME_NET_LAG_TICKS. Only the diffs count, and a diff
+     * is always queued if there are no others; a snapshot is
+     * queued only once the queue is empty.
+     *
+     * @param[in] bytes    Most bytes queued for a client.
+     * @param[in] overflow What to do when a client falls behind.
+     */
+    void setQueueLimit( unsigned int bytes, Overflow overflow );
+    /**
+     * @brief Sets how long the control events may wait for their turn.
+     *
+     * The events of a client are played in the pace of the ticks
+     * they carry; those which come early wait, so that the jitter
+     * of the network does not bunch them up. Those which come late,
+     * or more than one for a tick, are collapsed, see
+     * GameClient::drain().
+     *
+     * @param[in] ticks Most ticks to wait; 0 plays them as they come.
+     */
+    void setJitterDepth( unsigned int ticks ) { mJitter = ticks; }
+    /**
+     * @brief Loses some of the datagrams sent, for testing.
+     *
+     * @param[in] percent How many % to lose.
+     */
+    void setLoss( unsigned int percent ) { mLoss = percent; }
+
+    /**
+     * @brief Obtains the network syscall counters.
+     *
+     * @return The counters.
+     */
+    const NetStats& netStats() const { return mNetStats; }
+    /**
+     * @brief Obtains the send queues of the joined clients.
+     *
+     * @param[out] stats Where to store them, one per client.
+     */
+    void clientStats( std::vector<ClientStats>& stats ) const;
+
 protected:
+    /// An encoded message shared by the clients.
+    typedef StreamPeer::Message Message;
+
     /**
      * @brief A connected game client.
      *
+     * A datagram client has no stream; it uses none
+     * of the stream methods.
+     *
      * @author Jan Bobek
      */
     class GameClient
+    : public StreamPeer
     {
     public:
         /**
          * @brief Initializes the client.
          *
-         * @param[in] sock Socket of the client.
+         * @param[in] sock  Socket of the client.
+         * @param[in] stats Where to count the syscalls.
+         */
+        GameClient( Socket*& sock, NetStats& stats );
+        /**
+         * @brief Initializes a client sending datagrams.
+         *
+         * @param[in] peer    Address of the client.
+         * @param[in] peerlen Length of the address.
+         * @param[in] stats   Where to count the syscalls.
          */
-        GameClient( Socket*& sock );
+        GameClient( const sockaddr* peer, unsigned int peerlen,
+                    NetStats& stats );
         /**
          * @brief Releases the socket and other resources.
          */
         ~GameClient();
 
         /**
-         * @brief Obtain an associated controller.
+         * @brief Obtain the controller of a channel.
+         *
+         * @param[in] channel The channel.
          *
          * @return The associated controller.
          */
-        GameController* ctl();
+        GameController* ctl( unsigned int channel );
+        /**
+         * @brief Notes the entity of a channel.
+         *
+         * The channels are spawned in order.
+         *
+         * @param[in] channel The channel.
+         * @param[in] entity  The entity, spawned with ctl().
+         */
+        void attach( unsigned int channel, const GameCtlEntity* entity );
+        /**
+         * @brief Obtains number of the channels opened by the client.
+         *
+         * @return The number.
+         */
+        unsigned int channels() const { return mChannels.size(); }
+        /**
+         * @brief Obtains number of the channels spawned.
+         *
+         * @return The number; the first channel not spawned yet.
+         */
+        unsigned int spawned() const { return mSpawned; }
+        /**
+         * @brief Has the client joined the game?
+         *
+         * @retval true  The client gets the updates.
+         * @retval false The client is still connecting.
+         */
+        bool joined() const { return mJoined; }
+        /**
+         * @brief Lets the client receive the updates.
+         *
+         * It gets a snapshot first, see stale().
+         */
+        void join() { mJoined = mStale = true; }
+        /**
+         * @brief Does the client need a snapshot?
+         *
+         * @retval true  A diff is no use to the client.
+         * @retval false The client has all the frames sent.
+         */
+        bool stale() const { return mStale; }
+        /**
+         * @brief Has the client fallen behind?
+         *
+         * It has if it has not acknowledged a frame
+         * for GAME_NET_LAG_TICKS since its last snapshot.
+         *
+         * @param[in] tick Number of the current tick.
+         *
+         * @retval true  The client is behind; stop sending diffs.
+         * @retval false The client keeps up.
+         */
+        bool behind( unsigned int tick ) const;
+        /**
+         * @brief Stops the diffs until the client gets a snapshot.
+         *
+         * Drops the diffs queued; the snapshot replaces them.
+         */
+        void stall();
+        /**
+         * @brief Is the client ready for a snapshot?
+         *
+         * It is once the send buffer is drained and, if it
+         * has fallen behind, it has acknowledged a frame since.
+         *
+         * @retval true  Send the snapshot now.
+         * @retval false It would only pile up.
+         */
+        bool ready() const
+        {
+            return !mWaiting && mQueue.empty() && mReliable.empty();
+        }
+        /**
+         * @brief Describes the send queue.
+         *
+         * @return The description.
+         */
+        ClientStats stats() const;
+        /**
+         * @brief Obtains a player of the client.
+         *
+         * @param[in]  channel The channel of the player.
+         * @param[out] player  Where to store it.
+         */
+        void player( unsigned int channel,
+                     GameProtocol::Player& player ) const;
+        /**
+         * @brief Encodes all players of the client.
+         *
+         * @param[out] buf Where to append the records.
+         */
+        void players( std::vector<unsigned char>& buf ) const;
+
+        /**
+         * @brief Does the client send datagrams?
+         *
+         * @retval true  UDP; see peer().
+         * @retval false TCP; see socket().
+         */
+        bool datagram() const { return !mSocket; }
+        /**
+         * @brief Obtains the address of a client sending datagrams.
+         *
+         * @return The address.
+         */
+        const sockaddr* peer() const { return (const sockaddr*)&mPeer; }
+        /**
+         * @brief Obtains length of the address of the client.
+         *
+         * @return The length.
+         */
+        unsigned int peerLength() const { return mPeerLen; }
+        /**
+         * @brief Obtains the address as a key.
+         *
+         * @return The bytes of the address.
+         */
+        std::string key() const
+        {
+            return std::string( (const char*)&mPeer, mPeerLen );
+        }
+        /**
+         * @brief Obtains the reliable channel of a datagram client.
+         *
+         * @return The channel.
+         */
+        ReliableChannel& reliable() { return mReliable; }
+        /**
+         * @brief Obtains the tick of the frame the client has.
+         *
+         * @return The tick; a diff against it brings the client
+         *         up to date.
+         */
+        unsigned int base() const { return std::max( mAcked, mSynced ); }
+        /**
+         * @brief Has the client gone silent?
+         *
+         * @param[in] tick The clock of the server.
+         *
+         * @retval true  Not heard for GAME_NET_TIMEOUT_TICKS.
+         * @retval false Heard lately.
+         */
+        bool silent( unsigned int tick ) const
+        {
+            return GAME_NET_TIMEOUT_TICKS < tick - mHeard;
+        }
+
+        /**
+         * @brief Queues a frame of a snapshot for the client.
+         *
+         * A datagram client gets it over the reliable channel.
+         *
+         * @param[in] tick     Number of the tick.
+         * @param[in] snapshot The frame; a reference is taken.
+         */
+        void sync( unsigned int tick, Message* snapshot );
         /**
-         * @brief Pushes a game model evente to the client.
+         * @brief Queues a frame of the players of the client.
          *
-         * @param[in] event The event to send.
+         * Only those changed since the last one, unless
+         * a snapshot has been queued since.
          *
-         * @retval true  Push ok.
-         * @retval false Push failed.
+         * @param[in] tick Number of the tick.
          */
-        bool push( const GameModelEvent& event );
+        void report( unsigned int tick );
+
+        /**
+         * @brief Handles a hello datagram of the client.
+         *
+         * @param[in] version The newest version of the client.
+         * @param[in] tick    The clock of the server.
+         */
+        void hello( unsigned char version, unsigned int tick );
+        /**
+         * @brief Handles an input datagram of the client.
+         *
+         * Notes the acknowledgements and queues the control
+         * events not seen yet.
+         *
+         * @param[in] buf  The datagram.
+         * @param[in] len  Size of the datagram.
+         * @param[in] tick The clock of the server.
+         */
+        void receive( const unsigned char* buf, unsigned int len,
+                      unsigned int tick );
+        /**
+         * @brief Schedules the control events received.
+         *
+         * Maps the ticks of the client to those of the server,
+         * lagging by up to the depth, and picks the event of the
+         * tick for each channel, see pop(). Moves due in the same
+         * tick are collapsed to the last one; so are the events
+         * which come late.
+         *
+         * @param[in] tick  The clock of the server.
+         * @param[in] depth Most ticks an event may wait.
+         */
+        void drain( unsigned int tick, unsigned int depth );
 
     protected:
         class Controller;
 
+        /**
+         * @brief Control events of a channel, of a single tick.
+         *
+         * @author Jan Bobek
+         */
+        struct Input
+        {
+            /// Tick of the client; of the server once drained.
+            unsigned int tick;
+            /// The control event.
+            GameCtlEvent event;
+            /// Number of the events collapsed into it.
+            unsigned int count;
+        };
+
+        /**
+         * @brief A local player of the client.
+         *
+         * @author Jan Bobek
+         */
+        struct Channel
+        {
+            /// The associated controller; NULL if not spawned or dead.
+            Controller* ctl;
+            /// Entity of the controller; NULL if not spawned or dead.
+            const GameCtlEntity* entity;
+            /// The control events not drained yet.
+            std::vector<Input> arrived;
+            /// The control events drained, waiting for their tick.
+            std::deque<Input> buffer;
+            /// The control event of the tick; GCE_NOOP once popped.
+            GameCtlEvent due;
+            /// Number of the control events arrived or buffered.
+            unsigned int queued;
+            /// Number of the control events ever received.
+            unsigned int received;
+            /// The player record of the last report().
+            std::vector<unsigned char> reported;
+        };
+
         /**
          * @brief Notify the client about death.
+         *
+         * @param[in] channel The channel of the dead player.
+         */
+        void die( unsigned int channel );
+        /**
+         * @brief Parses the whole messages received.
+         *
+         * Notes the acknowledgements and queues the control
+         * events, if there is a controller to pop them. The
+         * rest stays buffered for the next read.
+         */
+        void parse();
+        /**
+         * @brief Drops the bytes parsed from the receive buffer.
+         *
+         * @param[in] count Number of the bytes.
+         */
+        void consume( unsigned int count );
+        /**
+         * @brief Opens the channels up to one.
+         *
+         * @param[in] channel The channel.
+         *
+         * @retval true  The channel is open.
+         * @retval false Too many channels.
+         */
+        bool open( unsigned int channel );
+        /**
+         * @brief Queues a control event of the client.
+         *
+         * @param[in] channel The channel, open.
+         * @param[in] tick    Tick of the client the event is of.
+         * @param[in] event   The control event.
+         */
+        void control( unsigned int channel, unsigned int tick,
+                      GameCtlEvent event );
+        /**
+         * @brief Maps a tick of the client to a tick of the server.
+         *
+         * The first event sets the lag to the depth; an event which
+         * comes late raises it, one which would wait longer than
+         * the depth lowers it.
+         *
+         * @param[in] stamp Tick of the client.
+         * @param[in] tick  The clock of the server.
+         * @param[in] depth Most ticks an event may wait.
+         *
+         * @return Tick of the server to play the event in.
+         */
+        unsigned int target( unsigned int stamp, unsigned int tick,
+                             unsigned int depth );
+        /**
+         * @brief Collapses two control events of a tick into one.
+         *
+         * A GCE_NOOP gives way to anything, a move to a later
+         * move; bombs and RC triggers are never lost.
+         *
+         * @param[in,out] into  The earlier event; the result.
+         * @param[in]     event The later event.
+         *
+         * @retval true  Collapsed.
+         * @retval false Both have to be played.
          */
-        void die();
+        static bool collapse( GameCtlEvent& into, GameCtlEvent event );
         /**
-         * @brief Pushes the buffer to the client.
+         * @brief Pops the control event of the tick.
+         *
+         * @param[in]  channel The channel.
+         * @param[out] event   The control event.
          *
-         * @retval true  Push ok.
-         * @retval false Push failed.
+         * @retval true  An event was popped.
+         * @retval false No event for the tick.
          */
-        bool push();
+        bool pop( unsigned int channel, GameCtlEvent& event );
 
-        /// The send buffer.
-        std::vector<unsigned char> mBuffer;
-        /// Socket of the client.
-        Socket* mSocket;
-        /// Our associated controller.
-        Controller* mCtl;
+        /// The local players of the client.
+        std::vector<Channel> mChannels;
+        /// Number of the channels spawned.
+        unsigned int mSpawned;
+        /// Ticks of the server ahead of those of the client.
+        unsigned int mOffset;
+        /// Has the first control event set mOffset yet?
+        bool mAnchored;
+        /// The last tick acknowledged.
+        unsigned int mAcked;
+        /// Tick of the last snapshot sent.
+        unsigned int mSynced;
+        /// Snapshots sent after falling behind.
+        unsigned int mResyncs;
+        /// Address of a datagram client.
+        sockaddr_storage mPeer;
+        /// Length of the address.
+        unsigned int mPeerLen;
+        /// The snapshots for a datagram client.
+        ReliableChannel mReliable;
+        /// Tick a datagram was last heard at.
+        unsigned int mHeard;
+        /// Does the client get the updates?
+        bool mJoined;
+        /// Does the client need a snapshot?
+        bool mStale;
+        /// Is an acknowledgement due before the snapshot?
+        bool mWaiting;
     };
     /**
      * @brief A controller associated with a client.
@@ -130,9 +588,10 @@ protected:
         /**
          * @brief Initializes the controller.
          *
-         * @param[in] client The associated game client.
+         * @param[in] client  The associated game client.
+         * @param[in] channel The channel of the client.
          */
-        Controller( GameClient* client );
+        Controller( GameClient* client, unsigned int channel );
         /**
          * @brief Notifies the client about its death.
          */
@@ -154,6 +613,8 @@ protected:
     protected:
         /// Our associated game client.
         GameClient* mClient;
+        /// The channel of the client.
+        unsigned int mChannel;
     };
 
     /**
@@ -164,19 +625,174 @@ protected:
      */
     bool checkEndCond();
 
+    /**
+     * @brief Handles the sockets reported ready by the reactor.
+     */
+    void tickSockets();
+    /**
+     * @brief Accepts all pending connections.
+     */
+    void tickAccept();
     /**
      * @brief Handles a new client.
      *
      * @param[in] sock The socket of the client.
      */
     void tickClientConnected( Socket*& sock );
+    /**
+     * @brief Lets a client join the game once it has said hello.
+     *
+     * @param[in] client The client.
+     */
+    void tickClientHello( GameClient* client );
+    /**
+     * @brief Lets a client receive the updates.
+     *
+     * @param[in] client The client, which has said hello.
+     */
+    void tickClientJoin( GameClient* client );
+    /**
+     * @brief Adds the players of the channels a client has opened.
+     *
+     * @param[in] client The client.
+     */
+    void tickClientSpawn( GameClient* client );
+    /**
+     * @brief Schedules the control events of all clients.
+     */
+    void tickControls();
+    /**
+     * @brief Reads all datagrams pending.
+     *
+     * A hello from a new address makes a client, the rest goes
+     * to the client of the address.
+     */
+    void tickDatagrams();
+    /**
+     * @brief Notes a changed tile for the frame of the tick.
+     *
+     * @param[in] pos  Position of the tile.
+     * @param[in] prev The entity which was there before.
+     */
+    void dispatchTileChanged( const GameCoord& pos, GameEntity prev );
+
+    /**
+     * @brief Sends the frame of the tick to all clients.
+     */
+    void tickFlush();
+    /**
+     * @brief Sends the frame of the tick to a client.
+     *
+     * Clients which keep up get a diff of the tiles changed,
+     * the rest a snapshot once they drain their queues; both
+     * followed by the player of the client.
+     *
+     * @param[in]     client   The client.
+     * @param[in]     diff     The frame of the diff.
+     * @param[in,out] snapshot The frame of a snapshot; encoded
+     *                         on first use.
+     *
+     * @retval true  The client stays.
+     * @retval false The client must be dropped.
+     */
+    bool tickFlushClient( GameClient* client, Message* diff,
+                          Message*& snapshot );
+    /**
+     * @brief Sends the frame of the tick to a datagram client.
+     *
+     * Clients which keep up get a diff against the frame they
+     * have acknowledged, the rest a snapshot over the reliable
+     * channel once the previous one is through. A diff too big
+     * for a datagram goes over the reliable channel, too.
+     *
+     * @param[in]     client   The client.
+     * @param[in,out] deltas   The frames of the diffs by their base;
+     *                         encoded on first use.
+     * @param[in,out] snapshot The frame of a snapshot; encoded
+     *                         on first use.
+     *
+     * @retval true  The client stays.
+     * @retval false The client must be dropped.
+     */
+    bool tickFlushDatagram( GameClient* client,
+                            std::map<unsigned int, Message*>& deltas,
+                            Message*& snapshot );
+    /**
+     * @brief Encodes the tiles changed since a frame.
+     *
+     * @param[in] base Tick of the frame; at most GAME_NET_LAG_TICKS ago.
+     *
+     * @return The frame of the diff, with a reference.
+     */
+    Message* tickDelta( unsigned int base );
+    /**
+     * @brief Sends a datagram to a client.
+     *
+     * @param[in] client The client.
+     * @param[in] data   The datagram.
+     */
+    void sendDatagram( GameClient* client,
+                       const std::vector<unsigned char>& data );
+    /**
+     * @brief Encodes the tiles changed since the last frame.
+     *
+     * Leaves each changed tile once, with the final value, and
+     * drops the tiles changed back to what was sent before.
+     *
+     * @return The frame of the diff, with a reference.
+     */
+    Message* tickDiff();
+    /**
+     * @brief Encodes a snapshot of the map.
+     *
+     * @return The frame of the snapshot, with a reference.
+     */
+    Message* tickSnapshot();
+    /**
+     * @brief Disconnects a client.
+     *
+     * @param[in] client The client.
+     */
+    void drop( GameClient* client );
 
-    /// Our listen socket.
+    /// Watches our sockets.
+    Reactor mReactor;
+    /// The network syscall counters.
+    NetStats mNetStats;
+    /// Our listen socket, or the socket of the datagrams.
     Socket mSocket;
+    /// The transport of mSocket.
+    GameProtocol::Transport mTransport;
+    /// The datagram clients by their addresses.
+    std::map<std::string, GameClient*> mPeers;
     /// Candidate client socket.
     Socket* mClientSocket;
     /// Our connected clients.
     std::list<GameClient*> mClients;
+    /// Most bytes queued for a client.
+    unsigned int mQueueLimit;
+    /// What to do with a client which falls behind.
+    Overflow mOverflow;
+    /// Most ticks a control event may wait for its turn.
+    unsigned int mJitter;
+    /// The tiles as sent in the last frame.
+    std::vector<GameEntity> mSent;
+    /// Indices of the tiles changed since; may repeat.
+    std::vector<unsigned int> mChanged;
+    /// The tiles changed by each of the last GAME_NET_LAG_TICKS ticks.
+    std::deque< std::pair< unsigned int, std::vector<unsigned int> > > mHistory;
+    /// The tiles of a diff being encoded.
+    std::vector<unsigned int> mDelta;
+    /// A datagram being encoded.
+    std::vector<unsigned char> mDatagram;
+    /// The fragments to send to a client.
+    std::vector<const ReliableChannel::Fragment*> mDue;
+    /// How many % of the datagrams to lose.
+    unsigned int mLoss;
+    /// State of the generator of the losses.
+    unsigned int mLossSeed;
+    /// Number of the calls to tick(); runs before the game does, too.
+    unsigned int mClock;
 };
 
 #endif /* !__GAME_SERVER_MODEL_H__INCL__ */
@@ -0,0 +1,124 @@
+/** @file
+ * @brief Implementation of hardware performance counters.
+ *
+ * @author Jan Bobek
+ */
+
+#include "PerfCounters.h"
+
+/*************************************************************************/
+/* PerfCounters                                                          */
+/*************************************************************************/
+PerfCounters::PerfCounters()
+{
+    /* Types and configs of the counters. */
+    static const unsigned int TYPES[PC_COUNT] =
+    {
+        /* PC_CYCLES */        PERF_TYPE_HARDWARE,
+        /* PC_INSTRUCTIONS */  PERF_TYPE_HARDWARE,
+        /* PC_L1D_MISSES */    PERF_TYPE_HW_CACHE,
+        /* PC_LLC_MISSES */    PERF_TYPE_HARDWARE,
+        /* PC_BRANCH_MISSES */ PERF_TYPE_HARDWARE
+    };
+    static const unsigned long long CONFIGS[PC_COUNT] =
+    {
+        /* PC_CYCLES */        PERF_COUNT_HW_CPU_CYCLES,
+        /* PC_INSTRUCTIONS */  PERF_COUNT_HW_INSTRUCTIONS,
+        /* PC_L1D_MISSES */    PERF_COUNT_HW_CACHE_L1D
+                               | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                               | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        /* PC_LLC_MISSES */    PERF_COUNT_HW_CACHE_MISSES,
+        /* PC_BRANCH_MISSES */ PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    for( unsigned int i = 0; i < PC_COUNT; ++i )
+    {
+        perf_event_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+
+        attr.size = sizeof( attr );
+        attr.type = TYPES[i];
+        attr.config = CONFIGS[i];
+        /* Start disabled, count only us. */
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        /* And the threads we start later, eg. the AI workers. */
+        attr.inherit = 1;
+
+        /* Calling thread, any CPU, no group. */
+        mFds[i] = syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    for( unsigned int i = 0; i < PC_COUNT; ++i )
+        if( 0 <= mFds[i] )
+            ::close( mFds[i] );
+}
+
+bool
+PerfCounters::available() const
+{
+    for( unsigned int i = 0; i < PC_COUNT; ++i )
+        if( 0 <= mFds[i] )
+            return true;
+
+    return false;
+}
+
+void
+PerfCounters::start()
+{
+    for( unsigned int i = 0; i < PC_COUNT; ++i )
+        if( 0 <= mFds[i] )
+            ioctl( mFds[i], PERF_EVENT_IOC_ENABLE, 0 );
+}
+
+void
+PerfCounters::stop()
+{
+    for( unsigned int i = 0; i < PC_COUNT; ++i )
+        if( 0 <= mFds[i] )
+            ioctl( mFds[i], PERF_EVENT_IOC_DISABLE, 0 );
+}
+
+void
+PerfCounters::reset()
+{
+    for( unsigned int i = 0; i < PC_COUNT; ++i )
+        if( 0 <= mFds[i] )
+            ioctl( mFds[i], PERF_EVENT_IOC_RESET, 0 );
+}
+
+unsigned long long
+PerfCounters::read(
+    Counter counter
+    ) const
+{
+    unsigned long long value = 0;
+    if( 0 <= mFds[counter] &&
+        sizeof( value ) != ::read( mFds[counter], &value, sizeof( value ) ) )
+        /* Read failed, pretend nothing. */
+        value = 0;
+
+    return value;
+}
+
+const char*
+PerfCounters::name(
+    Counter counter
+    )
+{
+    static const char* const NAMES[PC_COUNT] =
+    {
+        /* PC_CYCLES */        "cycles",
+        /* PC_INSTRUCTIONS */  "instructions",
+        /* PC_L1D_MISSES */    "L1d-misses",
+        /* PC_LLC_MISSES */    "LLC-misses",
+        /* PC_BRANCH_MISSES */ "branch-misses"
+    };
+
+    return NAMES[counter];
+}
@@ -0,0 +1,108 @@
+/** @file
+ * @brief Hardware performance counters.
+ *
+ * @author Jan Bobek
+ */
+
+#ifndef __PERF_COUNTERS_H__INCL__
+#define __PERF_COUNTERS_H__INCL__
+
+#include "Game.h"
+
+/**
+ * @brief A set of hardware performance counters.
+ *
+ * Wraps <code>perf_event_open</code>; each counter is opened
+ * separately, so the set degrades gracefully when some (or all)
+ * of the counters are not available, eg. in a container.
+ *
+ * @author Jan Bobek
+ */
+class PerfCounters
+{
+public:
+    /**
+     * @brief Describes the collected counters.
+     *
+     * @author Jan Bobek
+     */
+    enum Counter
+    {
+        PC_CYCLES,        ///< CPU cycles.
+        PC_INSTRUCTIONS,  ///< Retired instructions.
+        PC_L1D_MISSES,    ///< L1 data cache read misses.
+        PC_LLC_MISSES,    ///< Last level cache misses.
+        PC_BRANCH_MISSES, ///< Mispredicted branches.
+
+        PC_COUNT          ///< Number of counters.
+    };
+
+    /**
+     * @brief Opens the counters of the calling thread.
+     *
+     * The threads it creates from now on are counted too, summed
+     * into the same counts; those which already run are not. The
+     * counters are initially disabled.
+     */
+    PerfCounters();
+    /**
+     * @brief Closes the counters.
+     */
+    ~PerfCounters();
+
+    /**
+     * @brief Checks if any counter is available.
+     *
+     * @retval true  At least one counter is available.
+     * @retval false No counter is available.
+     */
+    bool available() const;
+    /**
+     * @brief Checks if a counter is available.
+     *
+     * @param[in] counter The counter.
+     *
+     * @retval true  The counter is available.
+     * @retval false The counter is not available.
+     */
+    bool available( Counter counter ) const { return 0 <= mFds[counter]; }
+
+    /**
+     * @brief Starts counting.
+     *
+     * The counts accumulate over multiple start/stop pairs.
+     */
+    void start();
+    /**
+     * @brief Stops counting.
+     */
+    void stop();
+    /**
+     * @brief Resets the counts to zero.
+     */
+    void reset();
+
+    /**
+     * @brief Reads a counter.
+     *
+     * @param[in] counter The counter.
+     *
+     * @return The value of the counter; zero if not available.
+     */
+    unsigned long long read( Counter counter ) const;
+
+    /**
+     * @brief Obtains a printable name of a counter.
+     *
+     * @param[in] counter The counter.
+     *
+     * @return Name of the counter.
+     */
+    static const char* name( Counter counter );
+
+protected:
+    /// File descriptors of the counters; -1 if not available.
+    int mFds[PC_COUNT];
+};
+
+#endif /* !__PERF_COUNTERS_H__INCL__ */
@@ -0,0 +1,84 @@
+/** @file
+ * @brief Implementation of a readiness notification loop.
+ *
+ * @author Jan Bobek
+ */
+
+#include "Reactor.h"
+
+/*************************************************************************/
+/* Reactor                                                               */
+/*************************************************************************/
+Reactor::Reactor()
+: mFd( epoll_create1( EPOLL_CLOEXEC ) ),
+  mEvents( 64 )
+{
+    assert( 0 <= mFd );
+}
+
+Reactor::~Reactor()
+{
+    if( 0 <= mFd )
+        ::close( mFd );
+}
+
+int
+Reactor::add(
+    int fd,
+    unsigned int events,
+    void* data
+    )
+{
+    return ctl( EPOLL_CTL_ADD, fd, events, data );
+}
+
+int
+Reactor::modify(
+    int fd,
+    unsigned int events,
+    void* data
+    )
+{
+    return ctl( EPOLL_CTL_MOD, fd, events, data );
+}
+
+int
+Reactor::remove(
+    int fd
+    )
+{
+    return ctl( EPOLL_CTL_DEL, fd, 0, NULL );
+}
+
+int
+Reactor::wait(
+    int timeout
+    )
+{
+    int count;
+    do
+        count = epoll_wait( mFd, &mEvents[0], mEvents.size(), timeout );
+    while( 0 > count && EINTR == errno );
+
+    /* All slots taken, there may be more next time. */
+    if( mEvents.size() == (unsigned int)count )
+        mEvents.resize( 2 * mEvents.size() );
+
+    return count;
+}
+
+int
+Reactor::ctl(
+    int op,
+    int fd,
+    unsigned int events,
+    void* data
+    )
+{
+    epoll_event ev;
+    memset( &ev, 0, sizeof( ev ) );
+    ev.events = events;
+    ev.data.ptr = data;
+
+    return epoll_ctl( mFd, op, fd, &ev );
+}
@@ -0,0 +1,109 @@
+/** @file
+ * @brief A readiness notification loop declarations.
+ *
+ * @author Jan Bobek
+ */
+
+#ifndef __REACTOR_H__INCL__
+#define __REACTOR_H__INCL__
+
+#include "Game.h"
+
+/**
+ * @brief Simple wrapper for epoll.
+ *
+ * Watches any number of descriptors and reports those which
+ * are ready, each with the data it has been added with. One
+ * wait() costs a single syscall, no matter how many descriptors
+ * are watched.
+ *
+ * @author Jan Bobek
+ */
+class Reactor
+{
+public:
+    /**
+     * @brief Creates the epoll instance.
+     */
+    Reactor();
+    /**
+     * @brief Closes the epoll instance.
+     */
+    ~Reactor();
+
+    /**
+     * @brief Starts watching a descriptor.
+     *
+     * @param[in] fd     The descriptor.
+     * @param[in] events The events to watch, EPOLLIN etc.
+     * @param[in] data   Reported along with the events.
+     *
+     * @return A value returned by <code>epoll_ctl</code>.
+     */
+    int add( int fd, unsigned int events, void* data );
+    /**
+     * @brief Changes the events watched on a descriptor.
+     *
+     * @param[in] fd     The descriptor.
+     * @param[in] events The events to watch, EPOLLIN etc.
+     * @param[in] data   Reported along with the events.
+     *
+     * @return A value returned by <code>epoll_ctl</code>.
+     */
+    int modify( int fd, unsigned int events, void* data );
+    /**
+     * @brief Stops watching a descriptor.
+     *
+     * Closing the descriptor does this as well.
+     *
+     * @param[in] fd The descriptor.
+     *
+     * @return A value returned by <code>epoll_ctl</code>.
+     */
+    int remove( int fd );
+
+    /**
+     * @brief Waits for the descriptors to become ready.
+     *
+     * @param[in] timeout How many ms to wait; 0 not to block.
+     *
+     * @return Number of ready descriptors; -1 on error.
+     */
+    int wait( int timeout );
+    /**
+     * @brief Obtains the events of a ready descriptor.
+     *
+     * @param[in] i Index of the descriptor, below wait().
+     *
+     * @return The events, EPOLLIN etc.
+     */
+    unsigned int events( unsigned int i ) const { return mEvents[i].events; }
+    /**
+     * @brief Obtains the data of a ready descriptor.
+     *
+     * @param[in] i Index of the descriptor, below wait().
+     *
+     * @return The data given to add().
+     */
+    void* data( unsigned int i ) const { return mEvents[i].data.ptr; }
+
+protected:
+    /**
+     * @brief Calls <code>epoll_ctl</code>.
+     *
+     * @param[in] op     The operation.
+     * @param[in] fd     The descriptor.
+     * @param[in] events The events to watch.
+     * @param[in] data   Reported along with the events.
+     *
+     * @return A value returned by <code>epoll_ctl</code>.
+     */
+    int ctl( int op, int fd, unsigned int events, void* data );
+
+    /// The epoll instance.
+    int mFd;
+    /// The ready descriptors.
+    std::vector<epoll_event> mEvents;
+};
+
+#endif /* !__REACTOR_H__INCL__ */
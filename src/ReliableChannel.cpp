@@ -0,0 +1,143 @@
+/** @file
+ * @brief Implementation of a reliable channel over datagrams.
+ *
+ * @author Jan Bobek
+ */
+
+#include "ReliableChannel.h"
+
+/*************************************************************************/
+/* ReliableChannel                                                       */
+/*************************************************************************/
+ReliableChannel::ReliableChannel(
+    unsigned int size,
+    unsigned int window,
+    unsigned int resend
+    )
+: mSize( size ),
+  mWindow( window ),
+  mResend( resend ),
+  mNext( 0 ),
+  mIn( 0 )
+{
+}
+
+void
+ReliableChannel::push(
+    const unsigned char* data,
+    unsigned int len
+    )
+{
+    /* An empty message still takes a fragment. */
+    unsigned int pos = 0;
+    do
+    {
+        const unsigned int n = std::min( mSize, len - pos );
+
+        mOut.push_back( Fragment() );
+        Fragment& frag = mOut.back();
+        frag.seq = mNext++;
+        frag.last = len == pos + n;
+        frag.data.assign( data + pos, data + pos + n );
+        frag.sent = 0;
+        frag.fresh = true;
+
+        pos += n;
+    }
+    while( pos < len );
+}
+
+void
+ReliableChannel::ack(
+    unsigned int count
+    )
+{
+    /* Old acknowledgements may come late; mind the wrap. */
+    while( !mOut.empty() && (int)(count - mOut.front().seq) > 0 )
+        mOut.pop_front();
+}
+
+unsigned int
+ReliableChannel::resend(
+    unsigned int tick,
+    std::vector<const Fragment*>& due
+    )
+{
+    unsigned int again = 0;
+    due.clear();
+
+    std::deque<Fragment>::iterator cur, end;
+    cur = mOut.begin();
+    end = mOut.begin() + std::min<size_t>( mWindow, mOut.size() );
+    for(; cur != end; ++cur )
+        if( cur->fresh || mResend <= tick - cur->sent )
+        {
+            if( !cur->fresh )
+                ++again;
+
+            cur->sent = tick;
+            cur->fresh = false;
+            due.push_back( &*cur );
+        }
+
+    return again;
+}
+
+bool
+ReliableChannel::receive(
+    unsigned int seq,
+    bool last,
+    const unsigned char* data,
+    unsigned int len
+    )
+{
+    /* Mind the wrap. */
+    const unsigned int ahead = seq - mIn;
+    if( mWindow <= ahead )
+        /* A duplicate, or too far ahead; it comes again. */
+        return false;
+    else if( ahead )
+    {
+        /* Wait for those before it. */
+        Fragment& frag = mAhead[seq];
+        frag.seq = seq;
+        frag.last = last;
+        frag.data.assign( data, data + len );
+        return false;
+    }
+
+    bool complete = append( last, data, len );
+
+    /* Those which have come ahead of it. */
+    std::map<unsigned int, Fragment>::iterator next;
+    while( mAhead.end() != (next = mAhead.find( mIn )) )
+    {
+        if( append( next->second.last, next->second.data.empty()
+                    ? NULL : &next->second.data[0],
+                    next->second.data.size() ) )
+            complete = true;
+
+        mAhead.erase( next );
+    }
+
+    return complete;
+}
+
+bool
+ReliableChannel::append(
+    bool last,
+    const unsigned char* data,
+    unsigned int len
+    )
+{
+    mPartial.insert( mPartial.end(), data, data + len );
+    ++mIn;
+
+    if( !last )
+        return false;
+
+    /* Complete; the next one starts afresh. */
+    mMessage.swap( mPartial );
+    mPartial.clear();
+    return true;
+}
@@ -0,0 +1,153 @@
+/** @file
+ * @brief A reliable channel over datagrams declarations.
+ *
+ * @author Jan Bobek
+ */
+
+#ifndef __RELIABLE_CHANNEL_H__INCL__
+#define __RELIABLE_CHANNEL_H__INCL__
+
+#include "Game.h"
+
+/**
+ * @brief Delivers messages over datagrams, whole and in order.
+ *
+ * A message is split into fragments, numbered one after another
+ * across the messages. The peer acknowledges how many fragments
+ * it has in a row; the rest is sent again after a while. Only
+ * a window of the fragments is in flight at once; the peer keeps
+ * those which come ahead of a lost one until it comes again.
+ * The sending and the receiving half are independent; neither
+ * does any I/O.
+ *
+ * @author Jan Bobek
+ */
+class ReliableChannel
+{
+public:
+    /**
+     * @brief A fragment of a message.
+     *
+     * @author Jan Bobek
+     */
+    struct Fragment
+    {
+        /// Number of the fragment.
+        unsigned int seq;
+        /// Is it the last fragment of its message?
+        bool last;
+        /// The data.
+        std::vector<unsigned char> data;
+        /// Tick it was last sent at.
+        unsigned int sent;
+        /// Has it been sent at all?
+        bool fresh;
+    };
+
+    /**
+     * @brief Initializes an empty channel.
+     *
+     * @param[in] size   Most bytes of a fragment.
+     * @param[in] window Most fragments in flight.
+     * @param[in] resend Ticks to wait for an acknowledgement.
+     */
+    ReliableChannel( unsigned int size, unsigned int window,
+                     unsigned int resend );
+
+    /**
+     * @brief Has the peer acknowledged everything?
+     *
+     * @retval true  Nothing to send.
+     * @retval false Some fragments are on their way.
+     */
+    bool empty() const { return mOut.empty(); }
+    /**
+     * @brief Splits a message into fragments to send.
+     *
+     * @param[in] data The message.
+     * @param[in] len  Size of the message.
+     */
+    void push( const unsigned char* data, unsigned int len );
+    /**
+     * @brief Notes an acknowledgement of the peer.
+     *
+     * @param[in] count Number of the fragments it has in a row.
+     */
+    void ack( unsigned int count );
+    /**
+     * @brief Picks the fragments to send.
+     *
+     * Those in the window which have not been sent yet,
+     * or not acknowledged for too long.
+     *
+     * @param[in]  tick Number of the current tick.
+     * @param[out] due  Where to store them; valid until the next push().
+     *
+     * @return Number of the fragments sent before.
+     */
+    unsigned int resend( unsigned int tick,
+                         std::vector<const Fragment*>& due );
+
+    /**
+     * @brief Takes a fragment received from the peer.
+     *
+     * @param[in] seq  Number of the fragment.
+     * @param[in] last Is it the last fragment of its message?
+     * @param[in] data The data.
+     * @param[in] len  Size of the data.
+     *
+     * @retval true  A message is complete, see message(); if more
+     *               than one, the newest.
+     * @retval false No message yet.
+     */
+    bool receive( unsigned int seq, bool last,
+                  const unsigned char* data, unsigned int len );
+    /**
+     * @brief Obtains the message completed by the last receive().
+     *
+     * @return The message.
+     */
+    const std::vector<unsigned char>& message() const { return mMessage; }
+    /**
+     * @brief Obtains number of the fragments received in a row.
+     *
+     * @return The number, to acknowledge.
+     */
+    unsigned int received() const { return mIn; }
+
+protected:
+    /**
+     * @brief Appends the next fragment to the message.
+     *
+     * @param[in] last Is it the last fragment of its message?
+     * @param[in] data The data.
+     * @param[in] len  Size of the data.
+     *
+     * @retval true  The message is complete.
+     * @retval false More fragments to come.
+     */
+    bool append( bool last, const unsigned char* data, unsigned int len );
+
+    /// Most bytes of a fragment.
+    unsigned int mSize;
+    /// Most fragments in flight.
+    unsigned int mWindow;
+    /// Ticks to wait for an acknowledgement.
+    unsigned int mResend;
+
+    /// The fragments not acknowledged yet.
+    std::deque<Fragment> mOut;
+    /// Number of the next fragment to push.
+    unsigned int mNext;
+
+    /// The fragments received ahead, by their numbers.
+    std::map<unsigned int, Fragment> mAhead;
+    /// The message being received.
+    std::vector<unsigned char> mPartial;
+    /// The last message complete.
+    std::vector<unsigned char> mMessage;
+    /// Number of the next fragment expected.
+    unsigned int mIn;
+};
+
+#endif /* !__RELIABLE_CHANNEL_H__INCL__ */
@@ -0,0 +1,128 @@
+/** @file
+ * @brief Implementation of a queue of shared messages to send.
+ *
+ * @author Jan Bobek
+ */
+
+#include "SendQueue.h"
+
+/*************************************************************************/
+/* SendQueue                                                             */
+/*************************************************************************/
+const unsigned int SendQueue::IOV_BATCH;
+const unsigned int SendQueue::CAPACITY;
+
+SendQueue::SendQueue()
+: mRing( CAPACITY ),
+  mHead( 0 ),
+  mCount( 0 ),
+  mOffset( 0 ),
+  mBytes( 0 )
+{
+}
+
+SendQueue::~SendQueue()
+{
+    /* Drop what has not been sent. */
+    for(; mCount; --mCount, ++mHead )
+        mRing[mHead & (mRing.size() - 1)]->release();
+}
+
+void
+SendQueue::push(
+    Message* msg
+    )
+{
+    if( mRing.size() == mCount )
+        grow();
+
+    /* No copy, just a reference. */
+    mRing[(mHead + mCount++) & (mRing.size() - 1)] = msg->acquire();
+    mBytes += msg->size();
+}
+
+void
+SendQueue::drop()
+{
+    const unsigned int keep = mOffset ? 1 : 0;
+    for(; keep < mCount; --mCount )
+        mRing[(mHead + mCount - 1) & (mRing.size() - 1)]->release();
+
+    mBytes = keep ? mRing[mHead]->size() - mOffset : 0;
+}
+
+int
+SendQueue::send(
+    Socket& sock,
+    int flags
+    )
+{
+    /* Gather the messages straight from where they are. */
+    iovec iov[IOV_BATCH];
+    const unsigned int count = std::min( mCount, IOV_BATCH );
+    for( unsigned int i = 0; i < count; ++i )
+    {
+        const Message* msg = mRing[(mHead + i) & (mRing.size() - 1)];
+        iov[i].iov_base = (void*)msg->begin();
+        iov[i].iov_len = msg->size();
+    }
+    iov[0].iov_base = (unsigned char*)iov[0].iov_base + mOffset;
+    iov[0].iov_len -= mOffset;
+
+    msghdr msg;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    const int code = sock.sendmsg( &msg, flags );
+    if( 0 < code )
+        pop( code );
+
+    return code;
+}
+
+void
+SendQueue::pop(
+    unsigned int sent
+    )
+{
+    mBytes -= sent;
+
+    /* Drop the messages sent whole. */
+    const unsigned int mask = mRing.size() - 1;
+    for( sent += mOffset; mCount && mRing[mHead]->size() <= sent; --mCount )
+    {
+        sent -= mRing[mHead]->size();
+        mRing[mHead]->release();
+        mHead = (mHead + 1) & mask;
+    }
+
+    mOffset = sent;
+}
+
+void
+SendQueue::grow()
+{
+    /* Unwrap the messages to the start of the bigger ring. */
+    std::vector<Message*> ring( 2 * mRing.size() );
+    for( unsigned int i = 0; i < mCount; ++i )
+        ring[i] = mRing[(mHead + i) & (mRing.size() - 1)];
+
+    mRing.swap( ring );
+    mHead = 0;
+}
+
+/*************************************************************************/
+/* SendQueue::Message                                                    */
+/*************************************************************************/
+SendQueue::Message::Message()
+: mRefs( 1 )
+{
+}
+
+void
+SendQueue::Message::release()
+{
+    if( !--mRefs )
+        delete this;
+}
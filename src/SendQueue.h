@@ -0,0 +1,165 @@
+/** @file
+ * @brief A queue of shared messages to send declarations.
+ *
+ * @author Jan Bobek
+ */
+
+#ifndef __SEND_QUEUE_H__INCL__
+#define __SEND_QUEUE_H__INCL__
+
+#include "Game.h"
+#include "Socket.h"
+
+/**
+ * @brief Queues shared messages for a socket.
+ *
+ * Keeps references to the messages in a ring, which only grows
+ * when full; nothing is copied or moved as the messages go out.
+ * A send gathers up to IOV_BATCH messages straight from where
+ * they are. Not thread-safe.
+ *
+ * @author Jan Bobek
+ */
+class SendQueue
+{
+public:
+    /**
+     * @brief An encoded message shared by the queues.
+     *
+     * Built once, then only read; every queue which has it
+     * holds a reference.
+     *
+     * @author Jan Bobek
+     */
+    class Message
+    {
+    public:
+        /**
+         * @brief Initializes an empty message with a reference.
+         */
+        Message();
+
+        /**
+         * @brief Takes another reference.
+         *
+         * @return The message.
+         */
+        Message* acquire() { ++mRefs; return this; }
+        /**
+         * @brief Drops a reference, deleting the message with the last.
+         */
+        void release();
+
+        /**
+         * @brief Obtains the data to append to while building.
+         *
+         * @return The data.
+         */
+        std::vector<unsigned char>& data() { return mData; }
+        /**
+         * @brief Obtains the data.
+         *
+         * @return The data.
+         */
+        const unsigned char* begin() const { return &mData[0]; }
+        /**
+         * @brief Obtains size of the data.
+         *
+         * @return The size.
+         */
+        unsigned int size() const { return mData.size(); }
+
+    protected:
+        /**
+         * @brief Only release() deletes.
+         */
+        ~Message() {}
+
+        /// The data.
+        std::vector<unsigned char> mData;
+        /// Number of the references.
+        unsigned int mRefs;
+    };
+
+    /**
+     * @brief Initializes an empty queue.
+     */
+    SendQueue();
+    /**
+     * @brief Releases the messages not sent.
+     */
+    ~SendQueue();
+
+    /**
+     * @brief Is there nothing to send?
+     *
+     * @retval true  The queue is empty.
+     * @retval false Some data are waiting.
+     */
+    bool empty() const { return !mCount; }
+    /**
+     * @brief Obtains number of the messages queued.
+     *
+     * @return Number of the messages.
+     */
+    unsigned int size() const { return mCount; }
+    /**
+     * @brief Obtains number of the bytes not sent yet.
+     *
+     * @return Number of the bytes.
+     */
+    unsigned long long bytes() const { return mBytes; }
+
+    /**
+     * @brief Queues a message.
+     *
+     * @param[in] msg The message; a reference is taken.
+     */
+    void push( Message* msg );
+    /**
+     * @brief Drops the messages not started yet.
+     *
+     * A message partly sent stays, so that the peer
+     * does not get half of it.
+     */
+    void drop();
+    /**
+     * @brief Sends as much of the queue as a single syscall takes.
+     *
+     * @param[in] sock  The socket.
+     * @param[in] flags Flags of the send, MSG_NOSIGNAL etc.
+     *
+     * @return A value returned by <code>sendmsg</code>.
+     */
+    int send( Socket& sock, int flags );
+
+protected:
+    /// Most messages gathered into a send.
+    static const unsigned int IOV_BATCH = 64;
+    /// Capacity of an empty ring.
+    static const unsigned int CAPACITY = 16;
+
+    /**
+     * @brief Drops the bytes sent.
+     *
+     * @param[in] sent Number of the bytes.
+     */
+    void pop( unsigned int sent );
+    /**
+     * @brief Doubles the capacity of the ring.
+     */
+    void grow();
+
+    /// The ring; its size is a power of two.
+    std::vector<Message*> mRing;
+    /// Index of the first message.
+    unsigned int mHead;
+    /// Number of the messages.
+    unsigned int mCount;
+    /// Bytes of the first message already sent.
+    unsigned int mOffset;
+    /// Bytes not sent yet.
+    unsigned long long mBytes;
+};
+
+#endif /* !__SEND_QUEUE_H__INCL__ */
@@ -105,7 +105,8 @@ int
 Socket::accept(
     Socket& sock,
     sockaddr* addr,
-    unsigned int* len
+    unsigned int* len,
+    int flags
     )
 {
     /* Close the other socket first. */
@@ -114,7 +115,7 @@ Socket::accept(
         return code;
 
     /* Accept the connection. */
-    sock.mSock = ::accept( mSock, addr, len );
+    sock.mSock = ::accept4( mSock, addr, len, flags );
     return !(0 < sock.mSock);
 }
 
@@ -166,6 +167,15 @@ Socket::sendto(
         flags, to, tolen );
 }
 
+int
+Socket::sendmsg(
+    const msghdr* msg,
+    int flags
+    )
+{
+    return ::sendmsg( mSock, msg, flags );
+}
+
 int
 Socket::setopt(
     int level,
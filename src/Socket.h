@@ -88,14 +88,17 @@ public:
     /**
      * @brief Accepts an incoming connection.
      *
-     * @param[out] sock Where to store the accepted socket.
-     * @param[out] addr Address of the connectee.
-     * @param[out] len  Length of the address of the connectee.
+     * @param[out] sock  Where to store the accepted socket.
+     * @param[out] addr  Address of the connectee.
+     * @param[out] len   Length of the address of the connectee.
+     * @param[in]  flags Optional; flags of the accepted socket,
+     *                   SOCK_NONBLOCK etc.
      *
      * @retval  0  Connection accepted successfully.
      * @retval !=0 Failed to accept the connection.
      */
-    int accept( Socket& sock, sockaddr* addr, unsigned int* len );
+    int accept( Socket& sock, sockaddr* addr, unsigned int* len,
+                int flags = 0 );
 
     /**
      * @brief Retrieves data from the socket.
@@ -144,6 +147,15 @@ public:
      */
     int sendto( const void* buf, unsigned int len, int flags,
                 const sockaddr* to, unsigned int tolen );
+    /**
+     * @brief Sends data gathered from several buffers.
+     *
+     * @param[in] msg   The buffers and other parameters.
+     * @param[in] flags Optional flags.
+     *
+     * @return A value returned by <code>sendmsg</code>.
+     */
+    int sendmsg( const msghdr* msg, int flags );
 
     /**
      * @brief Sets an option of the socket.
@@ -167,6 +179,13 @@ public:
      */
     int fcntl( int cmd, long arg );
 
+    /**
+     * @brief Obtains the descriptor of the socket.
+     *
+     * @return The descriptor; -1 if invalid.
+     */
+    int fd() const { return mSock; }
+
 protected:
     /// The socket
     int mSock;
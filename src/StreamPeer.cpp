@@ -0,0 +1,202 @@
+/** @file
+ * @brief Implementation of a peer over a non-blocking stream.
+ *
+ * @author Jan Bobek
+ */
+
+#include "GameProtocol.h"
+#include "StreamPeer.h"
+#include "util.h"
+
+/*************************************************************************/
+/* StreamPeer                                                            */
+/*************************************************************************/
+StreamPeer::StreamPeer(
+    Socket* sock,
+    unsigned long long& recvs,
+    unsigned long long& sends,
+    unsigned long long& bytesOut
+    )
+: mInputLen( 0 ),
+  mPushed( 0 ),
+  mSyncedEnd( 0 ),
+  mPeak( 0 ),
+  mSocket( sock ),
+  mRecvs( recvs ),
+  mSends( sends ),
+  mBytesOut( bytesOut ),
+  mVersion( 0 ),
+  mWritable( true )
+{
+}
+
+StreamPeer::~StreamPeer()
+{
+    /* Delete the socket. */
+    safeDelete( mSocket );
+}
+
+bool
+StreamPeer::watch(
+    Reactor& reactor,
+    void* data
+    )
+{
+    unsigned int bufsize = 64 * 1024;
+    return
+        /* Increase recv buffer size. */
+        !mSocket->setopt( SOL_SOCKET, SO_RCVBUF,
+                          &bufsize, sizeof( bufsize ) ) &&
+        /* Bound the send buffer; the queue limit does the rest. */
+        !mSocket->setopt( SOL_SOCKET, SO_SNDBUF,
+                          &bufsize, sizeof( bufsize ) ) &&
+        /* Edge-triggered: reported once each time it becomes ready. */
+        !reactor.add( mSocket->fd(),
+                      EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, data );
+}
+
+bool
+StreamPeer::wake(
+    unsigned int events
+    )
+{
+    if( (EPOLLERR & events) || (EPOLLHUP & events) )
+        /* So long, dont come back. */
+        return false;
+
+    if( EPOLLOUT & events )
+        /* The socket takes data again. */
+        mWritable = true;
+
+    if( ((EPOLLIN & events) || (EPOLLRDHUP & events)) && !receive() )
+        /* Whatever came before the end has been handled. */
+        return false;
+
+    /* Once the hello is in. */
+    return mVersion || greet();
+}
+
+void
+StreamPeer::push(
+    Message* msg
+    )
+{
+    mQueue.push( msg );
+    mPushed += msg->size();
+    mPeak = std::max( mPeak, mQueue.bytes() );
+}
+
+bool
+StreamPeer::flush()
+{
+    while( mWritable && !mQueue.empty() )
+    {
+        ++mSends;
+        int code = mQueue.send( *mSocket, MSG_NOSIGNAL );
+
+        if( 0 <= code )
+            /* Sent "code" bytes. */
+            mBytesOut += code;
+        else if( EAGAIN == errno || EWOULDBLOCK == errno )
+            /* Wait for the reactor to tell us it takes data again. */
+            mWritable = false;
+        else if( EINTR != errno )
+            /* Something's fucked up. */
+            return false;
+    }
+
+    return true;
+}
+
+bool
+StreamPeer::greet()
+{
+    if( mInputLen < GameProtocol::HELLO_SIZE )
+        /* Not yet. */
+        return true;
+
+    unsigned char version;
+    if( !GameProtocol::getHello( &mInput[0], version ) )
+        /* Not a hello at all, hang up without a word. */
+        return false;
+    /* receive() has read no further. */
+    mInputLen = 0;
+
+    /* Reply before any frame, so that the snapshot need not wait. */
+    mVersion = GameProtocol::negotiate( version );
+    Message* reply = new Message;
+    GameProtocol::putHello( reply->data(), mVersion );
+    push( reply );
+    reply->release();
+    if( !flush() || !mVersion )
+        /* We have told him why, hang up. */
+        return false;
+
+    /* He may have said more already; receive() left it in the socket. */
+    return receive();
+}
+
+bool
+StreamPeer::receive()
+{
+    /* Edge-triggered, so read until the socket is empty. */
+    while( true )
+    {
+        /* Nothing past the hello until it is checked, see greet(). */
+        const unsigned int want = mVersion ? GAME_NET_RECV_BYTES
+            : GameProtocol::HELLO_SIZE - mInputLen;
+
+        /* Straight behind what is buffered already. */
+        if( mInput.size() < mInputLen + want )
+            mInput.resize( mInputLen + want );
+
+        ++mRecvs;
+        int code = mSocket->recv( &mInput[mInputLen], want, 0 );
+
+        if( 0 < code )
+        {
+            mInputLen += code;
+            /* Keeps the buffer small. */
+            if( mVersion )
+                parse();
+            else if( mInputLen < GameProtocol::HELLO_SIZE )
+                /* The rest of the hello is on the way. */
+                ;
+            else
+            {
+                unsigned char version;
+                /* Junk gets no further than its first bytes. */
+                if( !GameProtocol::getHello( &mInput[0], version ) )
+                    return false;
+                /* The hello is in; greet() reads on. */
+                break;
+            }
+        }
+        else if( !code )
+        {
+            if( !mVersion || !readOnly() )
+                /* The peer has hung up. */
+                return false;
+            /* Done talking, but still listening. */
+            break;
+        }
+        else if( EAGAIN == errno || EWOULDBLOCK == errno )
+            break;
+        else if( EINTR != errno )
+            /* Something's fucked up. */
+            return false;
+
+        if( want > (unsigned int)code )
+            /* Short read, the socket is empty. */
+            break;
+    }
+
+    return true;
+}
+
+void
+StreamPeer::parse()
+{
+    /* Nothing to say to us. */
+    mInputLen = 0;
+}
@@ -0,0 +1,181 @@
+/** @file
+ * @brief A peer over a non-blocking stream declarations.
+ *
+ * @author Jan Bobek
+ */
+
+#ifndef __STREAM_PEER_H__INCL__
+#define __STREAM_PEER_H__INCL__
+
+#include "Game.h"
+#include "Reactor.h"
+#include "SendQueue.h"
+#include "Socket.h"
+
+/**
+ * @brief A peer connected over a non-blocking stream.
+ *
+ * Watched by a reactor, edge-triggered. Reads in bulk until
+ * the socket is empty, but no further than the hello until it
+ * is checked; replies to the hello with the version to speak.
+ * Sends the messages queued as long as the socket takes them.
+ * What comes after the hello is up to parse().
+ *
+ * @author Jan Bobek
+ */
+class StreamPeer
+{
+public:
+    /// An encoded message shared by the peers.
+    typedef SendQueue::Message Message;
+
+    /**
+     * @brief Initializes the peer.
+     *
+     * @param[in] sock     Socket of the peer; taken over.
+     * @param[in] recvs    Where to count the calls to <code>recv</code>.
+     * @param[in] sends    Where to count the calls to <code>send</code>.
+     * @param[in] bytesOut Where to count the bytes sent.
+     */
+    StreamPeer( Socket* sock, unsigned long long& recvs,
+                unsigned long long& sends, unsigned long long& bytesOut );
+    /**
+     * @brief Releases the socket.
+     */
+    virtual ~StreamPeer();
+
+    /**
+     * @brief Obtains the version of the protocol spoken.
+     *
+     * @return The version; 0 until the hello is received.
+     */
+    unsigned char version() const { return mVersion; }
+    /**
+     * @brief Obtains number of the bytes queued since the last snapshot.
+     *
+     * The snapshot still being sent does not count.
+     *
+     * @return Number of the bytes.
+     */
+    unsigned long long backlog() const
+    {
+        return std::min( mQueue.bytes(), mPushed - mSyncedEnd );
+    }
+
+    /**
+     * @brief Obtains the socket of the peer.
+     *
+     * @return The socket.
+     */
+    Socket& socket() { return *mSocket; }
+    /**
+     * @brief Starts watching the socket.
+     *
+     * Bounds the socket buffers first; the queue limit
+     * of the model does the rest.
+     *
+     * @param[in] reactor The reactor.
+     * @param[in] data    Reported along with the events.
+     *
+     * @retval true  Watched.
+     * @retval false Failed; the peer must be dropped.
+     */
+    bool watch( Reactor& reactor, void* data );
+    /**
+     * @brief Handles the events reported by the reactor.
+     *
+     * Notes that the socket takes data again, reads whatever
+     * has come and handles the hello once it is in. A hangup
+     * of the reading side is noticed only once everything sent
+     * before it has been read.
+     *
+     * @param[in] events The events, EPOLLIN etc.
+     *
+     * @retval true  Ok.
+     * @retval false The peer has hung up, is not speaking
+     *               our language, or I/O failed.
+     */
+    bool wake( unsigned int events );
+    /**
+     * @brief Queues a message for the peer.
+     *
+     * @param[in] msg The message; a reference is taken.
+     */
+    void push( Message* msg );
+    /**
+     * @brief Sends as much of the queue as the socket takes.
+     *
+     * @retval true  Send ok.
+     * @retval false Send failed.
+     */
+    bool flush();
+
+protected:
+    /**
+     * @brief Handles the hello of the peer, if received.
+     *
+     * Replies with the version to speak right away,
+     * then reads whatever has come after the hello.
+     *
+     * @retval true  The hello is ok or yet to come.
+     * @retval false The peer must be dropped.
+     */
+    bool greet();
+    /**
+     * @brief Reads everything the peer has sent.
+     *
+     * Until the hello is handled, reads no further than
+     * the hello and fails if it is not one; after it,
+     * parses as it goes, so that the buffer stays small.
+     *
+     * @retval true  Read ok.
+     * @retval false The peer has hung up, or read failed.
+     *               A peer which only reads may hang up
+     *               once it has said hello, see readOnly().
+     */
+    bool receive();
+    /**
+     * @brief Parses the whole messages received after the hello.
+     *
+     * The rest stays buffered for the next read. Throws
+     * everything away, unless overridden.
+     */
+    virtual void parse();
+    /**
+     * @brief Does the peer only read after the hello?
+     *
+     * Such a peer may shut down its side of the stream once
+     * it has said hello; it is not dropped for that.
+     *
+     * @retval true  It only reads.
+     * @retval false It keeps talking; a hangup drops it.
+     */
+    virtual bool readOnly() const { return false; }
+
+    /// The messages to send.
+    SendQueue mQueue;
+    /// The receive buffer; an incomplete message at most after parse().
+    std::vector<unsigned char> mInput;
+    /// Bytes of the receive buffer filled.
+    unsigned int mInputLen;
+    /// Bytes ever queued.
+    unsigned long long mPushed;
+    /// Bytes ever queued up to the end of the last snapshot.
+    unsigned long long mSyncedEnd;
+    /// Most bytes ever queued.
+    unsigned long long mPeak;
+    /// Socket of the peer; NULL if there is no stream.
+    Socket* mSocket;
+    /// Where to count the calls to <code>recv</code>.
+    unsigned long long& mRecvs;
+    /// Where to count the calls to <code>send</code>.
+    unsigned long long& mSends;
+    /// Where to count the bytes sent.
+    unsigned long long& mBytesOut;
+    /// Version of the protocol spoken; 0 until the hello.
+    unsigned char mVersion;
+    /// Does the socket take data?
+    bool mWritable;
+};
+
+#endif /* !__STREAM_PEER_H__INCL__ */
@@ -0,0 +1,117 @@
+/** @file
+ * @brief Implementation of a pool of worker threads.
+ *
+ * @author Jan Bobek
+ */
+
+#include "ThreadPool.h"
+
+/*************************************************************************/
+/* ThreadPool                                                            */
+/*************************************************************************/
+ThreadPool::ThreadPool(
+    unsigned int threads
+    )
+: mTask( NULL ),
+  mCount( 0 ),
+  mNext( 0 ),
+  mBusy( 0 ),
+  mBatch( 0 ),
+  mQuit( false )
+{
+    pthread_mutex_init( &mMutex, NULL );
+    pthread_cond_init( &mStart, NULL );
+    pthread_cond_init( &mDone, NULL );
+
+    for( unsigned int i = 0; i < threads; ++i )
+    {
+        pthread_t thread;
+        if( !pthread_create( &thread, NULL, worker, this ) )
+            mThreads.push_back( thread );
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    /* Tell the workers to quit. */
+    pthread_mutex_lock( &mMutex );
+    mQuit = true;
+    pthread_cond_broadcast( &mStart );
+    pthread_mutex_unlock( &mMutex );
+
+    std::vector<pthread_t>::iterator cur, end;
+    cur = mThreads.begin();
+    end = mThreads.end();
+    for(; cur != end; ++cur )
+        pthread_join( *cur, NULL );
+
+    pthread_cond_destroy( &mDone );
+    pthread_cond_destroy( &mStart );
+    pthread_mutex_destroy( &mMutex );
+}
+
+void
+ThreadPool::run(
+    Task& task,
+    unsigned int count
+    )
+{
+    /* Publish the batch. */
+    pthread_mutex_lock( &mMutex );
+    mTask = &task;
+    mCount = count;
+    mNext = 0;
+    mBusy = mThreads.size();
+    ++mBatch;
+    pthread_cond_broadcast( &mStart );
+    pthread_mutex_unlock( &mMutex );
+
+    /* Lend a hand. */
+    work();
+
+    /* Wait for the workers. */
+    pthread_mutex_lock( &mMutex );
+    while( mBusy )
+        pthread_cond_wait( &mDone, &mMutex );
+    mTask = NULL;
+    pthread_mutex_unlock( &mMutex );
+}
+
+void*
+ThreadPool::worker(
+    void* pool
+    )
+{
+    ThreadPool* tp = (ThreadPool*)pool;
+    unsigned int batch = 0;
+
+    pthread_mutex_lock( &tp->mMutex );
+    while( true )
+    {
+        /* Wait for a batch. */
+        while( batch == tp->mBatch && !tp->mQuit )
+            pthread_cond_wait( &tp->mStart, &tp->mMutex );
+        if( tp->mQuit )
+            break;
+
+        batch = tp->mBatch;
+        pthread_mutex_unlock( &tp->mMutex );
+
+        tp->work();
+
+        pthread_mutex_lock( &tp->mMutex );
+        if( !--tp->mBusy )
+            pthread_cond_signal( &tp->mDone );
+    }
+    pthread_mutex_unlock( &tp->mMutex );
+
+    return NULL;
+}
+
+void
+ThreadPool::work()
+{
+    unsigned int idx;
+    while( (idx = __sync_fetch_and_add( &mNext, 1 )) < mCount )
+        mTask->run( idx );
+}
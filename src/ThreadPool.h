@@ -0,0 +1,109 @@
+/** @file
+ * @brief A simple pool of worker threads.
+ *
+ * @author Jan Bobek
+ */
+
+#ifndef __THREAD_POOL_H__INCL__
+#define __THREAD_POOL_H__INCL__
+
+#include "Game.h"
+
+/**
+ * @brief A pool of worker threads.
+ *
+ * Runs a batch of indexed jobs at a time; the calling
+ * thread joins the workers until the batch is done.
+ *
+ * @author Jan Bobek
+ */
+class ThreadPool
+{
+public:
+    /**
+     * @brief A batch of jobs.
+     *
+     * @author Jan Bobek
+     */
+    class Task
+    {
+    public:
+        /**
+         * @brief Properly delete the task.
+         */
+        virtual ~Task() {}
+
+        /**
+         * @brief Runs a single job.
+         *
+         * May be called from any thread.
+         *
+         * @param[in] idx Index of the job.
+         */
+        virtual void run( unsigned int idx ) = 0;
+    };
+
+    /**
+     * @brief Starts the worker threads.
+     *
+     * @param[in] threads Number of worker threads.
+     */
+    ThreadPool( unsigned int threads );
+    /**
+     * @brief Stops the worker threads.
+     */
+    ~ThreadPool();
+
+    /**
+     * @brief Obtains number of worker threads.
+     *
+     * @return Number of worker threads.
+     */
+    unsigned int size() const { return mThreads.size(); }
+
+    /**
+     * @brief Runs a batch of jobs, waits until done.
+     *
+     * @param[in] task  The task.
+     * @param[in] count Number of jobs; run with indices 0 .. count-1.
+     */
+    void run( Task& task, unsigned int count );
+
+protected:
+    /**
+     * @brief Entry point of a worker thread.
+     *
+     * @param[in] pool The pool.
+     *
+     * @return Always NULL.
+     */
+    static void* worker( void* pool );
+    /**
+     * @brief Runs jobs of the current batch until none is left.
+     */
+    void work();
+
+    /// The worker threads.
+    std::vector<pthread_t> mThreads;
+    /// Guards the members below.
+    pthread_mutex_t mMutex;
+    /// Signals a new batch (or quit) to the workers.
+    pthread_cond_t mStart;
+    /// Signals end of a batch to the caller.
+    pthread_cond_t mDone;
+
+    /// The current task.
+    Task* mTask;
+    /// Number of jobs in the current batch.
+    unsigned int mCount;
+    /// Index of the next job to run.
+    unsigned int mNext;
+    /// Number of workers still in the current batch.
+    unsigned int mBusy;
+    /// Number of the current batch.
+    unsigned int mBatch;
+    /// Shall the workers quit?
+    bool mQuit;
+};
+
+#endif /* !__THREAD_POOL_H__INCL__ */
@@ -0,0 +1,2112 @@
+/** @file
+ * @brief The benchmark entry point.
+ *
+ * @author Jan Bobek
+ */
+
+#include "GameCanvas.h"
+#include "GameController.h"
+#include "GameDistanceField.h"
+#include "GameLocalModel.h"
+#include "GameMonsterKernel.h"
+#include "GamePathGraph.h"
+#include "GameProtocol.h"
+#include "GameRelayModel.h"
+#include "GameRemoteModel.h"
+#include "GameServerModel.h"
+#include "PerfCounters.h"
+#include "util.h"
+
+/**
+ * @brief A canvas which draws nothing.
+ *
+ * Used to measure the rendering path without a terminal.
+ *
+ * @author Jan Bobek
+ */
+class NullCanvas
+: public GameCanvas
+{
+public:
+    /**
+     * @brief Initializes the counter.
+     */
+    NullCanvas() : mDraws( 0 ) {}
+
+    /**
+     * @brief Counts the draw.
+     *
+     * @param[in] entity The entity to draw.
+     * @param[in] coord  The coords at which to draw.
+     */
+    void draw( GameEntity entity, const GameCoord& coord )
+    {
+        mDraws += entity + coord.row + coord.col;
+    }
+    /**
+     * @brief Does nothing.
+     */
+    void flush() {}
+
+    /// A checksum of the draws.
+    unsigned long mDraws;
+};
+
+/**
+ * @brief A canvas which follows the only player.
+ *
+ * Used to see when a move shows up on the screen.
+ *
+ * @author Jan Bobek
+ */
+class TrackCanvas
+: public GameCanvas
+{
+public:
+    /**
+     * @brief Initializes the canvas.
+     */
+    TrackCanvas() : mSeen( false ), mMoved( false ), mHash( 0 ) {}
+
+    /**
+     * @brief Notes where the player is drawn.
+     *
+     * @param[in] entity The entity to draw.
+     * @param[in] coord  The coords at which to draw.
+     */
+    void draw( GameEntity entity, const GameCoord& coord )
+    {
+        if( GENT_PLAYER == entity && (!mSeen || coord != mPlayer) )
+        {
+            /* Showing up is no move. */
+            mMoved = mSeen;
+            mPlayer = coord;
+            mSeen = true;
+        }
+
+        mHash = mHash * 31 + entity * 7 + coord.row * 131 + coord.col;
+    }
+    /**
+     * @brief Does nothing.
+     */
+    void flush() {}
+
+    /// Has the player been drawn yet?
+    bool mSeen;
+    /// Where the player has been drawn last.
+    GameCoord mPlayer;
+    /// Has the player been drawn elsewhere since?
+    bool mMoved;
+    /// A hash of the draws.
+    unsigned long mHash;
+};
+
+/**
+ * @brief A controller which plays what it is told.
+ *
+ * @author Jan Bobek
+ */
+class ScriptController
+: public GameController
+{
+public:
+    /**
+     * @brief Initializes the controller.
+     *
+     * @param[in] next Where the next action is put; reset once played.
+     */
+    ScriptController( GameCtlEvent& next ) : mNext( next ) {}
+
+    /**
+     * @brief Plays the next action.
+     *
+     * @param[out] event The control event.
+     */
+    void tick( GameCtlEvent& event )
+    {
+        event = mNext;
+        mNext = GCE_NOOP;
+    }
+
+protected:
+    /// Where the next action is put.
+    GameCtlEvent& mNext;
+};
+
+/**
+ * @brief Joins a remote model to a server ticked elsewhere.
+ *
+ * @author Jan Bobek
+ */
+struct RemoteJoin
+{
+    /// The remote model.
+    GameRemoteModel* model;
+    /// The event adding the player.
+    GameModelEvent event;
+    /// Has the model joined?
+    volatile bool done;
+};
+
+/**
+ * @brief Opens a relay to a server ticked elsewhere.
+ *
+ * @author Jan Bobek
+ */
+struct RelayOpen
+{
+    /// The relay.
+    GameRelayModel* relay;
+    /// Address to listen at, IP-NUL-port-NUL.
+    const char* addr;
+    /// Has the relay opened?
+    bool ok;
+    /// Has the open returned?
+    volatile bool done;
+};
+
+/**
+ * @brief A client which only acknowledges the frames.
+ *
+ * Used to measure the server without any remote models.
+ *
+ * @author Jan Bobek
+ */
+class NetClient
+{
+public:
+    /**
+     * @brief Initializes the client.
+     *
+     * @param[in] sock A connected socket; consumed.
+     */
+    NetClient( Socket*& sock );
+    /**
+     * @brief Closes the socket.
+     */
+    ~NetClient();
+
+    /**
+     * @brief Sends a control event and an acknowledgement.
+     *
+     * @param[in] event The control event.
+     * @param[in] tick  Tick of the client the event is of.
+     * @param[in] more  Held back for the next send, in a single segment.
+     */
+    void send( GameCtlEvent event, unsigned int tick, bool more = false );
+    /**
+     * @brief Acknowledges the frames read, if not yet.
+     *
+     * No control events, so the server opens no channels.
+     */
+    void ack();
+    /**
+     * @brief Reads whatever has arrived.
+     */
+    void read();
+
+    /// Bytes received.
+    unsigned long long mBytes;
+
+protected:
+    /// Our socket.
+    Socket* mSocket;
+    /// Bytes to skip until the next frame header.
+    unsigned int mSkip;
+    /// The frame header read so far.
+    unsigned char mHeader[GameProtocol::HEADER_SIZE];
+    /// Bytes of the frame header read so far.
+    unsigned int mHeaderGot;
+    /// Tick of the last frame.
+    unsigned int mTick;
+    /// The last tick acknowledged.
+    unsigned int mAcked;
+};
+
+int bench_game( int argc, char* argv[] );
+int bench_dist( int argc, char* argv[] );
+int bench_path( int argc, char* argv[] );
+int bench_monsters( int argc, char* argv[] );
+int bench_input( int argc, char* argv[] );
+int bench_net( int argc, char* argv[] );
+int bench_sendq( int argc, char* argv[] );
+int bench_predict( int argc, char* argv[] );
+int bench_udp( int argc, char* argv[] );
+int bench_jitter( int argc, char* argv[] );
+int bench_relay( int argc, char* argv[] );
+void* bench_predict_join( void* arg );
+void* bench_relay_open( void* arg );
+bool bench_relay_connect( const char* port, unsigned int count,
+                          std::vector<NetClient*>& clients );
+void bench_spawn( GameRemoteModel& rm, GameServerModel& gm );
+bool bench_sendq_connect( const char* port, Socket& writer, Socket& reader );
+unsigned int bench_sendq_drain( Socket& reader, unsigned int chunk );
+void bench_path_size( const GameCoord& size, unsigned int queries );
+
+template< typename T >
+T* bench_map( const GameCoord& size );
+GameEntity bench_tile( const GameCoord& pos );
+double bench_time();
+void bench_report( const char* tit, const PerfCounters& pc,
+                   double secs, unsigned int ticks );
+
+int
+main(
+    int argc,
+    char* argv[]
+    )
+{
+    /* Make the runs reproducible. */
+    srand( 1 );
+
+    const char* mode = (1 < argc ? argv[1] : "game");
+    if( !strcmp( mode, "game" ) )
+        return bench_game( argc - 1, argv + 1 );
+    else if( !strcmp( mode, "dist" ) )
+        return bench_dist( argc - 1, argv + 1 );
+    else if( !strcmp( mode, "path" ) )
+        return bench_path( argc - 1, argv + 1 );
+    else if( !strcmp( mode, "monsters" ) )
+        return bench_monsters( argc - 1, argv + 1 );
+    else if( !strcmp( mode, "input" ) )
+        return bench_input( argc - 1, argv + 1 );
+    else if( !strcmp( mode, "net" ) )
+        return bench_net( argc - 1, argv + 1 );
+    else if( !strcmp( mode, "sendq" ) )
+        return bench_sendq( argc - 1, argv + 1 );
+    else if( !strcmp( mode, "predict" ) )
+        return bench_predict( argc - 1, argv + 1 );
+    else if( !strcmp( mode, "udp" ) )
+        return bench_udp( argc - 1, argv + 1 );
+    else if( !strcmp( mode, "jitter" ) )
+        return bench_jitter( argc - 1, argv + 1 );
+    else if( !strcmp( mode, "relay" ) )
+        return bench_relay( argc - 1, argv + 1 );
+
+    fprintf( stderr, "Usage: %s [game|dist|path|monsters|input|net|sendq|predict|udp|jitter|relay] [args...]\n", argv[0] );
+    return 1;
+}
+
+int
+bench_game(
+    int argc,
+    char* argv[]
+    )
+{
+    /* Parse the arguments. */
+    GameCoord size(
+        1 < argc ? atoi( argv[1] ) : 101,
+        2 < argc ? atoi( argv[2] ) : 101 );
+    unsigned int players  = 3 < argc ? atoi( argv[3] ) : 8;
+    unsigned int monsters = 4 < argc ? atoi( argv[4] ) : 200;
+    unsigned int ticks    = 5 < argc ? atoi( argv[5] ) : 1000;
+    unsigned int budget   = 6 < argc ? atoi( argv[6] ) : 0;
+    unsigned int iters    = 7 < argc ? atoi( argv[7] ) : 0;
+    unsigned int threads  = 8 < argc ? atoi( argv[8] ) : 0;
+    unsigned int graph    = 9 < argc ? atoi( argv[9] )
+        : GAME_PATH_GRAPH_TILES <= size.row * size.col;
+    /* 0 for no batch, otherwise GameMonsterKernel::Isa + 1. */
+    unsigned int kernel   = 10 < argc ? atoi( argv[10] ) : 0;
+    unsigned int scripted = 11 < argc ? atoi( argv[11] ) : 0;
+
+    /* Before the workers start, so that they are counted too. */
+    PerfCounters simpc, drawpc;
+    double simsecs = 0.0, drawsecs = 0.0, t;
+
+    /* Build the map. */
+    GameLocalModel* gm = bench_map<GameLocalModel>( size );
+    gm->setSearchBudget( budget, iters );
+    gm->setThreads( threads );
+    gm->setPathGraph( graph );
+    gm->setMonsterKernel( 0 < kernel, (GameMonsterKernel::Isa)(kernel - 1) );
+    gm->setScriptedMonsters( scripted );
+    if( gm->spawnCount() < players + monsters )
+    {
+        fprintf( stderr, "Not enough spawns (%u) for %u entities.\n",
+                 gm->spawnCount(), players + monsters );
+        safeDelete( gm );
+        return 1;
+    }
+
+    /* Spawn the entities. */
+    GameModelEvent event;
+    event.coords = GameCoordRect( size, size );
+    event.ctl = NULL;
+
+    event.entity = GENT_PLAYER;
+    for( unsigned int i = 0; i < players; ++i )
+        gm->dispatch( event );
+    event.entity = GENT_MONSTER;
+    for( unsigned int i = 0; i < monsters; ++i )
+        gm->dispatch( event );
+
+    /* Initial draw. */
+    NullCanvas canvas;
+    gm->redraw( canvas );
+
+    unsigned int done = 0;
+    while( done < ticks )
+    {
+        /* Simulation. */
+        t = bench_time();
+        simpc.start();
+        const bool cont = gm->tick();
+        simpc.stop();
+        simsecs += bench_time() - t;
+
+        if( !cont )
+            break;
+
+        /* Rendering. */
+        t = bench_time();
+        drawpc.start();
+        gm->draw( canvas );
+        drawpc.stop();
+        drawsecs += bench_time() - t;
+
+        ++done;
+    }
+
+    printf( "map %ux%u, %u players, %u %smonsters, %u/%u ticks, %u threads, %s, %s\n",
+            size.row, size.col, players, monsters, scripted ? "scripted " : "",
+            done, ticks, threads,
+            graph ? "path graph" : "distance field",
+            kernel ? GameMonsterKernel::name( (GameMonsterKernel::Isa)(kernel - 1) )
+            : "no monster batch" );
+    bench_report( "simulation", simpc, simsecs, done );
+    bench_report( "render", drawpc, drawsecs, done );
+    printf( "render checksum %lu\n", canvas.mDraws );
+
+    const GameLocalModel::SearchStats ss = gm->searchStats();
+    if( ss.ticks )
+        printf( "search: %.1f iterations/tick, %.1f nodes/tick, "
+                "%.0f nodes/s, %.0f%% of %u us budget used, %.1f%% nodes reused\n",
+                (double)ss.iterations / ss.ticks,
+                (double)ss.nodes / ss.ticks,
+                ss.usedNs ? 1e9 * ss.nodes / ss.usedNs : 0.0,
+                ss.budgetNs ? 100.0 * ss.usedNs / ss.budgetNs : 0.0,
+                budget,
+                ss.nodes + ss.reused
+                ? 100.0 * ss.reused / (ss.nodes + ss.reused) : 0.0 );
+
+    const GameFramePool& fp = gm->framePool();
+    if( fp.frames() )
+        printf( "frame pool: %u frames, %.1f KiB in chunks, %u heap allocations\n",
+                (unsigned int)fp.frames(), fp.memory() / 1024.0,
+                (unsigned int)fp.heapAllocs() );
+
+    safeDelete( gm );
+    return 0;
+}
+
+int
+bench_dist(
+    int argc,
+    char* argv[]
+    )
+{
+    /* Parse the arguments. */
+    GameCoord size(
+        1 < argc ? atoi( argv[1] ) : 501,
+        2 < argc ? atoi( argv[2] ) : 501 );
+    unsigned int sources = 3 < argc ? atoi( argv[3] ) : 8;
+    unsigned int ticks   = 4 < argc ? atoi( argv[4] ) : 200;
+    unsigned int breaks  = 5 < argc ? atoi( argv[5] ) : 16;
+    unsigned int speed   = 6 < argc ? atoi( argv[6] ) : GAME_SPEED_DEFAULT;
+
+    /* Build the map. */
+    GameDistanceField inc( size ), full( size );
+    std::vector<GameCoord> walls, spawns, srcs;
+
+    for( GameCoord cur; cur.row < size.row; ++cur.row )
+        for( cur.col = 0; cur.col < size.col; ++cur.col )
+            switch( bench_tile( cur ) )
+            {
+                case GENT_SPAWN:
+                    spawns.push_back( cur );
+                    break;
+                case GENT_WALL:
+                    walls.push_back( cur );
+                    /* Fall through. */
+                case GENT_BARRIER:
+                    inc.set( cur, GameDistanceField::TILE_BLOCKED );
+                    full.set( cur, GameDistanceField::TILE_BLOCKED );
+                    break;
+                default:
+                    break;
+            }
+
+    for( unsigned int i = 0; i < sources && !spawns.empty(); ++i )
+    {
+        const size_t idx = rand() % spawns.size();
+        srcs.push_back( spawns[idx] );
+        spawns.erase( spawns.begin() + idx );
+
+        inc.set( srcs.back(), GameDistanceField::TILE_SOURCE );
+        full.set( srcs.back(), GameDistanceField::TILE_SOURCE );
+    }
+
+    inc.update();
+    full.update();
+
+    PerfCounters incpc, fullpc;
+    double incsecs = 0.0, fullsecs = 0.0, t;
+    unsigned long long visited = inc.visited(), wrong = 0;
+
+    for( unsigned int tick = 0; tick < ticks; ++tick )
+    {
+        /* Break some walls ... */
+        for( unsigned int i = 0; i < breaks && !walls.empty(); ++i )
+        {
+            const size_t idx = rand() % walls.size();
+            inc.set( walls[idx], GameDistanceField::TILE_PASSABLE );
+            full.set( walls[idx], GameDistanceField::TILE_PASSABLE );
+
+            walls[idx] = walls.back();
+            walls.pop_back();
+        }
+
+        /* ... and move the sources, each at its own time. */
+        for( size_t i = 0; i < srcs.size(); ++i )
+        {
+            if( !speed || (tick + i) % speed )
+                continue;
+
+            const unsigned int move = rand() % 4;
+            const GameCoord next(
+                srcs[i].row + (move < 2 ? 2 * (int)move - 1 : 0),
+                srcs[i].col + (move < 2 ? 0 : 2 * (int)move - 5) );
+
+            if( !(next.row < size.row) || !(next.col < size.col) ||
+                GameDistanceField::TILE_PASSABLE != inc.tile( next ) )
+                continue;
+
+            inc.set( srcs[i], GameDistanceField::TILE_PASSABLE );
+            full.set( srcs[i], GameDistanceField::TILE_PASSABLE );
+            inc.set( next, GameDistanceField::TILE_SOURCE );
+            full.set( next, GameDistanceField::TILE_SOURCE );
+            srcs[i] = next;
+        }
+
+        /* Repair ... */
+        t = bench_time();
+        incpc.start();
+        inc.update();
+        incpc.stop();
+        incsecs += bench_time() - t;
+
+        /* ... and compute from scratch. */
+        t = bench_time();
+        fullpc.start();
+        full.invalidate();
+        full.update();
+        fullpc.stop();
+        fullsecs += bench_time() - t;
+
+        /* They must agree. */
+        for( GameCoord cur; cur.row < size.row; ++cur.row )
+            for( cur.col = 0; cur.col < size.col; ++cur.col )
+                if( inc.dist( cur ) != full.dist( cur ) )
+                    ++wrong;
+    }
+
+    printf( "map %ux%u, %u sources moving every %u ticks, %u ticks, "
+            "%u walls broken/tick\n", size.row, size.col,
+            (unsigned int)srcs.size(), speed, ticks, breaks );
+    bench_report( "repair", incpc, incsecs, ticks );
+    bench_report( "rebuild", fullpc, fullsecs, ticks );
+    printf( "repair visited %.1f tiles/tick of %u, %llu wrong distances\n",
+            (double)(inc.visited() - visited) / (ticks ? ticks : 1),
+            size.row * size.col, wrong );
+
+    return wrong ? 1 : 0;
+}
+
+int
+bench_monsters(
+    int argc,
+    char* argv[]
+    )
+{
+    /* Parse the arguments. */
+    GameCoord size(
+        1 < argc ? atoi( argv[1] ) : 501,
+        2 < argc ? atoi( argv[2] ) : 501 );
+    unsigned int monsters = 3 < argc ? atoi( argv[3] ) : 10000;
+    unsigned int ticks    = 4 < argc ? atoi( argv[4] ) : 200;
+    unsigned int sources  = 5 < argc ? atoi( argv[5] ) : 8;
+
+    /* A kernel for each supported instruction set. */
+    const unsigned int isas = GameMonsterKernel::best() + 1;
+    std::vector<GameMonsterKernel*> kernels;
+    for( unsigned int i = 0; i < isas; ++i )
+        kernels.push_back(
+            new GameMonsterKernel( size, (GameMonsterKernel::Isa)i ) );
+
+    /* Build the map. */
+    GameDistanceField field( size );
+    std::vector<GameCoord> spawns;
+
+    for( GameCoord cur; cur.row < size.row; ++cur.row )
+        for( cur.col = 0; cur.col < size.col; ++cur.col )
+        {
+            const GameEntity ent = bench_tile( cur );
+            if( GENT_SPAWN == ent )
+                spawns.push_back( cur );
+
+            const bool passable = GENT_WALL != ent && GENT_BARRIER != ent;
+            field.set( cur, passable ? GameDistanceField::TILE_PASSABLE
+                       : GameDistanceField::TILE_BLOCKED );
+            for( unsigned int i = 0; i < isas; ++i )
+                kernels[i]->set( cur, passable );
+        }
+
+    for( unsigned int i = 0; i < sources && !spawns.empty(); ++i )
+        field.set( spawns[rand() % spawns.size()],
+                   GameDistanceField::TILE_SOURCE );
+    field.update();
+
+    /* The monsters may share tiles, the kernel does not mind. */
+    std::vector<GameCoord> pos;
+    std::vector<std::vector<unsigned int> > seeds( isas );
+    for( unsigned int i = 0; i < monsters && !spawns.empty(); ++i )
+    {
+        pos.push_back( spawns[rand() % spawns.size()] );
+
+        const unsigned int seed = rand();
+        for( unsigned int j = 0; j < isas; ++j )
+            seeds[j].push_back( seed );
+    }
+
+    std::vector<PerfCounters> pcs( isas );
+    std::vector<double> secs( isas, 0.0 );
+    unsigned long long wrong = 0, moves = 0;
+    double t;
+
+    for( unsigned int tick = 0; tick < ticks; ++tick )
+    {
+        /* Decide, with the field half the time. */
+        const unsigned int* dist = tick % 2 ? field.distances() : NULL;
+        for( unsigned int i = 0; i < isas; ++i )
+        {
+            GameMonsterKernel& k = *kernels[i];
+
+            t = bench_time();
+            pcs[i].start();
+            k.clear();
+            for( size_t j = 0; j < pos.size(); ++j )
+                k.add( pos[j], seeds[i][j] );
+            k.decide( dist );
+            pcs[i].stop();
+            secs[i] += bench_time() - t;
+
+            /* Must decide exactly as the scalar kernel. */
+            for( size_t j = 0; j < pos.size(); ++j )
+            {
+                seeds[i][j] = k.seed( j );
+                if( k.event( j ) != kernels[0]->event( j ) ||
+                    seeds[i][j] != seeds[0][j] )
+                    ++wrong;
+            }
+        }
+
+        /* Move the monsters. */
+        for( size_t j = 0; j < pos.size(); ++j )
+        {
+            const GameCtlEvent ev = kernels[0]->event( j );
+            if( GCE_NOOP == ev )
+                continue;
+
+            const unsigned int move = ev - GCE_MOVEUP;
+            pos[j].row += (move < 2 ? 2 * (int)move - 1 : 0);
+            pos[j].col += (move < 2 ? 0 : 2 * (int)move - 5);
+            ++moves;
+        }
+    }
+
+    printf( "map %ux%u, %u monsters, %u ticks, %.1f%% moved/tick\n",
+            size.row, size.col, (unsigned int)pos.size(), ticks,
+            pos.empty() || !ticks ? 0.0
+            : 100.0 * moves / pos.size() / ticks );
+    for( unsigned int i = 0; i < isas; ++i )
+        bench_report( GameMonsterKernel::name( (GameMonsterKernel::Isa)i ),
+                      pcs[i], secs[i], ticks );
+    printf( "%llu decisions differ from the scalar kernel\n", wrong );
+
+    for( unsigned int i = 0; i < isas; ++i )
+        safeDelete( kernels[i] );
+    return wrong ? 1 : 0;
+}
+
+int
+bench_input(
+    int argc,
+    char* argv[]
+    )
+{
+    /* Parse the arguments. */
+    unsigned int ticks    = 1 < argc ? atoi( argv[1] ) : 300;
+    unsigned int periodUs = 2 < argc ? atoi( argv[2] ) : 1000000 / GAME_TICKS_PER_SEC / 10;
+    unsigned int burst    = 3 < argc ? atoi( argv[3] ) : 3;
+
+    int fds[2];
+    if( pipe( fds ) )
+    {
+        perror( "pipe" );
+        return 1;
+    }
+
+    static const char* const KEYS[] =
+    {
+        "\033[A", "\033OB", "\033[D", "\033OC", " ", "\n"
+    };
+
+    NcursesController* ctl = new NcursesController( fds[0] );
+
+    /* Reading one key per tick, as wgetch() in nodelay mode did. */
+    std::queue<double> fifo;
+    double fifoLatency = 0.0, fifoMax = 0.0;
+    unsigned int fifoPlayed = 0;
+
+    unsigned int pressed = 0, played = 0, tick = 0;
+    for(; tick < ticks || (played < pressed && tick < ticks + 100); ++tick )
+    {
+        /* Press some keys, half of them in two pieces. */
+        const unsigned int keys = tick < ticks ? rand() % (burst + 1) : 0;
+        for( unsigned int i = 0; i < keys; ++i )
+        {
+            const unsigned int key = rand() % 6;
+            const char* seq = KEYS[key];
+            const size_t len = strlen( seq ), cut = rand() % 2 ? len / 2 : len;
+
+            if( write( fds[1], seq, cut ) < 0 ||
+                (cut < len && write( fds[1], seq + cut, len - cut ) < 0) )
+                perror( "write" );
+
+            fifo.push( bench_time() );
+            if( 4 <= key )
+                ++pressed;
+        }
+
+        usleep( periodUs );
+
+        GameCtlEvent event;
+        ctl->tick( event );
+        if( GCE_PUTBOMB == event || GCE_RCEXPLODE == event )
+            ++played;
+
+        if( !fifo.empty() )
+        {
+            const double lat = bench_time() - fifo.front();
+            fifoLatency += lat;
+            fifoMax = std::max( fifoMax, lat );
+            ++fifoPlayed;
+            fifo.pop();
+        }
+    }
+
+    /* Whatever is left, then a move, a bomb and a move at once. */
+    GameCtlEvent event;
+    do
+        ctl->tick( event );
+    while( GCE_NOOP != event );
+
+    const char* order = "\033[A \033[B";
+    if( write( fds[1], order, strlen( order ) ) < 0 )
+        perror( "write" );
+    usleep( periodUs );
+
+    GameCtlEvent first, second, third;
+    ctl->tick( first );
+    ctl->tick( second );
+    ctl->tick( third );
+    const bool ordered = GCE_MOVEUP == first && GCE_PUTBOMB == second
+        && GCE_MOVEDOWN == third;
+
+    const NcursesController::Stats stats = ctl->stats();
+    safeDelete( ctl );
+    close( fds[0] );
+    close( fds[1] );
+
+    printf( "%u ticks of %u us, up to %u keys/tick\n", tick, periodUs, burst );
+    printf( "ring: %llu actions, %.0f us average latency, %.0f us max; "
+            "%llu directions collapsed, %llu dropped\n",
+            stats.actions,
+            stats.actions ? stats.latencyNs / 1e3 / stats.actions : 0.0,
+            stats.latencyMaxNs / 1e3, stats.collapsed, stats.dropped );
+    printf( "one key/tick: %u actions, %.0f us average latency, %.0f us max; "
+            "%u keys left\n",
+            fifoPlayed, fifoPlayed ? 1e6 * fifoLatency / fifoPlayed : 0.0,
+            1e6 * fifoMax, (unsigned int)fifo.size() );
+    printf( "%u of %u bomb and RC presses played; "
+            "move, bomb, move played %s\n", played, pressed,
+            ordered ? "in order" : "out of order" );
+
+    return played == pressed && ordered ? 0 : 1;
+}
+
+int
+bench_net(
+    int argc,
+    char* argv[]
+    )
+{
+    /* Parse the arguments. */
+    GameCoord size(
+        1 < argc ? atoi( argv[1] ) : 101,
+        2 < argc ? atoi( argv[2] ) : 101 );
+    unsigned int clients  = 3 < argc ? atoi( argv[3] ) : 32;
+    unsigned int monsters = 4 < argc ? atoi( argv[4] ) : 200;
+    unsigned int ticks    = 5 < argc ? atoi( argv[5] ) : 300;
+    const char* port      = 6 < argc ? argv[6] : "42036";
+    unsigned int stalled  = 7 < argc ? atoi( argv[7] ) : 0;
+    unsigned int limit    = 8 < argc ? atoi( argv[8] ) : GAME_NET_QUEUE_BYTES;
+    const bool disconnect = 9 < argc && !strcmp( argv[9], "disconnect" );
+
+    /* Address in the form of IP-NUL-port-NUL. */
+    std::string addr( "127.0.0.1" );
+    addr += '\0';
+    addr += port;
+    addr += '\0';
+
+    GameServerModel* gm = bench_map<GameServerModel>( size );
+    gm->setQueueLimit( limit, disconnect
+                       ? GameServerModel::OVERFLOW_DISCONNECT
+                       : GameServerModel::OVERFLOW_RESYNC );
+    if( !gm->open( addr.c_str() ) )
+    {
+        perror( "open" );
+        safeDelete( gm );
+        return 1;
+    }
+
+    GameModelEvent event;
+    event.coords = GameCoordRect( size, size );
+    event.ctl = NULL;
+    event.entity = GENT_MONSTER;
+    for( unsigned int i = 0; i < monsters; ++i )
+        gm->dispatch( event );
+
+    /* Connect the clients; the kernel completes the handshakes. */
+    addrinfo* ai = NULL, hints;
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    hints.ai_socktype = SOCK_STREAM;
+    if( getaddrinfo( "127.0.0.1", port, &hints, &ai ) || !ai )
+    {
+        fprintf( stderr, "Cannot resolve port %s.\n", port );
+        safeDelete( gm );
+        return 1;
+    }
+
+    std::vector<unsigned char> hello;
+    GameProtocol::putHello( hello, GameProtocol::VERSION );
+
+    std::vector<NetClient*> socks;
+    for( unsigned int i = 0; i < clients; ++i )
+    {
+        Socket* sock = new Socket;
+        if( sock->create( ai->ai_family, ai->ai_socktype, ai->ai_protocol ) ||
+            sock->connect( ai->ai_addr, ai->ai_addrlen ) ||
+            sock->send( &hello[0], hello.size(), MSG_NOSIGNAL ) < 0 ||
+            sock->fcntl( F_SETFL, O_NONBLOCK ) )
+        {
+            perror( "connect" );
+            safeDelete( sock );
+            break;
+        }
+
+        socks.push_back( new NetClient( sock ) );
+    }
+    safeRelease( ai, freeaddrinfo );
+
+    GameServerModel::NetStats join;
+    std::vector<GameServerModel::ClientStats> cs;
+    unsigned long long bytesIn = 0, peak = 0, backlog = 0;
+    double secs = 0.0, joinsecs = 0.0;
+
+    /* The clients join once accepted and heard. */
+    bool joined = false;
+    unsigned int done = 0;
+    for( unsigned int tick = 0; done < ticks; ++tick )
+    {
+        /* Every client presses something. */
+        for( unsigned int i = 0; i < socks.size(); ++i )
+            socks[i]->send(
+                (GameCtlEvent)(rand() % 5 ? GCE_MOVEUP + rand() % 4 : GCE_PUTBOMB),
+                tick );
+
+        const double t = bench_time();
+        const bool cont = gm->tick();
+        (joined ? secs : joinsecs) += bench_time() - t;
+
+        /* The deepest queue of any client. */
+        gm->clientStats( cs );
+        for( unsigned int i = 0; i < cs.size(); ++i )
+        {
+            peak = std::max( peak, cs[i].bytes );
+            backlog = std::max( backlog, cs[i].backlog );
+        }
+
+        /* Drain the clients; the stalled ones stop for a while. */
+        const bool stall = 10 <= done && done < 10 + 4 * GAME_NET_LAG_TICKS;
+        for( unsigned int i = stall ? stalled : 0; i < socks.size(); ++i )
+            socks[i]->read();
+
+        if( !joined )
+        {
+            /* The game is on once there are players. */
+            if( cont )
+            {
+                joined = true;
+                join = gm->netStats();
+            }
+            else if( 10 < tick )
+                break;
+        }
+        else if( cont )
+            ++done;
+        else
+            break;
+    }
+
+    GameServerModel::NetStats ns = gm->netStats();
+    const unsigned int played = std::max( done, 1U );
+
+    for( unsigned int i = 0; i < socks.size(); ++i )
+        bytesIn += socks[i]->mBytes;
+
+    printf( "map %ux%u, %u clients (%u stalled), %u monsters, %u/%u ticks\n",
+            size.row, size.col, (unsigned int)socks.size(), stalled, monsters,
+            done, ticks );
+    printf( "server tick: %.3f us/tick\n", 1e6 * secs / played );
+    printf( "join: %.3f ms, %llu accepts, %llu sends, %.1f KiB sent\n",
+            1e3 * joinsecs, join.accepts, join.sends, join.bytesOut / 1024.0 );
+    printf( "play: %.1f waits, %.1f recvs, %.1f sends, %.1f KiB sent per tick; "
+            "%.1f events/tick (%.1f sends/tick if one per event per client)\n",
+            (double)(ns.waits - join.waits) / played,
+            (double)(ns.recvs - join.recvs) / played,
+            (double)(ns.sends - join.sends) / played,
+            (ns.bytesOut - join.bytesOut) / 1024.0 / played,
+            (double)(ns.events - join.events) / played,
+            (double)(ns.events - join.events) * socks.size() / played );
+    printf( "diffs: %.1f tiles/tick, %.1f KiB encoded per tick\n",
+            (double)(ns.tiles - join.tiles) / played,
+            (ns.bytesEncoded - join.bytesEncoded) / 1024.0 / played );
+    printf( "queues: limit %.1f KiB, deepest %.1f KiB (%.1f KiB of diffs); "
+            "%llu resyncs, %llu disconnects\n",
+            limit / 1024.0, peak / 1024.0, backlog / 1024.0,
+            ns.resyncs - join.resyncs, ns.disconnects - join.disconnects );
+    printf( "clients received %.1f KiB\n", bytesIn / 1024.0 );
+
+    for( unsigned int i = 0; i < socks.size(); ++i )
+        safeDelete( socks[i] );
+    safeDelete( gm );
+    return 0;
+}
+
+int
+bench_sendq(
+    int argc,
+    char* argv[]
+    )
+{
+    /* Parse the arguments. */
+    unsigned int frames = 1 < argc ? atoi( argv[1] ) : 10000;
+    unsigned int size   = 2 < argc ? atoi( argv[2] ) : 512;
+    unsigned int chunk  = 3 < argc ? atoi( argv[3] ) : 16 * 1024;
+    const char* port    = 4 < argc ? argv[4] : "42042";
+
+    /* The same frames for both runs, built once. */
+    std::vector<SendQueue::Message*> msgs;
+    for( unsigned int i = 0; i < frames; ++i )
+    {
+        SendQueue::Message* msg = new SendQueue::Message;
+        msg->data().assign( size, (unsigned char)i );
+        msgs.push_back( msg );
+    }
+
+    const unsigned long long total = (unsigned long long)frames * size;
+    printf( "backlog of %u frames, %u bytes each (%.1f MiB), "
+            "the client reads %u bytes per send\n",
+            frames, size, total / 1048576.0, chunk );
+
+    /* A flat buffer as GameClient used to have, then the ring. */
+    for( unsigned int run = 0; run < 2; ++run )
+    {
+        Socket writer, reader;
+        if( !bench_sendq_connect( port, writer, reader ) )
+        {
+            perror( "connect" );
+            break;
+        }
+
+        std::vector<unsigned char> buf;
+        SendQueue queue;
+
+        double t = bench_time();
+        for( unsigned int i = 0; i < frames; ++i )
+            if( run )
+                queue.push( msgs[i] );
+            else
+                buf.insert( buf.end(), msgs[i]->begin(),
+                            msgs[i]->begin() + msgs[i]->size() );
+        const double queued = bench_time() - t;
+
+        /* A slow client: it takes a chunk after each send. */
+        unsigned long long got = 0, moved = 0, sends = 0;
+        double sent = 0.0;
+        while( got < total )
+        {
+            t = bench_time();
+            if( run && !queue.empty() )
+            {
+                ++sends;
+                queue.send( writer, MSG_NOSIGNAL );
+            }
+            else if( !run && !buf.empty() )
+            {
+                ++sends;
+                const int code = writer.send(
+                    &buf[0], buf.size(), MSG_NOSIGNAL );
+                if( 0 < code )
+                {
+                    buf.erase( buf.begin(), buf.begin() + code );
+                    moved += buf.size();
+                }
+            }
+            sent += bench_time() - t;
+
+            got += bench_sendq_drain( reader, chunk );
+        }
+
+        printf( "%s: queued in %.3f ms, sent in %.3f ms "
+                "(%llu sends, %.2f us/send), %.1f MiB moved\n",
+                run ? "ring" : "flat", 1e3 * queued, 1e3 * sent,
+                sends, 1e6 * sent / std::max( sends, 1ULL ),
+                moved / 1048576.0 );
+    }
+
+    for( unsigned int i = 0; i < frames; ++i )
+        msgs[i]->release();
+    return 0;
+}
+
+int
+bench_predict(
+    int argc,
+    char* argv[]
+    )
+{
+    /* Parse the arguments. */
+    GameCoord size(
+        1 < argc ? atoi( argv[1] ) : 41,
+        2 < argc ? atoi( argv[2] ) : 41 );
+    unsigned int ticks = 3 < argc ? atoi( argv[3] ) : 600;
+    unsigned int every = 4 < argc ? atoi( argv[4] ) : GAME_SPEED_DEFAULT + 1;
+    const char* port   = 5 < argc ? argv[5] : "42046";
+
+    /* Address in the form of IP-NUL-port-NUL. */
+    std::string addr( "127.0.0.1" );
+    addr += '\0';
+    addr += port;
+    addr += '\0';
+
+    printf( "map %ux%u, a move every %u of %u ticks, "
+            "the server ticks right after the client\n",
+            size.row, size.col, every, ticks );
+
+    /* Without the prediction, then with it. */
+    int ret = 0;
+    for( unsigned int run = 0; run < 2; ++run )
+    {
+        srand( 1 );
+        GameServerModel* gm = bench_map<GameServerModel>( size );
+        if( !gm->open( addr.c_str() ) )
+        {
+            perror( "open" );
+            safeDelete( gm );
+            return 1;
+        }
+
+        GameRemoteModel rm( addr.c_str() );
+        rm.setPrediction( run );
+
+        /* The join blocks until the server says hello. */
+        GameCtlEvent next = GCE_NOOP;
+        RemoteJoin join;
+        join.model = &rm;
+        join.event.entity = GENT_PLAYER;
+        join.event.coords = GameCoordRect( size, size );
+        join.event.ctl = new ScriptController( next );
+        join.done = false;
+
+        pthread_t thread;
+        if( pthread_create( &thread, NULL, bench_predict_join, &join ) )
+        {
+            perror( "pthread_create" );
+            safeDelete( join.event.ctl );
+            safeDelete( gm );
+            return 1;
+        }
+        while( !join.done )
+        {
+            gm->tick();
+            usleep( 1000 );
+        }
+        pthread_join( thread, NULL );
+
+        /* The player shows up once the server hears of it. */
+        bench_spawn( rm, *gm );
+
+        TrackCanvas canvas;
+        rm.redraw( canvas );
+        canvas.mMoved = false;
+
+        /* Lockstep: the client, then the server. */
+        unsigned int pressed = 0, shown = 0, stray = 0, frames = 0, worst = 0;
+        unsigned int press = 0;
+        bool waiting = false;
+        for( unsigned int tick = 1; tick <= ticks + 2 * every; ++tick )
+        {
+            if( tick <= ticks && !(tick % every) )
+            {
+                next = (GameCtlEvent)(GCE_MOVEUP + rand() % 4);
+                press = tick;
+                waiting = true;
+                ++pressed;
+            }
+
+            if( !rm.tick() )
+                break;
+            rm.draw( canvas );
+
+            if( canvas.mMoved )
+            {
+                /* A move shows up; was it pressed? */
+                if( waiting )
+                {
+                    frames += tick - press;
+                    worst = std::max( worst, tick - press );
+                    ++shown;
+                }
+                else
+                    ++stray;
+
+                waiting = canvas.mMoved = false;
+            }
+
+            gm->tick();
+        }
+
+        /* With no more moves, both see the same. */
+        TrackCanvas local, remote;
+        gm->redraw( local );
+        rm.redraw( remote );
+
+        printf( "%s: %u of %u moves shown, %.2f frames from key to screen "
+                "(%u max), %u moves taken back; maps %s\n",
+                run ? "predicted" : "server only", shown, pressed,
+                shown ? (double)frames / shown : 0.0, worst, stray,
+                local.mHash == remote.mHash ? "match" : "differ" );
+        if( local.mHash != remote.mHash )
+            ret = 1;
+
+        safeDelete( gm );
+    }
+
+    return ret;
+}
+
+int
+bench_udp(
+    int argc,
+    char* argv[]
+    )
+{
+    /* Parse the arguments. */
+    GameCoord size(
+        1 < argc ? atoi( argv[1] ) : 101,
+        2 < argc ? atoi( argv[2] ) : 101 );
+    unsigned int ticks    = 3 < argc ? atoi( argv[3] ) : 600;
+    unsigned int loss     = 4 < argc ? atoi( argv[4] ) : 20;
+    unsigned int monsters = 5 < argc ? atoi( argv[5] ) : 0;
+    const char* port      = 6 < argc ? argv[6] : "42047";
+    /* Enough monsters for diffs too big for a datagram. */
+    unsigned int crowd    = 7 < argc ? atoi( argv[7] ) : 1500;
+    GameCoord crowdSize(
+        8 < argc ? atoi( argv[8] ) : 301,
+        9 < argc ? atoi( argv[9] ) : 301 );
+
+    /* Address in the form of IP-NUL-port-NUL. */
+    std::string addr( "127.0.0.1" );
+    addr += '\0';
+    addr += port;
+    addr += '\0';
+
+    printf( "map %ux%u, %u monsters (crowded %ux%u, %u monsters), "
+            "%u ticks in lockstep, %u%% of the datagrams lost both ways\n",
+            size.row, size.col, monsters, crowdSize.row, crowdSize.col,
+            crowd, ticks, loss );
+
+    /* The stream, then datagrams without and with the loss,
+       then without the loss in a crowd. */
+    int ret = 0;
+    for( unsigned int run = 0; run < 4; ++run )
+    {
+        const GameProtocol::Transport transport = run
+            ? GameProtocol::TRANSPORT_UDP : GameProtocol::TRANSPORT_TCP;
+        const unsigned int lost = 2 == run ? loss : 0;
+        const unsigned int count = 3 == run ? crowd : monsters;
+        const GameCoord& dim = 3 == run ? crowdSize : size;
+
+        srand( 1 );
+        GameServerModel* gm = bench_map<GameServerModel>( dim );
+        gm->setLoss( lost );
+        if( !gm->open( addr.c_str(), transport ) )
+        {
+            perror( "open" );
+            safeDelete( gm );
+            return 1;
+        }
+
+        GameModelEvent event;
+        event.coords = GameCoordRect( dim, dim );
+        event.ctl = NULL;
+        event.entity = GENT_MONSTER;
+        for( unsigned int i = 0; i < count; ++i )
+            gm->dispatch( event );
+
+        /* The map of the server as it is. */
+        GameRemoteModel rm( addr.c_str(), transport );
+        rm.setPrediction( false );
+        rm.setLoss( lost );
+
+        /* The join blocks until the server says hello. */
+        GameCtlEvent next = GCE_NOOP;
+        RemoteJoin join;
+        join.model = &rm;
+        join.event.entity = GENT_PLAYER;
+        join.event.coords = GameCoordRect( dim, dim );
+        join.event.ctl = new ScriptController( next );
+        join.done = false;
+
+        pthread_t thread;
+        if( pthread_create( &thread, NULL, bench_predict_join, &join ) )
+        {
+            perror( "pthread_create" );
+            safeDelete( join.event.ctl );
+            safeDelete( gm );
+            return 1;
+        }
+        while( !join.done )
+        {
+            gm->tick();
+            usleep( 1000 );
+        }
+        pthread_join( thread, NULL );
+        bench_spawn( rm, *gm );
+
+        /* Lockstep: the client, then the server. */
+        TrackCanvas served;
+        gm->redraw( served );
+
+        unsigned int synced = 0, played = 0;
+        for( unsigned int tick = 1; tick <= ticks; ++tick )
+        {
+            next = (GameCtlEvent)(GCE_MOVEUP + rand() % 4);
+            if( !rm.tick() )
+                break;
+
+            /* Has the last frame made it? */
+            TrackCanvas shown;
+            rm.redraw( shown );
+            if( served.mHash == shown.mHash )
+                ++synced;
+            ++played;
+
+            if( !gm->tick() )
+                /* The player is dead. */
+                break;
+
+            served = TrackCanvas();
+            gm->redraw( served );
+        }
+
+        /* Without the loss, it catches up soon. */
+        gm->setLoss( 0 );
+
+        TrackCanvas local, remote;
+        for( unsigned int tick = 0; tick < GAME_NET_TIMEOUT_TICKS; ++tick )
+        {
+            gm->tick();
+            rm.tick();
+
+            local = remote = TrackCanvas();
+            gm->redraw( local );
+            rm.redraw( remote );
+            if( local.mHash == remote.mHash )
+                break;
+        }
+
+        const GameServerModel::NetStats& ns = gm->netStats();
+        printf( "%s: %u of %u ticks up to date, %.1f KiB sent, "
+                "%llu datagrams (%llu lost), %llu frames split, "
+                "%llu fragments resent, %llu resyncs; maps %s\n",
+                run ? (lost ? "udp, lossy" : 3 == run ? "udp, crowded" : "udp")
+                : "tcp",
+                synced, played, ns.bytesOut / 1024.0, ns.datagrams,
+                ns.lost, ns.split, ns.resent, ns.resyncs,
+                local.mHash == remote.mHash ? "match" : "differ" );
+        if( local.mHash != remote.mHash )
+            ret = 1;
+
+        safeDelete( gm );
+    }
+
+    return ret;
+}
+
+int
+bench_jitter(
+    int argc,
+    char* argv[]
+    )
+{
+    /* Parse the arguments. */
+    GameCoord size(
+        1 < argc ? atoi( argv[1] ) : 41,
+        2 < argc ? atoi( argv[2] ) : 41 );
+    unsigned int ticks  = 3 < argc ? atoi( argv[3] ) : 600;
+    unsigned int jitter = 4 < argc ? atoi( argv[4] ) : 2;
+    unsigned int every  = 5 < argc ? atoi( argv[5] ) : GAME_SPEED_DEFAULT + 1;
+    const char* port    = 6 < argc ? argv[6] : "42049";
+
+    /* Address in the form of IP-NUL-port-NUL. */
+    std::string addr( "127.0.0.1" );
+    addr += '\0';
+    addr += port;
+    addr += '\0';
+
+    printf( "open map %ux%u, a move every %u of %u ticks, "
+            "up to %u ticks of jitter\n",
+            size.row, size.col, every, ticks, jitter );
+
+    /* As they come, then buffered; then a client ticking twice as fast. */
+    for( unsigned int run = 0; run < 3; ++run )
+    {
+        const unsigned int depth = run ? jitter : 0;
+        const unsigned int rate = 2 == run ? 2 : 1;
+
+        srand( 1 );
+        GameServerModel* gm = new GameServerModel( size );
+        gm->setJitterDepth( depth );
+
+        /* Nothing in the way, a single spawn in the middle. */
+        GameModelEvent event;
+        event.ctl = NULL;
+        event.entity = GENT_SPAWN;
+        event.coords = GameCoordRect(
+            GameCoord( size.row / 2, size.col / 2 ),
+            GameCoord( size.row / 2, size.col / 2 ) );
+        gm->dispatch( event );
+
+        if( !gm->open( addr.c_str() ) )
+        {
+            perror( "open" );
+            safeDelete( gm );
+            return 1;
+        }
+
+        addrinfo* ai = NULL, hints;
+        memset( &hints, 0, sizeof( hints ) );
+        hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+        hints.ai_socktype = SOCK_STREAM;
+        if( getaddrinfo( "127.0.0.1", port, &hints, &ai ) || !ai )
+        {
+            fprintf( stderr, "Cannot resolve port %s.\n", port );
+            safeDelete( gm );
+            return 1;
+        }
+
+        std::vector<unsigned char> hello;
+        GameProtocol::putHello( hello, GameProtocol::VERSION );
+
+        Socket* sock = new Socket;
+        if( sock->create( ai->ai_family, ai->ai_socktype, ai->ai_protocol ) ||
+            sock->connect( ai->ai_addr, ai->ai_addrlen ) ||
+            sock->send( &hello[0], hello.size(), MSG_NOSIGNAL ) < 0 ||
+            sock->fcntl( F_SETFL, O_NONBLOCK ) )
+        {
+            perror( "connect" );
+            safeRelease( ai, freeaddrinfo );
+            safeDelete( sock );
+            safeDelete( gm );
+            return 1;
+        }
+        safeRelease( ai, freeaddrinfo );
+        NetClient client( sock );
+
+        /* The game is on once the server adds the player. */
+        unsigned int stamp = 0;
+        for( unsigned int i = 0; i < GAME_NET_TIMEOUT_TICKS; ++i )
+        {
+            client.send( GCE_NOOP, ++stamp );
+            const bool cont = gm->tick();
+            client.read();
+            if( cont )
+                break;
+        }
+
+        TrackCanvas canvas;
+        gm->redraw( canvas );
+        canvas.mMoved = false;
+
+        /* The events of the client, each sent once its delay is up. */
+        std::deque< std::pair<unsigned int, unsigned int> > line;
+        std::deque<GameCtlEvent> events;
+        unsigned int pressed = 0, shown = 0, stray = 0, frames = 0, worst = 0;
+        unsigned int press = 0, arrival = 0;
+        bool waiting = false;
+        for( unsigned int tick = 1; tick <= ticks + 2 * every; ++tick )
+        {
+            for( unsigned int i = 0; i < rate; ++i )
+            {
+                GameCtlEvent next = GCE_NOOP;
+                if( !(++stamp % (rate * every)) && tick <= ticks )
+                {
+                    next = (GameCtlEvent)(GCE_MOVEUP + rand() % 4);
+                    press = tick;
+                    waiting = true;
+                    ++pressed;
+                }
+
+                /* In order, as over a stream. */
+                arrival = std::max( arrival, tick + rand() % (jitter + 1) );
+                line.push_back( std::make_pair( arrival, stamp ) );
+                events.push_back( next );
+            }
+
+            while( !line.empty() && line.front().first <= tick )
+            {
+                const unsigned int sent = line.front().second;
+                line.pop_front();
+                client.send( events.front(), sent,
+                             !line.empty() && line.front().first <= tick );
+                events.pop_front();
+            }
+
+            if( !gm->tick() )
+                break;
+            client.read();
+            gm->draw( canvas );
+
+            if( canvas.mMoved )
+            {
+                /* A move shows up; was it pressed? */
+                if( waiting )
+                {
+                    frames += tick - press;
+                    worst = std::max( worst, tick - press );
+                    ++shown;
+                }
+                else
+                    ++stray;
+
+                waiting = canvas.mMoved = false;
+            }
+        }
+
+        char title[64];
+        if( !run )
+            snprintf( title, sizeof( title ), "as they come" );
+        else
+            snprintf( title, sizeof( title ), "%u ticks deep%s", depth,
+                      1 < rate ? ", client twice as fast" : "" );
+
+        printf( "%s: %u of %u moves played, %.2f ticks from key to move "
+                "(%u max), %u stray\n",
+                title, shown, pressed,
+                shown ? (double)frames / shown : 0.0, worst, stray );
+
+        safeDelete( gm );
+    }
+
+    return 0;
+}
+
+int
+bench_relay(
+    int argc,
+    char* argv[]
+    )
+{
+    /* Parse the arguments. */
+    GameCoord size(
+        1 < argc ? atoi( argv[1] ) : 101,
+        2 < argc ? atoi( argv[2] ) : 101 );
+    unsigned int players    = 3 < argc ? atoi( argv[3] ) : 8;
+    unsigned int spectators = 4 < argc ? atoi( argv[4] ) : 64;
+    unsigned int monsters   = 5 < argc ? atoi( argv[5] ) : 100;
+    unsigned int ticks      = 6 < argc ? atoi( argv[6] ) : 300;
+    const char* port        = 7 < argc ? argv[7] : "42050";
+    const char* relayPort   = 8 < argc ? argv[8] : "42051";
+
+    /* Addresses in the form of IP-NUL-port-NUL. */
+    std::string addr( "127.0.0.1" );
+    addr += '\0';
+    addr += port;
+    addr += '\0';
+    std::string relayAddr( "127.0.0.1" );
+    relayAddr += '\0';
+    relayAddr += relayPort;
+    relayAddr += '\0';
+
+    printf( "map %ux%u, %u players, %u spectators, %u monsters, %u ticks\n",
+            size.row, size.col, players, spectators, monsters, ticks );
+
+    /* The spectators on the server, then behind a relay. */
+    int ret = 0;
+    for( unsigned int run = 0; run < 2; ++run )
+    {
+        srand( 1 );
+        GameServerModel* gm = bench_map<GameServerModel>( size );
+        if( !gm->open( addr.c_str() ) )
+        {
+            perror( "open" );
+            safeDelete( gm );
+            return 1;
+        }
+
+        GameModelEvent event;
+        event.coords = GameCoordRect( size, size );
+        event.ctl = NULL;
+        event.entity = GENT_MONSTER;
+        for( unsigned int i = 0; i < monsters; ++i )
+            gm->dispatch( event );
+
+        /* The relay waits for the snapshot, so tick the server meanwhile. */
+        GameRelayModel* relay = NULL;
+        if( run )
+        {
+            RelayOpen open;
+            open.relay = relay = new GameRelayModel( addr.c_str() );
+            open.addr = relayAddr.c_str();
+            open.ok = false;
+            open.done = false;
+
+            pthread_t thread;
+            if( pthread_create( &thread, NULL, bench_relay_open, &open ) )
+            {
+                perror( "pthread_create" );
+                safeDelete( relay );
+                safeDelete( gm );
+                return 1;
+            }
+            while( !open.done )
+            {
+                gm->tick();
+                usleep( 1000 );
+            }
+            pthread_join( thread, NULL );
+
+            if( !open.ok )
+            {
+                perror( "relay" );
+                safeDelete( relay );
+                safeDelete( gm );
+                return 1;
+            }
+        }
+
+        /* The players play on the server; the spectators watch. */
+        std::vector<NetClient*> playing, watching;
+        if( !bench_relay_connect( port, players, playing )
+            || !bench_relay_connect( run ? relayPort : port,
+                                     spectators, watching ) )
+            perror( "connect" );
+
+        /* A remote model joins the relay halfway. */
+        GameRemoteModel* late = NULL;
+        GameCtlEvent next = GCE_NOOP;
+        RemoteJoin join;
+        pthread_t thread;
+        bool joining = false;
+
+        GameServerModel::NetStats start = gm->netStats();
+        GameRelayModel::NetStats relayStart;
+        memset( &relayStart, 0, sizeof( relayStart ) );
+        double secs = 0.0;
+
+        bool joined = false;
+        unsigned int done = 0;
+        for( unsigned int tick = 0; done < ticks; ++tick )
+        {
+            for( unsigned int i = 0; i < playing.size(); ++i )
+                playing[i]->send(
+                    (GameCtlEvent)(rand() % 5 ? GCE_MOVEUP + rand() % 4 : GCE_PUTBOMB),
+                    tick );
+
+            const double t = bench_time();
+            const bool cont = gm->tick();
+            if( joined )
+                secs += bench_time() - t;
+
+            if( relay )
+                relay->tick();
+            if( late && join.done )
+                late->tick();
+
+            for( unsigned int i = 0; i < playing.size(); ++i )
+                playing[i]->read();
+            for( unsigned int i = 0; i < watching.size(); ++i )
+            {
+                watching[i]->read();
+                watching[i]->ack();
+            }
+
+            if( relay && !late && ticks / 2 <= done )
+            {
+                /* The join blocks until the relay says hello. */
+                late = new GameRemoteModel( relayAddr.c_str() );
+                join.model = late;
+                join.event.entity = GENT_PLAYER;
+                join.event.coords = GameCoordRect( size, size );
+                join.event.ctl = new ScriptController( next );
+                join.done = false;
+                joining = !pthread_create( &thread, NULL,
+                                           bench_predict_join, &join );
+                if( !joining )
+                {
+                    perror( "pthread_create" );
+                    safeDelete( join.event.ctl );
+                    join.done = true;
+                }
+            }
+            if( joining && join.done )
+            {
+                pthread_join( thread, NULL );
+                joining = false;
+            }
+
+            if( !joined )
+            {
+                /* The game is on once there are players. */
+                if( cont )
+                {
+                    joined = true;
+                    start = gm->netStats();
+                    if( relay )
+                        relayStart = relay->netStats();
+                }
+                else if( 10 < tick )
+                    break;
+            }
+            else if( cont )
+                ++done;
+            else
+                break;
+        }
+        while( joining && !join.done )
+        {
+            gm->tick();
+            relay->tick();
+            usleep( 1000 );
+        }
+        if( joining )
+            pthread_join( thread, NULL );
+
+        /* The late spectator sees what the server does, a frame later. */
+        bool match = false;
+        for( unsigned int i = 0; late && !match && i < GAME_NET_LAG_TICKS; ++i )
+        {
+            gm->tick();
+            relay->tick();
+            late->tick();
+
+            TrackCanvas local, remote;
+            gm->redraw( local );
+            late->redraw( remote );
+            match = local.mHash == remote.mHash;
+        }
+
+        const GameServerModel::NetStats& ns = gm->netStats();
+        const unsigned int played = std::max( done, 1U );
+        unsigned long long bytesIn = 0;
+        for( unsigned int i = 0; i < watching.size(); ++i )
+            bytesIn += watching[i]->mBytes;
+
+        printf( "%s: %u ticks; server %.3f us/tick, %.1f sends, "
+                "%.1f KiB sent per tick; spectators received %.1f KiB\n",
+                run ? "relayed" : "direct", done, 1e6 * secs / played,
+                (double)(ns.sends - start.sends) / played,
+                (ns.bytesOut - start.bytesOut) / 1024.0 / played,
+                bytesIn / 1024.0 );
+        if( relay )
+        {
+            const GameRelayModel::NetStats& rs = relay->netStats();
+            printf( "  relay: %u spectators, %.1f sends, %.1f KiB sent "
+                    "per tick; %llu frames, %llu snapshots, %llu resyncs; "
+                    "late spectator %s\n",
+                    relay->spectators(),
+                    (double)(rs.sends - relayStart.sends) / played,
+                    (rs.bytesOut - relayStart.bytesOut) / 1024.0 / played,
+                    rs.frames, rs.snapshots, rs.resyncs,
+                    !late ? "never joined" : match ? "matches" : "differs" );
+            if( late && !match )
+                ret = 1;
+        }
+
+        safeDelete( late );
+        for( unsigned int i = 0; i < watching.size(); ++i )
+            safeDelete( watching[i] );
+        safeDelete( relay );
+        for( unsigned int i = 0; i < playing.size(); ++i )
+            safeDelete( playing[i] );
+        safeDelete( gm );
+    }
+
+    return ret;
+}
+
+void*
+bench_predict_join(
+    void* arg
+    )
+{
+    RemoteJoin* join = (RemoteJoin*)arg;
+    join->model->dispatch( join->event );
+
+    join->done = true;
+    return NULL;
+}
+
+void*
+bench_relay_open(
+    void* arg
+    )
+{
+    RelayOpen* open = (RelayOpen*)arg;
+    open->ok = open->relay->open( open->addr );
+
+    open->done = true;
+    return NULL;
+}
+
+bool
+bench_relay_connect(
+    const char* port,
+    unsigned int count,
+    std::vector<NetClient*>& clients
+    )
+{
+    /* The kernel completes the handshakes. */
+    addrinfo* ai = NULL, hints;
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    hints.ai_socktype = SOCK_STREAM;
+    if( getaddrinfo( "127.0.0.1", port, &hints, &ai ) || !ai )
+        return false;
+
+    std::vector<unsigned char> hello;
+    GameProtocol::putHello( hello, GameProtocol::VERSION );
+
+    bool ok = true;
+    for( unsigned int i = 0; ok && i < count; ++i )
+    {
+        Socket* sock = new Socket;
+        ok = !sock->create( ai->ai_family, ai->ai_socktype, ai->ai_protocol ) &&
+            !sock->connect( ai->ai_addr, ai->ai_addrlen ) &&
+            0 <= sock->send( &hello[0], hello.size(), MSG_NOSIGNAL ) &&
+            !sock->fcntl( F_SETFL, O_NONBLOCK );
+
+        if( ok )
+            clients.push_back( new NetClient( sock ) );
+        else
+            safeDelete( sock );
+    }
+
+    safeRelease( ai, freeaddrinfo );
+    return ok;
+}
+
+void
+bench_spawn(
+    GameRemoteModel& rm,
+    GameServerModel& gm
+    )
+{
+    /* The game is on once the server adds the player. */
+    for( unsigned int i = 0; i < GAME_NET_TIMEOUT_TICKS; ++i )
+    {
+        rm.tick();
+        if( gm.tick() )
+            break;
+    }
+}
+
+bool
+bench_sendq_connect(
+    const char* port,
+    Socket& writer,
+    Socket& reader
+    )
+{
+    addrinfo* ai = NULL, hints;
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    hints.ai_socktype = SOCK_STREAM;
+
+    /* A small send buffer, so that the backlog stays with us. */
+    Socket listener;
+    unsigned int reuse_addr = 1, bufsize = 64 * 1024;
+    const bool ok =
+        !getaddrinfo( "127.0.0.1", port, &hints, &ai ) && ai &&
+        !listener.create( ai->ai_family, ai->ai_socktype, ai->ai_protocol ) &&
+        !listener.setopt( SOL_SOCKET, SO_REUSEADDR,
+                          &reuse_addr, sizeof( reuse_addr ) ) &&
+        !listener.bind( ai->ai_addr, ai->ai_addrlen ) &&
+        !listener.listen() &&
+        !reader.create( ai->ai_family, ai->ai_socktype, ai->ai_protocol ) &&
+        !reader.connect( ai->ai_addr, ai->ai_addrlen ) &&
+        !listener.accept( writer, NULL, NULL, SOCK_NONBLOCK ) &&
+        !writer.setopt( SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof( bufsize ) );
+
+    safeRelease( ai, freeaddrinfo );
+    return ok;
+}
+
+unsigned int
+bench_sendq_drain(
+    Socket& reader,
+    unsigned int chunk
+    )
+{
+    unsigned char buf[4096];
+    unsigned int got = 0;
+    while( got < chunk )
+    {
+        const int code = reader.recv(
+            buf, std::min<unsigned int>( sizeof( buf ), chunk - got ),
+            MSG_DONTWAIT );
+        if( code <= 0 )
+            break;
+
+        got += code;
+    }
+
+    return got;
+}
+
+int
+bench_path(
+    int argc,
+    char* argv[]
+    )
+{
+    /* Parse the arguments. */
+    unsigned int queries = 1 < argc ? atoi( argv[1] ) : 200;
+
+    if( 2 < argc )
+        for( int i = 2; i < argc; ++i )
+            bench_path_size(
+                GameCoord( atoi( argv[i] ), atoi( argv[i] ) ), queries );
+    else
+        for( unsigned int side = 256; side <= 2048; side *= 2 )
+            bench_path_size( GameCoord( side, side ), queries );
+
+    return 0;
+}
+
+void
+bench_path_size(
+    const GameCoord& size,
+    unsigned int queries
+    )
+{
+    /* Flat queries take long, do not run that many. */
+    const unsigned int flat = std::min( queries, 10u );
+
+    GamePathGraph graph( size );
+    GameDistanceField field( size );
+    double t;
+
+    /* Build the map. */
+    for( GameCoord cur; cur.row < size.row; ++cur.row )
+        for( cur.col = 0; cur.col < size.col; ++cur.col )
+            switch( bench_tile( cur ) )
+            {
+                case GENT_WALL:
+                case GENT_BARRIER:
+                    graph.set( cur, false );
+                    field.set( cur, GameDistanceField::TILE_BLOCKED );
+                    break;
+                default:
+                    break;
+            }
+
+    t = bench_time();
+    graph.update();
+    const double buildsecs = bench_time() - t;
+
+    /* Pick the queries. */
+    std::vector<GameCoordRect> pairs;
+    while( pairs.size() < queries )
+    {
+        const GameCoord from( rand() % size.row, rand() % size.col );
+        const GameCoord to( rand() % size.row, rand() % size.col );
+        if( graph.passable( from ) && graph.passable( to ) )
+            pairs.push_back( GameCoordRect( from, to ) );
+    }
+
+    /* Hierarchical queries: plan and refine the first step. */
+    std::vector<GameCoord> route;
+    unsigned int found = 0, legs = 0;
+
+    t = bench_time();
+    for( unsigned int i = 0; i < queries; ++i )
+    {
+        GameCoord next;
+        if( graph.route( pairs[i].first, pairs[i].second, route ) &&
+            route.back() == pairs[i].second &&
+            graph.step( pairs[i].first, route.front(), next ) )
+        {
+            ++found;
+            legs += route.size();
+        }
+    }
+    const double routesecs = bench_time() - t;
+
+    /* Flat queries: a BFS from the goal; compare the lengths. */
+    unsigned long long walked = 0, shortest = 0;
+    double flatsecs = 0.0;
+    for( unsigned int i = 0; i < flat; ++i )
+    {
+        const GameCoord& from = pairs[i].first;
+        const GameCoord& to = pairs[i].second;
+
+        t = bench_time();
+        field.set( to, GameDistanceField::TILE_SOURCE );
+        field.invalidate();
+        field.update();
+        flatsecs += bench_time() - t;
+
+        const unsigned int dist = field.dist( from );
+        field.set( to, GameDistanceField::TILE_PASSABLE );
+
+        if( GAME_DIST_INFINITE == dist ||
+            !graph.route( from, to, route ) || route.back() != to )
+            continue;
+
+        /* Walk the route step by step. */
+        GameCoord pos = from, next;
+        unsigned int steps = 0, leg = 0;
+        while( pos != to && steps <= 4 * dist )
+        {
+            if( route[leg] == pos )
+                ++leg;
+            if( !graph.step( pos, route[leg], next ) )
+                break;
+
+            pos = next;
+            ++steps;
+        }
+
+        if( pos == to )
+        {
+            walked += steps;
+            shortest += dist;
+        }
+        else
+            printf( "  route %u did not reach the goal\n", i );
+    }
+
+    /* Break some walls and repair. */
+    unsigned int broken = 0;
+    t = bench_time();
+    while( broken < 64 )
+    {
+        const GameCoord pos( rand() % size.row, rand() % size.col );
+        if( !graph.passable( pos ) && (pos.row % 2 || pos.col % 2) )
+        {
+            graph.set( pos, true );
+            graph.update();
+            ++broken;
+        }
+    }
+    const double updatesecs = bench_time() - t;
+
+    printf( "map %ux%u: %u portals in %u-tile clusters, built in %.1f ms\n",
+            size.row, size.col, graph.portals(), GamePathGraph::CLUSTER,
+            1e3 * buildsecs );
+    printf( "  memory: %.2f MiB path graph, %.2f MiB distance field\n",
+            graph.memory() / 1048576.0, field.memory() / 1048576.0 );
+    printf( "  hierarchical: %.1f us/query, %u/%u found, %.1f legs/route\n",
+            1e6 * routesecs / queries, found, queries,
+            found ? (double)legs / found : 0.0 );
+    printf( "  flat BFS: %.1f us/query; routes %.1f%% longer than shortest\n",
+            1e6 * flatsecs / flat,
+            shortest ? 100.0 * walked / shortest - 100.0 : 0.0 );
+    printf( "  wall broken: %.1f us/update\n", 1e6 * updatesecs / broken );
+}
+
+template< typename T >
+T*
+bench_map(
+    const GameCoord& size
+    )
+{
+    T* gm = new T( size );
+    GameModelEvent event;
+    event.ctl = NULL;
+
+    for( GameCoord cur; cur.row < size.row; ++cur.row )
+        for( cur.col = 0; cur.col < size.col; ++cur.col )
+        {
+            event.entity = bench_tile( cur );
+            event.coords = GameCoordRect( cur, cur );
+            gm->dispatch( event );
+        }
+
+    return gm;
+}
+
+GameEntity
+bench_tile(
+    const GameCoord& pos
+    )
+{
+    const bool spawn = !(pos.row % 4) && !(pos.col % 4);
+    const bool clear =
+        (!(pos.row % 4) && 1 >= pos.col % 4) ||
+        (!(pos.col % 4) && 1 >= pos.row % 4) ||
+        (!(pos.row % 4) && 3 == pos.col % 4) ||
+        (!(pos.col % 4) && 3 == pos.row % 4);
+
+    if( spawn )
+        return GENT_SPAWN;
+    else if( 1 == pos.row % 2 && 1 == pos.col % 2 )
+        return GENT_BARRIER;
+    else if( !clear && rand() % 100 < 40 )
+        return GENT_WALL;
+    else
+        return GENT_NONE;
+}
+
+double
+bench_time()
+{
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void
+bench_report(
+    const char* tit,
+    const PerfCounters& pc,
+    double secs,
+    unsigned int ticks
+    )
+{
+    if( !ticks )
+        ticks = 1;
+
+    printf( "%s: %.3f us/tick\n", tit, 1e6 * secs / ticks );
+    if( !pc.available() )
+    {
+        printf( "  (perf counters not available)\n" );
+        return;
+    }
+
+    for( unsigned int i = 0; i < PerfCounters::PC_COUNT; ++i )
+    {
+        const PerfCounters::Counter c = (PerfCounters::Counter)i;
+        if( pc.available( c ) )
+            printf( "  %-14s %14.1f /tick\n", PerfCounters::name( c ),
+                    (double)pc.read( c ) / ticks );
+        else
+            printf( "  %-14s %14s\n", PerfCounters::name( c ), "n/a" );
+    }
+}
+
+/*************************************************************************/
+/* NetClient                                                             */
+/*************************************************************************/
+NetClient::NetClient(
+    Socket*& sock
+    )
+: mBytes( 0 ),
+  mSocket( sock ),
+  mSkip( GameProtocol::HELLO_SIZE ),
+  mHeaderGot( 0 ),
+  mTick( 0 ),
+  mAcked( 0 )
+{
+    /* Consume the socket. */
+    sock = NULL;
+}
+
+NetClient::~NetClient()
+{
+    safeDelete( mSocket );
+}
+
+void
+NetClient::send(
+    GameCtlEvent event,
+    unsigned int tick,
+    bool more
+    )
+{
+    std::vector<unsigned char> msg;
+    if( mAcked != mTick )
+        GameProtocol::putAck( msg, mAcked = mTick );
+    GameProtocol::putControls( msg, tick,
+                               std::vector<GameCtlEvent>( 1, event ) );
+
+    mSocket->send( &msg[0], msg.size(),
+                   MSG_NOSIGNAL | (more ? MSG_MORE : 0) );
+}
+
+void
+NetClient::ack()
+{
+    if( mAcked == mTick )
+        return;
+
+    std::vector<unsigned char> msg;
+    GameProtocol::putAck( msg, mAcked = mTick );
+    mSocket->send( &msg[0], msg.size(), MSG_NOSIGNAL );
+}
+
+void
+NetClient::read()
+{
+    unsigned char buf[64 * 1024];
+    int code;
+    while( 0 < (code = mSocket->recv( buf, sizeof( buf ), 0 )) )
+    {
+        mBytes += code;
+
+        /* Only the headers matter, skip the rest. */
+        const unsigned char* cur = buf, *end = buf + code;
+        while( cur != end )
+            if( mSkip )
+            {
+                const unsigned int n = std::min<unsigned int>( mSkip, end - cur );
+                cur += n;
+                mSkip -= n;
+            }
+            else
+            {
+                mHeader[mHeaderGot++] = *cur++;
+                if( sizeof( mHeader ) == mHeaderGot )
+                {
+                    GameProtocol::getHeader( mHeader, mTick, mSkip );
+                    mHeaderGot = 0;
+                }
+            }
+    }
+}
@@ -9,6 +9,7 @@
 #include "GameLocalModel.h"
 #include "GameServerModel.h"
 #include "GameRemoteModel.h"
+#include "GameRelayModel.h"
 #include "GameModelLoader.h"
 #include "util.h"
 
@@ -16,6 +17,7 @@ static volatile bool g_run;
 
 void main_menu();
 void play_game( GameModel& model );
+void end_game();
 void sig_recv( int );
 
 int
@@ -75,22 +77,29 @@ main_menu()
         /* The menu itself. */
         switch(
             menu_select(
-                "HLAVNI MENU", 4,
+                "HLAVNI MENU", 5,
                 "Zacit hru jednoho hrace", "",
                 "Zacit hru vice hracu", "",
                 "Pripojit se ke hre vice hracu", "",
+                "Predavat hru divakum", "",
                 "Ukoncit hru", "" ) )
         {
             case 0: gm = GameModelLoader::load<GameLocalModel>(); break;
             case 1: gm = GameModelLoader::load<GameServerModel>(); break;
             case 2: gm = GameModelLoader::load<GameRemoteModel>(); break;
-            case 3: return;
+            case 3: gm = GameModelLoader::load<GameRelayModel>(); break;
+            case 4: return;
         }
 
         if( gm )
+        {
             play_game( *gm );
 
-        safeDelete( gm );
+            /* Stops the input thread first, else it takes the key
+               the message waits for. */
+            safeDelete( gm );
+            end_game();
+        }
     }
 }
 
@@ -143,7 +152,11 @@ play_game(
     }
 
     safeDelete( gc );
+}
 
+void
+end_game()
+{
     /* Print an endgame message. */
     msgbox( "Informace", "Konec hry.                            " );
 }